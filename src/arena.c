@@ -0,0 +1,59 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+#include "error.h"
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+uint8_t arena_init(struct arena *arena, size_t capacity)
+{
+	arena->data = malloc(capacity);
+	if (arena->data == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	arena->capacity = capacity;
+	arena->used = 0;
+	arena->peak = 0;
+	return NO_ERRORS;
+}
+
+void arena_fini(struct arena *arena)
+{
+	free(arena->data);
+	arena->data = NULL;
+	arena->capacity = 0;
+	arena->used = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size_t alignment = alignof(max_align_t);
+	size_t offset = (arena->used + alignment - 1) / alignment * alignment;
+	if (offset > arena->capacity || size > arena->capacity - offset) {
+		printf("Arena of %zu bytes can't fit %zu more\n", arena->capacity,
+		       size);
+		return NULL;
+	}
+	arena->used = offset + size;
+	if (arena->used > arena->peak) {
+		arena->peak = arena->used;
+	}
+	return arena->data + offset;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_ARENA_H
+#define HELLO_VULKAN_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator over one block allocated up front, for arrays that only live
+ * as long as the setup function asking for them. Scopes nest like the calls
+ * that make them: take a mark on the way in and reset to it on every way out,
+ * so recreating the swapchain reuses the same memory instead of the heap.
+ * Not thread safe.
+ */
+struct arena {
+	char *data;
+	size_t capacity;
+	size_t used;
+	size_t peak;
+};
+
+uint8_t arena_init(struct arena *arena, size_t capacity);
+void arena_fini(struct arena *arena);
+
+/* Aligned for any type, NULL with a message when the arena is full */
+void *arena_alloc(struct arena *arena, size_t size);
+
+static inline size_t arena_mark(const struct arena *arena)
+{
+	return arena->used;
+}
+
+static inline void arena_reset(struct arena *arena, size_t mark)
+{
+	arena->used = mark;
+}
+
+#endif
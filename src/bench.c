@@ -0,0 +1,490 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs hello-vulkan headless through fixed scenarios, each for a fixed number
+ * of frames and a few times over, taking the median of every measurement it
+ * reports. Results can be written out as a baseline and later runs compared
+ * against it, failing when a measurement got worse by more than a tolerance.
+ */
+
+#include "error.h"
+#include "stats.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_SCENARIO_ARGS 8
+#define MAX_NAME_LENGTH 64
+
+struct scenario {
+	const char *name;
+	const char *args[MAX_SCENARIO_ARGS];
+};
+
+static const struct scenario scenarios[] = {
+	{
+		.name = "idle",
+		.args = { "--headless", NULL },
+	},
+	{
+		.name = "instances",
+		.args = { "--headless", "--depth", "--objects=256", NULL },
+	},
+	{
+		.name = "resize_storm",
+		.args = { "--headless", "--resize-interval=5", NULL },
+	},
+	/* Bursts of configures coalesced into one recreation a frame */
+	{
+		.name = "drag_storm",
+		.args = { "--headless", "--resize-storm=600", NULL },
+	},
+	{
+		.name = "compute",
+		.args = { "--headless", "--depth", "--objects=4096",
+		          "--gpu-culling", NULL },
+	},
+	/* The same many lights shaded per fragment drawn, then per pixel */
+	{
+		.name = "forward_lights",
+		.args = { "--headless", "--depth", "--objects=256",
+		          "--lights=256", NULL },
+	},
+	{
+		.name = "deferred_lights",
+		.args = { "--headless", "--deferred", "--objects=256",
+		          "--lights=256", NULL },
+	},
+	/* The same mesh through the vertex input, then pulled by the shader */
+	{
+		.name = "mesh_vertex_input",
+		.args = { "--headless", "--depth", "--objects=256",
+		          "--mesh=sphere", NULL },
+	},
+	{
+		.name = "mesh_vertex_pulling",
+		.args = { "--headless", "--depth", "--objects=256",
+		          "--mesh=sphere", "--vertex-pulling", NULL },
+	},
+	/* A million particles simulated, sorted and blended every frame */
+	{
+		.name = "particles",
+		.args = { "--headless", "--depth", "--particles=1048576",
+		          NULL },
+	},
+};
+
+struct metric {
+	const char *name;
+	bool higher_is_better;
+};
+
+static const struct metric metrics[] = {
+	{ .name = "startup_ms", .higher_is_better = false },
+	{ .name = "fps", .higher_is_better = true },
+	{ .name = "frame_ms_p50", .higher_is_better = false },
+	{ .name = "frame_ms_p90", .higher_is_better = false },
+	{ .name = "frame_ms_p99", .higher_is_better = false },
+	{ .name = "peak_rss_kb", .higher_is_better = false },
+	/* Zero, and so not compared, in the scenarios that never resize */
+	{ .name = "resize_ms_p90", .higher_is_better = false },
+	{ .name = "resize_rss_growth_kb", .higher_is_better = false },
+	/* Overdraw and culling regressions, zero without statistics queries */
+	{ .name = "fragment_shader_invocations_per_frame",
+	  .higher_is_better = false },
+	{ .name = "clipping_primitives_per_frame", .higher_is_better = false },
+};
+
+#define METRIC_COUNT ARRAY_SIZE(metrics)
+
+struct options {
+	const char *program;
+	uint32_t frame_count;
+	uint32_t run_count;
+	const char *baseline_filename;
+	const char *output_filename;
+	double tolerance;
+	const char *icd_filename;
+};
+
+static struct options options = {
+	.program = "./hello-vulkan",
+	.frame_count = 300,
+	.run_count = 3,
+	.baseline_filename = NULL,
+	.output_filename = NULL,
+	.tolerance = 0.1,
+	.icd_filename = NULL,
+};
+
+struct baseline_entry {
+	char scenario[MAX_NAME_LENGTH];
+	char metric[MAX_NAME_LENGTH];
+	double value;
+};
+
+static struct baseline_entry baseline[ARRAY_SIZE(scenarios) * METRIC_COUNT];
+static uint32_t baseline_count = 0;
+
+static double results[ARRAY_SIZE(scenarios)][METRIC_COUNT];
+
+static int find_metric(const char *name)
+{
+	for (uint32_t i = 0; i < METRIC_COUNT; ++i) {
+		if (strcmp(metrics[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Runs the program once, keeping its "report <name> <value>" lines */
+static uint8_t run_once(const struct scenario *scenario,
+                        double values[METRIC_COUNT])
+{
+	char frames_arg[32];
+	snprintf(frames_arg, sizeof(frames_arg), "--frames=%u",
+	         options.frame_count);
+
+	const char *argv[MAX_SCENARIO_ARGS + 4];
+	uint32_t argc = 0;
+	argv[argc++] = options.program;
+	for (uint32_t i = 0; scenario->args[i] != NULL; ++i) {
+		argv[argc++] = scenario->args[i];
+	}
+	argv[argc++] = frames_arg;
+	argv[argc++] = "--report";
+	argv[argc++] = NULL;
+
+	int fds[2];
+	if (pipe(fds) != 0) {
+		printf("Could not create a pipe\n");
+		return POSIX_ERROR_BIT;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		printf("Could not fork\n");
+		close(fds[0]);
+		close(fds[1]);
+		return POSIX_ERROR_BIT;
+	}
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execv(options.program, (char *const *) argv);
+		/* stdout is the pipe now, so the parent reports this */
+		_exit(127);
+	}
+	close(fds[1]);
+
+	bool found[METRIC_COUNT] = { false };
+	FILE *output = fdopen(fds[0], "r");
+	if (output == NULL) {
+		close(fds[0]);
+	}
+	else {
+		char line[256];
+		while (fgets(line, sizeof(line), output) != NULL) {
+			char name[MAX_NAME_LENGTH];
+			double value;
+			if (sscanf(line, "report %63s %lf", name, &value) != 2) {
+				continue;
+			}
+			int metric = find_metric(name);
+			if (metric >= 0) {
+				values[metric] = value;
+				found[metric] = true;
+			}
+		}
+		fclose(output);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) != pid) {
+		printf("Could not wait for %s\n", options.program);
+		return POSIX_ERROR_BIT;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		printf("Could not run %s\n", options.program);
+		return POSIX_ERROR_BIT;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("%s: %s failed\n", scenario->name, options.program);
+		return APP_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < METRIC_COUNT; ++i) {
+		if (!found[i]) {
+			printf("%s: no %s reported\n", scenario->name,
+			       metrics[i].name);
+			return APP_ERROR_BIT;
+		}
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t run_scenario(const struct scenario *scenario,
+                            double medians[METRIC_COUNT])
+{
+	struct stats runs[METRIC_COUNT];
+	uint8_t err = NO_ERRORS;
+	uint32_t initialized = 0;
+	for (; initialized < METRIC_COUNT && !err; ++initialized) {
+		err = stats_init(&runs[initialized], options.run_count);
+	}
+
+	for (uint32_t r = 0; r < options.run_count && !err; ++r) {
+		double values[METRIC_COUNT];
+		err = run_once(scenario, values);
+		for (uint32_t i = 0; i < METRIC_COUNT && !err; ++i) {
+			stats_add(&runs[i], values[i]);
+		}
+	}
+
+	for (uint32_t i = 0; i < initialized; ++i) {
+		if (!err) {
+			medians[i] = stats_percentile(&runs[i], 50.0);
+		}
+		stats_fini(&runs[i]);
+	}
+	return err;
+}
+
+static uint8_t load_baseline(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		printf("Could not open %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+
+	struct baseline_entry entry;
+	while (baseline_count < ARRAY_SIZE(baseline)
+	       && fscanf(file, "%63s %63s %lf", entry.scenario, entry.metric,
+	                 &entry.value) == 3) {
+		baseline[baseline_count++] = entry;
+	}
+	fclose(file);
+	return NO_ERRORS;
+}
+
+static const struct baseline_entry *find_baseline(const char *scenario,
+                                                  const char *metric)
+{
+	for (uint32_t i = 0; i < baseline_count; ++i) {
+		if (strcmp(baseline[i].scenario, scenario) == 0
+		    && strcmp(baseline[i].metric, metric) == 0) {
+			return &baseline[i];
+		}
+	}
+	return NULL;
+}
+
+/* Same format as the baseline: "<scenario> <metric> <value>" per line */
+static uint8_t write_results(const char *filename)
+{
+	FILE *file = fopen(filename, "w");
+	if (file == NULL) {
+		printf("Could not create %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t s = 0; s < ARRAY_SIZE(scenarios); ++s) {
+		for (uint32_t m = 0; m < METRIC_COUNT; ++m) {
+			fprintf(file, "%s %s %.4f\n", scenarios[s].name,
+			        metrics[m].name, results[s][m]);
+		}
+	}
+	if (fclose(file) != 0) {
+		return LIBC_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
+
+/* Prints every result next to its baseline, returning the regression count */
+static uint32_t compare_results(void)
+{
+	uint32_t regressions = 0;
+	printf("%-14s %-37s %14s %14s %8s\n",
+	       "scenario", "metric", "value", "baseline", "change");
+	for (uint32_t s = 0; s < ARRAY_SIZE(scenarios); ++s) {
+		for (uint32_t m = 0; m < METRIC_COUNT; ++m) {
+			double value = results[s][m];
+			const struct baseline_entry *entry
+				= find_baseline(scenarios[s].name, metrics[m].name);
+			if (entry == NULL || entry->value == 0.0) {
+				printf("%-14s %-37s %14.4f %14s\n", scenarios[s].name,
+				       metrics[m].name, value, "-");
+				continue;
+			}
+
+			double change = (value - entry->value) / entry->value;
+			bool regressed = metrics[m].higher_is_better
+			                 ? change < -options.tolerance
+			                 : change > options.tolerance;
+			if (regressed) {
+				++regressions;
+			}
+			printf("%-14s %-37s %14.4f %14.4f %+7.1f%%%s\n",
+			       scenarios[s].name, metrics[m].name, value,
+			       entry->value, 100.0 * change,
+			       regressed ? "  REGRESSION" : "");
+		}
+	}
+	return regressions;
+}
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+	       "  --program=PATH     hello-vulkan to run (./hello-vulkan)\n"
+	       "  --frames=N         frames per run (300)\n"
+	       "  --runs=N           runs per scenario, the median is kept (3)\n"
+	       "  --baseline=FILE    compare against a previous --output\n"
+	       "  --tolerance=F      allowed relative regression (0.1)\n"
+	       "  --output=FILE      write the results\n"
+	       "  --icd=FILE         Vulkan driver manifest, e.g. lavapipe's\n",
+	       program);
+}
+
+static uint8_t parse_options(int argc, char **argv)
+{
+	enum {
+		OPTION_PROGRAM = 256,
+		OPTION_FRAMES,
+		OPTION_RUNS,
+		OPTION_BASELINE,
+		OPTION_TOLERANCE,
+		OPTION_OUTPUT,
+		OPTION_ICD,
+	};
+	static const struct option long_options[] = {
+		{ "program", required_argument, NULL, OPTION_PROGRAM },
+		{ "frames", required_argument, NULL, OPTION_FRAMES },
+		{ "runs", required_argument, NULL, OPTION_RUNS },
+		{ "baseline", required_argument, NULL, OPTION_BASELINE },
+		{ "tolerance", required_argument, NULL, OPTION_TOLERANCE },
+		{ "output", required_argument, NULL, OPTION_OUTPUT },
+		{ "icd", required_argument, NULL, OPTION_ICD },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		char *end;
+		switch (c) {
+		case OPTION_PROGRAM:
+			options.program = optarg;
+			break;
+		case OPTION_FRAMES:
+			options.frame_count = strtoul(optarg, &end, 10);
+			/* Percentiles need some frames to mean anything */
+			if (*end != '\0' || options.frame_count < 10) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_RUNS:
+			options.run_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.run_count == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_BASELINE:
+			options.baseline_filename = optarg;
+			break;
+		case OPTION_TOLERANCE:
+			options.tolerance = strtod(optarg, &end);
+			if (*end != '\0' || options.tolerance < 0.0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_OUTPUT:
+			options.output_filename = optarg;
+			break;
+		case OPTION_ICD:
+			options.icd_filename = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+			return APP_ERROR_BIT;
+		}
+	}
+	if (optind != argc) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+
+	return NO_ERRORS;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t err = parse_options(argc, argv);
+	if (err) {
+		return err;
+	}
+
+	if (options.icd_filename != NULL) {
+		/* Older loaders only know the first name */
+		setenv("VK_ICD_FILENAMES", options.icd_filename, 1);
+		setenv("VK_DRIVER_FILES", options.icd_filename, 1);
+	}
+
+	/* Without it the regression check would silently pass */
+	if (options.baseline_filename != NULL) {
+		err = load_baseline(options.baseline_filename);
+		if (err) {
+			printf("Record one with make bench-baseline\n");
+			return err;
+		}
+	}
+
+	for (uint32_t s = 0; s < ARRAY_SIZE(scenarios); ++s) {
+		err = run_scenario(&scenarios[s], results[s]);
+		if (err) {
+			return err;
+		}
+	}
+
+	uint32_t regressions = compare_results();
+
+	if (options.output_filename != NULL) {
+		err = write_results(options.output_filename);
+		if (err) {
+			return err;
+		}
+	}
+
+	if (regressions > 0) {
+		printf("%u regressions beyond %.0f%%\n", regressions,
+		       100.0 * options.tolerance);
+		return APP_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
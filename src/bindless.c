@@ -0,0 +1,451 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bindless.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const VkDescriptorType descriptor_types[BINDLESS_BINDING_COUNT] = {
+	[BINDLESS_STORAGE_BUFFERS] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	[BINDLESS_SAMPLED_IMAGES] = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+};
+
+static const char *const binding_names[BINDLESS_BINDING_COUNT] = {
+	[BINDLESS_STORAGE_BUFFERS] = "storage buffers",
+	[BINDLESS_SAMPLED_IMAGES] = "sampled images",
+};
+
+static void write_descriptor(const struct bindless *bindless,
+                             VkDevice device,
+                             enum bindless_binding binding,
+                             uint32_t index,
+                             const VkDescriptorBufferInfo *buffer_info,
+                             const VkDescriptorImageInfo *image_info)
+{
+	VkWriteDescriptorSet write_descriptor_set = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = bindless->descriptor_set,
+		.dstBinding = binding,
+		.dstArrayElement = index,
+		.descriptorCount = 1,
+		.descriptorType = descriptor_types[binding],
+		.pImageInfo = image_info,
+		.pBufferInfo = buffer_info,
+		.pTexelBufferView = NULL,
+	};
+	vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+}
+
+static void write_null_descriptor(const struct bindless *bindless,
+                                  VkDevice device,
+                                  enum bindless_binding binding,
+                                  uint32_t index)
+{
+	VkDescriptorBufferInfo buffer_info = {
+		.buffer = bindless->null_buffer.buffer,
+		.offset = 0,
+		.range = VK_WHOLE_SIZE,
+	};
+	VkDescriptorImageInfo image_info = {
+		.sampler = VK_NULL_HANDLE,
+		.imageView = bindless->null_image.view,
+		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+	if (binding == BINDLESS_STORAGE_BUFFERS) {
+		write_descriptor(bindless, device, binding, index,
+		                 &buffer_info, NULL);
+	}
+	else {
+		write_descriptor(bindless, device, binding, index,
+		                 NULL, &image_info);
+	}
+}
+
+/* Zeroed, and the image in the layout the descriptors name */
+static uint8_t create_null_resources(
+	struct bindless *bindless,
+	VkDevice device,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	VkQueue queue,
+	uint32_t queue_family_index)
+{
+	uint8_t err = gpu_buffer_init(device, memory_properties, 16,
+	                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	                              | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                              0,
+	                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                              &bindless->null_buffer);
+	if (err) {
+		return err;
+	}
+
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = VK_FORMAT_R8G8B8A8_UNORM,
+		.extent = {
+			.width = 1,
+			.height = 1,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_SAMPLED_BIT
+		         | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	err = gpu_image_init(device, memory_properties, &image_create_info,
+	                     VK_IMAGE_ASPECT_COLOR_BIT,
+	                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                     &bindless->null_image);
+	if (err) {
+		return err;
+	}
+
+	struct gpu_one_shot one_shot;
+	err = gpu_one_shot_begin(device, queue_family_index, &one_shot);
+	if (err) {
+		return err;
+	}
+	VkCommandBuffer command_buffer = one_shot.command_buffer;
+
+	vkCmdFillBuffer(command_buffer, bindless->null_buffer.buffer, 0,
+	                VK_WHOLE_SIZE, 0);
+
+	VkImageSubresourceRange subresource_range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	VkImageMemoryBarrier to_transfer = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = bindless->null_image.image,
+		.subresourceRange = subresource_range,
+	};
+	vkCmdPipelineBarrier(command_buffer,
+	                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     0, 0, NULL, 0, NULL, 1, &to_transfer);
+
+	VkClearColorValue clear_color_value = {
+		.float32 = {0.0f, 0.0f, 0.0f, 0.0f},
+	};
+	vkCmdClearColorImage(command_buffer, bindless->null_image.image,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     &clear_color_value, 1, &subresource_range);
+
+	VkImageMemoryBarrier to_shader = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = bindless->null_image.image,
+		.subresourceRange = subresource_range,
+	};
+	VkBufferMemoryBarrier buffer_to_shader = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = bindless->null_buffer.buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	vkCmdPipelineBarrier(command_buffer,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+	                     | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	                     0, 0, NULL, 1, &buffer_to_shader, 1, &to_shader);
+
+	return gpu_one_shot_end(device, queue, &one_shot);
+}
+
+static uint8_t create_descriptor_set(
+	struct bindless *bindless,
+	VkDevice device,
+	const uint32_t capacities[BINDLESS_BINDING_COUNT])
+{
+	VkDescriptorSetLayoutBinding bindings[BINDLESS_BINDING_COUNT];
+	VkDescriptorBindingFlagsEXT binding_flags[BINDLESS_BINDING_COUNT];
+	VkDescriptorPoolSize descriptor_pool_sizes[BINDLESS_BINDING_COUNT];
+	for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; ++i) {
+		VkDescriptorSetLayoutBinding binding = {
+			.binding = i,
+			.descriptorType = descriptor_types[i],
+			.descriptorCount = capacities[i],
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+			              | VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL,
+		};
+		bindings[i] = binding;
+		binding_flags[i]
+			= VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+			  | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+		VkDescriptorPoolSize descriptor_pool_size = {
+			.type = descriptor_types[i],
+			.descriptorCount = capacities[i],
+		};
+		descriptor_pool_sizes[i] = descriptor_pool_size;
+	}
+	binding_flags[BINDLESS_BINDING_COUNT - 1]
+		|= VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+		.pNext = NULL,
+		.bindingCount = ARRAY_SIZE(binding_flags),
+		.pBindingFlags = binding_flags,
+	};
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = bindless->update_after_bind
+		         ? &binding_flags_create_info : NULL,
+		.flags = bindless->update_after_bind
+		         ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT
+		         : 0,
+		.bindingCount = ARRAY_SIZE(bindings),
+		.pBindings = bindings,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &bindless->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = bindless->update_after_bind
+		         ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT
+		         : 0,
+		.maxSets = 1,
+		.poolSizeCount = ARRAY_SIZE(descriptor_pool_sizes),
+		.pPoolSizes = descriptor_pool_sizes,
+	};
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &bindless->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	uint32_t variable_count = capacities[BINDLESS_BINDING_COUNT - 1];
+	VkDescriptorSetVariableDescriptorCountAllocateInfoEXT
+	variable_count_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT,
+		.pNext = NULL,
+		.descriptorSetCount = 1,
+		.pDescriptorCounts = &variable_count,
+	};
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = bindless->update_after_bind
+		         ? &variable_count_allocate_info : NULL,
+		.descriptorPool = bindless->descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &bindless->descriptor_set_layout,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  &bindless->descriptor_set);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+uint8_t bindless_init(struct bindless *bindless,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      VkQueue queue,
+                      uint32_t queue_family_index,
+                      bool update_after_bind,
+                      const uint32_t capacities[BINDLESS_BINDING_COUNT])
+{
+	memset(bindless, 0, sizeof(*bindless));
+	bindless->update_after_bind = update_after_bind;
+
+	for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; ++i) {
+		struct bindless_slots *slots = &bindless->slots[i];
+		slots->free = malloc(capacities[i] * sizeof(uint32_t));
+		if (slots->free == NULL) {
+			bindless_fini(bindless, device);
+			return LIBC_ERROR_BIT;
+		}
+		slots->capacity = capacities[i];
+		slots->free_count = capacities[i];
+		for (uint32_t j = 0; j < capacities[i]; ++j) {
+			slots->free[j] = capacities[i] - 1 - j;
+		}
+	}
+
+	uint8_t err = create_descriptor_set(bindless, device, capacities);
+	if (!err && !update_after_bind) {
+		err = create_null_resources(bindless, device, memory_properties,
+		                            queue, queue_family_index);
+	}
+	if (err) {
+		bindless_fini(bindless, device);
+		return err;
+	}
+
+	/* Every descriptor must be valid without partially bound bindings */
+	if (!update_after_bind) {
+		for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; ++i) {
+			for (uint32_t j = 0; j < capacities[i]; ++j) {
+				write_null_descriptor(bindless, device, i, j);
+			}
+		}
+	}
+	return NO_ERRORS;
+}
+
+void bindless_fini(struct bindless *bindless, VkDevice device)
+{
+	gpu_image_fini(device, &bindless->null_image);
+	gpu_buffer_fini(device, &bindless->null_buffer);
+	if (bindless->descriptor_pool != VK_NULL_HANDLE) {
+		vkDestroyDescriptorPool(device, bindless->descriptor_pool,
+		                        &host_allocator);
+		bindless->descriptor_pool = VK_NULL_HANDLE;
+		bindless->descriptor_set = VK_NULL_HANDLE;
+	}
+	if (bindless->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device,
+		                             bindless->descriptor_set_layout,
+		                             &host_allocator);
+		bindless->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+	for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; ++i) {
+		free(bindless->slots[i].free);
+		bindless->slots[i].free = NULL;
+		bindless->slots[i].free_count = 0;
+		bindless->slots[i].capacity = 0;
+	}
+}
+
+static uint8_t allocate_slot(struct bindless *bindless,
+                             enum bindless_binding binding,
+                             uint32_t *index)
+{
+	struct bindless_slots *slots = &bindless->slots[binding];
+	if (slots->free_count == 0) {
+		printf("All %u bindless %s are in use\n", slots->capacity,
+		       binding_names[binding]);
+		return APP_ERROR_BIT;
+	}
+	*index = slots->free[--slots->free_count];
+	return NO_ERRORS;
+}
+
+uint8_t bindless_add_buffer(struct bindless *bindless,
+                            VkDevice device,
+                            VkBuffer buffer,
+                            VkDeviceSize offset,
+                            VkDeviceSize range,
+                            uint32_t *index)
+{
+	uint8_t err = allocate_slot(bindless, BINDLESS_STORAGE_BUFFERS, index);
+	if (err) {
+		return err;
+	}
+	VkDescriptorBufferInfo buffer_info = {
+		.buffer = buffer,
+		.offset = offset,
+		.range = range,
+	};
+	write_descriptor(bindless, device, BINDLESS_STORAGE_BUFFERS, *index,
+	                 &buffer_info, NULL);
+	return NO_ERRORS;
+}
+
+uint8_t bindless_add_image(struct bindless *bindless,
+                           VkDevice device,
+                           VkImageView view,
+                           VkImageLayout layout,
+                           uint32_t *index)
+{
+	uint8_t err = allocate_slot(bindless, BINDLESS_SAMPLED_IMAGES, index);
+	if (err) {
+		return err;
+	}
+	VkDescriptorImageInfo image_info = {
+		.sampler = VK_NULL_HANDLE,
+		.imageView = view,
+		.imageLayout = layout,
+	};
+	write_descriptor(bindless, device, BINDLESS_SAMPLED_IMAGES, *index,
+	                 NULL, &image_info);
+	return NO_ERRORS;
+}
+
+void bindless_remove(struct bindless *bindless,
+                     VkDevice device,
+                     enum bindless_binding binding,
+                     uint32_t index)
+{
+	/* Partially bound descriptors can go stale while unused */
+	if (!bindless->update_after_bind) {
+		write_null_descriptor(bindless, device, binding, index);
+	}
+	struct bindless_slots *slots = &bindless->slots[binding];
+	slots->free[slots->free_count++] = index;
+}
+
+void bindless_record_bind(const struct bindless *bindless,
+                          VkCommandBuffer command_buffer,
+                          VkPipelineBindPoint pipeline_bind_point,
+                          VkPipelineLayout pipeline_layout,
+                          uint32_t set)
+{
+	vkCmdBindDescriptorSets(command_buffer, pipeline_bind_point,
+	                        pipeline_layout, set, 1,
+	                        &bindless->descriptor_set, 0, NULL);
+}
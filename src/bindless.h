@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_BINDLESS_H
+#define HELLO_VULKAN_BINDLESS_H
+
+#include "gpu.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The images come last, only the last binding can have a variable count */
+enum bindless_binding {
+	BINDLESS_STORAGE_BUFFERS,
+	BINDLESS_SAMPLED_IMAGES,
+	BINDLESS_BINDING_COUNT,
+};
+
+/* Free descriptor indices of a binding, the lowest on top */
+struct bindless_slots {
+	uint32_t *free;
+	uint32_t free_count;
+	uint32_t capacity;
+};
+
+/*
+ * One descriptor set holding every storage buffer and sampled image, bound
+ * once per command buffer; draws pick their resources with an index, so
+ * nothing is rebound between draws. With VK_EXT_descriptor_indexing the
+ * bindings are update after bind and partially bound, so resources can be
+ * added while command buffers using the set are pending. Without it the
+ * capacities are the small core limits, free slots point at null resources
+ * and the set must only be written while no command buffer is pending.
+ */
+struct bindless {
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet descriptor_set;
+	bool update_after_bind;
+	struct bindless_slots slots[BINDLESS_BINDING_COUNT];
+	struct gpu_buffer null_buffer;
+	struct gpu_image null_image;
+};
+
+uint8_t bindless_init(struct bindless *bindless,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      VkQueue queue,
+                      uint32_t queue_family_index,
+                      bool update_after_bind,
+                      const uint32_t capacities[BINDLESS_BINDING_COUNT]);
+void bindless_fini(struct bindless *bindless, VkDevice device);
+
+uint8_t bindless_add_buffer(struct bindless *bindless,
+                            VkDevice device,
+                            VkBuffer buffer,
+                            VkDeviceSize offset,
+                            VkDeviceSize range,
+                            uint32_t *index);
+uint8_t bindless_add_image(struct bindless *bindless,
+                           VkDevice device,
+                           VkImageView view,
+                           VkImageLayout layout,
+                           uint32_t *index);
+/* The caller makes sure no pending command buffer still uses it */
+void bindless_remove(struct bindless *bindless,
+                     VkDevice device,
+                     enum bindless_binding binding,
+                     uint32_t index);
+
+void bindless_record_bind(const struct bindless *bindless,
+                          VkCommandBuffer command_buffer,
+                          VkPipelineBindPoint pipeline_bind_point,
+                          VkPipelineLayout pipeline_layout,
+                          uint32_t set);
+
+#endif
@@ -0,0 +1,575 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "capture.h"
+
+#include "error.h"
+#include "host_memory.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Frames are converted into a page aligned buffer and written in one call */
+#define CAPTURE_ALIGNMENT 4096
+#define CAPTURE_HEADER_SIZE 64
+#define CAPTURE_FRAME_RATE 60
+
+static bool has_suffix(const char *string, const char *suffix)
+{
+	size_t length = strlen(string);
+	size_t suffix_length = strlen(suffix);
+	return length >= suffix_length
+	       && strcmp(string + length - suffix_length, suffix) == 0;
+}
+
+static uint8_t write_all(int fd, const unsigned char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return POSIX_ERROR_BIT;
+		}
+		data += written;
+		size -= written;
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t reserve_output(struct capture *capture, size_t size)
+{
+	if (size <= capture->output_capacity) {
+		return NO_ERRORS;
+	}
+	size = (size + CAPTURE_ALIGNMENT - 1) & ~(size_t) (CAPTURE_ALIGNMENT - 1);
+	void *output;
+	if (posix_memalign(&output, CAPTURE_ALIGNMENT, size) != 0) {
+		return LIBC_ERROR_BIT;
+	}
+	free(capture->output);
+	capture->output = output;
+	capture->output_capacity = size;
+	return NO_ERRORS;
+}
+
+/* Pixels are 4 bytes, blue first unless swap_red_blue */
+static size_t convert_ppm(unsigned char *output,
+                          const unsigned char *pixels,
+                          uint32_t width,
+                          uint32_t height,
+                          bool swap_red_blue)
+{
+	int length = sprintf((char *) output, "P6\n%u %u\n255\n", width, height);
+	unsigned char *rgb = output + length;
+	uint32_t red = swap_red_blue ? 0 : 2;
+	uint32_t blue = swap_red_blue ? 2 : 0;
+	for (size_t i = 0; i < (size_t) width * height; ++i) {
+		rgb[0] = pixels[red];
+		rgb[1] = pixels[1];
+		rgb[2] = pixels[blue];
+		rgb += 3;
+		pixels += 4;
+	}
+	return rgb - output;
+}
+
+/* BT.601 studio range, one plane each of Y, Cb and Cr */
+static size_t convert_y4m(unsigned char *output,
+                          const unsigned char *pixels,
+                          uint32_t width,
+                          uint32_t height,
+                          bool swap_red_blue)
+{
+	static const char frame_header[] = "FRAME\n";
+	memcpy(output, frame_header, sizeof(frame_header) - 1);
+	size_t pixel_count = (size_t) width * height;
+	unsigned char *y = output + sizeof(frame_header) - 1;
+	unsigned char *u = y + pixel_count;
+	unsigned char *v = u + pixel_count;
+	uint32_t red = swap_red_blue ? 0 : 2;
+	uint32_t blue = swap_red_blue ? 2 : 0;
+	for (size_t i = 0; i < pixel_count; ++i) {
+		int r = pixels[red];
+		int g = pixels[1];
+		int b = pixels[blue];
+		y[i] = (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8)
+		                        + 16);
+		u[i] = (unsigned char) (((-38 * r - 74 * g + 112 * b + 128) >> 8)
+		                        + 128);
+		v[i] = (unsigned char) (((112 * r - 94 * g - 18 * b + 128) >> 8)
+		                        + 128);
+		pixels += 4;
+	}
+	return sizeof(frame_header) - 1 + 3 * pixel_count;
+}
+
+static uint8_t write_slot(struct capture *capture,
+                          const struct capture_slot *slot)
+{
+	struct trace_zone wait_zone = trace_begin("capture_wait");
+	VkSemaphoreWaitInfoKHR semaphore_wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+		.pNext = NULL,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &capture->timeline->semaphore,
+		.pValues = &slot->timeline_value,
+	};
+	VkResult result = capture->timeline->wait_semaphores(
+		capture->device,
+		&semaphore_wait_info,
+		UINT64_MAX
+	);
+	trace_end(&wait_zone);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	struct trace_zone convert_zone = trace_begin("capture_convert");
+	uint8_t err = reserve_output(capture,
+	                             2 * CAPTURE_HEADER_SIZE
+	                             + 3 * (size_t) slot->width * slot->height);
+	if (err) {
+		return err;
+	}
+	size_t size = 0;
+	if (capture->format == CAPTURE_FORMAT_PPM) {
+		size = convert_ppm(capture->output, slot->buffer.mapped,
+		                   slot->width, slot->height,
+		                   capture->swap_red_blue);
+	}
+	else {
+		if (capture->stream_width == 0) {
+			capture->stream_width = slot->width;
+			capture->stream_height = slot->height;
+			size = sprintf((char *) capture->output,
+			               "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+			               slot->width, slot->height,
+			               CAPTURE_FRAME_RATE);
+		}
+		/* A Y4M stream can't change size, so resized frames are lost */
+		else if (capture->stream_width != slot->width
+		         || capture->stream_height != slot->height) {
+			trace_end(&convert_zone);
+			pthread_mutex_lock(&capture->mutex);
+			++capture->frames_dropped;
+			pthread_mutex_unlock(&capture->mutex);
+			return NO_ERRORS;
+		}
+		size += convert_y4m(capture->output + size,
+		                    slot->buffer.mapped,
+		                    slot->width, slot->height,
+		                    capture->swap_red_blue);
+	}
+	trace_end(&convert_zone);
+
+	struct trace_zone write_zone = trace_begin("capture_write");
+	uint64_t begin_ns = trace_now_ns();
+	err = write_all(capture->fd, capture->output, size);
+	uint64_t end_ns = trace_now_ns();
+	trace_end(&write_zone);
+	if (err) {
+		return err;
+	}
+
+	if (capture->frames_written == 0) {
+		capture->first_write_ns = begin_ns;
+	}
+	capture->last_write_ns = end_ns;
+	capture->write_ns += end_ns - begin_ns;
+	capture->bytes_written += size;
+	++capture->frames_written;
+	return NO_ERRORS;
+}
+
+/* After an error the ring keeps draining, so nothing waits on it forever */
+static void *write_frames(void *data)
+{
+	struct capture *capture = data;
+	pthread_mutex_lock(&capture->mutex);
+	while (true) {
+		while (capture->count == 0 && !capture->stopping) {
+			pthread_cond_wait(&capture->queued, &capture->mutex);
+		}
+		if (capture->count == 0) {
+			break;
+		}
+		const struct capture_slot *slot
+			= &capture->slots[capture->tail];
+		bool failed = capture->err != 0;
+		pthread_mutex_unlock(&capture->mutex);
+
+		uint8_t err = failed ? NO_ERRORS : write_slot(capture, slot);
+
+		pthread_mutex_lock(&capture->mutex);
+		capture->err |= err;
+		capture->tail = (capture->tail + 1) % CAPTURE_SLOT_COUNT;
+		--capture->count;
+		pthread_cond_signal(&capture->written);
+	}
+	pthread_mutex_unlock(&capture->mutex);
+	return NULL;
+}
+
+uint8_t capture_init(struct capture *capture,
+                     VkDevice device,
+                     const struct timeline *timeline,
+                     uint32_t queue_family_index,
+                     const char *filename,
+                     uint32_t interval)
+{
+	memset(capture, 0, sizeof(*capture));
+	capture->fd = -1;
+	capture->format = has_suffix(filename, ".y4m") ? CAPTURE_FORMAT_Y4M
+	                                               : CAPTURE_FORMAT_PPM;
+	capture->interval = interval;
+	capture->device = device;
+	capture->timeline = timeline;
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->queued, NULL);
+	pthread_cond_init(&capture->written, NULL);
+
+	capture->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	                   0644);
+	if (capture->fd == -1) {
+		printf("Can't open %s for capture\n", filename);
+		return POSIX_ERROR_BIT;
+	}
+
+	/* Each copy is recorded again for whichever image it reads */
+	VkCommandPoolCreateInfo command_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = queue_family_index,
+	};
+	VkResult result;
+	result = vkCreateCommandPool(device, &command_pool_create_info,
+	                             &host_allocator, &capture->command_pool);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	VkCommandBuffer command_buffers[CAPTURE_SLOT_COUNT];
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = capture->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = CAPTURE_SLOT_COUNT,
+	};
+	result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info,
+	                                  command_buffers);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	for (uint32_t i = 0; i < CAPTURE_SLOT_COUNT; ++i) {
+		capture->slots[i].command_buffer = command_buffers[i];
+	}
+
+	capture->threaded = pthread_create(&capture->thread, NULL,
+	                                   write_frames, capture) == 0;
+	if (!capture->threaded) {
+		return POSIX_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
+
+uint8_t capture_fini(struct capture *capture)
+{
+	if (capture->device == VK_NULL_HANDLE) {
+		return NO_ERRORS;
+	}
+	if (capture->threaded) {
+		pthread_mutex_lock(&capture->mutex);
+		capture->stopping = true;
+		pthread_cond_signal(&capture->queued);
+		pthread_mutex_unlock(&capture->mutex);
+		pthread_join(capture->thread, NULL);
+		capture->threaded = false;
+	}
+	pthread_cond_destroy(&capture->written);
+	pthread_cond_destroy(&capture->queued);
+	pthread_mutex_destroy(&capture->mutex);
+
+	for (uint32_t i = 0; i < CAPTURE_SLOT_COUNT; ++i) {
+		gpu_buffer_fini(capture->device, &capture->slots[i].buffer);
+	}
+	if (capture->command_pool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(capture->device, capture->command_pool,
+		                     &host_allocator);
+		capture->command_pool = VK_NULL_HANDLE;
+	}
+	free(capture->images);
+	capture->images = NULL;
+	free(capture->output);
+	capture->output = NULL;
+
+	uint8_t err = capture->err;
+	if (capture->fd != -1 && close(capture->fd) == -1) {
+		err |= POSIX_ERROR_BIT;
+	}
+	capture->fd = -1;
+	if (capture->frames_dropped > 0) {
+		printf("Capture dropped %u of %u frames\n",
+		       capture->frames_dropped,
+		       capture->frames_dropped + capture->frames_written);
+	}
+	capture->device = VK_NULL_HANDLE;
+	return err;
+}
+
+uint8_t capture_use_swapchain(
+	struct capture *capture,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	const VkImage *images,
+	uint32_t image_count,
+	VkExtent2D extent,
+	VkFormat format)
+{
+	bool swap_red_blue;
+	switch (format) {
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		swap_red_blue = false;
+		break;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		swap_red_blue = true;
+		break;
+	default:
+		printf("Can't capture swapchain format %d\n", format);
+		return APP_ERROR_BIT;
+	}
+
+	/* Only a resize waits for the disk, the slots are about to change */
+	struct trace_zone zone = trace_begin("capture_drain");
+	pthread_mutex_lock(&capture->mutex);
+	while (capture->count > 0) {
+		pthread_cond_wait(&capture->written, &capture->mutex);
+	}
+	uint8_t err = capture->err;
+	pthread_mutex_unlock(&capture->mutex);
+	trace_end(&zone);
+	if (err) {
+		return err;
+	}
+	capture->recorded = false;
+
+	VkImage *copies = realloc(capture->images, image_count * sizeof(VkImage));
+	if (copies == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	memcpy(copies, images, image_count * sizeof(VkImage));
+	capture->images = copies;
+	capture->image_count = image_count;
+	capture->swap_red_blue = swap_red_blue;
+
+	if (capture->extent.width == extent.width
+	    && capture->extent.height == extent.height) {
+		return NO_ERRORS;
+	}
+	capture->extent.width = 0;
+	capture->extent.height = 0;
+	for (uint32_t i = 0; i < CAPTURE_SLOT_COUNT; ++i) {
+		struct capture_slot *slot = &capture->slots[i];
+		gpu_buffer_fini(capture->device, &slot->buffer);
+		/* Read by the CPU, so cached when there is such memory */
+		err = gpu_buffer_init(capture->device, memory_properties,
+		                      4 * (VkDeviceSize) extent.width
+		                      * extent.height,
+		                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		                      | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+		                      &slot->buffer);
+		if (err) {
+			return err;
+		}
+		slot->width = extent.width;
+		slot->height = extent.height;
+	}
+	capture->extent = extent;
+	return NO_ERRORS;
+}
+
+uint8_t capture_record(struct capture *capture,
+                       uint32_t image_index,
+                       VkCommandBuffer *command_buffer)
+{
+	*command_buffer = VK_NULL_HANDLE;
+	if (capture->frame++ % capture->interval != 0) {
+		return NO_ERRORS;
+	}
+
+	pthread_mutex_lock(&capture->mutex);
+	bool full = capture->count == CAPTURE_SLOT_COUNT;
+	if (full) {
+		++capture->frames_dropped;
+	}
+	pthread_mutex_unlock(&capture->mutex);
+	if (full) {
+		return NO_ERRORS;
+	}
+
+	/* The writer is done with the head slot and so is the GPU */
+	struct capture_slot *slot = &capture->slots[capture->head];
+	VkCommandBufferBeginInfo command_buffer_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	VkResult result;
+	result = vkBeginCommandBuffer(slot->command_buffer,
+	                              &command_buffer_begin_info);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkImageSubresourceRange subresource_range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	VkImageMemoryBarrier to_transfer = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = capture->images[image_index],
+		.subresourceRange = subresource_range,
+	};
+	/*
+	 * The render pass leaves the image at color attachment output, and
+	 * compute post processing ends with a barrier to the transfer stage
+	 */
+	vkCmdPipelineBarrier(slot->command_buffer,
+	                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+	                     | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     0, 0, NULL, 0, NULL, 1, &to_transfer);
+
+	/* Tightly packed rows, as the writer reads them */
+	VkBufferImageCopy buffer_image_copy = {
+		.bufferOffset = 0,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.imageOffset = {
+			.x = 0,
+			.y = 0,
+			.z = 0,
+		},
+		.imageExtent = {
+			.width = slot->width,
+			.height = slot->height,
+			.depth = 1,
+		},
+	};
+	vkCmdCopyImageToBuffer(slot->command_buffer,
+	                       capture->images[image_index],
+	                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                       slot->buffer.buffer,
+	                       1, &buffer_image_copy);
+
+	/* Presentation waits on the submit's semaphore, so no access */
+	VkImageMemoryBarrier to_present = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = 0,
+		.dstAccessMask = 0,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = capture->images[image_index],
+		.subresourceRange = subresource_range,
+	};
+	VkBufferMemoryBarrier to_host = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->buffer.buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	vkCmdPipelineBarrier(slot->command_buffer,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+	                     | VK_PIPELINE_STAGE_HOST_BIT,
+	                     0, 0, NULL, 1, &to_host, 1, &to_present);
+
+	result = vkEndCommandBuffer(slot->command_buffer);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	capture->recorded = true;
+	*command_buffer = slot->command_buffer;
+	return NO_ERRORS;
+}
+
+void capture_submitted(struct capture *capture, uint64_t timeline_value)
+{
+	if (!capture->recorded) {
+		return;
+	}
+	capture->recorded = false;
+	pthread_mutex_lock(&capture->mutex);
+	capture->slots[capture->head].timeline_value = timeline_value;
+	capture->head = (capture->head + 1) % CAPTURE_SLOT_COUNT;
+	++capture->count;
+	pthread_cond_signal(&capture->queued);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+void capture_print_report(const struct capture *capture)
+{
+	double seconds = (double) (capture->last_write_ns
+	                           - capture->first_write_ns) / 1e9;
+	double write_seconds = (double) capture->write_ns / 1e9;
+	double megabytes = (double) capture->bytes_written / (1024.0 * 1024.0);
+
+	printf("report capture_frames %u\n", capture->frames_written);
+	printf("report capture_dropped_frames %u\n", capture->frames_dropped);
+	printf("report capture_mb_per_s %.3f\n",
+	       seconds > 0.0 ? megabytes / seconds : 0.0);
+	printf("report capture_write_mb_per_s %.3f\n",
+	       write_seconds > 0.0 ? megabytes / write_seconds : 0.0);
+}
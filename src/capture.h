@@ -0,0 +1,136 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_CAPTURE_H
+#define HELLO_VULKAN_CAPTURE_H
+
+#include "gpu.h"
+#include "timeline.h"
+
+#include <vulkan/vulkan.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_SLOT_COUNT 8
+
+enum capture_format {
+	/* Concatenated binary PPM images, each with its own size */
+	CAPTURE_FORMAT_PPM,
+	/* 4:4:4 YUV4MPEG2, every frame at the first frame's size */
+	CAPTURE_FORMAT_Y4M,
+};
+
+struct capture_slot {
+	struct gpu_buffer buffer;
+	VkCommandBuffer command_buffer;
+	/* The timeline value of the submit copying into the buffer */
+	uint64_t timeline_value;
+	uint32_t width;
+	uint32_t height;
+};
+
+/*
+ * Streams swapchain images to a file. A captured frame appends a copy into
+ * the next free readback slot to its submit, and a writer thread waits on
+ * the frame timeline for it, converts it and writes it out. When every slot
+ * is still waiting for the disk the frame is dropped instead of stalling the
+ * render loop.
+ */
+struct capture {
+	int fd;
+	enum capture_format format;
+	uint32_t interval;
+	VkDevice device;
+	const struct timeline *timeline;
+	VkCommandPool command_pool;
+
+	/* Owned by the render thread, changed with the ring empty */
+	VkImage *images;
+	uint32_t image_count;
+	VkExtent2D extent;
+	bool swap_red_blue;
+	uint32_t frame;
+	/* The head slot holds a copy not yet submitted */
+	bool recorded;
+	struct capture_slot slots[CAPTURE_SLOT_COUNT];
+
+	pthread_t thread;
+	bool threaded;
+	pthread_mutex_t mutex;
+	pthread_cond_t queued;
+	pthread_cond_t written;
+	/* Slots from tail, count of them, are queued for the writer */
+	uint32_t head;
+	uint32_t tail;
+	uint32_t count;
+	bool stopping;
+	uint8_t err;
+
+	/* Owned by the writer thread */
+	unsigned char *output;
+	size_t output_capacity;
+	uint32_t stream_width;
+	uint32_t stream_height;
+
+	uint32_t frames_written;
+	uint32_t frames_dropped;
+	uint64_t bytes_written;
+	uint64_t write_ns;
+	uint64_t first_write_ns;
+	uint64_t last_write_ns;
+};
+
+/*
+ * Opens filename, Y4M for a .y4m suffix and PPM otherwise, and starts the
+ * writer. Every interval-th frame is captured.
+ */
+uint8_t capture_init(struct capture *capture,
+                     VkDevice device,
+                     const struct timeline *timeline,
+                     uint32_t queue_family_index,
+                     const char *filename,
+                     uint32_t interval);
+/* Writes out every queued frame first, so the timeline must still exist */
+uint8_t capture_fini(struct capture *capture);
+
+/*
+ * Waits for the writer to empty the ring, then copies from images from now
+ * on, resizing the readback buffers for extent.
+ */
+uint8_t capture_use_swapchain(
+	struct capture *capture,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	const VkImage *images,
+	uint32_t image_count,
+	VkExtent2D extent,
+	VkFormat format);
+
+/*
+ * Sets command_buffer to the copy of image image_index to submit after the
+ * frame's command buffer, or null when the frame isn't captured. Once the
+ * submit worked, capture_submitted hands the copy to the writer.
+ */
+uint8_t capture_record(struct capture *capture,
+                       uint32_t image_index,
+                       VkCommandBuffer *command_buffer);
+void capture_submitted(struct capture *capture, uint64_t timeline_value);
+
+void capture_print_report(const struct capture *capture);
+
+#endif
@@ -0,0 +1,500 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "command_stream.h"
+
+#include "error.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + COMMAND_STREAM_ALIGNMENT - 1)
+	       / COMMAND_STREAM_ALIGNMENT * COMMAND_STREAM_ALIGNMENT;
+}
+
+void command_stream_init(struct command_stream *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+	memcpy(stream->header.magic, COMMAND_STREAM_MAGIC,
+	       sizeof(stream->header.magic));
+	stream->header.version = COMMAND_STREAM_VERSION;
+}
+
+void command_stream_fini(struct command_stream *stream)
+{
+	for (uint32_t i = 0; i < stream->header.resource_count; ++i) {
+		free(stream->blobs[i]);
+	}
+	free(stream->blobs);
+	free(stream->resources);
+	free(stream->words);
+	memset(stream, 0, sizeof(*stream));
+}
+
+uint32_t command_stream_add_resource(struct command_stream *stream,
+                                     enum command_stream_resource_type type,
+                                     const void *data,
+                                     uint32_t size)
+{
+	if (stream == NULL) {
+		return UINT32_MAX;
+	}
+	uint32_t index = stream->header.resource_count;
+	if (index == stream->resource_capacity) {
+		uint32_t capacity = index == 0 ? 8 : index * 2;
+		struct command_stream_resource *resources = realloc(
+			stream->resources,
+			capacity * sizeof(struct command_stream_resource)
+		);
+		if (resources != NULL) {
+			stream->resources = resources;
+		}
+		void **blobs = realloc(stream->blobs, capacity * sizeof(void *));
+		if (blobs != NULL) {
+			stream->blobs = blobs;
+		}
+		if (resources == NULL || blobs == NULL) {
+			stream->err |= LIBC_ERROR_BIT;
+			return UINT32_MAX;
+		}
+		stream->resource_capacity = capacity;
+	}
+
+	void *blob = malloc(size > 0 ? size : 1);
+	if (blob == NULL) {
+		stream->err |= LIBC_ERROR_BIT;
+		return UINT32_MAX;
+	}
+	memcpy(blob, data, size);
+	stream->resources[index] = (struct command_stream_resource) {
+		.type = type,
+		.size = size,
+		.offset = 0,
+	};
+	stream->blobs[index] = blob;
+	stream->header.resource_count = index + 1;
+	return index;
+}
+
+static void record_words(struct command_stream *stream,
+                         const uint32_t *words,
+                         uint32_t count)
+{
+	if (count == 0) {
+		return;
+	}
+	uint32_t needed = stream->header.word_count + count;
+	if (needed > stream->word_capacity) {
+		uint32_t capacity = stream->word_capacity == 0
+		                    ? 1024
+		                    : stream->word_capacity;
+		while (capacity < needed) {
+			capacity *= 2;
+		}
+		uint32_t *grown = realloc(stream->words,
+		                          capacity * sizeof(uint32_t));
+		if (grown == NULL) {
+			stream->err |= LIBC_ERROR_BIT;
+			return;
+		}
+		stream->words = grown;
+		stream->word_capacity = capacity;
+	}
+	memcpy(stream->words + stream->header.word_count, words,
+	       count * sizeof(uint32_t));
+	stream->header.word_count = needed;
+}
+
+void command_stream_record(struct command_stream *stream,
+                           enum command_stream_op op,
+                           const uint32_t *arguments,
+                           uint32_t argument_count)
+{
+	if (stream == NULL) {
+		return;
+	}
+	uint32_t word = op;
+	record_words(stream, &word, 1);
+	record_words(stream, arguments, argument_count);
+}
+
+void command_stream_record_push_constants(struct command_stream *stream,
+                                          uint32_t offset,
+                                          uint32_t size,
+                                          const void *data)
+{
+	if (stream == NULL) {
+		return;
+	}
+	uint32_t arguments[2] = {offset, size};
+	command_stream_record(stream, COMMAND_STREAM_PUSH_CONSTANTS,
+	                      arguments, 2);
+	/* Push constant ranges are multiples of 4 bytes */
+	uint32_t words[32];
+	uint32_t count = size / sizeof(uint32_t);
+	if (count > sizeof(words) / sizeof(words[0])) {
+		stream->err |= APP_ERROR_BIT;
+		return;
+	}
+	memcpy(words, data, count * sizeof(uint32_t));
+	record_words(stream, words, count);
+}
+
+uint8_t command_stream_write(const struct command_stream *stream,
+                             const char *filename)
+{
+	if (stream->err) {
+		printf("Could not record the command stream\n");
+		return stream->err;
+	}
+
+	struct command_stream_header header = stream->header;
+	uint64_t offset = sizeof(header)
+	                  + header.resource_count
+	                    * sizeof(struct command_stream_resource)
+	                  + header.word_count * sizeof(uint32_t);
+	struct command_stream_resource *resources = malloc(
+		(header.resource_count + 1)
+		* sizeof(struct command_stream_resource)
+	);
+	if (resources == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < header.resource_count; ++i) {
+		resources[i] = stream->resources[i];
+		offset = align(offset);
+		resources[i].offset = offset;
+		offset += resources[i].size;
+	}
+
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) {
+		free(resources);
+		printf("Could not create %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+	static const char zeros[COMMAND_STREAM_ALIGNMENT] = {0};
+	bool written
+		= fwrite(&header, sizeof(header), 1, file) == 1
+		  && fwrite(resources, sizeof(struct command_stream_resource),
+		            header.resource_count, file)
+		     == header.resource_count
+		  && fwrite(stream->words, sizeof(uint32_t), header.word_count,
+		            file) == header.word_count;
+	for (uint32_t i = 0; i < header.resource_count && written; ++i) {
+		long padding = (long) resources[i].offset - ftell(file);
+		written = padding >= 0
+		          && fwrite(zeros, 1, padding, file) == (size_t) padding
+		          && fwrite(stream->blobs[i], 1, resources[i].size, file)
+		             == resources[i].size;
+	}
+	free(resources);
+	uint8_t err = written ? NO_ERRORS : LIBC_ERROR_BIT;
+	if (fclose(file) != 0) {
+		err |= LIBC_ERROR_BIT;
+	}
+	if (err) {
+		remove(filename);
+		return err;
+	}
+	printf("Wrote %u command words and %u resources to %s\n",
+	       header.word_count, header.resource_count, filename);
+	return NO_ERRORS;
+}
+
+/* Whether vertices first to last, inclusive, are in the bound buffer */
+static bool vertices_in_bounds(const struct command_stream *stream,
+                               uint32_t vertex_buffer,
+                               int64_t first,
+                               int64_t last)
+{
+	if (vertex_buffer == UINT32_MAX || stream->header.vertex_stride == 0) {
+		return false;
+	}
+	uint64_t vertex_count = stream->resources[vertex_buffer].size
+	                        / stream->header.vertex_stride;
+	return first >= 0 && last < (int64_t) vertex_count;
+}
+
+static bool draw_in_bounds(const struct command_stream *stream,
+                           uint32_t vertex_buffer,
+                           const uint32_t *arguments)
+{
+	uint32_t vertex_count = arguments[0];
+	uint32_t first_vertex = arguments[2];
+	/* Without vertex input, the shader makes up the vertices */
+	if (stream->header.attribute_count == 0 || vertex_count == 0) {
+		return true;
+	}
+	return vertices_in_bounds(stream, vertex_buffer, first_vertex,
+	                          (int64_t) first_vertex + vertex_count - 1);
+}
+
+/* Reads the drawn indices to find the vertices they fetch */
+static bool draw_indexed_in_bounds(const struct command_stream *stream,
+                                   uint32_t vertex_buffer,
+                                   uint32_t index_buffer,
+                                   uint32_t index_type,
+                                   const uint32_t *arguments)
+{
+	uint32_t index_count = arguments[0];
+	uint32_t first_index = arguments[2];
+	int32_t vertex_offset = (int32_t) arguments[3];
+	if (index_buffer == UINT32_MAX) {
+		return false;
+	}
+	uint32_t index_size = index_type == VK_INDEX_TYPE_UINT16
+	                      ? sizeof(uint16_t)
+	                      : sizeof(uint32_t);
+	if ((uint64_t) first_index + index_count
+	    > stream->resources[index_buffer].size / index_size) {
+		return false;
+	}
+	if (stream->header.attribute_count == 0 || index_count == 0) {
+		return true;
+	}
+
+	const void *indices = stream->blobs[index_buffer];
+	uint32_t min = UINT32_MAX;
+	uint32_t max = 0;
+	for (uint32_t i = first_index; i < first_index + index_count; ++i) {
+		uint32_t index = index_type == VK_INDEX_TYPE_UINT16
+		                 ? ((const uint16_t *) indices)[i]
+		                 : ((const uint32_t *) indices)[i];
+		min = index < min ? index : min;
+		max = index > max ? index : max;
+	}
+	return vertices_in_bounds(stream, vertex_buffer,
+	                          (int64_t) min + vertex_offset,
+	                          (int64_t) max + vertex_offset);
+}
+
+/*
+ * Walks the commands the way a replay records them, so every one is well
+ * formed and every draw reads within the buffers bound when it is issued
+ */
+static bool commands_valid(const struct command_stream *stream)
+{
+	const uint32_t *words = stream->words;
+	uint32_t count = stream->header.word_count;
+	uint32_t vertex_buffer = UINT32_MAX;
+	uint32_t index_buffer = UINT32_MAX;
+	uint32_t index_type = VK_INDEX_TYPE_UINT16;
+	for (uint32_t w = 0; w < count;) {
+		uint32_t arguments = command_stream_argument_count(
+			stream, words + w, count - w
+		);
+		if (arguments == UINT32_MAX) {
+			return false;
+		}
+		const uint32_t *a = words + w + 1;
+		bool valid = true;
+		switch (words[w]) {
+		case COMMAND_STREAM_BIND_VERTEX_BUFFER:
+			vertex_buffer = a[0];
+			break;
+		case COMMAND_STREAM_BIND_INDEX_BUFFER:
+			index_buffer = a[0];
+			index_type = a[1];
+			break;
+		case COMMAND_STREAM_DRAW:
+			valid = draw_in_bounds(stream, vertex_buffer, a);
+			break;
+		case COMMAND_STREAM_DRAW_INDEXED:
+			valid = draw_indexed_in_bounds(stream, vertex_buffer,
+			                               index_buffer, index_type,
+			                               a);
+			break;
+		default:
+			break;
+		}
+		if (!valid) {
+			return false;
+		}
+		w += 1 + arguments;
+	}
+	return true;
+}
+
+uint8_t command_stream_read(struct command_stream *stream,
+                            const char *filename)
+{
+	memset(stream, 0, sizeof(*stream));
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		printf("Could not open %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+
+	struct command_stream_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || memcmp(header.magic, COMMAND_STREAM_MAGIC,
+	              sizeof(header.magic)) != 0
+	    || header.version != COMMAND_STREAM_VERSION
+	    || header.attribute_count > COMMAND_STREAM_MAX_ATTRIBUTES) {
+		fclose(file);
+		printf("%s is not a command stream\n", filename);
+		return APP_ERROR_BIT;
+	}
+
+	/*
+	 * Every count has to fit in the file before anything is allocated
+	 * for it, in 64 bits so that no count can wrap the sizes around
+	 */
+	uint64_t file_size = 0;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long end = ftell(file);
+		file_size = end > 0 ? (uint64_t) end : 0;
+	}
+	uint64_t table_size = sizeof(header)
+	                      + (uint64_t) header.resource_count
+	                        * sizeof(struct command_stream_resource)
+	                      + (uint64_t) header.word_count * sizeof(uint32_t);
+	if (table_size > file_size
+	    || fseek(file, sizeof(header), SEEK_SET) != 0) {
+		fclose(file);
+		printf("%s is truncated or corrupt\n", filename);
+		return APP_ERROR_BIT;
+	}
+
+	uint8_t err = NO_ERRORS;
+	uint32_t resource_count = header.resource_count;
+	stream->resources = calloc((size_t) resource_count + 1,
+	                           sizeof(struct command_stream_resource));
+	stream->blobs = calloc((size_t) resource_count + 1, sizeof(void *));
+	stream->words = malloc(((size_t) header.word_count + 1)
+	                       * sizeof(uint32_t));
+	if (stream->resources == NULL || stream->blobs == NULL
+	    || stream->words == NULL) {
+		err = LIBC_ERROR_BIT;
+	}
+	else if (fread(stream->resources,
+	               sizeof(struct command_stream_resource), resource_count,
+	               file) != resource_count
+	         || fread(stream->words, sizeof(uint32_t), header.word_count,
+	                  file) != header.word_count) {
+		err = APP_ERROR_BIT;
+	}
+	stream->header = header;
+	stream->header.resource_count = 0;
+	stream->resource_capacity = resource_count;
+	stream->word_capacity = header.word_count;
+
+	for (uint32_t i = 0; i < resource_count && !err; ++i) {
+		const struct command_stream_resource *resource
+			= &stream->resources[i];
+		if (resource->type >= COMMAND_STREAM_RESOURCE_TYPE_COUNT
+		    || resource->offset > file_size
+		    || resource->size > file_size - resource->offset
+		    || fseek(file, (long) resource->offset, SEEK_SET) != 0) {
+			err = APP_ERROR_BIT;
+			break;
+		}
+		stream->blobs[i] = malloc(resource->size > 0
+		                          ? resource->size
+		                          : 1);
+		if (stream->blobs[i] == NULL) {
+			err = LIBC_ERROR_BIT;
+			break;
+		}
+		/* Counted as it is read, so fini frees exactly these */
+		stream->header.resource_count = i + 1;
+		if (fread(stream->blobs[i], 1, resource->size, file)
+		    != resource->size) {
+			err = APP_ERROR_BIT;
+		}
+	}
+	fclose(file);
+	if (!err && !commands_valid(stream)) {
+		err = APP_ERROR_BIT;
+	}
+	if (err) {
+		if (err & APP_ERROR_BIT) {
+			printf("%s is truncated or corrupt\n", filename);
+		}
+		command_stream_fini(stream);
+	}
+	return err;
+}
+
+static bool is_resource(const struct command_stream *stream,
+                        uint32_t resource,
+                        enum command_stream_resource_type type)
+{
+	return resource < stream->header.resource_count
+	       && stream->resources[resource].type == type;
+}
+
+uint32_t command_stream_argument_count(const struct command_stream *stream,
+                                       const uint32_t *words,
+                                       uint32_t count)
+{
+	static const uint32_t fixed_counts[COMMAND_STREAM_OP_COUNT] = {
+		[COMMAND_STREAM_BIND_PIPELINE] = 0,
+		[COMMAND_STREAM_BIND_UNIFORMS] = 1,
+		[COMMAND_STREAM_BIND_VERTEX_BUFFER] = 1,
+		[COMMAND_STREAM_BIND_INDEX_BUFFER] = 2,
+		[COMMAND_STREAM_PUSH_CONSTANTS] = 2,
+		[COMMAND_STREAM_DRAW] = 4,
+		[COMMAND_STREAM_DRAW_INDEXED] = 5,
+	};
+	if (count == 0 || words[0] >= COMMAND_STREAM_OP_COUNT
+	    || fixed_counts[words[0]] >= count) {
+		return UINT32_MAX;
+	}
+
+	uint32_t arguments = fixed_counts[words[0]];
+	switch (words[0]) {
+	case COMMAND_STREAM_BIND_UNIFORMS:
+		if (!is_resource(stream, words[1], COMMAND_STREAM_UNIFORMS)) {
+			return UINT32_MAX;
+		}
+		break;
+	case COMMAND_STREAM_BIND_VERTEX_BUFFER:
+		if (!is_resource(stream, words[1],
+		                 COMMAND_STREAM_VERTEX_BUFFER)) {
+			return UINT32_MAX;
+		}
+		break;
+	case COMMAND_STREAM_BIND_INDEX_BUFFER:
+		if (!is_resource(stream, words[1], COMMAND_STREAM_INDEX_BUFFER)
+		    || (words[2] != VK_INDEX_TYPE_UINT16
+		        && words[2] != VK_INDEX_TYPE_UINT32)) {
+			return UINT32_MAX;
+		}
+		break;
+	case COMMAND_STREAM_PUSH_CONSTANTS:
+		/* The data has to lie within the declared range */
+		if (words[2] % sizeof(uint32_t) != 0
+		    || words[1] > stream->header.push_constant_size
+		    || words[2] > stream->header.push_constant_size - words[1]
+		    || words[2] / sizeof(uint32_t) >= count - arguments) {
+			return UINT32_MAX;
+		}
+		arguments += words[2] / sizeof(uint32_t);
+		break;
+	default:
+		break;
+	}
+	return arguments;
+}
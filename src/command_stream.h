@@ -0,0 +1,153 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_COMMAND_STREAM_H
+#define HELLO_VULKAN_COMMAND_STREAM_H
+
+#include <stdint.h>
+
+/*
+ * One frame's draws and everything they read, recorded by hello-vulkan with
+ * --record-stream and replayed by hello-vulkan-replay, so the same GPU work
+ * runs without a window, a compositor or the app around it. The file is the
+ * header, the resource table, the command words and then the resource
+ * blobs, each aligned to COMMAND_STREAM_ALIGNMENT.
+ */
+#define COMMAND_STREAM_MAGIC "HVCS"
+#define COMMAND_STREAM_VERSION 1
+#define COMMAND_STREAM_ALIGNMENT 16
+#define COMMAND_STREAM_MAX_ATTRIBUTES 4
+
+enum command_stream_resource_type {
+	COMMAND_STREAM_VERTEX_SHADER,
+	COMMAND_STREAM_FRAGMENT_SHADER,
+	/* The Frame block, bound at set 0 */
+	COMMAND_STREAM_UNIFORMS,
+	COMMAND_STREAM_VERTEX_BUFFER,
+	COMMAND_STREAM_INDEX_BUFFER,
+	COMMAND_STREAM_RESOURCE_TYPE_COUNT,
+};
+
+/* Each is followed by its arguments, in 32 bit words */
+enum command_stream_op {
+	/* None, there is one pipeline */
+	COMMAND_STREAM_BIND_PIPELINE,
+	/* The uniforms resource */
+	COMMAND_STREAM_BIND_UNIFORMS,
+	/* The vertex buffer resource, bound at binding 0 */
+	COMMAND_STREAM_BIND_VERTEX_BUFFER,
+	/* The index buffer resource and a VkIndexType */
+	COMMAND_STREAM_BIND_INDEX_BUFFER,
+	/* Offset and size in bytes, then size / 4 words of data */
+	COMMAND_STREAM_PUSH_CONSTANTS,
+	/* Vertex count, instance count, first vertex and first instance */
+	COMMAND_STREAM_DRAW,
+	/* Index count, instance count, first index, vertex offset, first instance */
+	COMMAND_STREAM_DRAW_INDEXED,
+	COMMAND_STREAM_OP_COUNT,
+};
+
+struct command_stream_attribute {
+	uint32_t location;
+	/* VkFormat */
+	uint32_t format;
+	uint32_t offset;
+};
+
+/*
+ * The render pass and the one pipeline the commands draw with, a color
+ * attachment and a depth one unless its format is VK_FORMAT_UNDEFINED.
+ */
+struct command_stream_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t color_format;
+	uint32_t depth_format;
+	/* Vertex stage push constants, from offset 0 */
+	uint32_t push_constant_size;
+	/* No vertex input without attributes */
+	uint32_t vertex_stride;
+	uint32_t attribute_count;
+	struct command_stream_attribute attributes[COMMAND_STREAM_MAX_ATTRIBUTES];
+	uint32_t resource_count;
+	uint32_t word_count;
+};
+
+struct command_stream_resource {
+	uint32_t type;
+	uint32_t size;
+	/* From the start of the file */
+	uint64_t offset;
+};
+
+/*
+ * Built up in memory, with a copy of every resource. An allocation failure
+ * is kept in err and reported by the write, so recording never checks.
+ */
+struct command_stream {
+	struct command_stream_header header;
+	struct command_stream_resource *resources;
+	void **blobs;
+	uint32_t resource_capacity;
+	uint32_t *words;
+	uint32_t word_capacity;
+	uint8_t err;
+};
+
+void command_stream_init(struct command_stream *stream);
+void command_stream_fini(struct command_stream *stream);
+
+/*
+ * Returns the resource's index for the commands that use it. A null stream
+ * records nothing, here and in the commands, so callers capture only while
+ * they have one.
+ */
+uint32_t command_stream_add_resource(struct command_stream *stream,
+                                     enum command_stream_resource_type type,
+                                     const void *data,
+                                     uint32_t size);
+void command_stream_record(struct command_stream *stream,
+                           enum command_stream_op op,
+                           const uint32_t *arguments,
+                           uint32_t argument_count);
+void command_stream_record_push_constants(struct command_stream *stream,
+                                          uint32_t offset,
+                                          uint32_t size,
+                                          const void *data);
+
+uint8_t command_stream_write(const struct command_stream *stream,
+                             const char *filename);
+/*
+ * Initializes the stream from the file, which the caller then finishes. A
+ * stream is rejected unless every command is valid and every draw reads only
+ * vertices and indices in the buffers it has bound.
+ */
+uint8_t command_stream_read(struct command_stream *stream,
+                            const char *filename);
+
+/*
+ * How many argument words follow the op at words, count words before the
+ * end, or UINT32_MAX when the op is unknown, runs past the end, names a
+ * resource of the wrong type or binds indices neither 16 nor 32 bit
+ */
+uint32_t command_stream_argument_count(const struct command_stream *stream,
+                                       const uint32_t *words,
+                                       uint32_t count);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpu_cull.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_CULL_X86
+#include <immintrin.h>
+#endif
+
+/* For aligned loads of a whole AVX register */
+#define BOUNDS_ALIGNMENT 32
+
+typedef uint32_t (*cull_function)(const struct cpu_cull_bounds *bounds,
+                                  const struct frustum *frustum,
+                                  uint32_t begin,
+                                  uint32_t end,
+                                  uint32_t *visible);
+
+/*
+ * Every kernel stores each index and only advances past the visible ones,
+ * which keeps the compaction free of branches. Stores land at most at the
+ * object's own position within the range.
+ */
+static uint32_t cull_scalar(const struct cpu_cull_bounds *bounds,
+                            const struct frustum *frustum,
+                            uint32_t begin,
+                            uint32_t end,
+                            uint32_t *visible)
+{
+	uint32_t count = 0;
+	for (uint32_t i = begin; i < end; ++i) {
+		float negative_radius = -bounds->radius[i];
+		bool inside = true;
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+			const float *plane = frustum->planes[p];
+			float distance = plane[0] * bounds->x[i]
+			                 + plane[1] * bounds->y[i]
+			                 + plane[2] * bounds->z[i]
+			                 + plane[3];
+			inside &= distance >= negative_radius;
+		}
+		visible[count] = i;
+		count += inside;
+	}
+	return count;
+}
+
+#ifdef CPU_CULL_X86
+static uint32_t cull_sse2(const struct cpu_cull_bounds *bounds,
+                          const struct frustum *frustum,
+                          uint32_t begin,
+                          uint32_t end,
+                          uint32_t *visible)
+{
+	__m128 planes[FRUSTUM_PLANE_COUNT][4];
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+		for (int i = 0; i < 4; ++i) {
+			planes[p][i] = _mm_set1_ps(frustum->planes[p][i]);
+		}
+	}
+	const __m128 sign = _mm_set1_ps(-0.0f);
+
+	uint32_t count = 0;
+	for (uint32_t i = begin; i < end; i += 4) {
+		__m128 x = _mm_load_ps(bounds->x + i);
+		__m128 y = _mm_load_ps(bounds->y + i);
+		__m128 z = _mm_load_ps(bounds->z + i);
+		__m128 negative_radius = _mm_xor_ps(
+			_mm_load_ps(bounds->radius + i), sign
+		);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planes[p][0], x),
+				           _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z),
+				           planes[p][3])
+			);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance,
+			                                         negative_radius));
+		}
+		uint32_t mask = (uint32_t) _mm_movemask_ps(inside);
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			visible[count] = i + lane;
+			count += (mask >> lane) & 1;
+		}
+	}
+	return count;
+}
+
+/*
+ * For each mask of visible lanes, the lanes in order as bytes, so a
+ * permutation moves the visible indices to the front of a register.
+ */
+static uint64_t compact_lanes[256];
+static pthread_once_t compact_lanes_once = PTHREAD_ONCE_INIT;
+
+static void init_compact_lanes(void)
+{
+	for (uint32_t mask = 0; mask < 256; ++mask) {
+		uint64_t lanes = 0;
+		uint32_t count = 0;
+		for (uint32_t lane = 0; lane < 8; ++lane) {
+			if (mask & (1u << lane)) {
+				lanes |= (uint64_t) lane << (8 * count++);
+			}
+		}
+		compact_lanes[mask] = lanes;
+	}
+}
+
+/*
+ * Stores all eight permuted indices and advances by the visible ones, which
+ * stays within the range for the same reason as the scalar stores.
+ */
+__attribute__((target("avx2,fma")))
+static uint32_t cull_avx2(const struct cpu_cull_bounds *bounds,
+                          const struct frustum *frustum,
+                          uint32_t begin,
+                          uint32_t end,
+                          uint32_t *visible)
+{
+	__m256 planes[FRUSTUM_PLANE_COUNT][4];
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+		for (int i = 0; i < 4; ++i) {
+			planes[p][i] = _mm256_set1_ps(frustum->planes[p][i]);
+		}
+	}
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	/* Lane indices, added to the first index of each group */
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	uint32_t count = 0;
+	for (uint32_t i = begin; i < end; i += 8) {
+		__m256 x = _mm256_load_ps(bounds->x + i);
+		__m256 y = _mm256_load_ps(bounds->y + i);
+		__m256 z = _mm256_load_ps(bounds->z + i);
+		__m256 negative_radius = _mm256_xor_ps(
+			_mm256_load_ps(bounds->radius + i), sign
+		);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+			__m256 distance = _mm256_fmadd_ps(
+				planes[p][0], x,
+				_mm256_fmadd_ps(planes[p][1], y,
+				                _mm256_fmadd_ps(planes[p][2], z,
+				                                planes[p][3]))
+			);
+			inside = _mm256_and_ps(
+				inside,
+				_mm256_cmp_ps(distance, negative_radius,
+				              _CMP_GE_OQ)
+			);
+		}
+		uint32_t mask = (uint32_t) _mm256_movemask_ps(inside);
+		__m256i permutation = _mm256_cvtepu8_epi32(
+			_mm_loadl_epi64((const __m128i *) &compact_lanes[mask])
+		);
+		__m256i indices = _mm256_add_epi32(_mm256_set1_epi32((int) i),
+		                                   lanes);
+		_mm256_storeu_si256(
+			(__m256i *) (visible + count),
+			_mm256_permutevar8x32_epi32(indices, permutation)
+		);
+		count += (uint32_t) __builtin_popcount(mask);
+	}
+	return count;
+}
+#endif
+
+static const cull_function cull_functions[CPU_CULL_KERNEL_COUNT] = {
+	[CPU_CULL_SCALAR] = cull_scalar,
+#ifdef CPU_CULL_X86
+	[CPU_CULL_SSE2] = cull_sse2,
+	[CPU_CULL_AVX2] = cull_avx2,
+#endif
+};
+
+bool cpu_cull_kernel_supported(enum cpu_cull_kernel kernel)
+{
+	switch (kernel) {
+	case CPU_CULL_SCALAR:
+		return true;
+#ifdef CPU_CULL_X86
+	/* CPUID, which also checks the OS saves the AVX registers */
+	case CPU_CULL_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case CPU_CULL_AVX2:
+		return __builtin_cpu_supports("avx2")
+		       && __builtin_cpu_supports("fma");
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *cpu_cull_kernel_name(enum cpu_cull_kernel kernel)
+{
+	static const char *const names[CPU_CULL_KERNEL_COUNT] = {
+		[CPU_CULL_SCALAR] = "scalar",
+		[CPU_CULL_SSE2] = "sse2",
+		[CPU_CULL_AVX2] = "avx2",
+	};
+	return names[kernel];
+}
+
+static void free_bounds(struct cpu_cull_bounds *bounds)
+{
+	free(bounds->x);
+	free(bounds->y);
+	free(bounds->z);
+	free(bounds->radius);
+	memset(bounds, 0, sizeof(*bounds));
+}
+
+static uint8_t init_bounds(struct cpu_cull_bounds *bounds,
+                           const struct scene *scene)
+{
+	memset(bounds, 0, sizeof(*bounds));
+	uint32_t capacity = (scene->object_count + CPU_CULL_WIDTH - 1)
+	                    / CPU_CULL_WIDTH * CPU_CULL_WIDTH;
+	size_t size = capacity * sizeof(float);
+	bounds->x = aligned_alloc(BOUNDS_ALIGNMENT, size);
+	bounds->y = aligned_alloc(BOUNDS_ALIGNMENT, size);
+	bounds->z = aligned_alloc(BOUNDS_ALIGNMENT, size);
+	bounds->radius = aligned_alloc(BOUNDS_ALIGNMENT, size);
+	if (bounds->x == NULL || bounds->y == NULL || bounds->z == NULL
+	    || bounds->radius == NULL) {
+		free_bounds(bounds);
+		return LIBC_ERROR_BIT;
+	}
+	bounds->count = scene->object_count;
+	bounds->capacity = capacity;
+
+	for (uint32_t i = 0; i < scene->object_count; ++i) {
+		const struct scene_object *object = &scene->objects[i];
+		bounds->x[i] = object->center[0];
+		bounds->y[i] = object->center[1];
+		bounds->z[i] = object->center[2];
+		bounds->radius[i] = object->radius;
+	}
+	/* No plane distance is ever at least infinity */
+	for (uint32_t i = scene->object_count; i < capacity; ++i) {
+		bounds->x[i] = 0.0f;
+		bounds->y[i] = 0.0f;
+		bounds->z[i] = 0.0f;
+		bounds->radius[i] = -INFINITY;
+	}
+	return NO_ERRORS;
+}
+
+/* Whole groups of CPU_CULL_WIDTH, the last range taking the rest */
+static void range_bounds(const struct cpu_cull *cull,
+                         uint32_t range,
+                         uint32_t *begin,
+                         uint32_t *end)
+{
+	uint32_t groups = cull->bounds.capacity / CPU_CULL_WIDTH;
+	uint32_t per_range = groups / cull->range_count;
+	*begin = range * per_range * CPU_CULL_WIDTH;
+	*end = range + 1 == cull->range_count
+	       ? cull->bounds.capacity
+	       : (range + 1) * per_range * CPU_CULL_WIDTH;
+}
+
+static void cull_range(void *data, uint32_t range)
+{
+	struct cpu_cull *cull = data;
+	uint32_t begin;
+	uint32_t end;
+	range_bounds(cull, range, &begin, &end);
+	cull->range_counts[range] = cull_functions[cull->kernel](
+		&cull->bounds, cull->frustum, begin, end, cull->visible + begin
+	);
+}
+
+uint8_t cpu_cull_init(struct cpu_cull *cull,
+                      const struct scene *scene,
+                      uint32_t thread_count)
+{
+	memset(cull, 0, sizeof(*cull));
+#ifdef CPU_CULL_X86
+	pthread_once(&compact_lanes_once, init_compact_lanes);
+#endif
+	cull->kernel = CPU_CULL_SCALAR;
+	for (uint32_t k = 0; k < CPU_CULL_KERNEL_COUNT; ++k) {
+		if (cpu_cull_kernel_supported(k)) {
+			cull->kernel = k;
+		}
+	}
+
+	uint8_t err = init_bounds(&cull->bounds, scene);
+	if (err) {
+		return err;
+	}
+	/* At least one group of objects per range */
+	uint32_t groups = cull->bounds.capacity / CPU_CULL_WIDTH;
+	if (thread_count > groups) {
+		thread_count = groups;
+	}
+	err = thread_pool_init(&cull->pool, thread_count);
+	if (err) {
+		free_bounds(&cull->bounds);
+		return err;
+	}
+	cull->range_count = cull->pool.thread_count;
+
+	cull->range_counts = malloc(cull->range_count * sizeof(uint32_t));
+	if (cull->range_counts == NULL) {
+		cpu_cull_fini(cull);
+		return LIBC_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
+
+void cpu_cull_fini(struct cpu_cull *cull)
+{
+	thread_pool_fini(&cull->pool);
+	free(cull->range_counts);
+	cull->range_counts = NULL;
+	cull->range_count = 0;
+	free_bounds(&cull->bounds);
+}
+
+uint32_t cpu_cull_run(struct cpu_cull *cull,
+                      const struct frustum *frustum,
+                      uint32_t *visible)
+{
+	cull->frustum = frustum;
+	cull->visible = visible;
+	thread_pool_run(&cull->pool, cull_range, cull, cull->range_count);
+
+	/* Each range's visible objects start where the range does */
+	uint32_t count = cull->range_counts[0];
+	for (uint32_t r = 1; r < cull->range_count; ++r) {
+		uint32_t begin;
+		uint32_t end;
+		range_bounds(cull, r, &begin, &end);
+		memmove(visible + count, visible + begin,
+		        cull->range_counts[r] * sizeof(uint32_t));
+		count += cull->range_counts[r];
+	}
+	return count;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_CPU_CULL_H
+#define HELLO_VULKAN_CPU_CULL_H
+
+#include "frustum.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Objects per AVX2 iteration, which every array is padded to */
+#define CPU_CULL_WIDTH 8
+
+enum cpu_cull_kernel {
+	CPU_CULL_SCALAR,
+	CPU_CULL_SSE2,
+	CPU_CULL_AVX2,
+	CPU_CULL_KERNEL_COUNT,
+};
+
+/*
+ * The scene's bounding spheres as a structure of arrays, each aligned and
+ * padded to CPU_CULL_WIDTH with spheres that are never visible, so the
+ * kernels load whole registers without a remainder loop.
+ */
+struct cpu_cull_bounds {
+	float *x;
+	float *y;
+	float *z;
+	float *radius;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+/*
+ * Frustum culling on the CPU, with the widest kernel CPUID reports support
+ * for. The objects are split into one contiguous range per thread, each
+ * culled into the same range of the output, and the ranges are compacted in
+ * order afterwards, so the visible list is in scene order whatever the
+ * thread count.
+ */
+struct cpu_cull {
+	struct cpu_cull_bounds bounds;
+	enum cpu_cull_kernel kernel;
+	struct thread_pool pool;
+	uint32_t range_count;
+
+	/* The run in progress */
+	const struct frustum *frustum;
+	uint32_t *visible;
+	uint32_t *range_counts;
+};
+
+bool cpu_cull_kernel_supported(enum cpu_cull_kernel kernel);
+const char *cpu_cull_kernel_name(enum cpu_cull_kernel kernel);
+
+uint8_t cpu_cull_init(struct cpu_cull *cull,
+                      const struct scene *scene,
+                      uint32_t thread_count);
+void cpu_cull_fini(struct cpu_cull *cull);
+
+/*
+ * Writes the indices of the objects that intersect the frustum to visible,
+ * which must hold bounds.capacity of them, and returns how many there are.
+ */
+uint32_t cpu_cull_run(struct cpu_cull *cull,
+                      const struct frustum *frustum,
+                      uint32_t *visible);
+
+#endif
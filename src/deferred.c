@@ -0,0 +1,183 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deferred.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+uint8_t deferred_init(struct deferred *deferred, uint32_t capacity)
+{
+	deferred->objects = malloc(capacity * sizeof(struct deferred_object));
+	if (deferred->objects == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	deferred->count = 0;
+	deferred->capacity = capacity;
+	return NO_ERRORS;
+}
+
+void deferred_fini(struct deferred *deferred, VkDevice device)
+{
+	deferred_collect(deferred, device, UINT64_MAX);
+	free(deferred->objects);
+	deferred->objects = NULL;
+	deferred->capacity = 0;
+}
+
+uint8_t deferred_push(struct deferred *deferred,
+                      enum deferred_type type,
+                      union deferred_handle handle,
+                      uint64_t last_use)
+{
+	/* Only retiring a swapchain generation pushes, so growing is rare */
+	if (deferred->count == deferred->capacity) {
+		uint32_t capacity = deferred->capacity * 2;
+		struct deferred_object *objects = realloc(
+			deferred->objects,
+			capacity * sizeof(struct deferred_object)
+		);
+		if (objects == NULL) {
+			printf("Can't grow the deferred destruction queue"
+			       " past %u\n", deferred->capacity);
+			return LIBC_ERROR_BIT;
+		}
+		deferred->objects = objects;
+		deferred->capacity = capacity;
+	}
+	struct deferred_object object = {
+		.type = type,
+		.handle = handle,
+		.last_use = last_use,
+	};
+	deferred->objects[deferred->count++] = object;
+	return NO_ERRORS;
+}
+
+uint8_t deferred_push_buffer(struct deferred *deferred,
+                             VkDevice device,
+                             struct gpu_buffer *buffer,
+                             uint64_t last_use)
+{
+	/* Unmapping does not touch what the GPU reads */
+	if (buffer->mapped != NULL) {
+		vkUnmapMemory(device, buffer->memory);
+		buffer->mapped = NULL;
+	}
+	uint8_t err = NO_ERRORS;
+	if (buffer->buffer != VK_NULL_HANDLE) {
+		union deferred_handle handle = {.buffer = buffer->buffer};
+		err |= deferred_push(deferred, DEFERRED_BUFFER, handle,
+		                     last_use);
+		buffer->buffer = VK_NULL_HANDLE;
+	}
+	if (buffer->memory != VK_NULL_HANDLE) {
+		union deferred_handle handle = {.memory = buffer->memory};
+		err |= deferred_push(deferred, DEFERRED_MEMORY, handle,
+		                     last_use);
+		buffer->memory = VK_NULL_HANDLE;
+	}
+	buffer->size = 0;
+	return err;
+}
+
+uint8_t deferred_push_image(struct deferred *deferred,
+                            struct gpu_image *image,
+                            uint64_t last_use)
+{
+	uint8_t err = NO_ERRORS;
+	if (image->view != VK_NULL_HANDLE) {
+		union deferred_handle handle = {.image_view = image->view};
+		err |= deferred_push(deferred, DEFERRED_IMAGE_VIEW, handle,
+		                     last_use);
+		image->view = VK_NULL_HANDLE;
+	}
+	if (image->image != VK_NULL_HANDLE) {
+		union deferred_handle handle = {.image = image->image};
+		err |= deferred_push(deferred, DEFERRED_IMAGE, handle,
+		                     last_use);
+		image->image = VK_NULL_HANDLE;
+	}
+	if (image->memory != VK_NULL_HANDLE) {
+		union deferred_handle handle = {.memory = image->memory};
+		err |= deferred_push(deferred, DEFERRED_MEMORY, handle,
+		                     last_use);
+		image->memory = VK_NULL_HANDLE;
+	}
+	return err;
+}
+
+static void destroy(VkDevice device, const struct deferred_object *object)
+{
+	const union deferred_handle *handle = &object->handle;
+	switch (object->type) {
+	case DEFERRED_SWAPCHAIN:
+		vkDestroySwapchainKHR(device, handle->swapchain,
+		                      &host_allocator);
+		break;
+	case DEFERRED_SEMAPHORE:
+		vkDestroySemaphore(device, handle->semaphore, &host_allocator);
+		break;
+	case DEFERRED_COMMAND_POOL:
+		vkDestroyCommandPool(device, handle->command_pool,
+		                     &host_allocator);
+		break;
+	case DEFERRED_QUERY_POOL:
+		vkDestroyQueryPool(device, handle->query_pool, &host_allocator);
+		break;
+	case DEFERRED_FRAMEBUFFER:
+		vkDestroyFramebuffer(device, handle->framebuffer,
+		                     &host_allocator);
+		break;
+	case DEFERRED_DESCRIPTOR_POOL:
+		vkDestroyDescriptorPool(device, handle->descriptor_pool,
+		                        &host_allocator);
+		break;
+	case DEFERRED_IMAGE_VIEW:
+		vkDestroyImageView(device, handle->image_view, &host_allocator);
+		break;
+	case DEFERRED_IMAGE:
+		vkDestroyImage(device, handle->image, &host_allocator);
+		break;
+	case DEFERRED_BUFFER:
+		vkDestroyBuffer(device, handle->buffer, &host_allocator);
+		break;
+	case DEFERRED_MEMORY:
+		vkFreeMemory(device, handle->memory, &host_allocator);
+		break;
+	}
+}
+
+void deferred_collect(struct deferred *deferred,
+                      VkDevice device,
+                      uint64_t completed)
+{
+	/* Destroyed in push order, so views go before their images */
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < deferred->count; ++i) {
+		const struct deferred_object *object = &deferred->objects[i];
+		if (object->last_use <= completed) {
+			destroy(device, object);
+		}
+		else {
+			deferred->objects[kept++] = *object;
+		}
+	}
+	deferred->count = kept;
+}
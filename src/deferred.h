@@ -0,0 +1,90 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_DEFERRED_H
+#define HELLO_VULKAN_DEFERRED_H
+
+#include "gpu.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+enum deferred_type {
+	DEFERRED_SWAPCHAIN,
+	DEFERRED_SEMAPHORE,
+	DEFERRED_COMMAND_POOL,
+	DEFERRED_QUERY_POOL,
+	DEFERRED_FRAMEBUFFER,
+	DEFERRED_DESCRIPTOR_POOL,
+	DEFERRED_IMAGE_VIEW,
+	DEFERRED_IMAGE,
+	DEFERRED_BUFFER,
+	DEFERRED_MEMORY,
+};
+
+union deferred_handle {
+	VkSwapchainKHR swapchain;
+	VkSemaphore semaphore;
+	VkCommandPool command_pool;
+	VkQueryPool query_pool;
+	VkFramebuffer framebuffer;
+	VkDescriptorPool descriptor_pool;
+	VkImageView image_view;
+	VkImage image;
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+};
+
+struct deferred_object {
+	enum deferred_type type;
+	union deferred_handle handle;
+	/* The timeline value of the last submit using it */
+	uint64_t last_use;
+};
+
+/*
+ * Objects destroyed once the frame timeline passes their last use, in the
+ * order they were retired, instead of idling the device first.
+ */
+struct deferred {
+	struct deferred_object *objects;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+uint8_t deferred_init(struct deferred *deferred, uint32_t capacity);
+/* Destroys whatever is left, the GPU has to be done with all of it */
+void deferred_fini(struct deferred *deferred, VkDevice device);
+
+uint8_t deferred_push(struct deferred *deferred,
+                      enum deferred_type type,
+                      union deferred_handle handle,
+                      uint64_t last_use);
+/* Take over the handles, leaving them null for the owner's fini */
+uint8_t deferred_push_buffer(struct deferred *deferred,
+                             VkDevice device,
+                             struct gpu_buffer *buffer,
+                             uint64_t last_use);
+uint8_t deferred_push_image(struct deferred *deferred,
+                            struct gpu_image *image,
+                            uint64_t last_use);
+
+void deferred_collect(struct deferred *deferred,
+                      VkDevice device,
+                      uint64_t completed);
+
+#endif
@@ -0,0 +1,69 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+	uint lights;
+	uint light_count;
+	mat4 inverse_view_projection;
+} frame;
+
+// The bindless storage buffer capacity
+layout(constant_id = 0) const uint BUFFER_COUNT = 1;
+
+// Position and radius, then color and intensity
+struct Light {
+	vec4 position_radius;
+	vec4 color_intensity;
+};
+
+layout(set = 1, binding = 0) readonly buffer Lights {
+	Light lights[];
+} buffers[BUFFER_COUNT];
+
+// What the first subpass wrote at this pixel, read from tile memory
+layout(input_attachment_index = 0, set = 2, binding = 0)
+uniform subpassInput depth;
+layout(input_attachment_index = 1, set = 2, binding = 1)
+uniform subpassInput albedo;
+layout(input_attachment_index = 2, set = 2, binding = 2)
+uniform subpassInput normal;
+
+layout(location = 0) in vec2 fragNdc;
+
+layout(location = 0) out vec4 outColor;
+
+// The same lighting as lit.frag, once per pixel
+vec3 shade(vec3 albedo, vec3 position, vec3 normal) {
+	vec3 color = 0.05 * albedo;
+	for (uint i = 0; i < frame.light_count; ++i) {
+		Light light = buffers[frame.lights].lights[i];
+		vec3 to_light = light.position_radius.xyz - position;
+		float radius = light.position_radius.w;
+		float distance_squared = dot(to_light, to_light);
+		if (distance_squared >= radius * radius) {
+			continue;
+		}
+		float falloff = 1.0 - distance_squared / (radius * radius);
+		float diffuse = max(dot(normal, normalize(to_light)), 0.0);
+		color += albedo * light.color_intensity.rgb
+		         * light.color_intensity.w * diffuse * falloff * falloff;
+	}
+	return color;
+}
+
+void main() {
+	vec4 surface = subpassLoad(albedo);
+	if (surface.a == 0.0) {
+		outColor = vec4(0.0);
+		return;
+	}
+	// Back from depth to the position the scene was drawn at
+	vec4 position = frame.inverse_view_projection
+	                * vec4(fragNdc, subpassLoad(depth).r, 1.0);
+	vec3 n = normalize(subpassLoad(normal).xyz * 2.0 - 1.0);
+	outColor = vec4(shade(surface.rgb, position.xyz / position.w, n), 1.0);
+}
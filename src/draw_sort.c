@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "draw_sort.h"
+
+#include <string.h>
+
+/* Maps a float to an unsigned key with the same ordering */
+static uint32_t depth_key(float depth)
+{
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	if (bits & 0x80000000u) {
+		return ~bits;
+	}
+	return bits | 0x80000000u;
+}
+
+void draw_sort(struct draw_item *items,
+               struct draw_item *scratch,
+               const struct scene *scene,
+               const uint32_t *object_indices,
+               uint32_t count,
+               enum draw_order order)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t object_index = object_indices != NULL
+		                        ? object_indices[i] : i;
+		float depth = scene->objects[object_index].center[2];
+		uint32_t key;
+		switch (order) {
+		case DRAW_ORDER_FRONT_TO_BACK:
+			key = depth_key(depth);
+			break;
+		case DRAW_ORDER_BACK_TO_FRONT:
+			key = ~depth_key(depth);
+			break;
+		default:
+			key = object_index;
+			break;
+		}
+		items[i].key = key;
+		items[i].object_index = object_index;
+	}
+
+	if (order == DRAW_ORDER_SCENE || count == 0) {
+		return;
+	}
+
+	/* LSD radix sort, 8 bits per pass, skipping passes with one bucket */
+	struct draw_item *src = items;
+	struct draw_item *dst = scratch;
+	for (uint32_t shift = 0; shift < 32; shift += 8) {
+		uint32_t histogram[256] = { 0 };
+		for (uint32_t i = 0; i < count; ++i) {
+			++histogram[(src[i].key >> shift) & 0xFF];
+		}
+		if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (uint32_t d = 0; d < 256; ++d) {
+			uint32_t bucket = histogram[d];
+			histogram[d] = offset;
+			offset += bucket;
+		}
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t d = (src[i].key >> shift) & 0xFF;
+			dst[histogram[d]++] = src[i];
+		}
+
+		struct draw_item *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != items) {
+		memcpy(items, src, count * sizeof(struct draw_item));
+	}
+}
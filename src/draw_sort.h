@@ -0,0 +1,49 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_DRAW_SORT_H
+#define HELLO_VULKAN_DRAW_SORT_H
+
+#include "scene.h"
+
+#include <stdint.h>
+
+enum draw_order {
+	DRAW_ORDER_SCENE,
+	DRAW_ORDER_FRONT_TO_BACK,
+	DRAW_ORDER_BACK_TO_FRONT,
+};
+
+struct draw_item {
+	uint32_t key;
+	uint32_t object_index;
+};
+
+/*
+ * Fills items (one per object in object_indices, or per scene object when it
+ * is null) with keys for the given order, then sorts them by key using
+ * scratch, which must hold as many items. Opaque draws with a depth test want
+ * front to back, so that early depth testing rejects hidden fragments before
+ * they are shaded.
+ */
+void draw_sort(struct draw_item *items,
+               struct draw_item *scratch,
+               const struct scene *scene,
+               const uint32_t *object_indices,
+               uint32_t count,
+               enum draw_order order);
+
+#endif
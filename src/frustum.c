@@ -0,0 +1,67 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frustum.h"
+
+#include <math.h>
+
+void frustum_from_matrix(struct frustum *frustum, const float matrix[16])
+{
+	float rows[4][4];
+	for (int r = 0; r < 4; ++r) {
+		for (int c = 0; c < 4; ++c) {
+			rows[r][c] = matrix[c * 4 + r];
+		}
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		frustum->planes[FRUSTUM_LEFT][i] = rows[3][i] + rows[0][i];
+		frustum->planes[FRUSTUM_RIGHT][i] = rows[3][i] - rows[0][i];
+		frustum->planes[FRUSTUM_BOTTOM][i] = rows[3][i] + rows[1][i];
+		frustum->planes[FRUSTUM_TOP][i] = rows[3][i] - rows[1][i];
+		frustum->planes[FRUSTUM_NEAR][i] = rows[2][i];
+		frustum->planes[FRUSTUM_FAR][i] = rows[3][i] - rows[2][i];
+	}
+
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+		float *plane = frustum->planes[p];
+		float length = sqrtf(plane[0] * plane[0]
+		                     + plane[1] * plane[1]
+		                     + plane[2] * plane[2]);
+		if (length > 0.0f) {
+			for (int i = 0; i < 4; ++i) {
+				plane[i] /= length;
+			}
+		}
+	}
+}
+
+bool frustum_intersects_sphere(const struct frustum *frustum,
+                               const float center[3],
+                               float radius)
+{
+	for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+		const float *plane = frustum->planes[p];
+		float distance = plane[0] * center[0]
+		                 + plane[1] * center[1]
+		                 + plane[2] * center[2]
+		                 + plane[3];
+		if (distance < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_FRUSTUM_H
+#define HELLO_VULKAN_FRUSTUM_H
+
+#include <stdbool.h>
+
+enum {
+	FRUSTUM_LEFT,
+	FRUSTUM_RIGHT,
+	FRUSTUM_BOTTOM,
+	FRUSTUM_TOP,
+	FRUSTUM_NEAR,
+	FRUSTUM_FAR,
+	FRUSTUM_PLANE_COUNT,
+};
+
+/*
+ * Planes are (a, b, c, d) with unit normals pointing inwards, so a point p is
+ * inside when a * p.x + b * p.y + c * p.z + d >= 0 for every plane. The layout
+ * matches an array of vec4 in shaders.
+ */
+struct frustum {
+	float planes[FRUSTUM_PLANE_COUNT][4];
+};
+
+/* Extracts the planes of a column-major view-projection with depth in [0, 1] */
+void frustum_from_matrix(struct frustum *frustum, const float matrix[16]);
+bool frustum_intersects_sphere(const struct frustum *frustum,
+                               const float center[3],
+                               float radius);
+
+#endif
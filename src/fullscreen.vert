@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// Normalized device coordinates, for passes that reconstruct positions
+layout(location = 0) out vec2 fragNdc;
+
+// One triangle covering the viewport, wound clockwise like the scene's
+void main() {
+	vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	fragNdc = position * 2.0 - 1.0;
+	gl_Position = vec4(fragNdc, 0.0, 1.0);
+}
@@ -0,0 +1,415 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "gbuffer.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+/* The set of deferred_light.frag, after the scene's two */
+#define GBUFFER_SET 2
+/* Depth, then the G-buffer attachments in order */
+#define INPUT_ATTACHMENT_COUNT (1 + GBUFFER_ATTACHMENT_COUNT)
+
+static const VkFormat formats[GBUFFER_ATTACHMENT_COUNT] = {
+	[GBUFFER_ALBEDO] = GBUFFER_ALBEDO_FORMAT,
+	[GBUFFER_NORMAL] = GBUFFER_NORMAL_FORMAT,
+};
+
+static uint8_t create_shader_module(VkDevice device,
+                                    const struct pack *assets,
+                                    const char *name,
+                                    VkShaderModule *shader_module)
+{
+	const struct pack_entry *entry = pack_find(assets, name,
+	                                           PACK_TYPE_SPIRV);
+	if (entry == NULL) {
+		printf("No shader %s in the asset pack\n", name);
+		return APP_ERROR_BIT;
+	}
+
+	VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.codeSize = entry->size,
+		.pCode = pack_data(assets, entry),
+	};
+	VkResult result;
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator, shader_module);
+	if (result != VK_SUCCESS) {
+		*shader_module = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_pipeline_layout(
+	struct gbuffer *gbuffer,
+	VkDevice device,
+	const VkDescriptorSetLayout *scene_set_layouts,
+	const VkPushConstantRange *push_constant_range)
+{
+	VkDescriptorSetLayoutBinding
+	descriptor_set_layout_bindings[INPUT_ATTACHMENT_COUNT];
+	for (uint32_t i = 0; i < INPUT_ATTACHMENT_COUNT; ++i) {
+		VkDescriptorSetLayoutBinding binding = {
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL,
+		};
+		descriptor_set_layout_bindings[i] = binding;
+	}
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = ARRAY_SIZE(descriptor_set_layout_bindings),
+		.pBindings = descriptor_set_layout_bindings,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &gbuffer->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		gbuffer->descriptor_set_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSetLayout set_layouts[GBUFFER_SET + 1];
+	for (uint32_t i = 0; i < GBUFFER_SET; ++i) {
+		set_layouts[i] = scene_set_layouts[i];
+	}
+	set_layouts[GBUFFER_SET] = gbuffer->descriptor_set_layout;
+
+	/* The same range as the scene's keeps sets 0 and 1 compatible */
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.setLayoutCount = ARRAY_SIZE(set_layouts),
+		.pSetLayouts = set_layouts,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = push_constant_range,
+	};
+	result = vkCreatePipelineLayout(device, &pipeline_layout_create_info,
+	                                &host_allocator,
+	                                &gbuffer->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		gbuffer->pipeline_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+uint8_t gbuffer_init(struct gbuffer *gbuffer,
+                     VkDevice device,
+                     const struct pack *assets,
+                     struct pipeline_compiler *compiler,
+                     const VkDescriptorSetLayout *scene_set_layouts,
+                     const VkPushConstantRange *push_constant_range,
+                     VkRenderPass render_pass)
+{
+	memset(gbuffer, 0, sizeof(*gbuffer));
+
+	uint8_t err = create_pipeline_layout(gbuffer, device,
+	                                     scene_set_layouts,
+	                                     push_constant_range);
+	err = err ? err : create_shader_module(device, assets,
+	                                       "fullscreen.vert.spv",
+	                                       &gbuffer->vert_shader_module);
+	err = err ? err : create_shader_module(device, assets,
+	                                       "deferred_light.frag.spv",
+	                                       &gbuffer->frag_shader_module);
+	if (!err) {
+		struct pipeline_state state = {
+			.name = "deferred_lighting",
+			.vert_shader_module = gbuffer->vert_shader_module,
+			.frag_shader_module = gbuffer->frag_shader_module,
+			.layout = gbuffer->pipeline_layout,
+			.render_pass = render_pass,
+			.subpass = 1,
+			.color_attachment_count = 1,
+			.vertex_attribute_count = 0,
+			.constant_count = 0,
+			.depth_test = false,
+			.blend = false,
+		};
+		err = pipeline_compiler_add(compiler, &state,
+		                            &gbuffer->variant);
+	}
+	if (err) {
+		gbuffer_fini(gbuffer, device);
+	}
+	return err;
+}
+
+void gbuffer_fini(struct gbuffer *gbuffer, VkDevice device)
+{
+	if (gbuffer->vert_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, gbuffer->vert_shader_module,
+		                      &host_allocator);
+		gbuffer->vert_shader_module = VK_NULL_HANDLE;
+	}
+	if (gbuffer->frag_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, gbuffer->frag_shader_module,
+		                      &host_allocator);
+		gbuffer->frag_shader_module = VK_NULL_HANDLE;
+	}
+	if (gbuffer->pipeline_layout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, gbuffer->pipeline_layout,
+		                        &host_allocator);
+		gbuffer->pipeline_layout = VK_NULL_HANDLE;
+	}
+	if (gbuffer->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device,
+		                             gbuffer->descriptor_set_layout,
+		                             &host_allocator);
+		gbuffer->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+	gbuffer->pipeline = VK_NULL_HANDLE;
+}
+
+uint8_t gbuffer_wait_pipeline(struct gbuffer *gbuffer,
+                              struct pipeline_compiler *compiler)
+{
+	return pipeline_compiler_wait(compiler, gbuffer->variant,
+	                              &gbuffer->pipeline);
+}
+
+/* Transient, so lazily allocated memory is used where there is some */
+static uint8_t create_image(VkDevice device,
+                            const VkPhysicalDeviceMemoryProperties
+                            *memory_properties,
+                            VkFormat format,
+                            VkExtent2D extent,
+                            struct gpu_image *image)
+{
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent = {
+			.width = extent.width,
+			.height = extent.height,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+		         | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
+		         | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	return gpu_image_init(device, memory_properties, &image_create_info,
+	                      VK_IMAGE_ASPECT_COLOR_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      image);
+}
+
+static uint8_t create_depth_view(struct gbuffer_target *target,
+                                 VkDevice device,
+                                 VkImage depth_image,
+                                 VkFormat depth_format)
+{
+	VkImageViewCreateInfo image_view_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.image = depth_image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = depth_format,
+		.components = {
+			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+		},
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+	};
+	VkResult result;
+	result = vkCreateImageView(device, &image_view_create_info,
+	                           &host_allocator, &target->depth_view);
+	if (result != VK_SUCCESS) {
+		target->depth_view = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_descriptor_set(struct gbuffer_target *target,
+                                     const struct gbuffer *gbuffer,
+                                     VkDevice device)
+{
+	VkDescriptorPoolSize descriptor_pool_sizes[] = {
+		{
+			.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+			.descriptorCount = INPUT_ATTACHMENT_COUNT,
+		},
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = 1,
+		.poolSizeCount = ARRAY_SIZE(descriptor_pool_sizes),
+		.pPoolSizes = descriptor_pool_sizes,
+	};
+	VkResult result;
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &target->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		target->descriptor_pool = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = target->descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &gbuffer->descriptor_set_layout,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  &target->descriptor_set);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	/* In the layouts the lighting subpass reads them in */
+	VkDescriptorImageInfo descriptor_image_infos[INPUT_ATTACHMENT_COUNT];
+	VkDescriptorImageInfo depth_image_info = {
+		.sampler = VK_NULL_HANDLE,
+		.imageView = target->depth_view,
+		.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+	};
+	descriptor_image_infos[0] = depth_image_info;
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; ++i) {
+		VkDescriptorImageInfo descriptor_image_info = {
+			.sampler = VK_NULL_HANDLE,
+			.imageView = target->images[i].view,
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		};
+		descriptor_image_infos[1 + i] = descriptor_image_info;
+	}
+	VkWriteDescriptorSet write_descriptor_set = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = target->descriptor_set,
+		.dstBinding = 0,
+		.dstArrayElement = 0,
+		.descriptorCount = INPUT_ATTACHMENT_COUNT,
+		.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+		.pImageInfo = descriptor_image_infos,
+		.pBufferInfo = NULL,
+		.pTexelBufferView = NULL,
+	};
+	vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+	return NO_ERRORS;
+}
+
+uint8_t gbuffer_target_init(struct gbuffer_target *target,
+                            const struct gbuffer *gbuffer,
+                            VkDevice device,
+                            const VkPhysicalDeviceMemoryProperties
+                            *memory_properties,
+                            VkExtent2D extent,
+                            VkImage depth_image,
+                            VkFormat depth_format)
+{
+	memset(target, 0, sizeof(*target));
+
+	uint8_t err = NO_ERRORS;
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT && !err; ++i) {
+		err = create_image(device, memory_properties, formats[i],
+		                   extent, &target->images[i]);
+	}
+	err = err ? err : create_depth_view(target, device, depth_image,
+	                                    depth_format);
+	err = err ? err : create_descriptor_set(target, gbuffer, device);
+	return err;
+}
+
+uint8_t gbuffer_target_retire(struct gbuffer_target *target,
+                              struct deferred *deferred,
+                              uint64_t last_use)
+{
+	uint8_t err = NO_ERRORS;
+	/* Frees the descriptor set along with it */
+	if (target->descriptor_pool != VK_NULL_HANDLE) {
+		union deferred_handle handle = {
+			.descriptor_pool = target->descriptor_pool,
+		};
+		err |= deferred_push(deferred, DEFERRED_DESCRIPTOR_POOL, handle,
+		                     last_use);
+		target->descriptor_pool = VK_NULL_HANDLE;
+	}
+	target->descriptor_set = VK_NULL_HANDLE;
+	if (target->depth_view != VK_NULL_HANDLE) {
+		union deferred_handle handle = {
+			.image_view = target->depth_view,
+		};
+		err |= deferred_push(deferred, DEFERRED_IMAGE_VIEW, handle,
+		                     last_use);
+		target->depth_view = VK_NULL_HANDLE;
+	}
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; ++i) {
+		err |= deferred_push_image(deferred, &target->images[i],
+		                           last_use);
+	}
+	return err;
+}
+
+/* Sets 0 and 1 are still bound from the scene's subpass */
+void gbuffer_record_lighting(const struct gbuffer *gbuffer,
+                             const struct gbuffer_target *target,
+                             VkCommandBuffer command_buffer)
+{
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                  gbuffer->pipeline);
+	vkCmdBindDescriptorSets(command_buffer,
+	                        VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                        gbuffer->pipeline_layout,
+	                        GBUFFER_SET, 1, &target->descriptor_set,
+	                        0, NULL);
+	vkCmdDraw(command_buffer, 3, 1, 0, 0);
+}
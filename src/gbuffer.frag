@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 2) in vec3 fragNormal;
+
+// Alpha marks what was drawn, the albedo attachment clears to zero
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormal;
+
+void main() {
+	outAlbedo = vec4(fragColor, 1.0);
+	outNormal = vec4(normalize(fragNormal) * 0.5 + 0.5, 0.0);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_GBUFFER_H
+#define HELLO_VULKAN_GBUFFER_H
+
+#include "deferred.h"
+#include "gpu.h"
+#include "pack.h"
+#include "pipeline_compiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+#define GBUFFER_ALBEDO_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+#define GBUFFER_NORMAL_FORMAT VK_FORMAT_A2B10G10R10_UNORM_PACK32
+
+/* Attachments of the deferred render pass, after color and depth */
+enum gbuffer_attachment {
+	GBUFFER_ALBEDO,
+	GBUFFER_NORMAL,
+	GBUFFER_ATTACHMENT_COUNT,
+};
+
+/*
+ * Deferred shading in two subpasses of one render pass. The first writes
+ * albedo and normals next to depth, the second reads all three back as
+ * input attachments at its own pixel and adds up the lights over a full
+ * screen triangle. Nothing reads the G-buffer outside the render pass, so
+ * its images are transient and never stored: a tiled GPU keeps it on chip.
+ * Sets 0 and 1 of the lighting layout match the scene's, so only set 2 is
+ * bound between the subpasses.
+ */
+struct gbuffer {
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkPipelineLayout pipeline_layout;
+	VkShaderModule vert_shader_module;
+	VkShaderModule frag_shader_module;
+	uint32_t variant;
+	/* Set by gbuffer_wait_pipeline */
+	VkPipeline pipeline;
+};
+
+/* A window's G-buffer, sized and recreated with its swapchain */
+struct gbuffer_target {
+	struct gpu_image images[GBUFFER_ATTACHMENT_COUNT];
+	/* Only the depth aspect can be an input attachment */
+	VkImageView depth_view;
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet descriptor_set;
+};
+
+/*
+ * The lighting pipeline is queued on the compiler for subpass 1 of
+ * render_pass, and the compiler has to be finished before gbuffer_fini.
+ * The scene's layout has the two set layouts and the push constant range.
+ */
+uint8_t gbuffer_init(struct gbuffer *gbuffer,
+                     VkDevice device,
+                     const struct pack *assets,
+                     struct pipeline_compiler *compiler,
+                     const VkDescriptorSetLayout *scene_set_layouts,
+                     const VkPushConstantRange *push_constant_range,
+                     VkRenderPass render_pass);
+void gbuffer_fini(struct gbuffer *gbuffer, VkDevice device);
+
+uint8_t gbuffer_wait_pipeline(struct gbuffer *gbuffer,
+                              struct pipeline_compiler *compiler);
+
+/* The caller retires whatever was created, even on failure */
+uint8_t gbuffer_target_init(struct gbuffer_target *target,
+                            const struct gbuffer *gbuffer,
+                            VkDevice device,
+                            const VkPhysicalDeviceMemoryProperties
+                            *memory_properties,
+                            VkExtent2D extent,
+                            VkImage depth_image,
+                            VkFormat depth_format);
+uint8_t gbuffer_target_retire(struct gbuffer_target *target,
+                              struct deferred *deferred,
+                              uint64_t last_use);
+
+/* Records the lighting subpass, after vkCmdNextSubpass */
+void gbuffer_record_lighting(const struct gbuffer *gbuffer,
+                             const struct gbuffer_target *target,
+                             VkCommandBuffer command_buffer);
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+int print_result(VkResult result)
+{
+	const char *msg;
+#define PRINT_RESULT_CASE(x) \
+case x: \
+	msg = #x "\n"; \
+	return (size_t) printf("%s", msg) == strlen(msg) ? 0 : LIBC_ERROR_BIT;
+
+	switch (result) {
+	PRINT_RESULT_CASE(VK_ERROR_VALIDATION_FAILED_EXT)
+	PRINT_RESULT_CASE(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR)
+	PRINT_RESULT_CASE(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR)
+	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_DATE_KHR)
+	PRINT_RESULT_CASE(VK_ERROR_SURFACE_LOST_KHR)
+	PRINT_RESULT_CASE(VK_ERROR_FORMAT_NOT_SUPPORTED)
+	PRINT_RESULT_CASE(VK_ERROR_TOO_MANY_OBJECTS)
+	PRINT_RESULT_CASE(VK_ERROR_INCOMPATIBLE_DRIVER)
+	PRINT_RESULT_CASE(VK_ERROR_LAYER_NOT_PRESENT)
+	PRINT_RESULT_CASE(VK_ERROR_FEATURE_NOT_PRESENT)
+	PRINT_RESULT_CASE(VK_ERROR_EXTENSION_NOT_PRESENT)
+	PRINT_RESULT_CASE(VK_ERROR_DEVICE_LOST)
+	PRINT_RESULT_CASE(VK_ERROR_MEMORY_MAP_FAILED)
+	PRINT_RESULT_CASE(VK_ERROR_INITIALIZATION_FAILED)
+	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_DEVICE_MEMORY)
+	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_HOST_MEMORY)
+	PRINT_RESULT_CASE(VK_SUCCESS)
+	PRINT_RESULT_CASE(VK_NOT_READY)
+	PRINT_RESULT_CASE(VK_TIMEOUT)
+	PRINT_RESULT_CASE(VK_EVENT_SET)
+	PRINT_RESULT_CASE(VK_EVENT_RESET)
+	PRINT_RESULT_CASE(VK_INCOMPLETE)
+	PRINT_RESULT_CASE(VK_SUBOPTIMAL_KHR)
+#undef PRINT_RESULT_CASE
+	default:
+		return APP_ERROR_BIT;
+	}
+}
+
+uint8_t gpu_find_memory_type_index(
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	uint32_t memory_type_bits,
+	VkMemoryPropertyFlags property_flags,
+	uint32_t *memory_type_index)
+{
+	for (uint32_t i = 0; i < memory_properties->memoryTypeCount; ++i) {
+		if ((memory_type_bits & (1u << i)) == 0) {
+			continue;
+		}
+		VkMemoryPropertyFlags flags
+			= memory_properties->memoryTypes[i].propertyFlags;
+		if ((flags & property_flags) == property_flags) {
+			*memory_type_index = i;
+			return NO_ERRORS;
+		}
+	}
+	return APP_ERROR_BIT;
+}
+
+uint8_t gpu_buffer_init(VkDevice device,
+                        const VkPhysicalDeviceMemoryProperties *memory_properties,
+                        VkDeviceSize size,
+                        VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags required_flags,
+                        VkMemoryPropertyFlags preferred_flags,
+                        struct gpu_buffer *buffer)
+{
+	buffer->buffer = VK_NULL_HANDLE;
+	buffer->memory = VK_NULL_HANDLE;
+	buffer->size = size;
+	buffer->mapped = NULL;
+
+	VkBufferCreateInfo buffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+	};
+	VkResult result;
+	result = vkCreateBuffer(device, &buffer_create_info, &host_allocator,
+	                        &buffer->buffer);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkMemoryRequirements memory_requirements;
+	vkGetBufferMemoryRequirements(device, buffer->buffer,
+	                              &memory_requirements);
+
+	VkMemoryPropertyFlags property_flags = preferred_flags;
+	uint32_t memory_type_index;
+	uint8_t err = gpu_find_memory_type_index(
+		memory_properties,
+		memory_requirements.memoryTypeBits,
+		property_flags,
+		&memory_type_index
+	);
+	if (err) {
+		property_flags = required_flags;
+		err = gpu_find_memory_type_index(
+			memory_properties,
+			memory_requirements.memoryTypeBits,
+			property_flags,
+			&memory_type_index
+		);
+	}
+	if (err) {
+		gpu_buffer_fini(device, buffer);
+		return err;
+	}
+
+	VkMemoryAllocateInfo memory_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = NULL,
+		.allocationSize = memory_requirements.size,
+		.memoryTypeIndex = memory_type_index,
+	};
+	result = vkAllocateMemory(device, &memory_allocate_info,
+	                          &host_allocator, &buffer->memory);
+	if (result != VK_SUCCESS) {
+		gpu_buffer_fini(device, buffer);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	result = vkBindBufferMemory(device, buffer->buffer, buffer->memory, 0);
+	if (result != VK_SUCCESS) {
+		gpu_buffer_fini(device, buffer);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	if (property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		result = vkMapMemory(device, buffer->memory, 0, VK_WHOLE_SIZE,
+		                     0, &buffer->mapped);
+		if (result != VK_SUCCESS) {
+			gpu_buffer_fini(device, buffer);
+			return VULKAN_ERROR_BIT | print_result(result);
+		}
+	}
+
+	return NO_ERRORS;
+}
+
+void gpu_buffer_fini(VkDevice device, struct gpu_buffer *buffer)
+{
+	if (buffer->mapped != NULL) {
+		vkUnmapMemory(device, buffer->memory);
+		buffer->mapped = NULL;
+	}
+	if (buffer->buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device, buffer->buffer, &host_allocator);
+		buffer->buffer = VK_NULL_HANDLE;
+	}
+	if (buffer->memory != VK_NULL_HANDLE) {
+		vkFreeMemory(device, buffer->memory, &host_allocator);
+		buffer->memory = VK_NULL_HANDLE;
+	}
+	buffer->size = 0;
+}
+
+uint8_t gpu_one_shot_begin(VkDevice device,
+                           uint32_t queue_family_index,
+                           struct gpu_one_shot *one_shot)
+{
+	VkCommandPoolCreateInfo command_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = queue_family_index,
+	};
+	VkResult result;
+	result = vkCreateCommandPool(device, &command_pool_create_info,
+	                             &host_allocator, &one_shot->command_pool);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = one_shot->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info,
+	                                  &one_shot->command_buffer);
+	if (result == VK_SUCCESS) {
+		VkCommandBufferBeginInfo command_buffer_begin_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.pNext = NULL,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			.pInheritanceInfo = NULL,
+		};
+		result = vkBeginCommandBuffer(one_shot->command_buffer,
+		                              &command_buffer_begin_info);
+	}
+	if (result != VK_SUCCESS) {
+		vkDestroyCommandPool(device, one_shot->command_pool,
+		                     &host_allocator);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+uint8_t gpu_one_shot_end(VkDevice device,
+                         VkQueue queue,
+                         struct gpu_one_shot *one_shot)
+{
+	VkFenceCreateInfo fence_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+	};
+	VkResult result;
+	VkFence fence;
+	result = vkCreateFence(device, &fence_create_info, &host_allocator,
+	                       &fence);
+	if (result != VK_SUCCESS) {
+		vkDestroyCommandPool(device, one_shot->command_pool,
+		                     &host_allocator);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	result = vkEndCommandBuffer(one_shot->command_buffer);
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = NULL,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = NULL,
+		.pWaitDstStageMask = NULL,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &one_shot->command_buffer,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = NULL,
+	};
+	if (result == VK_SUCCESS) {
+		result = vkQueueSubmit(queue, 1, &submit_info, fence);
+	}
+	if (result == VK_SUCCESS) {
+		result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	}
+
+	vkDestroyFence(device, fence, &host_allocator);
+	vkDestroyCommandPool(device, one_shot->command_pool, &host_allocator);
+	one_shot->command_pool = VK_NULL_HANDLE;
+	one_shot->command_buffer = VK_NULL_HANDLE;
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+uint8_t gpu_buffer_init_with_data(
+	VkDevice device,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	VkQueue queue,
+	uint32_t queue_family_index,
+	VkBufferUsageFlags usage,
+	const void *data,
+	VkDeviceSize size,
+	struct gpu_buffer *buffer)
+{
+	const VkMemoryPropertyFlags host_flags
+		= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	uint8_t err = gpu_buffer_init(device, memory_properties, size,
+	                              usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	                              | host_flags,
+	                              buffer);
+	if (err) {
+		return err;
+	}
+	if (buffer->mapped != NULL) {
+		memcpy(buffer->mapped, data, size);
+		return NO_ERRORS;
+	}
+
+	struct gpu_buffer staging;
+	err = gpu_buffer_init(device, memory_properties, size,
+	                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	                      host_flags, host_flags, &staging);
+	if (err) {
+		gpu_buffer_fini(device, buffer);
+		return err;
+	}
+	memcpy(staging.mapped, data, size);
+
+	struct gpu_one_shot one_shot;
+	err = gpu_one_shot_begin(device, queue_family_index, &one_shot);
+	if (!err) {
+		VkBufferCopy region = {
+			.srcOffset = 0,
+			.dstOffset = 0,
+			.size = size,
+		};
+		vkCmdCopyBuffer(one_shot.command_buffer, staging.buffer,
+		                buffer->buffer, 1, &region);
+		err = gpu_one_shot_end(device, queue, &one_shot);
+	}
+	gpu_buffer_fini(device, &staging);
+	if (err) {
+		gpu_buffer_fini(device, buffer);
+	}
+	return err;
+}
+
+/* Ordered from the most to the least precise, depth-only formats first */
+static const VkFormat depth_formats[] = {
+	VK_FORMAT_D32_SFLOAT,
+	VK_FORMAT_X8_D24_UNORM_PACK32,
+	VK_FORMAT_D32_SFLOAT_S8_UINT,
+	VK_FORMAT_D24_UNORM_S8_UINT,
+	VK_FORMAT_D16_UNORM,
+};
+
+uint8_t gpu_select_depth_format(VkPhysicalDevice physical_device,
+                                VkFormat *format)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(depth_formats); ++i) {
+		VkFormatProperties format_properties;
+		vkGetPhysicalDeviceFormatProperties(physical_device,
+		                                    depth_formats[i],
+		                                    &format_properties);
+		if (format_properties.optimalTilingFeatures
+		    & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+			*format = depth_formats[i];
+			return NO_ERRORS;
+		}
+	}
+	printf("Cannot find a supported depth format\n");
+	return APP_ERROR_BIT;
+}
+
+bool gpu_format_has_stencil(VkFormat format)
+{
+	return format == VK_FORMAT_D32_SFLOAT_S8_UINT
+	       || format == VK_FORMAT_D24_UNORM_S8_UINT
+	       || format == VK_FORMAT_D16_UNORM_S8_UINT
+	       || format == VK_FORMAT_S8_UINT;
+}
+
+uint8_t gpu_image_init(VkDevice device,
+                       const VkPhysicalDeviceMemoryProperties *memory_properties,
+                       const VkImageCreateInfo *image_create_info,
+                       VkImageAspectFlags aspect_mask,
+                       VkMemoryPropertyFlags property_flags,
+                       struct gpu_image *image)
+{
+	image->image = VK_NULL_HANDLE;
+	image->memory = VK_NULL_HANDLE;
+	image->view = VK_NULL_HANDLE;
+
+	VkResult result;
+	result = vkCreateImage(device, image_create_info, &host_allocator,
+	                       &image->image);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkMemoryRequirements memory_requirements;
+	vkGetImageMemoryRequirements(device, image->image,
+	                             &memory_requirements);
+
+	/* On tiled GPUs transient attachments may never need backing memory */
+	uint32_t memory_type_index;
+	uint8_t err = APP_ERROR_BIT;
+	if (image_create_info->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) {
+		err = gpu_find_memory_type_index(
+			memory_properties,
+			memory_requirements.memoryTypeBits,
+			property_flags | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+			&memory_type_index
+		);
+	}
+	if (err) {
+		err = gpu_find_memory_type_index(
+			memory_properties,
+			memory_requirements.memoryTypeBits,
+			property_flags,
+			&memory_type_index
+		);
+	}
+	if (err) {
+		gpu_image_fini(device, image);
+		return err;
+	}
+
+	VkMemoryAllocateInfo memory_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = NULL,
+		.allocationSize = memory_requirements.size,
+		.memoryTypeIndex = memory_type_index,
+	};
+	result = vkAllocateMemory(device, &memory_allocate_info,
+	                          &host_allocator, &image->memory);
+	if (result != VK_SUCCESS) {
+		gpu_image_fini(device, image);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	result = vkBindImageMemory(device, image->image, image->memory, 0);
+	if (result != VK_SUCCESS) {
+		gpu_image_fini(device, image);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkImageViewCreateInfo image_view_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.image = image->image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = image_create_info->format,
+		.components = {
+			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+		},
+		.subresourceRange = {
+			.aspectMask = aspect_mask,
+			.baseMipLevel = 0,
+			.levelCount = image_create_info->mipLevels,
+			.baseArrayLayer = 0,
+			.layerCount = image_create_info->arrayLayers,
+		},
+	};
+	result = vkCreateImageView(device, &image_view_create_info,
+	                           &host_allocator, &image->view);
+	if (result != VK_SUCCESS) {
+		gpu_image_fini(device, image);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	return NO_ERRORS;
+}
+
+void gpu_image_fini(VkDevice device, struct gpu_image *image)
+{
+	if (image->view != VK_NULL_HANDLE) {
+		vkDestroyImageView(device, image->view, &host_allocator);
+		image->view = VK_NULL_HANDLE;
+	}
+	if (image->image != VK_NULL_HANDLE) {
+		vkDestroyImage(device, image->image, &host_allocator);
+		image->image = VK_NULL_HANDLE;
+	}
+	if (image->memory != VK_NULL_HANDLE) {
+		vkFreeMemory(device, image->memory, &host_allocator);
+		image->memory = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_GPU_H
+#define HELLO_VULKAN_GPU_H
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct gpu_buffer {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	void *mapped;
+};
+
+struct gpu_image {
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+};
+
+int print_result(VkResult result);
+
+/* A command buffer for setup work, submitted and waited for by end */
+struct gpu_one_shot {
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+};
+
+uint8_t gpu_one_shot_begin(VkDevice device,
+                           uint32_t queue_family_index,
+                           struct gpu_one_shot *one_shot);
+/* Also frees the command buffer, whether or not the submission worked */
+uint8_t gpu_one_shot_end(VkDevice device,
+                         VkQueue queue,
+                         struct gpu_one_shot *one_shot);
+
+uint8_t gpu_find_memory_type_index(
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	uint32_t memory_type_bits,
+	VkMemoryPropertyFlags property_flags,
+	uint32_t *memory_type_index);
+
+/*
+ * Uses a memory type with all of preferred_flags when there is one, otherwise
+ * one with required_flags. Host visible memory stays mapped for the lifetime
+ * of the buffer.
+ */
+uint8_t gpu_buffer_init(VkDevice device,
+                        const VkPhysicalDeviceMemoryProperties *memory_properties,
+                        VkDeviceSize size,
+                        VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags required_flags,
+                        VkMemoryPropertyFlags preferred_flags,
+                        struct gpu_buffer *buffer);
+void gpu_buffer_fini(VkDevice device, struct gpu_buffer *buffer);
+
+/*
+ * A device local buffer holding a copy of data. It is written in place when
+ * device local memory is host visible, otherwise through a staging buffer
+ * and a transfer on queue that is waited for.
+ */
+uint8_t gpu_buffer_init_with_data(
+	VkDevice device,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	VkQueue queue,
+	uint32_t queue_family_index,
+	VkBufferUsageFlags usage,
+	const void *data,
+	VkDeviceSize size,
+	struct gpu_buffer *buffer);
+
+uint8_t gpu_select_depth_format(VkPhysicalDevice physical_device,
+                                VkFormat *format);
+bool gpu_format_has_stencil(VkFormat format);
+
+/* Transient attachments prefer lazily allocated memory */
+uint8_t gpu_image_init(VkDevice device,
+                       const VkPhysicalDeviceMemoryProperties *memory_properties,
+                       const VkImageCreateInfo *image_create_info,
+                       VkImageAspectFlags aspect_mask,
+                       VkMemoryPropertyFlags property_flags,
+                       struct gpu_image *image);
+void gpu_image_fini(VkDevice device, struct gpu_image *image);
+
+#endif
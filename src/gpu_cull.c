@@ -0,0 +1,416 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_cull.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <string.h>
+
+#define CULL_WORKGROUP_SIZE 64
+
+struct cull_push_constants {
+	struct frustum frustum;
+	uint32_t object_count;
+};
+
+static uint8_t create_buffers(struct gpu_cull *cull,
+                              VkDevice device,
+                              const VkPhysicalDeviceMemoryProperties
+                              *memory_properties,
+                              const struct scene *scene)
+{
+	const VkMemoryPropertyFlags host_flags
+		= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	uint8_t err;
+	err = gpu_buffer_init(device, memory_properties,
+	                      scene->object_count * sizeof(struct scene_object),
+	                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	                      host_flags,
+	                      host_flags | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      &cull->object_buffer);
+	if (err) {
+		return err;
+	}
+	memcpy(cull->object_buffer.mapped, scene->objects,
+	       scene->object_count * sizeof(struct scene_object));
+
+	err = gpu_buffer_init(device, memory_properties,
+	                      scene->object_count
+	                      * sizeof(VkDrawIndexedIndirectCommand),
+	                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	                      | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	                      | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      &cull->command_buffer);
+	if (err) {
+		return err;
+	}
+
+	err = gpu_buffer_init(device, memory_properties,
+	                      sizeof(uint32_t),
+	                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	                      | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	                      | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      &cull->count_buffer);
+	if (err) {
+		return err;
+	}
+
+	/* Every object is the same triangle, picked apart by gl_InstanceIndex */
+	const uint16_t indices[] = { 0, 1, 2 };
+	err = gpu_buffer_init(device, memory_properties,
+	                      sizeof(indices),
+	                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	                      host_flags,
+	                      host_flags,
+	                      &cull->index_buffer);
+	if (err) {
+		return err;
+	}
+	memcpy(cull->index_buffer.mapped, indices, sizeof(indices));
+
+	return NO_ERRORS;
+}
+
+static uint8_t create_descriptor_set(struct gpu_cull *cull, VkDevice device)
+{
+	VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[] = {
+		{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		{
+			.binding = 2,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+	};
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = ARRAY_SIZE(descriptor_set_layout_bindings),
+		.pBindings = descriptor_set_layout_bindings,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &cull->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorPoolSize descriptor_pool_sizes[] = {
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = ARRAY_SIZE(descriptor_set_layout_bindings),
+		},
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = 1,
+		.poolSizeCount = ARRAY_SIZE(descriptor_pool_sizes),
+		.pPoolSizes = descriptor_pool_sizes,
+	};
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &cull->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = cull->descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &cull->descriptor_set_layout,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  &cull->descriptor_set);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorBufferInfo descriptor_buffer_infos[] = {
+		{
+			.buffer = cull->object_buffer.buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		},
+		{
+			.buffer = cull->command_buffer.buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		},
+		{
+			.buffer = cull->count_buffer.buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		},
+	};
+	VkWriteDescriptorSet write_descriptor_set = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = cull->descriptor_set,
+		.dstBinding = 0,
+		.dstArrayElement = 0,
+		.descriptorCount = ARRAY_SIZE(descriptor_buffer_infos),
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pImageInfo = NULL,
+		.pBufferInfo = descriptor_buffer_infos,
+		.pTexelBufferView = NULL,
+	};
+	vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+
+	return NO_ERRORS;
+}
+
+static uint8_t create_pipeline(struct gpu_cull *cull,
+                               VkDevice device,
+                               const struct pack *assets)
+{
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct cull_push_constants),
+	};
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &cull->descriptor_set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+	VkResult result;
+	result = vkCreatePipelineLayout(device, &pipeline_layout_create_info,
+	                                &host_allocator,
+	                                &cull->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	const struct pack_entry *comp = pack_find(assets, "cull.comp.spv",
+	                                          PACK_TYPE_SPIRV);
+	if (comp == NULL) {
+		return APP_ERROR_BIT;
+	}
+
+	VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.codeSize = comp->size,
+		.pCode = pack_data(assets, comp),
+	};
+	VkShaderModule comp_shader_module;
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator, &comp_shader_module);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkComputePipelineCreateInfo compute_pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = comp_shader_module,
+			.pName = "main",
+			.pSpecializationInfo = NULL,
+		},
+		.layout = cull->pipeline_layout,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1,
+	};
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+	                                  &compute_pipeline_create_info,
+	                                  &host_allocator, &cull->pipeline);
+	vkDestroyShaderModule(device, comp_shader_module, &host_allocator);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	return NO_ERRORS;
+}
+
+uint8_t gpu_cull_init(struct gpu_cull *cull,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      const struct scene *scene,
+                      const struct pack *assets,
+                      PFN_vkCmdDrawIndexedIndirectCountKHR
+                      cmd_draw_indexed_indirect_count)
+{
+	memset(cull, 0, sizeof(*cull));
+	cull->object_count = scene->object_count;
+	cull->cmd_draw_indexed_indirect_count = cmd_draw_indexed_indirect_count;
+
+	uint8_t err = create_buffers(cull, device, memory_properties, scene);
+	if (!err) {
+		err = create_descriptor_set(cull, device);
+	}
+	if (!err) {
+		err = create_pipeline(cull, device, assets);
+	}
+	if (err) {
+		gpu_cull_fini(cull, device);
+	}
+	return err;
+}
+
+void gpu_cull_fini(struct gpu_cull *cull, VkDevice device)
+{
+	if (cull->pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device, cull->pipeline, &host_allocator);
+		cull->pipeline = VK_NULL_HANDLE;
+	}
+	if (cull->pipeline_layout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, cull->pipeline_layout,
+		                        &host_allocator);
+		cull->pipeline_layout = VK_NULL_HANDLE;
+	}
+	if (cull->descriptor_pool != VK_NULL_HANDLE) {
+		vkDestroyDescriptorPool(device, cull->descriptor_pool,
+		                        &host_allocator);
+		cull->descriptor_pool = VK_NULL_HANDLE;
+		cull->descriptor_set = VK_NULL_HANDLE;
+	}
+	if (cull->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device,
+		                             cull->descriptor_set_layout,
+		                             &host_allocator);
+		cull->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+	gpu_buffer_fini(device, &cull->index_buffer);
+	gpu_buffer_fini(device, &cull->count_buffer);
+	gpu_buffer_fini(device, &cull->command_buffer);
+	gpu_buffer_fini(device, &cull->object_buffer);
+}
+
+void gpu_cull_record_dispatch(const struct gpu_cull *cull,
+                              VkCommandBuffer command_buffer,
+                              const struct frustum *frustum)
+{
+	/* The previous frame's indirect draws must finish reading first */
+	vkCmdPipelineBarrier(command_buffer,
+	                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     0, 0, NULL, 0, NULL, 0, NULL);
+
+	vkCmdFillBuffer(command_buffer, cull->count_buffer.buffer,
+	                0, VK_WHOLE_SIZE, 0);
+	if (cull->cmd_draw_indexed_indirect_count == NULL) {
+		/* Commands past the visible count must draw nothing */
+		vkCmdFillBuffer(command_buffer, cull->command_buffer.buffer,
+		                0, VK_WHOLE_SIZE, 0);
+	}
+
+	VkMemoryBarrier fill_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+		                 | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	vkCmdPipelineBarrier(command_buffer,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     0, 1, &fill_barrier, 0, NULL, 0, NULL);
+
+	struct cull_push_constants push_constants = {
+		.frustum = *frustum,
+		.object_count = cull->object_count,
+	};
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                  cull->pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                        cull->pipeline_layout, 0, 1,
+	                        &cull->descriptor_set, 0, NULL);
+	vkCmdPushConstants(command_buffer, cull->pipeline_layout,
+	                   VK_SHADER_STAGE_COMPUTE_BIT, 0,
+	                   sizeof(push_constants), &push_constants);
+	vkCmdDispatch(command_buffer,
+	              (cull->object_count + CULL_WORKGROUP_SIZE - 1)
+	              / CULL_WORKGROUP_SIZE,
+	              1, 1);
+
+	VkMemoryBarrier cull_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+	};
+	vkCmdPipelineBarrier(command_buffer,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+	                     0, 1, &cull_barrier, 0, NULL, 0, NULL);
+}
+
+void gpu_cull_record_draw(const struct gpu_cull *cull,
+                          VkCommandBuffer command_buffer)
+{
+	vkCmdBindIndexBuffer(command_buffer, cull->index_buffer.buffer, 0,
+	                     VK_INDEX_TYPE_UINT16);
+
+	if (cull->cmd_draw_indexed_indirect_count != NULL) {
+		cull->cmd_draw_indexed_indirect_count(
+			command_buffer,
+			cull->command_buffer.buffer, 0,
+			cull->count_buffer.buffer, 0,
+			cull->object_count,
+			sizeof(VkDrawIndexedIndirectCommand)
+		);
+	}
+	else {
+		vkCmdDrawIndexedIndirect(command_buffer,
+		                         cull->command_buffer.buffer, 0,
+		                         cull->object_count,
+		                         sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_GPU_CULL_H
+#define HELLO_VULKAN_GPU_CULL_H
+
+#include "frustum.h"
+#include "gpu.h"
+#include "pack.h"
+#include "scene.h"
+
+#include <vulkan/vulkan.h>
+
+/*
+ * GPU driven culling: a compute pass tests every object's bounding sphere
+ * against the frustum and appends a VkDrawIndexedIndirectCommand for each
+ * visible one, with firstInstance set to the object index. The graphics pass
+ * then draws them all with a single indirect call, so recording a frame costs
+ * the same regardless of the object count.
+ */
+struct gpu_cull {
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet descriptor_set;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipeline;
+
+	struct gpu_buffer object_buffer;
+	struct gpu_buffer command_buffer;
+	struct gpu_buffer count_buffer;
+	struct gpu_buffer index_buffer;
+
+	uint32_t object_count;
+	/* NULL without VK_KHR_draw_indirect_count */
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmd_draw_indexed_indirect_count;
+};
+
+uint8_t gpu_cull_init(struct gpu_cull *cull,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      const struct scene *scene,
+                      const struct pack *assets,
+                      PFN_vkCmdDrawIndexedIndirectCountKHR
+                      cmd_draw_indexed_indirect_count);
+void gpu_cull_fini(struct gpu_cull *cull, VkDevice device);
+
+/* Records the culling dispatch, outside of a render pass */
+void gpu_cull_record_dispatch(const struct gpu_cull *cull,
+                              VkCommandBuffer command_buffer,
+                              const struct frustum *frustum);
+/*
+ * Records the indirect draws inside a render pass. The graphics pipeline
+ * reads the bounding spheres from object_buffer itself, through whatever
+ * descriptors the caller bound.
+ */
+void gpu_cull_record_draw(const struct gpu_cull *cull,
+                          VkCommandBuffer command_buffer);
+
+#endif
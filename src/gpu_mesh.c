@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_mesh.h"
+
+#include "error.h"
+
+#include <stddef.h>
+
+const VkVertexInputBindingDescription gpu_mesh_binding = {
+	.binding = 0,
+	.stride = sizeof(struct mesh_vertex),
+	.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+};
+
+const VkVertexInputAttributeDescription
+gpu_mesh_attributes[GPU_MESH_ATTRIBUTE_COUNT] = {
+	{
+		.location = 0,
+		.binding = 0,
+		.format = VK_FORMAT_R16G16B16A16_SNORM,
+		.offset = offsetof(struct mesh_vertex, position),
+	},
+	{
+		.location = 1,
+		.binding = 0,
+		.format = VK_FORMAT_R16G16_SNORM,
+		.offset = offsetof(struct mesh_vertex, normal),
+	},
+};
+
+uint8_t gpu_mesh_init(struct gpu_mesh *gpu_mesh,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      VkQueue queue,
+                      uint32_t queue_family_index,
+                      const struct mesh *mesh,
+                      bool vertex_pulling)
+{
+	const struct mesh_header *header = mesh->header;
+	gpu_mesh->index_count = header->index_count;
+	gpu_mesh->index_type = header->index_size == 2 ? VK_INDEX_TYPE_UINT16
+	                                               : VK_INDEX_TYPE_UINT32;
+	gpu_mesh->vertex_pulling = vertex_pulling;
+
+	uint8_t err = gpu_buffer_init_with_data(
+		device, memory_properties, queue, queue_family_index,
+		vertex_pulling ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		               : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		mesh->vertices,
+		(VkDeviceSize) header->vertex_count * sizeof(struct mesh_vertex),
+		&gpu_mesh->vertex_buffer
+	);
+	if (err) {
+		return err;
+	}
+
+	err = gpu_buffer_init_with_data(
+		device, memory_properties, queue, queue_family_index,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		mesh->indices,
+		(VkDeviceSize) header->index_count * header->index_size,
+		&gpu_mesh->index_buffer
+	);
+	if (err) {
+		gpu_buffer_fini(device, &gpu_mesh->vertex_buffer);
+		return err;
+	}
+	return NO_ERRORS;
+}
+
+void gpu_mesh_fini(struct gpu_mesh *gpu_mesh, VkDevice device)
+{
+	gpu_buffer_fini(device, &gpu_mesh->index_buffer);
+	gpu_buffer_fini(device, &gpu_mesh->vertex_buffer);
+	gpu_mesh->index_count = 0;
+}
+
+void gpu_mesh_record_bind(const struct gpu_mesh *gpu_mesh,
+                          VkCommandBuffer command_buffer)
+{
+	if (!gpu_mesh->vertex_pulling) {
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(command_buffer, 0, 1,
+		                       &gpu_mesh->vertex_buffer.buffer,
+		                       &offset);
+	}
+	vkCmdBindIndexBuffer(command_buffer, gpu_mesh->index_buffer.buffer, 0,
+	                     gpu_mesh->index_type);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_GPU_MESH_H
+#define HELLO_VULKAN_GPU_MESH_H
+
+#include "gpu.h"
+#include "mesh.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+
+#define GPU_MESH_ATTRIBUTE_COUNT 2
+
+/*
+ * A mesh in device local vertex and index buffers, uploaded once. Vertices
+ * stay quantized; the vertex input formats normalize positions and mesh.vert
+ * decodes the octahedral normals. With vertex pulling the vertex buffer is
+ * read as a storage buffer instead, and mesh_pull.vert unpacks every field
+ * itself, so no vertex buffer is bound.
+ */
+struct gpu_mesh {
+	struct gpu_buffer vertex_buffer;
+	struct gpu_buffer index_buffer;
+	uint32_t index_count;
+	VkIndexType index_type;
+	bool vertex_pulling;
+};
+
+/* Binding 0, location 0 the position and location 1 the normal */
+extern const VkVertexInputBindingDescription gpu_mesh_binding;
+extern const VkVertexInputAttributeDescription
+gpu_mesh_attributes[GPU_MESH_ATTRIBUTE_COUNT];
+
+uint8_t gpu_mesh_init(struct gpu_mesh *gpu_mesh,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties *memory_properties,
+                      VkQueue queue,
+                      uint32_t queue_family_index,
+                      const struct mesh *mesh,
+                      bool vertex_pulling);
+void gpu_mesh_fini(struct gpu_mesh *gpu_mesh, VkDevice device);
+
+void gpu_mesh_record_bind(const struct gpu_mesh *gpu_mesh,
+                          VkCommandBuffer command_buffer);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_statistics.h"
+
+#include "error.h"
+#include "gpu.h"
+#include "host_memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char *const gpu_statistic_names[GPU_STATISTIC_COUNT] = {
+	[GPU_STATISTIC_INPUT_ASSEMBLY_VERTICES] = "input_assembly_vertices",
+	[GPU_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES] = "input_assembly_primitives",
+	[GPU_STATISTIC_VERTEX_SHADER_INVOCATIONS] = "vertex_shader_invocations",
+	[GPU_STATISTIC_CLIPPING_INVOCATIONS] = "clipping_invocations",
+	[GPU_STATISTIC_CLIPPING_PRIMITIVES] = "clipping_primitives",
+	[GPU_STATISTIC_FRAGMENT_SHADER_INVOCATIONS]
+		= "fragment_shader_invocations",
+	[GPU_STATISTIC_COMPUTE_SHADER_INVOCATIONS]
+		= "compute_shader_invocations",
+};
+
+static const VkQueryPipelineStatisticFlags statistic_flags
+	= VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+	  | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+uint8_t gpu_statistics_init(struct gpu_statistics *statistics,
+                            VkDevice device,
+                            uint32_t slot_count)
+{
+	memset(statistics, 0, sizeof(*statistics));
+
+	statistics->submitted = calloc(slot_count, sizeof(bool));
+	if (statistics->submitted == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+
+	VkQueryPoolCreateInfo query_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = slot_count,
+		.pipelineStatistics = statistic_flags,
+	};
+	VkResult result;
+	result = vkCreateQueryPool(device, &query_pool_create_info,
+	                           &host_allocator, &statistics->query_pool);
+	if (result != VK_SUCCESS) {
+		statistics->query_pool = VK_NULL_HANDLE;
+		free(statistics->submitted);
+		statistics->submitted = NULL;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	statistics->slot_count = slot_count;
+	return NO_ERRORS;
+}
+
+void gpu_statistics_fini(struct gpu_statistics *statistics, VkDevice device)
+{
+	if (statistics->query_pool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, statistics->query_pool,
+		                   &host_allocator);
+		statistics->query_pool = VK_NULL_HANDLE;
+	}
+	free(statistics->submitted);
+	statistics->submitted = NULL;
+}
+
+void gpu_statistics_record_begin(const struct gpu_statistics *statistics,
+                                 VkCommandBuffer command_buffer,
+                                 uint32_t slot)
+{
+	if (statistics->query_pool == VK_NULL_HANDLE) {
+		return;
+	}
+	vkCmdResetQueryPool(command_buffer, statistics->query_pool, slot, 1);
+	vkCmdBeginQuery(command_buffer, statistics->query_pool, slot, 0);
+}
+
+void gpu_statistics_record_end(const struct gpu_statistics *statistics,
+                               VkCommandBuffer command_buffer,
+                               uint32_t slot)
+{
+	if (statistics->query_pool == VK_NULL_HANDLE) {
+		return;
+	}
+	vkCmdEndQuery(command_buffer, statistics->query_pool, slot);
+}
+
+bool gpu_statistics_collect(struct gpu_statistics *statistics,
+                            VkDevice device,
+                            uint32_t slot,
+                            uint64_t values[GPU_STATISTIC_COUNT])
+{
+	if (statistics->query_pool == VK_NULL_HANDLE) {
+		return false;
+	}
+	/* Never reset, so there is nothing defined to read yet */
+	if (!statistics->submitted[slot]) {
+		statistics->submitted[slot] = true;
+		return false;
+	}
+
+	/* Every statistic followed by the availability */
+	uint64_t results[GPU_STATISTIC_COUNT + 1];
+	VkResult result;
+	result = vkGetQueryPoolResults(device, statistics->query_pool, slot, 1,
+	                               sizeof(results), results,
+	                               sizeof(results),
+	                               VK_QUERY_RESULT_64_BIT
+	                               | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if (result != VK_SUCCESS || results[GPU_STATISTIC_COUNT] == 0) {
+		return false;
+	}
+	memcpy(values, results, GPU_STATISTIC_COUNT * sizeof(uint64_t));
+	return true;
+}
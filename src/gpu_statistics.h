@@ -0,0 +1,77 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_GPU_STATISTICS_H
+#define HELLO_VULKAN_GPU_STATISTICS_H
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* In the order of their query bits, which is the order results come in */
+enum gpu_statistic {
+	GPU_STATISTIC_INPUT_ASSEMBLY_VERTICES,
+	GPU_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES,
+	GPU_STATISTIC_VERTEX_SHADER_INVOCATIONS,
+	GPU_STATISTIC_CLIPPING_INVOCATIONS,
+	GPU_STATISTIC_CLIPPING_PRIMITIVES,
+	GPU_STATISTIC_FRAGMENT_SHADER_INVOCATIONS,
+	GPU_STATISTIC_COMPUTE_SHADER_INVOCATIONS,
+	GPU_STATISTIC_COUNT,
+};
+
+extern const char *const gpu_statistic_names[GPU_STATISTIC_COUNT];
+
+/*
+ * A ring of pipeline statistics queries, one slot per command buffer, like
+ * gpu_timer. A slot is read back without waiting once the frame timeline
+ * says the previous submission of its command buffer finished.
+ */
+struct gpu_statistics {
+	VkQueryPool query_pool;
+	uint32_t slot_count;
+	/* Whether a slot was submitted since the pool was created */
+	bool *submitted;
+};
+
+uint8_t gpu_statistics_init(struct gpu_statistics *statistics,
+                            VkDevice device,
+                            uint32_t slot_count);
+void gpu_statistics_fini(struct gpu_statistics *statistics, VkDevice device);
+
+/*
+ * Outside of a render pass, both; the query can span compute dispatches and
+ * render passes in between
+ */
+void gpu_statistics_record_begin(const struct gpu_statistics *statistics,
+                                 VkCommandBuffer command_buffer,
+                                 uint32_t slot);
+void gpu_statistics_record_end(const struct gpu_statistics *statistics,
+                               VkCommandBuffer command_buffer,
+                               uint32_t slot);
+
+/*
+ * Call once the slot's last submission finished, right before submitting it
+ * again.
+ * Returns false when the slot has nothing to read yet.
+ */
+bool gpu_statistics_collect(struct gpu_statistics *statistics,
+                            VkDevice device,
+                            uint32_t slot,
+                            uint64_t values[GPU_STATISTIC_COUNT]);
+
+#endif
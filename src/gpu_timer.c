@@ -0,0 +1,248 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_timer.h"
+
+#include "error.h"
+#include "gpu.h"
+#include "host_memory.h"
+#include "trace.h"
+
+#include <string.h>
+
+static uint64_t to_trace_ns(const struct gpu_timer *timer, uint64_t timestamp)
+{
+	double ns = (double) (timestamp & timer->valid_mask) * timer->period_ns;
+	return (uint64_t) ((int64_t) ns + timer->offset_ns);
+}
+
+/*
+ * Writes one timestamp into the query after the slots and compares it with
+ * the trace clock read right after the fence signals. The difference is the
+ * submission latency at worst, well under the length of a frame.
+ */
+static uint8_t calibrate(struct gpu_timer *timer,
+                         VkDevice device,
+                         VkQueue queue,
+                         VkCommandPool command_pool)
+{
+	uint32_t query_count = timer->slot_count * timer->point_count + 1;
+	uint32_t calibration_query = query_count - 1;
+
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	VkResult result;
+	VkCommandBuffer command_buffer;
+	result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info,
+	                                  &command_buffer);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkFenceCreateInfo fence_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+	};
+	VkFence fence;
+	result = vkCreateFence(device, &fence_create_info, &host_allocator,
+	                       &fence);
+	if (result != VK_SUCCESS) {
+		vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkCommandBufferBeginInfo command_buffer_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	result = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+	if (result == VK_SUCCESS) {
+		/* Every slot starts out unavailable rather than undefined */
+		vkCmdResetQueryPool(command_buffer, timer->query_pool,
+		                    0, query_count);
+		vkCmdWriteTimestamp(command_buffer,
+		                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		                    timer->query_pool, calibration_query);
+		result = vkEndCommandBuffer(command_buffer);
+	}
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = NULL,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = NULL,
+		.pWaitDstStageMask = NULL,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &command_buffer,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = NULL,
+	};
+	if (result == VK_SUCCESS) {
+		result = vkQueueSubmit(queue, 1, &submit_info, fence);
+	}
+	if (result == VK_SUCCESS) {
+		result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	}
+	uint64_t cpu_ns = trace_now_ns();
+
+	uint64_t timestamp;
+	if (result == VK_SUCCESS) {
+		result = vkGetQueryPoolResults(device, timer->query_pool,
+		                               calibration_query, 1,
+		                               sizeof(timestamp), &timestamp,
+		                               sizeof(timestamp),
+		                               VK_QUERY_RESULT_64_BIT
+		                               | VK_QUERY_RESULT_WAIT_BIT);
+	}
+
+	vkDestroyFence(device, fence, &host_allocator);
+	vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	timer->offset_ns = 0;
+	timer->offset_ns = (int64_t) cpu_ns
+	                   - (int64_t) to_trace_ns(timer, timestamp);
+	return NO_ERRORS;
+}
+
+uint8_t gpu_timer_init(struct gpu_timer *timer,
+                       VkDevice device,
+                       VkQueue queue,
+                       VkCommandPool command_pool,
+                       uint32_t slot_count,
+                       uint32_t point_count,
+                       float timestamp_period,
+                       uint32_t timestamp_valid_bits)
+{
+	memset(timer, 0, sizeof(*timer));
+	if (timestamp_valid_bits == 0 || point_count > GPU_TIMER_MAX_POINTS) {
+		return NO_ERRORS;
+	}
+
+	timer->slot_count = slot_count;
+	timer->point_count = point_count;
+	timer->period_ns = timestamp_period;
+	timer->valid_mask = timestamp_valid_bits >= 64
+	                    ? UINT64_MAX
+	                    : (UINT64_C(1) << timestamp_valid_bits) - 1;
+
+	VkQueryPoolCreateInfo query_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = slot_count * point_count + 1,
+		.pipelineStatistics = 0,
+	};
+	VkResult result;
+	result = vkCreateQueryPool(device, &query_pool_create_info,
+	                           &host_allocator, &timer->query_pool);
+	if (result != VK_SUCCESS) {
+		timer->query_pool = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	uint8_t err = calibrate(timer, device, queue, command_pool);
+	if (err) {
+		gpu_timer_fini(timer, device);
+	}
+	return err;
+}
+
+void gpu_timer_fini(struct gpu_timer *timer, VkDevice device)
+{
+	if (timer->query_pool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, timer->query_pool, &host_allocator);
+		timer->query_pool = VK_NULL_HANDLE;
+	}
+}
+
+void gpu_timer_record_reset(const struct gpu_timer *timer,
+                            VkCommandBuffer command_buffer,
+                            uint32_t slot)
+{
+	if (timer->query_pool == VK_NULL_HANDLE) {
+		return;
+	}
+	vkCmdResetQueryPool(command_buffer, timer->query_pool,
+	                    slot * timer->point_count, timer->point_count);
+}
+
+void gpu_timer_record_point(const struct gpu_timer *timer,
+                            VkCommandBuffer command_buffer,
+                            uint32_t slot,
+                            uint32_t point,
+                            VkPipelineStageFlagBits stage)
+{
+	if (timer->query_pool == VK_NULL_HANDLE) {
+		return;
+	}
+	vkCmdWriteTimestamp(command_buffer, stage, timer->query_pool,
+	                    slot * timer->point_count + point);
+}
+
+bool gpu_timer_collect(const struct gpu_timer *timer,
+                       VkDevice device,
+                       uint32_t slot,
+                       const char *const *zone_names,
+                       double *zone_ms)
+{
+	if (timer->query_pool == VK_NULL_HANDLE
+	    || (!trace_enabled && zone_ms == NULL)) {
+		return false;
+	}
+
+	/* Each timestamp followed by its availability */
+	uint64_t results[2 * GPU_TIMER_MAX_POINTS];
+	VkResult result;
+	result = vkGetQueryPoolResults(device, timer->query_pool,
+	                               slot * timer->point_count,
+	                               timer->point_count,
+	                               sizeof(results), results,
+	                               2 * sizeof(uint64_t),
+	                               VK_QUERY_RESULT_64_BIT
+	                               | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if (result != VK_SUCCESS) {
+		return false;
+	}
+	for (uint32_t i = 0; i < timer->point_count; ++i) {
+		if (results[2 * i + 1] == 0) {
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i + 1 < timer->point_count; ++i) {
+		uint64_t begin_ns = to_trace_ns(timer, results[2 * i]);
+		uint64_t end_ns = to_trace_ns(timer, results[2 * i + 2]);
+		if (zone_ms != NULL) {
+			zone_ms[i] = (double) (int64_t) (end_ns - begin_ns) / 1e6;
+		}
+		if (trace_enabled && zone_names[i] != NULL) {
+			trace_gpu_zone(zone_names[i], begin_ns, end_ns);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_GPU_TIMER_H
+#define HELLO_VULKAN_GPU_TIMER_H
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPU_TIMER_MAX_POINTS 8
+
+/*
+ * Timestamp queries turned into trace zones. Each slot belongs to one command
+ * buffer and holds point_count timestamps, zone i spanning points i and i + 1.
+ * A slot is read back without waiting, once the frame timeline says the
+ * previous submission of its command buffer finished.
+ */
+struct gpu_timer {
+	VkQueryPool query_pool;
+	uint32_t slot_count;
+	uint32_t point_count;
+	double period_ns;
+	uint64_t valid_mask;
+	/* Added to GPU nanoseconds to land on the trace clock */
+	int64_t offset_ns;
+};
+
+/*
+ * Creates the query pool and lines the GPU clock up with the trace clock using
+ * a one off submission. Leaves the query pool null when the queue family has
+ * no timestamp support.
+ */
+uint8_t gpu_timer_init(struct gpu_timer *timer,
+                       VkDevice device,
+                       VkQueue queue,
+                       VkCommandPool command_pool,
+                       uint32_t slot_count,
+                       uint32_t point_count,
+                       float timestamp_period,
+                       uint32_t timestamp_valid_bits);
+void gpu_timer_fini(struct gpu_timer *timer, VkDevice device);
+
+/* Outside of a render pass, before any point of the slot */
+void gpu_timer_record_reset(const struct gpu_timer *timer,
+                            VkCommandBuffer command_buffer,
+                            uint32_t slot);
+void gpu_timer_record_point(const struct gpu_timer *timer,
+                            VkCommandBuffer command_buffer,
+                            uint32_t slot,
+                            uint32_t point,
+                            VkPipelineStageFlagBits stage);
+
+/*
+ * Null zone names are skipped, as is a slot without every point available,
+ * for which false is returned. Without zone_ms being null, it gets every
+ * zone's milliseconds whether or not traces are enabled.
+ */
+bool gpu_timer_collect(const struct gpu_timer *timer,
+                       VkDevice device,
+                       uint32_t slot,
+                       const char *const *zone_names,
+                       double *zone_ms);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "host_memory.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#define SCOPE_COUNT (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+
+struct scope_counts {
+	atomic_size_t bytes;
+	atomic_size_t peak_bytes;
+	atomic_uint_fast64_t allocations;
+	/* Reported through the internal allocation notifications */
+	atomic_size_t internal_bytes;
+	atomic_size_t internal_peak_bytes;
+};
+
+static const char *const scope_names[SCOPE_COUNT] = {
+	[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND] = "command",
+	[VK_SYSTEM_ALLOCATION_SCOPE_OBJECT] = "object",
+	[VK_SYSTEM_ALLOCATION_SCOPE_CACHE] = "cache",
+	[VK_SYSTEM_ALLOCATION_SCOPE_DEVICE] = "device",
+	[VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE] = "instance",
+};
+
+static struct scope_counts scope_counts[SCOPE_COUNT];
+static _Thread_local uint64_t thread_allocation_count = 0;
+
+/* Sits right before every block, which starts offset bytes into its memory */
+struct block_header {
+	size_t size;
+	size_t offset;
+	VkSystemAllocationScope scope;
+};
+
+static void add_bytes(atomic_size_t *bytes, atomic_size_t *peak_bytes,
+                      size_t size)
+{
+	size_t now = atomic_fetch_add(bytes, size) + size;
+	size_t peak = atomic_load(peak_bytes);
+	while (now > peak
+	       && !atomic_compare_exchange_weak(peak_bytes, &peak, now)) {
+	}
+}
+
+static struct block_header *header_of(void *memory)
+{
+	return (struct block_header *) memory - 1;
+}
+
+static void *VKAPI_CALL allocate(void *user_data,
+                                 size_t size,
+                                 size_t alignment,
+                                 VkSystemAllocationScope scope)
+{
+	(void) user_data;
+
+	if (alignment < _Alignof(struct block_header)) {
+		alignment = _Alignof(struct block_header);
+	}
+	size_t offset = (sizeof(struct block_header) + alignment - 1)
+	                / alignment * alignment;
+	void *base;
+	if (posix_memalign(&base, alignment, offset + size) != 0) {
+		return NULL;
+	}
+
+	void *memory = (char *) base + offset;
+	struct block_header *header = header_of(memory);
+	header->size = size;
+	header->offset = offset;
+	header->scope = scope;
+
+	struct scope_counts *counts = &scope_counts[scope];
+	add_bytes(&counts->bytes, &counts->peak_bytes, size);
+	atomic_fetch_add(&counts->allocations, 1);
+	++thread_allocation_count;
+	return memory;
+}
+
+static void VKAPI_CALL release(void *user_data, void *memory)
+{
+	(void) user_data;
+
+	if (memory == NULL) {
+		return;
+	}
+	struct block_header *header = header_of(memory);
+	atomic_fetch_sub(&scope_counts[header->scope].bytes, header->size);
+	free((char *) memory - header->offset);
+}
+
+static void *VKAPI_CALL reallocate(void *user_data,
+                                   void *original,
+                                   size_t size,
+                                   size_t alignment,
+                                   VkSystemAllocationScope scope)
+{
+	if (original == NULL) {
+		return allocate(user_data, size, alignment, scope);
+	}
+	if (size == 0) {
+		release(user_data, original);
+		return NULL;
+	}
+
+	/* A new block keeps the alignment and the counts simple */
+	void *memory = allocate(user_data, size, alignment, scope);
+	if (memory == NULL) {
+		return NULL;
+	}
+	size_t original_size = header_of(original)->size;
+	memcpy(memory, original, original_size < size ? original_size : size);
+	release(user_data, original);
+	return memory;
+}
+
+static void VKAPI_CALL internal_allocation(void *user_data,
+                                           size_t size,
+                                           VkInternalAllocationType type,
+                                           VkSystemAllocationScope scope)
+{
+	(void) user_data;
+	(void) type;
+
+	struct scope_counts *counts = &scope_counts[scope];
+	add_bytes(&counts->internal_bytes, &counts->internal_peak_bytes, size);
+}
+
+static void VKAPI_CALL internal_free(void *user_data,
+                                     size_t size,
+                                     VkInternalAllocationType type,
+                                     VkSystemAllocationScope scope)
+{
+	(void) user_data;
+	(void) type;
+
+	atomic_fetch_sub(&scope_counts[scope].internal_bytes, size);
+}
+
+const VkAllocationCallbacks host_allocator = {
+	.pUserData = NULL,
+	.pfnAllocation = allocate,
+	.pfnReallocation = reallocate,
+	.pfnFree = release,
+	.pfnInternalAllocation = internal_allocation,
+	.pfnInternalFree = internal_free,
+};
+
+uint64_t host_memory_thread_allocation_count(void)
+{
+	return thread_allocation_count;
+}
+
+size_t host_memory_live_bytes(void)
+{
+	size_t bytes = 0;
+	for (uint32_t i = 0; i < ARRAY_SIZE(scope_counts); ++i) {
+		bytes += atomic_load(&scope_counts[i].bytes);
+	}
+	return bytes;
+}
+
+void host_memory_print_report(void)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(scope_counts); ++i) {
+		struct scope_counts *counts = &scope_counts[i];
+		printf("report vulkan_%s_peak_bytes %zu\n", scope_names[i],
+		       atomic_load(&counts->peak_bytes));
+		printf("report vulkan_%s_internal_peak_bytes %zu\n",
+		       scope_names[i], atomic_load(&counts->internal_peak_bytes));
+		printf("report vulkan_%s_allocations %llu\n", scope_names[i],
+		       (unsigned long long) atomic_load(&counts->allocations));
+	}
+}
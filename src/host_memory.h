@@ -0,0 +1,45 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_HOST_MEMORY_H
+#define HELLO_VULKAN_HOST_MEMORY_H
+
+#include <vulkan/vulkan.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation callbacks passed to every vkCreate, vkAllocateMemory, vkDestroy
+ * and vkFreeMemory, counting the host memory the implementation takes by
+ * VkSystemAllocationScope. They are called from any thread, so the counts are
+ * atomic.
+ */
+extern const VkAllocationCallbacks host_allocator;
+
+/*
+ * Allocations and reallocations so far made on the calling thread, of every
+ * scope, so a thread can tell what its own calls cost
+ */
+uint64_t host_memory_thread_allocation_count(void);
+
+/* Bytes allocated through the callbacks and not yet freed, of every scope */
+size_t host_memory_live_bytes(void);
+
+/* "report vulkan_<scope>_..." lines, peak bytes and allocations per scope */
+void host_memory_print_report(void);
+
+#endif
@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+} frame;
+
+// The bindless storage buffer capacity
+layout(constant_id = 0) const uint BUFFER_COUNT = 1;
+
+// Bounding spheres, center in xyz and radius in w
+layout(set = 1, binding = 0) readonly buffer Objects {
+	vec4 spheres[];
+} buffers[BUFFER_COUNT];
+
+// The bindless index of the bounding spheres
+layout(push_constant) uniform Draw {
+	uint objects;
+} draw;
+
+layout(location = 0) out vec3 fragColor;
+// For lighting, triangles face the viewer
+layout(location = 1) out vec3 fragPosition;
+layout(location = 2) out vec3 fragNormal;
+
+vec2 positions[3] = vec2[](
+	vec2(0.0, -0.5),
+	vec2(0.5, 0.5),
+	vec2(-0.5, 0.5)
+);
+
+vec3 colors[3] = vec3[](
+	vec3(1.0, 0.0, 0.0),
+	vec3(0.0, 1.0, 0.0),
+	vec3(0.0, 0.0, 1.0)
+);
+
+void main() {
+	// The culling pass sets firstInstance to the object index
+	vec4 object = buffers[draw.objects].spheres[gl_InstanceIndex];
+	vec2 position = positions[gl_VertexIndex] * object.w * sqrt(2.0);
+	fragPosition = vec3(position + object.xy, object.z);
+	gl_Position = frame.view_projection * vec4(fragPosition, 1.0);
+	fragColor = colors[gl_VertexIndex];
+	fragNormal = vec3(0.0, 0.0, -1.0);
+}
@@ -0,0 +1,54 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+	uint lights;
+	uint light_count;
+} frame;
+
+// The bindless storage buffer capacity
+layout(constant_id = 0) const uint BUFFER_COUNT = 1;
+
+// Position and radius, then color and intensity
+struct Light {
+	vec4 position_radius;
+	vec4 color_intensity;
+};
+
+layout(set = 1, binding = 0) readonly buffer Lights {
+	Light lights[];
+} buffers[BUFFER_COUNT];
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragPosition;
+layout(location = 2) in vec3 fragNormal;
+
+layout(location = 0) out vec4 outColor;
+
+// The same lighting as deferred_light.frag, for every fragment drawn
+vec3 shade(vec3 albedo, vec3 position, vec3 normal) {
+	vec3 color = 0.05 * albedo;
+	for (uint i = 0; i < frame.light_count; ++i) {
+		Light light = buffers[frame.lights].lights[i];
+		vec3 to_light = light.position_radius.xyz - position;
+		float radius = light.position_radius.w;
+		float distance_squared = dot(to_light, to_light);
+		if (distance_squared >= radius * radius) {
+			continue;
+		}
+		float falloff = 1.0 - distance_squared / (radius * radius);
+		float diffuse = max(dot(normal, normalize(to_light)), 0.0);
+		color += albedo * light.color_intensity.rgb
+		         * light.color_intensity.w * diffuse * falloff * falloff;
+	}
+	return color;
+}
+
+void main() {
+	outColor = vec4(shade(fragColor, fragPosition, normalize(fragNormal)),
+	                1.0);
+}
@@ -14,12 +14,35 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "error.h"
-#include "mmap.h"
-
 #define VK_USE_PLATFORM_WAYLAND_KHR
 #include <vulkan/vulkan.h>
 
+#include "arena.h"
+#include "bindless.h"
+#include "capture.h"
+#include "command_stream.h"
+#include "cpu_cull.h"
+#include "deferred.h"
+#include "draw_sort.h"
+#include "error.h"
+#include "frustum.h"
+#include "gbuffer.h"
+#include "gpu.h"
+#include "gpu_cull.h"
+#include "gpu_mesh.h"
+#include "gpu_statistics.h"
+#include "gpu_timer.h"
+#include "host_memory.h"
+#include "pack.h"
+#include "particles.h"
+#include "pipeline_compiler.h"
+#include "post.h"
+#include "scene.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+#include "uniform_ring.h"
+
 #include <wayland-client.h>
 #include "xdg-shell-client-protocol.h"
 
@@ -27,52 +50,494 @@
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 #endif
 
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 480
+#define TRACE_CAPACITY 65536
+#define MAX_STARTUP_PHASES 32
+#define MAX_PIPELINE_VARIANTS 16
+#define ASSET_PACK_FILENAME "assets.pack"
+/* Plus the draw items, which grow with the scene */
+#define SETUP_ARENA_SIZE (128 * 1024)
+/* Upper bounds with VK_EXT_descriptor_indexing, below the device limits */
+#define BINDLESS_MAX_STORAGE_BUFFERS 1024
+#define BINDLESS_MAX_SAMPLED_IMAGES 4096
+/* Without it, every descriptor is written, so keep the arrays small */
+#define BINDLESS_FALLBACK_CAPACITY 16
+/*
+ * Objects one swapchain generation retires, for the deferred queue to hold
+ * them all up front: per image a view, framebuffers and a semaphore, per
+ * window the swapchain, a semaphore and the depth, post and G-buffer
+ * targets, and the command pool, query pools and uniform ring's once.
+ */
+#define DEFERRED_PER_IMAGE 4
+#define DEFERRED_PER_WINDOW 48
+#define DEFERRED_PER_GENERATION 8
+#define MAX_WINDOWS 4
+/* Sizes the per window semaphore arrays, more is refused */
+#define MAX_SWAPCHAIN_IMAGES 8
+/* Of each post processing chain, timed together */
+#define POST_BENCHMARK_ITERATIONS 16
+/* For --deferred without --lights */
+#define DEFAULT_LIGHT_COUNT 64
+#define DEFAULT_CULL_BENCHMARK_OBJECTS (1024 * 1024)
+#define DEFAULT_OVERDRAW_BENCHMARK_OBJECTS 256
+#define CULL_BENCHMARK_PASSES 64
+/* Seconds simulated per frame, whatever the frame rate */
+#define PARTICLE_TIME_STEP (1.0f / 60.0f)
+/* Configures --resize-storm sends per frame, at most */
+#define RESIZE_STORM_MAX_BURST 4
+#define RESIZE_STORM_SEED 1
 
 static bool running = true;
 static bool resize = false;
 
+static struct scene scene = {
+	.objects = NULL,
+	.object_count = 0,
+	.lights = NULL,
+	.light_count = 0,
+};
+
+struct options {
+	bool depth;
+	uint32_t object_count;
+	/* Benchmarks only pick their own count without --objects */
+	bool objects_given;
+	bool overdraw_benchmark;
+	bool gpu_culling;
+	bool cpu_culling;
+	bool cull_benchmark;
+	const char *trace_filename;
+	bool headless;
+	uint32_t frame_count;
+	uint32_t resize_interval;
+	uint32_t resize_storm;
+	bool report;
+	bool pipeline_library;
+	uint32_t mmap_hints;
+	const char *mesh_name;
+	const char *capture_filename;
+	uint32_t capture_interval;
+	uint32_t window_count;
+	enum post_mode post_mode;
+	bool post_benchmark;
+	uint32_t light_count;
+	bool deferred;
+	bool vertex_pulling;
+	uint32_t particle_count;
+	const char *stream_filename;
+};
+
+static struct options options = {
+	.depth = false,
+	.object_count = 1,
+	.objects_given = false,
+	.overdraw_benchmark = false,
+	.gpu_culling = false,
+	.cpu_culling = false,
+	.cull_benchmark = false,
+	.trace_filename = NULL,
+	.headless = false,
+	.frame_count = 0,
+	.resize_interval = 0,
+	.resize_storm = 0,
+	.report = false,
+	.pipeline_library = true,
+	.mmap_hints = MMAP_HINT_WILLNEED | MMAP_HINT_HUGE_PAGES
+	              | MMAP_HINT_READAHEAD_THREAD,
+	.mesh_name = NULL,
+	.capture_filename = NULL,
+	.capture_interval = 1,
+	.window_count = 1,
+	.post_mode = POST_MODE_NONE,
+	.post_benchmark = false,
+	.light_count = 0,
+	.deferred = false,
+	.vertex_pulling = false,
+	.particle_count = 0,
+	.stream_filename = NULL,
+};
+
+/* Frame loop measurements for --report */
+static uint64_t start_ns = 0;
+static uint64_t first_frame_ns = 0;
+static uint64_t last_frame_ns = 0;
+static uint32_t frames_drawn = 0;
+static struct stats frame_times = {
+	.samples = NULL,
+	.count = 0,
+	.capacity = 0,
+};
+/* Per frame pipeline statistics, indexed by enum gpu_statistic */
+static struct stats frame_statistics[GPU_STATISTIC_COUNT];
+/* GPU milliseconds per frame of the particle passes, with --particles */
+static struct stats particle_simulate_times = {
+	.samples = NULL,
+	.count = 0,
+	.capacity = 0,
+};
+static struct stats particle_sort_times = {
+	.samples = NULL,
+	.count = 0,
+	.capacity = 0,
+};
+/*
+ * Swapchain recreations after the first frame, each timed from the first
+ * configure it builds to the first frame presented at that size. Configures
+ * replaced by a later one before a recreation are coalesced, and frames
+ * dropped are the ones an out of date swapchain kept from being presented.
+ */
+static uint32_t resize_configures = 0;
+static uint32_t pending_configures = 0;
+static uint32_t coalesced_configures = 0;
+static uint32_t resize_swapchains = 0;
+static uint32_t dropped_frames = 0;
+static uint64_t configure_ns = 0;
+static bool resize_timing = false;
+static struct stats resize_times = {
+	.samples = NULL,
+	.count = 0,
+	.capacity = 0,
+};
+/* Memory when the first configure came and once the last frame was drawn */
+static long resize_begin_rss_kb = 0;
+static long resize_end_rss_kb = 0;
+static size_t resize_begin_vulkan_bytes = 0;
+static size_t resize_end_vulkan_bytes = 0;
+/* What --resize-storm has left to send */
+static uint32_t storm_remaining = 0;
+static uint32_t storm_state = RESIZE_STORM_SEED;
+
+/* Vulkan host allocations the main thread made after the first frame */
+static uint64_t first_frame_allocations = 0;
+static uint64_t frame_allocations = 0;
+static uint64_t last_allocations = 0;
+
+/* Arrays that only live through setup and swapchain recreation */
+static struct arena setup_arena = {
+	.data = NULL,
+	.capacity = 0,
+	.used = 0,
+	.peak = 0,
+};
+
+/* Everything up to the first frame, recorded from any thread */
+struct startup_phase {
+	const char *name;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+};
+
+static struct startup_phase startup_phases[MAX_STARTUP_PHASES];
+static atomic_uint startup_phase_count = 0;
+
+static struct trace_zone begin_phase(const char *name)
+{
+	struct trace_zone zone = {
+		.name = name,
+		.begin_ns = trace_now_ns(),
+	};
+	return zone;
+}
+
+static void end_phase(const struct trace_zone *zone)
+{
+	trace_end(zone);
+	/* Swapchain recreation goes through the same phases later on */
+	if (frames_drawn > 0) {
+		return;
+	}
+	uint32_t index = atomic_fetch_add(&startup_phase_count, 1);
+	if (index < MAX_STARTUP_PHASES) {
+		startup_phases[index].name = zone->name;
+		startup_phases[index].begin_ns = zone->begin_ns;
+		startup_phases[index].end_ns = trace_now_ns();
+	}
+}
+
+/* Startup work that can overlap with the main thread's */
+struct task {
+	uint8_t (*function)(void);
+	uint8_t err;
+	bool threaded;
+	pthread_t thread;
+};
+
+static void *run_task(void *data)
+{
+	struct task *task = data;
+	task->err = task->function();
+	return NULL;
+}
+
+/* Runs the function right away when no thread can be had */
+static void task_start(struct task *task, uint8_t (*function)(void))
+{
+	task->function = function;
+	task->err = NO_ERRORS;
+	task->threaded = pthread_create(&task->thread, NULL,
+	                                run_task, task) == 0;
+	if (!task->threaded) {
+		run_task(task);
+	}
+}
+
+static uint8_t task_join(struct task *task)
+{
+	if (task->threaded) {
+		pthread_join(task->thread, NULL);
+		task->threaded = false;
+	}
+	return task->err;
+}
+
+static struct gpu_cull gpu_cull;
+/* Culls before draws are recorded with --cpu-culling */
+static struct cpu_cull cpu_cull;
+/* The bindless index of the culled bounding spheres */
+static uint32_t gpu_cull_objects = 0;
+/* Every storage buffer and sampled image the graphics pipelines read */
+static struct bindless bindless;
+/* The scene's lights, in the bindless set at light_buffer_index */
+static struct gpu_buffer light_buffer = {
+	.buffer = VK_NULL_HANDLE,
+	.memory = VK_NULL_HANDLE,
+	.size = 0,
+	.mapped = NULL,
+};
+static uint32_t light_buffer_index = 0;
+
+/* Every submit signals the next value */
+static struct timeline timeline = {
+	.semaphore = VK_NULL_HANDLE,
+	.submitted = 0,
+	.completed = 0,
+	.wait_semaphores = NULL,
+	.get_semaphore_counter_value = NULL,
+};
+/* Per swapchain objects, destroyed once their last frame is done */
+/* Swapchain images streamed to --capture */
+static struct capture capture;
+
+static struct deferred deferred = {
+	.objects = NULL,
+	.count = 0,
+	.capacity = 0,
+};
+
+/* Hands a handle over to be destroyed after the last submit so far */
+static uint8_t retire(enum deferred_type type, union deferred_handle handle)
+{
+	return deferred_push(&deferred, type, handle, timeline.submitted);
+}
+
+/*
+ * With a resize every frame, a generation's semaphores outlive the frames
+ * of up to 2 * MAX_SWAPCHAIN_IMAGES + 1 later ones, and it has to fit too.
+ */
+static uint32_t deferred_capacity(void)
+{
+	uint32_t per_window = DEFERRED_PER_WINDOW
+	                      + DEFERRED_PER_IMAGE * MAX_SWAPCHAIN_IMAGES;
+	return (2 * MAX_SWAPCHAIN_IMAGES + 2)
+	       * (DEFERRED_PER_GENERATION + options.window_count * per_window);
+}
+/* Drawn for every object with --mesh, instead of the built in triangle */
+static struct gpu_mesh gpu_mesh;
+/* The bindless index of its vertices with --vertex-pulling */
+static uint32_t gpu_mesh_vertices = 0;
+
+/*
+ * With --record-stream, resources are added to the stream as they are
+ * created, and the first window's first image is captured the first time
+ * its command buffer is recorded. Null otherwise.
+ */
+static struct command_stream command_stream;
+static struct command_stream *stream = NULL;
+static bool stream_captured = false;
+/* The stream's copies of the --mesh buffers */
+static uint32_t stream_vertex_buffer = 0;
+static uint32_t stream_index_buffer = 0;
+
+/* Created once per device, ahead of the first swapchain */
+struct graphics {
+	VkShaderModule vert_shader_module;
+	VkShaderModule frag_shader_module;
+	VkPipelineLayout pipeline_layout;
+	VkRenderPass render_pass;
+	uint32_t variant;
+};
+
+static struct graphics graphics = {
+	.vert_shader_module = VK_NULL_HANDLE,
+	.frag_shader_module = VK_NULL_HANDLE,
+	.pipeline_layout = VK_NULL_HANDLE,
+	.render_pass = VK_NULL_HANDLE,
+	.variant = 0,
+};
+
+static struct pipeline_compiler pipeline_compiler;
+/* Bloom, tonemap and sharpen of the scene with --post-process */
+static struct post post;
+/* The lighting subpass with --deferred */
+static struct gbuffer gbuffer;
+static struct particles particles;
+/* The bindless index of the particles' state buffer */
+static uint32_t particle_state_index = 0;
+
+/* Every shader, mapped once at startup */
+static struct pack assets = {
+	.map = {
+		.data = NULL,
+		.data_size = 0,
+		.faults = {
+			.major = 0,
+			.minor = 0,
+		},
+		.readahead = false,
+	},
+	.entries = NULL,
+	.entry_count = 0,
+};
+
+/* Timestamps in every command buffer, while tracing or timing particles */
+enum gpu_timer_point {
+	GPU_TIMER_BEGIN,
+	GPU_TIMER_CULLED,
+	GPU_TIMER_PARTICLES_SIMULATED,
+	GPU_TIMER_PARTICLES_SORTED,
+	GPU_TIMER_RENDERED,
+	GPU_TIMER_END,
+	GPU_TIMER_POINT_COUNT,
+};
+
+static struct gpu_timer gpu_timer = {
+	.query_pool = VK_NULL_HANDLE,
+};
+
+/* Culling and the render pass of every command buffer, only for --report */
+static struct gpu_statistics gpu_statistics = {
+	.query_pool = VK_NULL_HANDLE,
+	.slot_count = 0,
+	.submitted = NULL,
+};
+
+/* The scene is already in clip space, so the view-projection is identity */
+static const float view_projection[16] = {
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 0.0f, 1.0f,
+};
+
+/*
+ * The std140 layout of the Frame block. Lights are a bindless storage
+ * buffer index, and only the deferred lighting needs the inverse.
+ */
+struct frame_uniforms {
+	float view_projection[16];
+	float time;
+	uint32_t index;
+	uint32_t lights;
+	uint32_t light_count;
+	float inverse_view_projection[16];
+};
+
+static void frame_uniforms_init(struct frame_uniforms *uniforms,
+                                float time,
+                                uint32_t index)
+{
+	memset(uniforms, 0, sizeof(*uniforms));
+	memcpy(uniforms->view_projection, view_projection,
+	       sizeof(uniforms->view_projection));
+	uniforms->time = time;
+	uniforms->index = index;
+	uniforms->lights = light_buffer_index;
+	uniforms->light_count = scene.light_count;
+	/* The identity is its own inverse */
+	memcpy(uniforms->inverse_view_projection, view_projection,
+	       sizeof(uniforms->inverse_view_projection));
+}
+
+/*
+ * A slot per command buffer. Since those are recorded once per swapchain
+ * image, the slot of a frame is its image index.
+ */
+static struct uniform_ring uniform_ring = {
+	.descriptor_set_layout = VK_NULL_HANDLE,
+	.descriptor_pool = VK_NULL_HANDLE,
+	.descriptor_set = VK_NULL_HANDLE,
+	.buffer = {
+		.buffer = VK_NULL_HANDLE,
+		.memory = VK_NULL_HANDLE,
+		.size = 0,
+		.mapped = NULL,
+	},
+	.element_size = 0,
+	.stride = 0,
+	.slot_count = 0,
+};
+
 static VkQueue queue;
 
 struct vulkan {
 	VkInstance instance;
-	VkSurfaceKHR surface;
 	VkPhysicalDevice *physical_devices;
 	uint32_t physical_device_count;
+	VkPhysicalDevice physical_device;
 	VkDevice device;
-	VkSwapchainKHR swapchain;
+
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	VkPhysicalDeviceFeatures enabled_features;
 
 	uint32_t graphics_queue_family_index;
-	uint32_t min_image_count;
-	VkSurfaceTransformFlagBitsKHR current_transform;
 
-	VkExtent2D swapchain_image_extent;
 	VkFormat swapchain_image_format;
 	VkColorSpaceKHR swapchain_image_color_space;
+	VkFormat depth_format;
+	bool draw_indirect_count;
+	bool graphics_pipeline_library;
+	float timestamp_period;
+	uint32_t timestamp_valid_bits;
+	VkDeviceSize min_uniform_buffer_offset_alignment;
+	bool descriptor_indexing;
+	uint32_t bindless_capacities[BINDLESS_BINDING_COUNT];
+	/* What every window's swapchain images can be used for */
+	VkImageUsageFlags swapchain_supported_usage;
+	bool post_storage_output;
 };
 
 static struct vulkan vulkan = {
 	.instance = VK_NULL_HANDLE,
-	.surface = VK_NULL_HANDLE,
 	.physical_devices = NULL,
 	.physical_device_count = 0,
+	.physical_device = VK_NULL_HANDLE,
 	.device = VK_NULL_HANDLE,
-	.swapchain = VK_NULL_HANDLE,
 
 	.graphics_queue_family_index = 0,
 
-	.swapchain_image_extent = {
-		.width = DEFAULT_WIDTH,
-		.height = DEFAULT_HEIGHT
-	},
 	.swapchain_image_format = VK_FORMAT_B8G8R8A8_UNORM,
 	.swapchain_image_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+	.depth_format = VK_FORMAT_UNDEFINED,
+	.draw_indirect_count = false,
+	.timestamp_period = 1.0f,
+	.timestamp_valid_bits = 0,
+	.min_uniform_buffer_offset_alignment = 1,
+	.descriptor_indexing = false,
+	.bindless_capacities = {0, 0},
+	.graphics_pipeline_library = false,
+	.swapchain_supported_usage = 0,
+	.post_storage_output = false,
 };
 
 struct wayland {
@@ -80,9 +545,6 @@ struct wayland {
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
 	struct zxdg_shell_v6 *shell;
-	struct wl_surface *surface;
-	struct zxdg_surface_v6 *shell_surface;
-	struct zxdg_toplevel_v6 *toplevel;
 	struct wl_seat *seat;
 	struct wl_keyboard *keyboard;
 };
@@ -92,110 +554,881 @@ static struct wayland wayland = {
 	.registry = NULL,
 	.compositor = NULL,
 	.shell = NULL,
-	.surface = NULL,
-	.shell_surface = NULL,
-	.toplevel = NULL,
 	.seat = NULL,
 	.keyboard = NULL,
 };
 
-int print_result(VkResult result)
-{
-	const char *msg;
-#define PRINT_RESULT_CASE(x) \
-case x: \
-	msg = #x "\n"; \
-	return (size_t) printf("%s", msg) == strlen(msg) ? 0 : LIBC_ERROR_BIT;
-
-	switch (result) {
-	PRINT_RESULT_CASE(VK_ERROR_VALIDATION_FAILED_EXT)
-	PRINT_RESULT_CASE(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR)
-	PRINT_RESULT_CASE(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR)
-	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_DATE_KHR)
-	PRINT_RESULT_CASE(VK_ERROR_SURFACE_LOST_KHR)
-	PRINT_RESULT_CASE(VK_ERROR_FORMAT_NOT_SUPPORTED)
-	PRINT_RESULT_CASE(VK_ERROR_TOO_MANY_OBJECTS)
-	PRINT_RESULT_CASE(VK_ERROR_INCOMPATIBLE_DRIVER)
-	PRINT_RESULT_CASE(VK_ERROR_LAYER_NOT_PRESENT)
-	PRINT_RESULT_CASE(VK_ERROR_FEATURE_NOT_PRESENT)
-	PRINT_RESULT_CASE(VK_ERROR_EXTENSION_NOT_PRESENT)
-	PRINT_RESULT_CASE(VK_ERROR_DEVICE_LOST)
-	PRINT_RESULT_CASE(VK_ERROR_MEMORY_MAP_FAILED)
-	PRINT_RESULT_CASE(VK_ERROR_INITIALIZATION_FAILED)
-	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_DEVICE_MEMORY)
-	PRINT_RESULT_CASE(VK_ERROR_OUT_OF_HOST_MEMORY)
-	PRINT_RESULT_CASE(VK_SUCCESS)
-	PRINT_RESULT_CASE(VK_NOT_READY)
-	PRINT_RESULT_CASE(VK_TIMEOUT)
-	PRINT_RESULT_CASE(VK_EVENT_SET)
-	PRINT_RESULT_CASE(VK_EVENT_RESET)
-	PRINT_RESULT_CASE(VK_INCOMPLETE)
-	PRINT_RESULT_CASE(VK_SUBOPTIMAL_KHR)
-#undef PRINT_RESULT_CASE
-	default:
-		return APP_ERROR_BIT;
+/*
+ * A surface with its own swapchain. One device draws every window, with a
+ * single submit and a single present for all of them per frame. Recreating
+ * the swapchains recreates every window's at once, and the generation
+ * arrays point into the setup arena until then.
+ */
+struct window {
+	/* Null when headless */
+	struct wl_surface *surface;
+	struct zxdg_surface_v6 *shell_surface;
+	struct zxdg_toplevel_v6 *toplevel;
+	bool configured;
+
+	VkSurfaceKHR surface_khr;
+	VkSwapchainKHR swapchain_khr;
+	VkExtent2D extent;
+	/* The latest configured size, built when the swapchain is next */
+	VkExtent2D pending_extent;
+	uint32_t min_image_count;
+	VkSurfaceTransformFlagBitsKHR current_transform;
+
+	uint32_t image_count;
+	VkImage *images;
+	VkImageView *image_views;
+	struct gpu_image depth_image;
+	/* The scene draws into its HDR image with --post-process */
+	struct post_target post_target;
+	/* Shares the depth image with --deferred */
+	struct gbuffer_target gbuffer_target;
+	VkFramebuffer *framebuffers;
+	/* Its command buffers and ring slots follow the earlier windows' */
+	uint32_t first_slot;
+	VkSemaphore image_available_semaphore;
+	/*
+	 * One per image, since a present waits on it until that image is
+	 * acquired again, which the timeline knows nothing about
+	 */
+	VkSemaphore render_finished_semaphores[MAX_SWAPCHAIN_IMAGES];
+	uint32_t render_finished_semaphore_count;
+	/* The last swapchain and semaphores, until presents are past them */
+	VkSwapchainKHR retired_swapchain;
+	VkSemaphore retired_semaphores[MAX_SWAPCHAIN_IMAGES];
+	uint32_t retired_semaphore_count;
+};
+
+/* Extents are set from --windows before any is used */
+static struct window windows[MAX_WINDOWS];
+
+/* Resident now, unlike getrusage's peak, or 0 without /proc */
+static long current_rss_kb(void)
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	long size;
+	long resident;
+	int count = fscanf(file, "%ld %ld", &size, &resident);
+	fclose(file);
+	if (count != 2) {
+		return 0;
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * Every configure comes here, from the compositor or from --resize-storm. It
+ * only records the size, so however many arrive before the swapchains are
+ * recreated, only the latest is built.
+ */
+static void configure_window(struct window *window,
+                             uint32_t width,
+                             uint32_t height)
+{
+	if (width == window->pending_extent.width
+	    && height == window->pending_extent.height) {
+		return;
+	}
+	window->pending_extent.width = width;
+	window->pending_extent.height = height;
+	resize = true;
+
+	/* The first swapchains are not recreations */
+	if (frames_drawn == 0) {
+		return;
 	}
+	if (resize_configures == 0) {
+		resize_begin_rss_kb = current_rss_kb();
+		resize_begin_vulkan_bytes = host_memory_live_bytes();
+	}
+	if (pending_configures == 0) {
+		configure_ns = trace_now_ns();
+	}
+	++pending_configures;
+	++resize_configures;
 }
 
+/* Takes each window's latest configured extent for its next swapchain */
+static void apply_configures(void)
+{
+	uint32_t built = 0;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		if (window->extent.width != window->pending_extent.width
+		    || window->extent.height != window->pending_extent.height) {
+			window->extent = window->pending_extent;
+			++built;
+		}
+	}
+	if (pending_configures == 0) {
+		return;
+	}
+	coalesced_configures += pending_configures > built
+	                        ? pending_configures - built
+	                        : 0;
+	pending_configures = 0;
+	++resize_swapchains;
+	resize_timing = true;
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/*
+ * Sends what a compositor would during a drag: a burst of configures each
+ * frame, to sizes from half to twice the default, until --resize-storm are
+ * sent
+ */
+static void send_storm_configures(void)
+{
+	uint32_t burst = 1 + xorshift32(&storm_state) % RESIZE_STORM_MAX_BURST;
+	for (uint32_t i = 0; i < burst && storm_remaining > 0; ++i) {
+		uint32_t w = xorshift32(&storm_state) % options.window_count;
+		uint32_t width = DEFAULT_WIDTH / 2
+		                 + xorshift32(&storm_state)
+		                   % (DEFAULT_WIDTH * 3 / 2 + 1);
+		uint32_t height = DEFAULT_HEIGHT / 2
+		                  + xorshift32(&storm_state)
+		                    % (DEFAULT_HEIGHT * 3 / 2 + 1);
+		configure_window(&windows[w], width, height);
+		--storm_remaining;
+	}
+}
+
+/* What each command buffer was recorded with, to record it again */
+struct recording {
+	VkRenderPass render_pass;
+	VkPipelineLayout pipeline_layout;
+	const struct draw_item *items;
+	uint32_t item_count;
+	VkPipeline *pipelines;
+};
+
+static uint8_t record_command_buffer(
+	VkCommandBuffer command_buffer,
+	VkRenderPass render_pass,
+	const struct window *window,
+	uint32_t image_index,
+	VkPipeline graphics_pipeline,
+	VkPipelineLayout pipeline_layout,
+	const struct draw_item *items,
+	uint32_t item_count,
+	VkQueryPool query_pool,
+	uint32_t query,
+	uint32_t slot);
+
+/*
+ * Each command buffer has the timeline value of its last submit, null in
+ * one-shot use, that guards reusing it and reading back the GPU timestamps it
+ * wrote last time. Once that value is reached, a command buffer still drawing
+ * with the fast linked pipeline is recorded again with the optimized one.
+ * Every window acquires its next image, then all of them go in one submit
+ * and one present. A swapchain out of date leaves its window out of the
+ * batch, counts the frame as dropped with presented false and asks for a
+ * resize; the images the other windows acquired are still presented.
+ */
 static uint8_t draw_frame(
 	VkDevice device,
 	VkCommandBuffer *command_buffers,
-	VkSemaphore image_available_semaphore,
-	VkSemaphore render_finished_semaphore)
+	uint64_t *last_submits,
+	struct recording *recording,
+	bool *presented)
 {
+	struct trace_zone frame_zone = trace_begin("draw_frame");
+
 	VkResult result;
-	uint32_t image_index;
-	// TODO: swapchain_khr
-	result = vkAcquireNextImageKHR(device, vulkan.swapchain, UINT64_MAX,
-	                               image_available_semaphore,
-	                               VK_NULL_HANDLE, &image_index);
-	if (result != VK_SUCCESS) {
-		uint8_t ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
+	uint32_t image_indices[MAX_WINDOWS];
+	uint32_t slots[MAX_WINDOWS];
+	VkSemaphore wait_semaphores[MAX_WINDOWS];
+	VkPipelineStageFlags wait_stages[MAX_WINDOWS];
+	/* Binary semaphores ignore their values */
+	uint64_t wait_values[MAX_WINDOWS];
+	VkSemaphore signal_semaphores[MAX_WINDOWS + 1];
+	uint64_t signal_values[MAX_WINDOWS + 1];
+	VkCommandBuffer submit_command_buffers[MAX_WINDOWS + 1];
+	uint32_t submit_command_buffer_count = 0;
+	VkSwapchainKHR swapchains[MAX_WINDOWS];
+	VkResult present_results[MAX_WINDOWS];
+	uint64_t submit_value = timeline.submitted + 1;
+	/* Windows in this frame's submit and present */
+	uint32_t count = 0;
+	bool dropped = false;
+
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		uint32_t image_index;
+		struct trace_zone acquire_zone = trace_begin("acquire");
+		result = vkAcquireNextImageKHR(device, window->swapchain_khr,
+		                               UINT64_MAX,
+		                               window->image_available_semaphore,
+		                               VK_NULL_HANDLE, &image_index);
+		trace_end(&acquire_zone);
+		/* Nothing was acquired, the semaphore stays unsignaled */
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			dropped = true;
+			resize = true;
+			continue;
+		}
+		if (result == VK_SUBOPTIMAL_KHR) {
+			resize = true;
+		}
+		else if (result != VK_SUCCESS) {
+			uint8_t ret = VULKAN_ERROR_BIT;
+			ret |= print_result(result);
+			return ret;
+		}
+		uint32_t slot = window->first_slot + image_index;
+
+		if (last_submits != NULL) {
+			struct trace_zone wait_zone
+				= trace_begin("wait_timeline");
+			uint8_t ret = timeline_wait(&timeline, device,
+			                            last_submits[slot]);
+			trace_end(&wait_zone);
+			if (ret != 0) {
+				return ret;
+			}
+
+			const char *const zone_names[GPU_TIMER_POINT_COUNT - 1] = {
+				[GPU_TIMER_BEGIN] = options.gpu_culling ? "cull"
+				                                        : NULL,
+				[GPU_TIMER_CULLED] = options.particle_count != 0
+				                     ? "particle_simulate"
+				                     : NULL,
+				[GPU_TIMER_PARTICLES_SIMULATED]
+					= options.particle_count != 0
+					  ? "particle_sort"
+					  : NULL,
+				[GPU_TIMER_PARTICLES_SORTED] = "render_pass",
+				[GPU_TIMER_RENDERED]
+					= options.post_mode != POST_MODE_NONE
+					  ? "post_process"
+					  : NULL,
+			};
+			/* Only the first window's frames run the particles */
+			double zone_ms[GPU_TIMER_POINT_COUNT - 1];
+			if (gpu_timer_collect(&gpu_timer, device, slot,
+			                      zone_names, zone_ms)
+			    && w == 0) {
+				stats_add(&particle_simulate_times,
+				          zone_ms[GPU_TIMER_CULLED]);
+				stats_add(&particle_sort_times,
+				          zone_ms[GPU_TIMER_PARTICLES_SIMULATED]);
+			}
+
+			uint64_t values[GPU_STATISTIC_COUNT];
+			if (gpu_statistics_collect(&gpu_statistics, device,
+			                           slot, values)) {
+				for (uint32_t i = 0; i < GPU_STATISTIC_COUNT;
+				     ++i) {
+					stats_add(&frame_statistics[i],
+					          (double) values[i]);
+				}
+			}
+		}
+
+		/* Nothing reads the slot once its command buffer is done */
+		struct frame_uniforms uniforms;
+		frame_uniforms_init(&uniforms,
+		                    (float) ((double) (trace_now_ns() - start_ns)
+		                             / 1e9),
+		                    frames_drawn);
+		memcpy(uniform_ring_slot(&uniform_ring, slot), &uniforms,
+		       sizeof(uniforms));
+
+		if (recording != NULL) {
+			VkPipeline pipeline = pipeline_compiler_get(
+				&pipeline_compiler,
+				graphics.variant
+			);
+			if (pipeline != recording->pipelines[slot]) {
+				struct trace_zone record_zone
+					= trace_begin("record_command_buffer");
+				uint8_t ret = record_command_buffer(
+					command_buffers[slot],
+					recording->render_pass,
+					window,
+					image_index,
+					pipeline,
+					recording->pipeline_layout,
+					recording->items,
+					recording->item_count,
+					VK_NULL_HANDLE,
+					0,
+					slot);
+				trace_end(&record_zone);
+				if (ret != 0) {
+					return ret;
+				}
+				recording->pipelines[slot] = pipeline;
+			}
+		}
+
+		image_indices[count] = image_index;
+		slots[count] = slot;
+		wait_semaphores[count] = window->image_available_semaphore;
+		wait_stages[count]
+			= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_values[count] = 0;
+		signal_semaphores[count]
+			= window->render_finished_semaphores[image_index];
+		signal_values[count] = 0;
+		submit_command_buffers[submit_command_buffer_count++]
+			= command_buffers[slot];
+		swapchains[count] = window->swapchain_khr;
+		++count;
+
+		/* Only the first window is captured, when a slot is free */
+		if (w == 0 && options.capture_filename != NULL) {
+			VkCommandBuffer capture_command_buffer;
+			uint8_t ret = capture_record(&capture, image_index,
+			                             &capture_command_buffer);
+			if (ret != 0) {
+				return ret;
+			}
+			if (capture_command_buffer != VK_NULL_HANDLE) {
+				submit_command_buffers
+				[submit_command_buffer_count++]
+					= capture_command_buffer;
+			}
+		}
 	}
 
-	VkSemaphore wait_semaphores[] = { image_available_semaphore };
-	VkPipelineStageFlags wait_stages[] = {
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-	};
-	VkSemaphore signal_semaphores[] = { render_finished_semaphore };
-	VkCommandBuffer submit_command_buffers[] = {
-		command_buffers[image_index],
+	/* Whatever the finished frames were the last to use */
+	deferred_collect(&deferred, device, timeline.completed);
+
+	if (count == 0) {
+		++dropped_frames;
+		*presented = false;
+		trace_end(&frame_zone);
+		return NO_ERRORS;
+	}
+
+	signal_semaphores[count] = timeline.semaphore;
+	signal_values[count] = submit_value;
+	VkTimelineSemaphoreSubmitInfoKHR timeline_semaphore_submit_info = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.pNext = NULL,
+		.waitSemaphoreValueCount = count,
+		.pWaitSemaphoreValues = wait_values,
+		.signalSemaphoreValueCount = count + 1,
+		.pSignalSemaphoreValues = signal_values,
 	};
 	VkSubmitInfo submit_info = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pNext = NULL,
-		.waitSemaphoreCount = ARRAY_SIZE(wait_semaphores),
+		.pNext = &timeline_semaphore_submit_info,
+		.waitSemaphoreCount = count,
 		.pWaitSemaphores = wait_semaphores,
 		.pWaitDstStageMask = wait_stages,
-		.commandBufferCount = ARRAY_SIZE(submit_command_buffers),
+		.commandBufferCount = submit_command_buffer_count,
 		.pCommandBuffers = submit_command_buffers,
-		.signalSemaphoreCount = ARRAY_SIZE(signal_semaphores),
+		.signalSemaphoreCount = count + 1,
 		.pSignalSemaphores = signal_semaphores,
 	};
 	VkSubmitInfo submits[] = { submit_info };
-	result = vkQueueSubmit(queue, ARRAY_SIZE(submits), submits, VK_NULL_HANDLE);
+	struct trace_zone submit_zone = trace_begin("submit");
+	result = vkQueueSubmit(queue, ARRAY_SIZE(submits), submits,
+	                       VK_NULL_HANDLE);
+	trace_end(&submit_zone);
 	if (result != VK_SUCCESS) {
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
+	timeline.submitted = submit_value;
+	if (last_submits != NULL) {
+		for (uint32_t i = 0; i < count; ++i) {
+			last_submits[slots[i]] = submit_value;
+		}
+	}
+	if (options.capture_filename != NULL) {
+		capture_submitted(&capture, submit_value);
+	}
 
-	// TODO: swapchain_khr
-	VkSwapchainKHR swapchains[] = { vulkan.swapchain };
 	VkPresentInfoKHR present_info = {
 		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
 		.pNext = NULL,
-		.waitSemaphoreCount = ARRAY_SIZE(signal_semaphores),
+		.waitSemaphoreCount = count,
 		.pWaitSemaphores = signal_semaphores,
-		.swapchainCount = ARRAY_SIZE(swapchains),
+		.swapchainCount = count,
 		.pSwapchains = swapchains,
-		.pImageIndices = &image_index,
-		.pResults = NULL,
+		.pImageIndices = image_indices,
+		.pResults = present_results,
 	};
 
+	struct trace_zone present_zone = trace_begin("present");
 	result = vkQueuePresentKHR(queue, &present_info);
+	trace_end(&present_zone);
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR
+	    && result != VK_ERROR_OUT_OF_DATE_KHR) {
+		uint8_t ret = VULKAN_ERROR_BIT;
+		ret |= print_result(result);
+		return ret;
+	}
+	/* The semaphore waits happen even for an out of date swapchain */
+	for (uint32_t i = 0; i < count; ++i) {
+		if (present_results[i] == VK_ERROR_OUT_OF_DATE_KHR) {
+			dropped = true;
+			resize = true;
+		}
+		else if (present_results[i] == VK_SUBOPTIMAL_KHR) {
+			resize = true;
+		}
+		else if (present_results[i] != VK_SUCCESS) {
+			uint8_t ret = VULKAN_ERROR_BIT;
+			ret |= print_result(present_results[i]);
+			return ret;
+		}
+	}
+	if (dropped) {
+		++dropped_frames;
+	}
+	*presented = !dropped;
+
+	trace_end(&frame_zone);
+	return 0;
+}
+
+/*
+ * Counts a presented frame, stopping after --frames and, headless, sending
+ * configures every --resize-interval frames the way a compositor would, or
+ * every frame until the --resize-storm is over.
+ */
+static void end_frame(void)
+{
+	uint64_t now_ns = trace_now_ns();
+	if (frames_drawn == 0) {
+		first_frame_ns = now_ns;
+		first_frame_allocations = host_memory_thread_allocation_count();
+	}
+	else {
+		stats_add(&frame_times, (double) (now_ns - last_frame_ns) / 1e6);
+	}
+	last_frame_ns = now_ns;
+	++frames_drawn;
+	if (resize_timing) {
+		stats_add(&resize_times, (double) (now_ns - configure_ns) / 1e6);
+		resize_timing = false;
+	}
+
+	if (options.frame_count != 0 && frames_drawn >= options.frame_count) {
+		running = false;
+	}
+	else if (options.resize_interval != 0
+	         && frames_drawn % options.resize_interval == 0) {
+		bool grow = (frames_drawn / options.resize_interval) % 2 == 1;
+		for (uint32_t w = 0; w < options.window_count; ++w) {
+			configure_window(&windows[w],
+			                 grow ? DEFAULT_WIDTH * 3 / 2
+			                      : DEFAULT_WIDTH,
+			                 grow ? DEFAULT_HEIGHT * 3 / 2
+			                      : DEFAULT_HEIGHT);
+		}
+	}
+	else if (options.resize_storm != 0) {
+		/* Once the last size built has been drawn */
+		if (storm_remaining == 0) {
+			running = false;
+		}
+		else {
+			send_storm_configures();
+		}
+	}
+}
+
+/*
+ * A present of the last swapchain may still wait on its render finished
+ * semaphores, and nothing signals when it stops. Presents are processed in
+ * order, though, so once the new swapchain has acquired one image more than
+ * it has, some image came back after being presented again, and every
+ * present queued before that one is done. The submit after that acquire is
+ * at most image_count + 1 past the last one.
+ */
+static uint8_t flush_retired_swapchain(struct window *window)
+{
+	uint8_t ret = NO_ERRORS;
+	uint64_t last_use = timeline.submitted + window->image_count + 1;
+	if (window->retired_swapchain != VK_NULL_HANDLE) {
+		union deferred_handle handle = {
+			.swapchain = window->retired_swapchain,
+		};
+		ret |= deferred_push(&deferred, DEFERRED_SWAPCHAIN, handle,
+		                     last_use);
+		window->retired_swapchain = VK_NULL_HANDLE;
+	}
+	for (uint32_t i = 0; i < window->retired_semaphore_count; ++i) {
+		if (window->retired_semaphores[i] == VK_NULL_HANDLE) {
+			continue;
+		}
+		union deferred_handle handle = {
+			.semaphore = window->retired_semaphores[i],
+		};
+		ret |= deferred_push(&deferred, DEFERRED_SEMAPHORE, handle,
+		                     last_use);
+	}
+	window->retired_semaphore_count = 0;
+	return ret;
+}
+
+/*
+ * The submits that wait on the image available semaphores are on the
+ * timeline, so those go once it passes them. The render finished ones wait
+ * for the next swapchain to present past them.
+ */
+static uint8_t retire_window_semaphores(void)
+{
+	uint8_t ret = NO_ERRORS;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		if (window->render_finished_semaphore_count != 0) {
+			ret |= flush_retired_swapchain(window);
+			memcpy(window->retired_semaphores,
+			       window->render_finished_semaphores,
+			       sizeof(window->retired_semaphores));
+			window->retired_semaphore_count
+				= window->render_finished_semaphore_count;
+			window->render_finished_semaphore_count = 0;
+		}
+		if (window->image_available_semaphore != VK_NULL_HANDLE) {
+			union deferred_handle handle = {
+				.semaphore = window->image_available_semaphore,
+			};
+			ret |= retire(DEFERRED_SEMAPHORE, handle);
+			window->image_available_semaphore = VK_NULL_HANDLE;
+		}
+	}
+	return ret;
+}
+
+/* On failure the ones created are left for retire_window_semaphores */
+static uint8_t create_window_semaphores(VkDevice device)
+{
+	VkSemaphoreCreateInfo semaphore_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+	};
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		/* The image count is the new swapchain's by now */
+		uint8_t ret = flush_retired_swapchain(window);
+		if (ret != 0) {
+			return ret;
+		}
+		VkResult result;
+		result = vkCreateSemaphore(device, &semaphore_create_info,
+		                           &host_allocator,
+		                           &window->image_available_semaphore);
+		if (result != VK_SUCCESS) {
+			window->image_available_semaphore = VK_NULL_HANDLE;
+			return VULKAN_ERROR_BIT | print_result(result);
+		}
+		/* All null, so a failure part way leaves nothing to skip */
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			window->render_finished_semaphores[i] = VK_NULL_HANDLE;
+		}
+		window->render_finished_semaphore_count = window->image_count;
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			result = vkCreateSemaphore(
+				device, &semaphore_create_info,
+				&host_allocator,
+				&window->render_finished_semaphores[i]
+			);
+			if (result != VK_SUCCESS) {
+				window->render_finished_semaphores[i]
+					= VK_NULL_HANDLE;
+				return VULKAN_ERROR_BIT | print_result(result);
+			}
+		}
+	}
+	return NO_ERRORS;
+}
+
+/*
+ * Draws until a resize or the end. Nothing waits for the last frames; the
+ * semaphores are retired and go once the timeline passes them.
+ */
+static uint8_t use_command_buffers(
+	VkDevice device,
+	VkCommandBuffer *command_buffers,
+	uint32_t command_buffer_count,
+	struct recording *recording)
+{
+	size_t mark = arena_mark(&setup_arena);
+	/* Nothing submitted yet, and value 0 is always reached */
+	uint64_t *last_submits = arena_alloc(
+		&setup_arena,
+		command_buffer_count * sizeof(uint64_t)
+	);
+	if (last_submits == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	memset(last_submits, 0, command_buffer_count * sizeof(uint64_t));
+
+	uint8_t ret = create_window_semaphores(device);
+	while (running && !resize && ret == 0) {
+		if (!options.headless) {
+			struct trace_zone roundtrip_zone
+				= trace_begin("wl_display_roundtrip");
+			wl_display_roundtrip(wayland.display);
+			trace_end(&roundtrip_zone);
+			/* A frame at the old size would only be stale */
+			if (resize) {
+				break;
+			}
+		}
+
+		uint64_t allocations = host_memory_thread_allocation_count();
+		bool presented;
+		ret = draw_frame(device, command_buffers, last_submits,
+		                 recording, &presented);
+		/* The first frame may set things up lazily */
+		if (frames_drawn > 0) {
+			frame_allocations += host_memory_thread_allocation_count()
+			                     - allocations;
+		}
+		if (ret == 0 && presented) {
+			end_frame();
+		}
+	}
+
+	ret |= retire_window_semaphores();
+	arena_reset(&setup_arena, mark);
+	return ret;
+}
+
+static uint8_t record_command_buffer(
+	VkCommandBuffer command_buffer,
+	VkRenderPass render_pass,
+	const struct window *window,
+	uint32_t image_index,
+	VkPipeline graphics_pipeline,
+	VkPipelineLayout pipeline_layout,
+	const struct draw_item *items,
+	uint32_t item_count,
+	VkQueryPool query_pool,
+	uint32_t query,
+	uint32_t slot)
+{
+	VkExtent2D extent = window->extent;
+	/* Null unless this is the recording --record-stream captures */
+	struct command_stream *capturing = NULL;
+	if (!stream_captured && window == &windows[0] && image_index == 0) {
+		capturing = stream;
+		stream_captured = stream != NULL;
+	}
+	uint32_t stream_uniforms = UINT32_MAX;
+	if (capturing != NULL) {
+		capturing->header.width = extent.width;
+		capturing->header.height = extent.height;
+		struct frame_uniforms uniforms;
+		frame_uniforms_init(&uniforms, 0.0f, 0);
+		stream_uniforms = command_stream_add_resource(
+			capturing, COMMAND_STREAM_UNIFORMS,
+			&uniforms, sizeof(uniforms)
+		);
+	}
+	VkCommandBufferBeginInfo command_buffer_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	VkResult result;
+	result = vkBeginCommandBuffer(command_buffer,
+	                              &command_buffer_begin_info);
+	if (result != VK_SUCCESS) {
+		uint8_t ret = VULKAN_ERROR_BIT;
+		ret |= print_result(result);
+		return ret;
+	}
+
+	if (query_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(command_buffer, query_pool, query, 1);
+	}
+	gpu_timer_record_reset(&gpu_timer, command_buffer, slot);
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_BEGIN,
+	                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	gpu_statistics_record_begin(&gpu_statistics, command_buffer, slot);
+
+	if (options.gpu_culling) {
+		struct frustum frustum;
+		frustum_from_matrix(&frustum, view_projection);
+		gpu_cull_record_dispatch(&gpu_cull, command_buffer, &frustum);
+	}
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_CULLED,
+	                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	/* Once per submit, by the first window, for every window to draw */
+	bool simulate = options.particle_count != 0 && window == &windows[0];
+	if (simulate) {
+		particles_record_simulate(&particles, command_buffer,
+		                          view_projection);
+	}
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_PARTICLES_SIMULATED,
+	                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	if (simulate) {
+		particles_record_sort(&particles, command_buffer);
+	}
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_PARTICLES_SORTED,
+	                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+	VkClearValue clear_value = {0.0f, 0.0f, 0.0f, 0.0f};
+	VkClearValue depth_clear_value = {
+		.depthStencil = {
+			.depth = 1.0f,
+			.stencil = 0,
+		},
+	};
+	/* The G-buffer albedo clears to a zero alpha, marking no surface */
+	VkClearValue clear_values[] = {
+		clear_value,
+		depth_clear_value,
+		clear_value,
+		clear_value,
+	};
+	uint32_t clear_value_count = 1;
+	if (options.deferred) {
+		clear_value_count = 2 + GBUFFER_ATTACHMENT_COUNT;
+	}
+	else if (options.depth) {
+		clear_value_count = 2;
+	}
+	VkRenderPassBeginInfo render_pass_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.pNext = NULL,
+		.renderPass = render_pass,
+		.framebuffer = window->framebuffers[image_index],
+		.renderArea = {
+			.offset = {
+				.x = 0,
+				.y = 0,
+			},
+			.extent = extent,
+		},
+		.clearValueCount = clear_value_count,
+		.pClearValues = clear_values,
+	};
+
+	vkCmdBeginRenderPass(command_buffer,
+	                     &render_pass_begin_info,
+	                     VK_SUBPASS_CONTENTS_INLINE);
+	if (query_pool != VK_NULL_HANDLE) {
+		vkCmdBeginQuery(command_buffer, query_pool, query, 0);
+	}
+	vkCmdBindPipeline(command_buffer,
+	                  VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                  graphics_pipeline);
+	command_stream_record(capturing, COMMAND_STREAM_BIND_PIPELINE, NULL, 0);
+	uniform_ring_record_bind(&uniform_ring, command_buffer, pipeline_layout,
+	                         0, slot);
+	command_stream_record(capturing, COMMAND_STREAM_BIND_UNIFORMS,
+	                      &stream_uniforms, 1);
+	bindless_record_bind(&bindless, command_buffer,
+	                     VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1);
+	VkViewport viewport = {
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float) extent.width,
+		.height = (float) extent.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	vkCmdSetScissor(command_buffer, 0, 1, &render_pass_begin_info.renderArea);
+	if (options.gpu_culling) {
+		vkCmdPushConstants(command_buffer, pipeline_layout,
+		                   VK_SHADER_STAGE_VERTEX_BIT,
+		                   0, sizeof(gpu_cull_objects),
+		                   &gpu_cull_objects);
+		gpu_cull_record_draw(&gpu_cull, command_buffer);
+	}
+	else {
+		if (options.mesh_name != NULL) {
+			gpu_mesh_record_bind(&gpu_mesh, command_buffer);
+			command_stream_record(capturing,
+			                      COMMAND_STREAM_BIND_VERTEX_BUFFER,
+			                      &stream_vertex_buffer, 1);
+			uint32_t index_buffer[] = {
+				stream_index_buffer,
+				gpu_mesh.index_type,
+			};
+			command_stream_record(capturing,
+			                      COMMAND_STREAM_BIND_INDEX_BUFFER,
+			                      index_buffer, 2);
+		}
+		for (uint32_t i = 0; i < item_count; ++i) {
+			const struct scene_object *object
+				= &scene.objects[items[i].object_index];
+			vkCmdPushConstants(command_buffer, pipeline_layout,
+			                   VK_SHADER_STAGE_VERTEX_BIT,
+			                   0, sizeof(struct scene_object),
+			                   object);
+			command_stream_record_push_constants(
+				capturing, 0, sizeof(struct scene_object), object
+			);
+			if (options.mesh_name != NULL) {
+				vkCmdDrawIndexed(command_buffer,
+				                 gpu_mesh.index_count, 1, 0, 0, 0);
+				uint32_t draw[] = {gpu_mesh.index_count, 1, 0, 0, 0};
+				command_stream_record(capturing,
+				                      COMMAND_STREAM_DRAW_INDEXED,
+				                      draw, 5);
+			}
+			else {
+				vkCmdDraw(command_buffer, 3, 1, 0, 0);
+				uint32_t draw[] = {3, 1, 0, 0};
+				command_stream_record(capturing,
+				                      COMMAND_STREAM_DRAW, draw, 4);
+			}
+		}
+	}
+	/* Blended over the opaque scene, farthest first */
+	if (options.particle_count != 0) {
+		particles_record_draw(&particles, command_buffer,
+		                      pipeline_layout, particle_state_index);
+	}
+	/* Queries in a render pass end in the subpass they began in */
+	if (query_pool != VK_NULL_HANDLE) {
+		vkCmdEndQuery(command_buffer, query_pool, query);
+	}
+	if (options.deferred) {
+		vkCmdNextSubpass(command_buffer, VK_SUBPASS_CONTENTS_INLINE);
+		gbuffer_record_lighting(&gbuffer, &window->gbuffer_target,
+		                        command_buffer);
+	}
+	vkCmdEndRenderPass(command_buffer);
+	gpu_statistics_record_end(&gpu_statistics, command_buffer, slot);
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_RENDERED,
+	                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+	if (options.post_mode != POST_MODE_NONE) {
+		post_record(&post, &window->post_target, command_buffer,
+		            image_index, window->images[image_index]);
+	}
+	gpu_timer_record_point(&gpu_timer, command_buffer, slot,
+	                       GPU_TIMER_END,
+	                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+	result = vkEndCommandBuffer(command_buffer);
 	if (result != VK_SUCCESS) {
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
@@ -205,59 +1438,145 @@ static uint8_t draw_frame(
 	return 0;
 }
 
-static uint8_t use_command_buffers(
+static const char *const draw_order_names[] = {
+	[DRAW_ORDER_SCENE] = "scene",
+	[DRAW_ORDER_FRONT_TO_BACK] = "front-to-back",
+	[DRAW_ORDER_BACK_TO_FRONT] = "back-to-front",
+};
+
+/*
+ * Draws the scene once per draw order with a pipeline statistics query around
+ * the draws, and reports how many fragment shader invocations the depth test
+ * rejected early compared to the worst case, back to front. Vertex shader
+ * invocations are reported alongside, per index drawn, which is how the
+ * post-transform cache hit rate of a mesh's triangle order shows up. Only the
+ * first window's command buffers have the queries.
+ */
+static uint8_t run_overdraw_benchmark(
 	VkDevice device,
-	VkCommandBuffer *command_buffers)
+	VkRenderPass render_pass,
+	VkPipeline graphics_pipeline,
+	VkPipelineLayout pipeline_layout,
+	VkCommandBuffer *command_buffers,
+	struct draw_item *items,
+	struct draw_item *scratch)
 {
-	VkSemaphore image_available_semaphore;
-	VkSemaphore render_finished_semaphore;
+	if (!vulkan.enabled_features.pipelineStatisticsQuery) {
+		printf("Overdraw benchmark needs pipeline statistics queries\n");
+		return APP_ERROR_BIT;
+	}
 
-	VkSemaphoreCreateInfo semaphore_create_info = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	enum draw_order orders[] = {
+		DRAW_ORDER_BACK_TO_FRONT,
+		DRAW_ORDER_SCENE,
+		DRAW_ORDER_FRONT_TO_BACK,
+	};
+
+	VkQueryPoolCreateInfo query_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = ARRAY_SIZE(orders),
+		.pipelineStatistics
+			= VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+			  | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
 	};
 	VkResult result;
-	result = vkCreateSemaphore(device, &semaphore_create_info, NULL, &image_available_semaphore);
-	if (result != VK_SUCCESS) {
-		uint8_t ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
-	}
-
-	result = vkCreateSemaphore(device, &semaphore_create_info, NULL, &render_finished_semaphore);
+	VkQueryPool query_pool;
+	result = vkCreateQueryPool(device, &query_pool_create_info,
+	                           &host_allocator, &query_pool);
 	if (result != VK_SUCCESS) {
-		vkDestroySemaphore(device, image_available_semaphore, NULL);
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
 
-	uint8_t ret;
-	while (running && !resize) {
-		wl_display_roundtrip(wayland.display);
+	uint8_t ret = create_window_semaphores(device);
+	for (uint32_t o = 0; o < ARRAY_SIZE(orders) && ret == 0; ++o) {
+		draw_sort(items, scratch, &scene, NULL, scene.object_count,
+		          orders[o]);
+		for (uint32_t w = 0; w < options.window_count && ret == 0; ++w) {
+			const struct window *window = &windows[w];
+			for (uint32_t i = 0; i < window->image_count && ret == 0;
+			     ++i) {
+				ret = record_command_buffer(
+					command_buffers[window->first_slot + i],
+					render_pass,
+					window,
+					i,
+					graphics_pipeline,
+					pipeline_layout,
+					items,
+					scene.object_count,
+					w == 0 ? query_pool : VK_NULL_HANDLE,
+					o,
+					window->first_slot + i);
+			}
+		}
+		if (ret != 0) {
+			break;
+		}
 
-		ret = draw_frame(device, command_buffers,
-		                 image_available_semaphore,
-		                 render_finished_semaphore);
+		bool presented;
+		ret = draw_frame(device, command_buffers, NULL, NULL,
+		                 &presented);
+		/* A dropped frame may not have written its queries */
+		if (ret == 0 && !presented) {
+			printf("The swapchain went out of date while measuring\n");
+			ret = APP_ERROR_BIT;
+		}
 		if (ret != 0) {
-			vkDestroySemaphore(device, render_finished_semaphore, NULL);
-			vkDestroySemaphore(device, image_available_semaphore, NULL);
-			return ret;
+			break;
 		}
+
+		/* The next order re-records the same command buffers */
+		ret = timeline_wait(&timeline, device, timeline.submitted);
 	}
 
-	result = vkDeviceWaitIdle(device);
-	if (result != VK_SUCCESS) {
-		vkDestroySemaphore(device, render_finished_semaphore, NULL);
-		vkDestroySemaphore(device, image_available_semaphore, NULL);
-		ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
+	/* Statistics come in the order of their bits, vertex first */
+	uint64_t invocations[ARRAY_SIZE(orders)][2];
+	if (ret == 0) {
+		result = vkGetQueryPoolResults(device, query_pool,
+		                               0, ARRAY_SIZE(orders),
+		                               sizeof(invocations),
+		                               invocations,
+		                               sizeof(invocations[0]),
+		                               VK_QUERY_RESULT_64_BIT
+		                               | VK_QUERY_RESULT_WAIT_BIT);
+		if (result != VK_SUCCESS) {
+			ret = VULKAN_ERROR_BIT;
+			ret |= print_result(result);
+		}
+	}
+
+	if (ret == 0) {
+		uint64_t worst = invocations[0][1];
+		printf("Overdraw (%u objects, %ux%u)\n", scene.object_count,
+		       windows[0].extent.width, windows[0].extent.height);
+		for (uint32_t o = 0; o < ARRAY_SIZE(orders); ++o) {
+			uint64_t saved = worst - invocations[o][1];
+			printf("  %-14s %12llu fragment invocations,"
+			       " %12llu saved (%.1f%%)\n",
+			       draw_order_names[orders[o]],
+			       (unsigned long long) invocations[o][1],
+			       (unsigned long long) saved,
+			       worst ? 100.0 * saved / worst : 0.0);
+		}
+
+		uint64_t indices = (uint64_t) scene.object_count
+		                   * (options.mesh_name != NULL
+		                      ? gpu_mesh.index_count : 3);
+		printf("  %12llu vertex invocations for %llu indices"
+		       " (%.3f per index)\n",
+		       (unsigned long long) invocations[0][0],
+		       (unsigned long long) indices,
+		       indices ? (double) invocations[0][0] / indices : 0.0);
 	}
 
-	vkDestroySemaphore(device, render_finished_semaphore, NULL);
-	vkDestroySemaphore(device, image_available_semaphore, NULL);
+	ret |= retire_window_semaphores();
+	union deferred_handle handle = {.query_pool = query_pool};
+	ret |= retire(DEFERRED_QUERY_POOL, handle);
 	return ret;
 }
 
@@ -265,299 +1584,234 @@ static uint8_t use_framebuffers(
 	VkDevice device,
 	VkRenderPass render_pass,
 	VkPipeline graphics_pipeline,
-	VkFramebuffer *swapchain_framebuffers,
-	uint32_t swapchain_framebuffer_count)
+	VkPipelineLayout pipeline_layout,
+	uint32_t slot_count)
 {
 	VkCommandPoolCreateInfo command_pool_create_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.pNext = NULL,
-		.flags = 0,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
 		.queueFamilyIndex = vulkan.graphics_queue_family_index,
 	};
 
 	VkResult result;
 	VkCommandPool command_pool;
-	result = vkCreateCommandPool(device, &command_pool_create_info, NULL,
-	                             &command_pool);
+	result = vkCreateCommandPool(device, &command_pool_create_info,
+	                             &host_allocator, &command_pool);
 	if (result != VK_SUCCESS) {
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
 
-	VkCommandBuffer *command_buffers = malloc(
-		swapchain_framebuffer_count * sizeof(VkCommandBuffer)
+	size_t mark = arena_mark(&setup_arena);
+	VkCommandBuffer *command_buffers = arena_alloc(
+		&setup_arena,
+		slot_count * sizeof(VkCommandBuffer)
+	);
+	/* Draw items and their sort scratch space */
+	struct draw_item *items = arena_alloc(
+		&setup_arena,
+		2 * scene.object_count * sizeof(struct draw_item)
 	);
-	if (command_buffers == NULL) {
-		vkDestroyCommandPool(device, command_pool, NULL);
+	VkPipeline *pipelines = arena_alloc(
+		&setup_arena,
+		slot_count * sizeof(VkPipeline)
+	);
+	/* The visible objects, in scene order */
+	uint32_t *visible = NULL;
+	if (options.cpu_culling) {
+		visible = arena_alloc(
+			&setup_arena,
+			cpu_cull.bounds.capacity * sizeof(uint32_t)
+		);
+	}
+	if (command_buffers == NULL || items == NULL || pipelines == NULL
+	    || (options.cpu_culling && visible == NULL)) {
+		arena_reset(&setup_arena, mark);
+		vkDestroyCommandPool(device, command_pool, &host_allocator);
 		return LIBC_ERROR_BIT;
 	}
+	struct draw_item *scratch = items + scene.object_count;
+	struct recording recording = {
+		.render_pass = render_pass,
+		.pipeline_layout = pipeline_layout,
+		.items = items,
+		.item_count = scene.object_count,
+		.pipelines = pipelines,
+	};
 
 	VkCommandBufferAllocateInfo command_buffer_allocate_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 		.pNext = NULL,
 		.commandPool = command_pool,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = swapchain_framebuffer_count,
+		.commandBufferCount = slot_count,
 	};
 
 	result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info,
 	                                  command_buffers);
 	if (result != VK_SUCCESS) {
-		free(command_buffers);
-		vkDestroyCommandPool(device, command_pool, NULL);
+		arena_reset(&setup_arena, mark);
+		vkDestroyCommandPool(device, command_pool, &host_allocator);
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
 
-	for (uint32_t i = 0; i < swapchain_framebuffer_count; ++i) {
-		VkCommandBufferBeginInfo command_buffer_begin_info = {
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-			.pNext = NULL,
-			.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
-			.pInheritanceInfo = NULL,
-		};
-		result = vkBeginCommandBuffer(command_buffers[i],
-		                              &command_buffer_begin_info);
-		if (result != VK_SUCCESS) {
-			vkFreeCommandBuffers(device, command_pool,
-			                     swapchain_framebuffer_count,
-			                     command_buffers);
-			free(command_buffers);
-			vkDestroyCommandPool(device, command_pool, NULL);
-			uint8_t ret = VULKAN_ERROR_BIT;
-			ret |= print_result(result);
-			return ret;
+	uint8_t ret = uniform_ring_use_slots(&uniform_ring, device,
+	                                     &vulkan.memory_properties,
+	                                     slot_count);
+	if (ret == 0 && options.overdraw_benchmark) {
+		ret = run_overdraw_benchmark(device,
+		                             render_pass,
+		                             graphics_pipeline,
+		                             pipeline_layout,
+		                             command_buffers,
+		                             items,
+		                             scratch);
+		running = false;
+	}
+	else if (ret == 0) {
+		/* Without a depth test the painter's order is the visible one */
+		if (trace_enabled
+		    || (options.report && options.particle_count != 0)) {
+			ret = gpu_timer_init(&gpu_timer, device, queue,
+			                     command_pool,
+			                     slot_count,
+			                     GPU_TIMER_POINT_COUNT,
+			                     vulkan.timestamp_period,
+			                     vulkan.timestamp_valid_bits);
+		}
+		if (ret == 0 && options.report
+		    && vulkan.enabled_features.pipelineStatisticsQuery) {
+			ret = gpu_statistics_init(&gpu_statistics, device,
+			                          slot_count);
 		}
 
-		VkClearValue clear_value = {0.0f, 0.0f, 0.0f, 0.0f};
-		VkClearValue clear_values[] = {
-			clear_value,
-		};
-		VkRenderPassBeginInfo render_pass_begin_info = {
-			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-			.pNext = NULL,
-			.renderPass = render_pass,
-			.framebuffer = swapchain_framebuffers[i],
-			.renderArea = {
-				.offset = {
-					.x = 0,
-					.y = 0,
-				},
-				.extent = vulkan.swapchain_image_extent,
-			},
-			.clearValueCount = ARRAY_SIZE(clear_values),
-			.pClearValues = clear_values,
-		};
-
-		vkCmdBeginRenderPass(command_buffers[i],
-		                     &render_pass_begin_info,
-		                     VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(command_buffers[i],
-		                  VK_PIPELINE_BIND_POINT_GRAPHICS,
-		                  graphics_pipeline);
-		vkCmdDraw(command_buffers[i], 3, 1, 0, 0);
-		vkCmdEndRenderPass(command_buffers[i]);
-
-		result = vkEndCommandBuffer(command_buffers[i]);
-		if (result != VK_SUCCESS) {
-			vkFreeCommandBuffers(device, command_pool,
-			                     swapchain_framebuffer_count,
-			                     command_buffers);
-			free(command_buffers);
-			vkDestroyCommandPool(device, command_pool, NULL);
-			uint8_t ret = VULKAN_ERROR_BIT;
-			ret |= print_result(result);
-			return ret;
+		if (options.cpu_culling) {
+			struct trace_zone cull_zone = begin_phase("cpu_cull");
+			struct frustum frustum;
+			frustum_from_matrix(&frustum, view_projection);
+			recording.item_count = cpu_cull_run(&cpu_cull, &frustum,
+			                                    visible);
+			end_phase(&cull_zone);
 		}
+		struct trace_zone record_zone
+			= begin_phase("record_command_buffers");
+		draw_sort(items, scratch, &scene, visible,
+		          recording.item_count,
+		          options.depth ? DRAW_ORDER_FRONT_TO_BACK
+		                        : DRAW_ORDER_BACK_TO_FRONT);
+		for (uint32_t w = 0; w < options.window_count && ret == 0;
+		     ++w) {
+			const struct window *window = &windows[w];
+			for (uint32_t i = 0; i < window->image_count && ret == 0;
+			     ++i) {
+				uint32_t slot = window->first_slot + i;
+				ret = record_command_buffer(
+					command_buffers[slot],
+					render_pass,
+					window,
+					i,
+					graphics_pipeline,
+					pipeline_layout,
+					items,
+					recording.item_count,
+					VK_NULL_HANDLE,
+					0,
+					slot);
+				pipelines[slot] = graphics_pipeline;
+			}
+		}
+		end_phase(&record_zone);
+		if (ret == 0) {
+			ret = use_command_buffers(device, command_buffers,
+			                          slot_count,
+			                          &recording);
+		}
+		/* The queries of frames still in flight are dropped */
+		if (gpu_statistics.query_pool != VK_NULL_HANDLE) {
+			union deferred_handle handle = {
+				.query_pool = gpu_statistics.query_pool,
+			};
+			ret |= retire(DEFERRED_QUERY_POOL, handle);
+			gpu_statistics.query_pool = VK_NULL_HANDLE;
+		}
+		gpu_statistics_fini(&gpu_statistics, device);
+		if (gpu_timer.query_pool != VK_NULL_HANDLE) {
+			union deferred_handle handle = {
+				.query_pool = gpu_timer.query_pool,
+			};
+			ret |= retire(DEFERRED_QUERY_POOL, handle);
+			gpu_timer.query_pool = VK_NULL_HANDLE;
+		}
+		gpu_timer_fini(&gpu_timer, device);
 	}
+	ret |= uniform_ring_retire_slots(&uniform_ring, device, &deferred,
+	                                 timeline.submitted);
 
-	uint8_t ret = use_command_buffers(device, command_buffers);
-
-	vkFreeCommandBuffers(device, command_pool, swapchain_framebuffer_count,
-	                     command_buffers);
-	free(command_buffers);
-	vkDestroyCommandPool(device, command_pool, NULL);
+	/* Frees the command buffers along with it */
+	union deferred_handle handle = {.command_pool = command_pool};
+	ret |= retire(DEFERRED_COMMAND_POOL, handle);
+	arena_reset(&setup_arena, mark);
 	return ret;
 }
 
-static uint8_t use_shader_modules(
-	VkDevice device,
-	VkImageView *image_views,
-	uint32_t image_view_count,
-	VkShaderModule frag_shader_module,
-	VkShaderModule vert_shader_module)
-{
-	VkPipelineShaderStageCreateInfo
-	pipeline_shader_frag_stage_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-		.module = frag_shader_module,
-		.pName = "main",
-		.pSpecializationInfo = NULL,
-	};
-
-	VkPipelineShaderStageCreateInfo
-	pipeline_shader_vert_stage_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.stage = VK_SHADER_STAGE_VERTEX_BIT,
-		.module = vert_shader_module,
-		.pName = "main",
-		.pSpecializationInfo = NULL,
-	};
-
-	VkPipelineShaderStageCreateInfo pipeline_shader_stages[] = {
-		pipeline_shader_vert_stage_create_info,
-		pipeline_shader_frag_stage_create_info,
-	};
-
-	VkPipelineVertexInputStateCreateInfo
-	pipeline_vertex_input_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.vertexBindingDescriptionCount = 0,
-		.pVertexBindingDescriptions = NULL,
-		.vertexAttributeDescriptionCount = 0,
-		.pVertexAttributeDescriptions = NULL,
-	};
-
-	VkPipelineInputAssemblyStateCreateInfo
-	pipeline_input_assembly_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-		.primitiveRestartEnable = VK_FALSE,
-	};
-
-	VkViewport viewport = {
-		.x = 0.0f,
-		.y = 0.0f,
-		.width = (float) vulkan.swapchain_image_extent.width,
-		.height = (float) vulkan.swapchain_image_extent.height,
-		.minDepth = 0.0f,
-		.maxDepth = 1.0f,
-	};
-	VkViewport viewports[] = { viewport };
-
-	VkRect2D scissor = {
-		.offset = {
-			.x = 0,
-			.y = 0,
-		},
-		.extent = vulkan.swapchain_image_extent,
-	};
-	VkRect2D scissors[] = { scissor };
-
-	VkPipelineViewportStateCreateInfo
-	pipeline_viewport_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.viewportCount = ARRAY_SIZE(viewports),
-		.pViewports = viewports,
-		.scissorCount = ARRAY_SIZE(scissors),
-		.pScissors = scissors,
-	};
-
-	VkPipelineRasterizationStateCreateInfo
-	pipeline_rasterization_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.depthClampEnable = VK_FALSE,
-		.rasterizerDiscardEnable = VK_FALSE,
-		.polygonMode = VK_POLYGON_MODE_FILL,
-		.cullMode = VK_CULL_MODE_BACK_BIT,
-		.frontFace = VK_FRONT_FACE_CLOCKWISE,
-		.depthBiasEnable = VK_FALSE,
-		.depthBiasConstantFactor = 0.0f,
-		.depthBiasClamp = 0.0f,
-		.depthBiasSlopeFactor = 0.0f,
-		.lineWidth = 1.0f,
-	};
-
-	VkPipelineMultisampleStateCreateInfo
-	pipeline_multisample_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-		.sampleShadingEnable = VK_FALSE,
-		.minSampleShading = 1.0f,
-		.pSampleMask = NULL,
-		.alphaToCoverageEnable = VK_FALSE,
-		.alphaToOneEnable = VK_FALSE,
-	};
+/* Enough for the replay to create the same render pass and pipeline */
+static void record_stream_pipeline(const struct pipeline_state *state)
+{
+	struct command_stream_header *header = &stream->header;
+	header->color_format = vulkan.swapchain_image_format;
+	header->depth_format = options.depth ? vulkan.depth_format
+	                                     : VK_FORMAT_UNDEFINED;
+	header->push_constant_size = sizeof(struct scene_object);
+	header->vertex_stride = state->vertex_binding.stride;
+	header->attribute_count = state->vertex_attribute_count;
+	for (uint32_t i = 0; i < state->vertex_attribute_count; ++i) {
+		header->attributes[i] = (struct command_stream_attribute) {
+			.location = state->vertex_attributes[i].location,
+			.format = state->vertex_attributes[i].format,
+			.offset = state->vertex_attributes[i].offset,
+		};
+	}
+}
 
-	VkPipelineColorBlendAttachmentState
-	pipeline_color_blend_attachment_state = {
-		.blendEnable = VK_FALSE,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
-		.colorBlendOp = VK_BLEND_OP_ADD,
-		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-		.alphaBlendOp = VK_BLEND_OP_ADD,
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-		                  | VK_COLOR_COMPONENT_G_BIT
-		                  | VK_COLOR_COMPONENT_B_BIT
-		                  | VK_COLOR_COMPONENT_A_BIT
-	};
-	VkPipelineColorBlendAttachmentState attachments[] = {
-		pipeline_color_blend_attachment_state,
+/*
+ * The layout and render pass only depend on the formats, so they outlive
+ * swapchain recreation. The pipeline itself is left to the compiler threads.
+ */
+static uint8_t create_graphics_pipeline(VkDevice device)
+{
+	VkPushConstantRange object_push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(struct scene_object),
 	};
-
-	VkPipelineColorBlendStateCreateInfo
-	pipeline_color_blend_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.logicOpEnable = VK_FALSE,
-		.logicOp = VK_LOGIC_OP_COPY,
-		.attachmentCount = ARRAY_SIZE(attachments),
-		.pAttachments = attachments,
-		.blendConstants = {
-			[0] = 0.0f,
-			[1] = 0.0f,
-			[2] = 0.0f,
-			[3] = 0.0f,
-		},
+	VkPushConstantRange push_constant_ranges[] = {
+		object_push_constant_range,
 	};
 
-	VkDynamicState dynamic_states[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
-	};
-	VkPipelineDynamicStateCreateInfo
-	pipeline_dynamic_state_create_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.dynamicStateCount = ARRAY_SIZE(dynamic_states),
-		.pDynamicStates = dynamic_states,
+	/* Per frame data at set 0, every other resource at set 1 */
+	VkDescriptorSetLayout set_layouts[] = {
+		uniform_ring.descriptor_set_layout,
+		bindless.descriptor_set_layout,
 	};
 
 	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
-		.setLayoutCount = 0,
-		.pSetLayouts = NULL,
-		.pushConstantRangeCount = 0,
-		.pPushConstantRanges = NULL,
+		.setLayoutCount = ARRAY_SIZE(set_layouts),
+		.pSetLayouts = set_layouts,
+		.pushConstantRangeCount = ARRAY_SIZE(push_constant_ranges),
+		.pPushConstantRanges = push_constant_ranges,
 	};
 
 	VkResult result;
 	VkPipelineLayout pipeline_layout;
 	result = vkCreatePipelineLayout(device, &pipeline_layout_create_info,
-	                                NULL, &pipeline_layout);
+	                                &host_allocator, &pipeline_layout);
 	if (result != VK_SUCCESS) {
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
@@ -575,9 +1829,61 @@ static uint8_t use_shader_modules(
 		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 	};
-	VkAttachmentDescription color_attachment_descriptions[] = {
+	/* Post processing loads the HDR image in the general layout */
+	if (options.post_mode != POST_MODE_NONE) {
+		color_attachment_description.format = POST_HDR_FORMAT;
+		color_attachment_description.finalLayout
+			= VK_IMAGE_LAYOUT_GENERAL;
+	}
+	VkAttachmentDescription depth_attachment_description = {
+		.flags = 0,
+		.format = vulkan.depth_format,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+	/* Left in the layout the lighting subpass reads it in */
+	if (options.deferred) {
+		depth_attachment_description.finalLayout
+			= VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	}
+	/*
+	 * The G-buffer only lives through the render pass, so it is never
+	 * stored. Albedo clears to a zero alpha where nothing was drawn, and
+	 * normals there are never read, so they need no clear.
+	 */
+	VkAttachmentDescription albedo_attachment_description = {
+		.flags = 0,
+		.format = GBUFFER_ALBEDO_FORMAT,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+	VkAttachmentDescription normal_attachment_description
+		= albedo_attachment_description;
+	normal_attachment_description.format = GBUFFER_NORMAL_FORMAT;
+	normal_attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	VkAttachmentDescription attachment_descriptions[] = {
 		color_attachment_description,
+		depth_attachment_description,
+		[2 + GBUFFER_ALBEDO] = albedo_attachment_description,
+		[2 + GBUFFER_NORMAL] = normal_attachment_description,
 	};
+	uint32_t attachment_count = 1;
+	if (options.deferred) {
+		attachment_count = ARRAY_SIZE(attachment_descriptions);
+	}
+	else if (options.depth) {
+		attachment_count = 2;
+	}
 
 	VkAttachmentReference color_attachment_reference = {
 		.attachment = 0,
@@ -587,6 +1893,34 @@ static uint8_t use_shader_modules(
 		color_attachment_reference,
 	};
 
+	VkAttachmentReference depth_attachment_reference = {
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+
+	/* Written by the scene, then read by lighting along with depth */
+	VkAttachmentReference
+	gbuffer_attachment_references[GBUFFER_ATTACHMENT_COUNT];
+	VkAttachmentReference
+	input_attachment_references[1 + GBUFFER_ATTACHMENT_COUNT];
+	VkAttachmentReference depth_input_attachment_reference = {
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+	};
+	input_attachment_references[0] = depth_input_attachment_reference;
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; ++i) {
+		VkAttachmentReference gbuffer_attachment_reference = {
+			.attachment = 2 + i,
+			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		};
+		gbuffer_attachment_references[i] = gbuffer_attachment_reference;
+		VkAttachmentReference input_attachment_reference = {
+			.attachment = 2 + i,
+			.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		};
+		input_attachment_references[1 + i] = input_attachment_reference;
+	}
+
 	VkSubpassDescription subpass_description = {
 		.flags = 0,
 		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -595,12 +1929,34 @@ static uint8_t use_shader_modules(
 		.colorAttachmentCount = ARRAY_SIZE(color_attachments_references),
 		.pColorAttachments = color_attachments_references,
 		.pResolveAttachments = NULL,
+		.pDepthStencilAttachment = options.depth
+		                           ? &depth_attachment_reference
+		                           : NULL,
+		.preserveAttachmentCount = 0,
+		.pPreserveAttachments = NULL,
+	};
+	/* Deferred shading draws the scene into the G-buffer instead */
+	if (options.deferred) {
+		subpass_description.colorAttachmentCount
+			= ARRAY_SIZE(gbuffer_attachment_references);
+		subpass_description.pColorAttachments
+			= gbuffer_attachment_references;
+	}
+	VkSubpassDescription lighting_subpass_description = {
+		.flags = 0,
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.inputAttachmentCount = ARRAY_SIZE(input_attachment_references),
+		.pInputAttachments = input_attachment_references,
+		.colorAttachmentCount = ARRAY_SIZE(color_attachments_references),
+		.pColorAttachments = color_attachments_references,
+		.pResolveAttachments = NULL,
 		.pDepthStencilAttachment = NULL,
 		.preserveAttachmentCount = 0,
 		.pPreserveAttachments = NULL,
 	};
 	VkSubpassDescription subpass_descriptions[] = {
 		subpass_description,
+		lighting_subpass_description,
 	};
 
 	VkSubpassDependency subpass_dependency = {
@@ -613,241 +1969,493 @@ static uint8_t use_shader_modules(
 		                 | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 		.dependencyFlags = 0,
 	};
+	/* So is the HDR image, read by the last frame's post processing */
+	if (options.post_mode != POST_MODE_NONE) {
+		subpass_dependency.srcStageMask
+			|= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+			   | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	/* The single depth image is shared by every frame in flight */
+	if (options.depth) {
+		subpass_dependency.srcStageMask
+			|= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		subpass_dependency.dstStageMask
+			|= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		subpass_dependency.srcAccessMask
+			|= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		subpass_dependency.dstAccessMask
+			|= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+			   | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	}
+	/* And the G-buffer, read by the last frame's lighting */
+	if (options.deferred) {
+		subpass_dependency.srcStageMask
+			|= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	/*
+	 * Lighting only reads what the scene wrote at the same pixel, so by
+	 * region: a tiled GPU goes from one subpass to the next per tile.
+	 */
+	VkSubpassDependency lighting_dependency = {
+		.srcSubpass = 0,
+		.dstSubpass = 1,
+		.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		                | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+		                | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		                 | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT
+		                 | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+	};
 	VkSubpassDependency dependencies[] = {
 		subpass_dependency,
+		lighting_dependency,
 	};
 
 	VkRenderPassCreateInfo render_pass_create_info = {
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
-		.attachmentCount = ARRAY_SIZE(color_attachment_descriptions),
-		.pAttachments = color_attachment_descriptions,
-		.subpassCount = ARRAY_SIZE(subpass_descriptions),
+		.attachmentCount = attachment_count,
+		.pAttachments = attachment_descriptions,
+		.subpassCount = options.deferred ? 2 : 1,
 		.pSubpasses = subpass_descriptions,
-		.dependencyCount = ARRAY_SIZE(dependencies),
+		.dependencyCount = options.deferred ? 2 : 1,
 		.pDependencies = dependencies,
 	};
 
 	VkRenderPass render_pass;
-	result = vkCreateRenderPass(device, &render_pass_create_info, NULL,
-	                            &render_pass);
+	result = vkCreateRenderPass(device, &render_pass_create_info,
+	                            &host_allocator, &render_pass);
 	if (result != VK_SUCCESS) {
-		vkDestroyPipelineLayout(device, pipeline_layout, NULL);
+		vkDestroyPipelineLayout(device, pipeline_layout,
+		                        &host_allocator);
 		uint8_t ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
 
-	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
-		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-		.pNext = NULL,
-		.flags = 0,
-		.stageCount = ARRAY_SIZE(pipeline_shader_stages),
-		.pStages = pipeline_shader_stages,
-		.pVertexInputState = &pipeline_vertex_input_state_create_info,
-		.pInputAssemblyState = &pipeline_input_assembly_state_create_info,
-		.pTessellationState = NULL,
-		.pViewportState = &pipeline_viewport_state_create_info,
-		.pRasterizationState = &pipeline_rasterization_state_create_info,
-		.pMultisampleState = &pipeline_multisample_state_create_info,
-		.pDepthStencilState = NULL,
-		.pColorBlendState = &pipeline_color_blend_state_create_info,
-		.pDynamicState = NULL,
+	graphics.pipeline_layout = pipeline_layout;
+	graphics.render_pass = render_pass;
+
+	/* One compile at a time is enough until there are more variants */
+	long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t thread_count = processor_count > 1 ? 2 : 1;
+	uint8_t err = pipeline_compiler_init(&pipeline_compiler, device,
+	                                     vulkan.graphics_pipeline_library,
+	                                     thread_count,
+	                                     MAX_PIPELINE_VARIANTS);
+	if (err) {
+		return err;
+	}
+
+	struct pipeline_state state = {
+		.name = options.gpu_culling ? "indirect" : "push_constants",
+		.vert_shader_module = graphics.vert_shader_module,
+		.frag_shader_module = graphics.frag_shader_module,
 		.layout = pipeline_layout,
-		.renderPass = render_pass,
+		.render_pass = render_pass,
 		.subpass = 0,
-		.basePipelineHandle = VK_NULL_HANDLE,
-		.basePipelineIndex = -1,
-	};
-	VkGraphicsPipelineCreateInfo graphics_pipeline_create_infos[1] = {
-		graphics_pipeline_create_info,
+		.color_attachment_count = options.deferred
+		                          ? GBUFFER_ATTACHMENT_COUNT
+		                          : 1,
+		.vertex_attribute_count = 0,
+		/* Sizes the bindless storage buffer arrays */
+		.constants = {
+			vulkan.bindless_capacities[BINDLESS_STORAGE_BUFFERS],
+		},
+		.constant_count = 1,
+		.depth_test = options.depth,
+		.blend = false,
 	};
+	/* Pulled vertices are found by a constant, with no vertex input */
+	if (options.mesh_name != NULL && options.vertex_pulling) {
+		state.name = "mesh_pulling";
+		state.constants[1] = gpu_mesh_vertices;
+		state.constant_count = 2;
+	}
+	else if (options.mesh_name != NULL) {
+		state.name = "mesh";
+		state.vertex_binding = gpu_mesh_binding;
+		for (uint32_t i = 0; i < GPU_MESH_ATTRIBUTE_COUNT; ++i) {
+			state.vertex_attributes[i] = gpu_mesh_attributes[i];
+		}
+		state.vertex_attribute_count = GPU_MESH_ATTRIBUTE_COUNT;
+	}
+	if (stream != NULL) {
+		record_stream_pipeline(&state);
+	}
+	err = pipeline_compiler_add(&pipeline_compiler, &state,
+	                            &graphics.variant);
+	if (!err && options.deferred) {
+		err = gbuffer_init(&gbuffer, device, &assets, &pipeline_compiler,
+		                   set_layouts, &object_push_constant_range,
+		                   render_pass);
+	}
+	if (!err && options.particle_count != 0) {
+		err = particles_add_pipeline(
+			&particles, device, &assets, &pipeline_compiler,
+			pipeline_layout, render_pass,
+			vulkan.bindless_capacities[BINDLESS_STORAGE_BUFFERS],
+			options.depth
+		);
+	}
+	if (err || options.post_mode == POST_MODE_NONE) {
+		return err;
+	}
 
-	VkPipeline graphics_pipelines[1];
-	result = vkCreateGraphicsPipelines(
-		device,
-		VK_NULL_HANDLE,                  /* pipelineCache */
-		ARRAY_SIZE(graphics_pipeline_create_infos),
-		graphics_pipeline_create_infos,  /* pCreateInfos */
-		NULL,                            /* pAllocator */
-		graphics_pipelines               /* pPipelines */
-	);
-	if (result != VK_SUCCESS) {
-		vkDestroyRenderPass(device, render_pass, NULL);
-		vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-		uint8_t ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
+	/* Queued behind the scene's pipeline, which is waited for first */
+	struct trace_zone post_zone = begin_phase("post_init");
+	struct mmap_faults faults;
+	mmap_faults_now(&faults);
+	err = post_init(&post, device, &assets, &pipeline_compiler,
+	                vulkan.swapchain_image_format,
+	                options.post_mode,
+	                vulkan.post_storage_output,
+	                options.capture_filename != NULL,
+	                options.post_benchmark);
+	mmap_faults_add_since(&assets.map, &faults);
+	end_phase(&post_zone);
+	return err;
+}
+
+static void destroy_graphics(VkDevice device)
+{
+	pipeline_compiler_fini(&pipeline_compiler);
+	/* The compiler's post pipelines use its modules and render passes */
+	post_fini(&post, device);
+	gbuffer_fini(&gbuffer, device);
+	if (graphics.render_pass != VK_NULL_HANDLE) {
+		vkDestroyRenderPass(device, graphics.render_pass,
+		                    &host_allocator);
+		graphics.render_pass = VK_NULL_HANDLE;
 	}
+	if (graphics.pipeline_layout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, graphics.pipeline_layout,
+		                        &host_allocator);
+		graphics.pipeline_layout = VK_NULL_HANDLE;
+	}
+	if (graphics.vert_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, graphics.vert_shader_module,
+		                      &host_allocator);
+		graphics.vert_shader_module = VK_NULL_HANDLE;
+	}
+	if (graphics.frag_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, graphics.frag_shader_module,
+		                      &host_allocator);
+		graphics.frag_shader_module = VK_NULL_HANDLE;
+	}
+}
 
-	VkFramebuffer *swapchain_framebuffers = malloc(
-		image_view_count * sizeof(VkFramebuffer)
-	);
-	if (swapchain_framebuffers == NULL) {
-		vkDestroyPipeline(device, graphics_pipelines[0], NULL);
-		vkDestroyRenderPass(device, render_pass, NULL);
-		vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-		return LIBC_ERROR_BIT;
+/* Uploads the --mesh from the asset pack, straight from the mapping */
+static uint8_t create_mesh(VkDevice device)
+{
+	const struct pack_entry *entry = pack_find(&assets, options.mesh_name,
+	                                           PACK_TYPE_MESH);
+	if (entry == NULL) {
+		printf("No mesh %s in " ASSET_PACK_FILENAME "\n",
+		       options.mesh_name);
+		return APP_ERROR_BIT;
 	}
 
-	for (uint32_t i = 0; i < image_view_count; ++i) {
-		VkImageView attachments[] = {
-			image_views[i],
-		};
-		VkFramebufferCreateInfo framebuffer_create_info = {
-			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-			.pNext = NULL,
-			.flags = 0,
-			.renderPass = render_pass,
-			.attachmentCount = ARRAY_SIZE(attachments),
-			.pAttachments = attachments,
-			.width = vulkan.swapchain_image_extent.width,
-			.height = vulkan.swapchain_image_extent.height,
-			.layers = 1,
-		};
-		result = vkCreateFramebuffer(device,
-		                             &framebuffer_create_info,
-		                             NULL,
-		                             &(swapchain_framebuffers[i]));
-		if (result != VK_SUCCESS) {
-			for (uint32_t j = 0; j < i; ++j) {
-				vkDestroyFramebuffer(device,
-				                     swapchain_framebuffers[j],
-				                     NULL);
-			}
-			free(swapchain_framebuffers);
-			vkDestroyPipeline(device, graphics_pipelines[0], NULL);
-			vkDestroyRenderPass(device, render_pass, NULL);
-			vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-			uint8_t ret = VULKAN_ERROR_BIT;
-			ret |= print_result(result);
-			return ret;
-		}
+	struct mesh mesh;
+	uint8_t err = mesh_init(&mesh, pack_data(&assets, entry), entry->size);
+	if (err) {
+		printf("Mesh %s is not valid\n", options.mesh_name);
+		return err;
 	}
 
-	uint8_t ret = use_framebuffers(device,
-	                               render_pass,
-	                               graphics_pipelines[0],
-	                               swapchain_framebuffers,
-	                               image_view_count);
+	const struct mesh_header *header = mesh.header;
+	stream_vertex_buffer = command_stream_add_resource(
+		stream, COMMAND_STREAM_VERTEX_BUFFER, mesh.vertices,
+		header->vertex_count * sizeof(struct mesh_vertex)
+	);
+	stream_index_buffer = command_stream_add_resource(
+		stream, COMMAND_STREAM_INDEX_BUFFER, mesh.indices,
+		header->index_count * header->index_size
+	);
 
-	for (uint32_t i = 0; i < image_view_count; ++i) {
-		vkDestroyFramebuffer(device, swapchain_framebuffers[i], NULL);
+	err = gpu_mesh_init(&gpu_mesh, device, &vulkan.memory_properties,
+	                    queue, vulkan.graphics_queue_family_index, &mesh,
+	                    options.vertex_pulling);
+	if (err || !options.vertex_pulling) {
+		return err;
 	}
-	free(swapchain_framebuffers);
-	vkDestroyPipeline(device, graphics_pipelines[0], NULL);
-	vkDestroyRenderPass(device, render_pass, NULL);
-	vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-	return ret;
+	return bindless_add_buffer(&bindless, device,
+	                           gpu_mesh.vertex_buffer.buffer,
+	                           0, VK_WHOLE_SIZE, &gpu_mesh_vertices);
 }
 
-uint8_t use_image_views(VkDevice device,
-                        VkImageView *image_views,
-                        uint32_t image_view_count)
+/* Loads the shaders and creates the pipeline, independent of the swapchain */
+static uint8_t create_graphics(VkDevice device)
 {
-	struct mmap_result frag;
-	struct mmap_result vert;
-
-	uint8_t ret = mmap_init("frag.spv", &frag);
-	if (ret != 0) {
-		return ret;
+	struct trace_zone shader_zone = begin_phase("create_shader_modules");
+	struct mmap_faults faults;
+	mmap_faults_now(&faults);
+	const char *frag_name = "frag.spv";
+	if (options.deferred) {
+		frag_name = "gbuffer.frag.spv";
 	}
-
-	ret = mmap_init("vert.spv", &vert);
-	if (ret != 0) {
-		mmap_fini(&frag);
-		return ret;
+	else if (scene.light_count != 0) {
+		frag_name = "lit.frag.spv";
+	}
+	const struct pack_entry *frag = pack_find(&assets, frag_name,
+	                                          PACK_TYPE_SPIRV);
+	const char *vert_name = "vert.spv";
+	if (options.gpu_culling) {
+		vert_name = "indirect.vert.spv";
+	}
+	else if (options.mesh_name != NULL && options.vertex_pulling) {
+		vert_name = "mesh_pull.vert.spv";
 	}
+	else if (options.mesh_name != NULL) {
+		vert_name = "mesh.vert.spv";
+	}
+	const struct pack_entry *vert = pack_find(&assets, vert_name,
+	                                          PACK_TYPE_SPIRV);
+	if (frag == NULL || vert == NULL) {
+		printf("Shaders missing from " ASSET_PACK_FILENAME "\n");
+		return APP_ERROR_BIT;
+	}
+	command_stream_add_resource(stream, COMMAND_STREAM_VERTEX_SHADER,
+	                            pack_data(&assets, vert), vert->size);
+	command_stream_add_resource(stream, COMMAND_STREAM_FRAGMENT_SHADER,
+	                            pack_data(&assets, frag), frag->size);
 
 	VkShaderModuleCreateInfo shader_module_create_info = {
 		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
-		.codeSize = frag.data_size,
-		.pCode = frag.data,
+		.codeSize = frag->size,
+		.pCode = pack_data(&assets, frag),
 	};
 	VkResult result;
-	VkShaderModule frag_shader_module;
-	result = vkCreateShaderModule(device, &shader_module_create_info, NULL,
-	                              &frag_shader_module);
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator,
+	                              &graphics.frag_shader_module);
 	if (result != VK_SUCCESS) {
-		mmap_fini(&vert);
-		mmap_fini(&frag);
+		graphics.frag_shader_module = VK_NULL_HANDLE;
 		int ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
 
-	shader_module_create_info.codeSize = vert.data_size;
-	shader_module_create_info.pCode = vert.data;
+	shader_module_create_info.codeSize = vert->size;
+	shader_module_create_info.pCode = pack_data(&assets, vert);
 
-	VkShaderModule vert_shader_module;
-	result = vkCreateShaderModule(device, &shader_module_create_info, NULL,
-	                              &vert_shader_module);
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator,
+	                              &graphics.vert_shader_module);
 	if (result != VK_SUCCESS) {
-		vkDestroyShaderModule(device, frag_shader_module, NULL);
-		mmap_fini(&vert);
-		mmap_fini(&frag);
+		graphics.vert_shader_module = VK_NULL_HANDLE;
 		int ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
 	}
+	mmap_faults_add_since(&assets.map, &faults);
+	end_phase(&shader_zone);
+
+	return create_graphics_pipeline(device);
+}
+
+/*
+ * Times the compute post processing chain against the fragment one on the
+ * first window's images, in place of drawing any frames.
+ */
+static uint8_t run_post_benchmark(VkDevice device)
+{
+	if (vulkan.timestamp_valid_bits == 0) {
+		printf("Post process benchmark needs timestamp queries\n");
+		return APP_ERROR_BIT;
+	}
+
+	double compute_ms;
+	double fragment_ms;
+	uint8_t ret = post_benchmark(&post, &windows[0].post_target, device,
+	                             queue, vulkan.graphics_queue_family_index,
+	                             vulkan.timestamp_period,
+	                             vulkan.timestamp_valid_bits,
+	                             POST_BENCHMARK_ITERATIONS,
+	                             &compute_ms, &fragment_ms);
+	if (ret != 0) {
+		return ret;
+	}
+	printf("Post process (%ux%u, %u iterations)\n",
+	       windows[0].extent.width, windows[0].extent.height,
+	       POST_BENCHMARK_ITERATIONS);
+	printf("  compute  %8.3f ms per frame\n", compute_ms);
+	printf("  fragment %8.3f ms per frame\n", fragment_ms);
+	return NO_ERRORS;
+}
+
+/* Every window's framebuffers, retired once its last frame is done */
+uint8_t use_image_views(VkDevice device, uint32_t slot_count)
+{
+	size_t mark = arena_mark(&setup_arena);
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		windows[w].framebuffers = NULL;
+	}
+
+	uint8_t ret = NO_ERRORS;
+	struct trace_zone framebuffer_zone = begin_phase("create_framebuffers");
+	for (uint32_t w = 0; w < options.window_count && ret == 0; ++w) {
+		struct window *window = &windows[w];
+		window->framebuffers = arena_alloc(
+			&setup_arena,
+			window->image_count * sizeof(VkFramebuffer)
+		);
+		if (window->framebuffers == NULL) {
+			ret = LIBC_ERROR_BIT;
+			break;
+		}
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			window->framebuffers[i] = VK_NULL_HANDLE;
+		}
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			const struct gpu_image *gbuffer_images
+				= window->gbuffer_target.images;
+			VkImageView attachments[] = {
+				options.post_mode != POST_MODE_NONE
+				? window->post_target.hdr.view
+				: window->image_views[i],
+				window->depth_image.view,
+				[2 + GBUFFER_ALBEDO]
+					= gbuffer_images[GBUFFER_ALBEDO].view,
+				[2 + GBUFFER_NORMAL]
+					= gbuffer_images[GBUFFER_NORMAL].view,
+			};
+			uint32_t attachment_count = 1;
+			if (options.deferred) {
+				attachment_count = ARRAY_SIZE(attachments);
+			}
+			else if (options.depth) {
+				attachment_count = 2;
+			}
+			VkFramebufferCreateInfo framebuffer_create_info = {
+				.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+				.pNext = NULL,
+				.flags = 0,
+				.renderPass = graphics.render_pass,
+				.attachmentCount = attachment_count,
+				.pAttachments = attachments,
+				.width = window->extent.width,
+				.height = window->extent.height,
+				.layers = 1,
+			};
+			VkResult result;
+			result = vkCreateFramebuffer(device,
+			                             &framebuffer_create_info,
+			                             &host_allocator,
+			                             &window->framebuffers[i]);
+			if (result != VK_SUCCESS) {
+				window->framebuffers[i] = VK_NULL_HANDLE;
+				ret = VULKAN_ERROR_BIT;
+				ret |= print_result(result);
+				break;
+			}
+		}
+	}
+	end_phase(&framebuffer_zone);
+
+	if (ret == 0) {
+		/* Fast linked at first, re-recorded once the optimized one is in */
+		VkPipeline pipeline;
+		struct trace_zone pipeline_zone
+			= begin_phase("wait_for_pipeline");
+		ret = pipeline_compiler_wait(&pipeline_compiler,
+		                             graphics.variant, &pipeline);
+		if (ret == 0) {
+			ret = post_wait_pipelines(&post, &pipeline_compiler);
+		}
+		if (ret == 0 && options.deferred) {
+			ret = gbuffer_wait_pipeline(&gbuffer, &pipeline_compiler);
+		}
+		if (ret == 0 && options.particle_count != 0) {
+			ret = particles_wait_pipeline(&particles,
+			                              &pipeline_compiler);
+		}
+		end_phase(&pipeline_zone);
 
-	ret = use_shader_modules(device, image_views, image_view_count,
-	                         frag_shader_module, vert_shader_module);
+		if (ret == 0 && options.post_benchmark) {
+			ret = run_post_benchmark(device);
+			running = false;
+		}
+		else if (ret == 0) {
+			ret = use_framebuffers(device,
+			                       graphics.render_pass,
+			                       pipeline,
+			                       graphics.pipeline_layout,
+			                       slot_count);
+		}
+	}
 
-	vkDestroyShaderModule(device, vert_shader_module, NULL);
-	vkDestroyShaderModule(device, frag_shader_module, NULL);
-	mmap_fini(&vert);
-	mmap_fini(&frag);
-	return 0;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		if (window->framebuffers == NULL) {
+			continue;
+		}
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			if (window->framebuffers[i] == VK_NULL_HANDLE) {
+				continue;
+			}
+			union deferred_handle handle = {
+				.framebuffer = window->framebuffers[i],
+			};
+			ret |= retire(DEFERRED_FRAMEBUFFER, handle);
+		}
+		window->framebuffers = NULL;
+	}
+	arena_reset(&setup_arena, mark);
+	return ret;
 }
 
-uint8_t use_swapchain(VkDevice device, VkSwapchainKHR swapchain)
+/* The caller retires whatever was created, even on failure */
+static uint8_t create_window_image_views(VkDevice device,
+                                         struct window *window)
 {
-	uint32_t swapchain_image_count;
-
 	VkResult result;
-	result = vkGetSwapchainImagesKHR(device, swapchain,
-	                                 &swapchain_image_count, NULL);
+	result = vkGetSwapchainImagesKHR(device, window->swapchain_khr,
+	                                 &window->image_count, NULL);
 	if (result != VK_SUCCESS) {
-		int ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
+		window->image_count = 0;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	if (window->image_count > MAX_SWAPCHAIN_IMAGES) {
+		printf("Can't use %u swapchain images, at most %u\n",
+		       window->image_count, MAX_SWAPCHAIN_IMAGES);
+		window->image_count = 0;
+		return APP_ERROR_BIT;
 	}
 
-	VkImage *swapchain_images = malloc(
-		swapchain_image_count * sizeof(VkImage)
+	window->images = arena_alloc(&setup_arena,
+	                             window->image_count * sizeof(VkImage));
+	window->image_views = arena_alloc(
+		&setup_arena,
+		window->image_count * sizeof(VkImageView)
 	);
-	if (swapchain_images == NULL) {
+	if (window->images == NULL || window->image_views == NULL) {
+		window->image_views = NULL;
 		return LIBC_ERROR_BIT;
 	}
-
-	result = vkGetSwapchainImagesKHR(device, swapchain,
-	                                 &swapchain_image_count,
-	                                 swapchain_images);
-	if (result != VK_SUCCESS) {
-		free(swapchain_images);
-		int ret = VULKAN_ERROR_BIT;
-		ret |= print_result(result);
-		return ret;
+	for (uint32_t i = 0; i < window->image_count; ++i) {
+		window->image_views[i] = VK_NULL_HANDLE;
 	}
 
-	VkImageView *image_views = malloc(
-		swapchain_image_count * sizeof(VkImageView)
-	);
-	if (image_views == NULL) {
-		free(swapchain_images);
-		return LIBC_ERROR_BIT;
+	result = vkGetSwapchainImagesKHR(device, window->swapchain_khr,
+	                                 &window->image_count,
+	                                 window->images);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
 	}
 
-	for (uint32_t i = 0; i < swapchain_image_count; ++i) {
+	for (uint32_t i = 0; i < window->image_count; ++i) {
 		VkImageViewCreateInfo image_view_create_info = {
 			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
 			.pNext = NULL,
 			.flags = 0,
-			.image = swapchain_images[i],
+			.image = window->images[i],
 			.viewType = VK_IMAGE_VIEW_TYPE_2D,
 			.format = vulkan.swapchain_image_format,
 			.components = {
@@ -864,38 +2472,174 @@ uint8_t use_swapchain(VkDevice device, VkSwapchainKHR swapchain)
 				.layerCount = 1,
 			},
 		};
-		VkResult result;
 		result = vkCreateImageView(device, &image_view_create_info,
-		                           NULL, &(image_views[i]));
+		                           &host_allocator,
+		                           &window->image_views[i]);
 		if (result != VK_SUCCESS) {
-			for (uint32_t j = 0; j < i; ++j) {
-				vkDestroyImageView(device, image_views[j], NULL);
-			}
-			free(image_views);
-			free(swapchain_images);
-			int ret = VULKAN_ERROR_BIT;
-			ret |= print_result(result);
-			return ret;
+			window->image_views[i] = VK_NULL_HANDLE;
+			return VULKAN_ERROR_BIT | print_result(result);
+		}
+	}
+	return NO_ERRORS;
+}
+
+/* Each window has a depth image of its own size */
+static uint8_t create_window_depth_image(VkDevice device,
+                                         struct window *window)
+{
+	VkImageCreateInfo depth_image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = vulkan.depth_format,
+		.extent = {
+			.width = window->extent.width,
+			.height = window->extent.height,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+		         | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	/* Never stored, and read back only within the render pass */
+	if (options.deferred) {
+		depth_image_create_info.usage
+			|= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	}
+	VkImageAspectFlags depth_aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	if (gpu_format_has_stencil(vulkan.depth_format)) {
+		depth_aspect_mask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+	return gpu_image_init(device,
+	                      &vulkan.memory_properties,
+	                      &depth_image_create_info,
+	                      depth_aspect_mask,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      &window->depth_image);
+}
+
+/*
+ * Sets up every window's new swapchain and draws with them. Command buffers
+ * and ring slots are numbered across the windows, each window's from its
+ * first_slot.
+ */
+uint8_t use_swapchains(VkDevice device)
+{
+	size_t mark = arena_mark(&setup_arena);
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		windows[w].image_count = 0;
+		windows[w].images = NULL;
+		windows[w].image_views = NULL;
+	}
+
+	uint8_t ret = NO_ERRORS;
+	uint32_t slot_count = 0;
+	struct trace_zone image_view_zone = begin_phase("create_image_views");
+	for (uint32_t w = 0; w < options.window_count && ret == 0; ++w) {
+		ret = create_window_image_views(device, &windows[w]);
+		windows[w].first_slot = slot_count;
+		slot_count += windows[w].image_count;
+	}
+	end_phase(&image_view_zone);
+
+	if (ret == 0 && options.depth) {
+		struct trace_zone depth_zone = begin_phase("create_depth_image");
+		for (uint32_t w = 0; w < options.window_count && ret == 0;
+		     ++w) {
+			ret = create_window_depth_image(device, &windows[w]);
 		}
+		end_phase(&depth_zone);
+	}
+
+	if (ret == 0 && options.post_mode != POST_MODE_NONE) {
+		struct trace_zone post_zone = begin_phase("create_post_targets");
+		for (uint32_t w = 0; w < options.window_count && ret == 0;
+		     ++w) {
+			struct window *window = &windows[w];
+			ret = post_target_init(&window->post_target, &post,
+			                       device,
+			                       &vulkan.memory_properties,
+			                       &setup_arena,
+			                       window->extent,
+			                       window->image_views,
+			                       window->image_count);
+		}
+		end_phase(&post_zone);
+	}
+
+	if (ret == 0 && options.deferred) {
+		struct trace_zone gbuffer_zone
+			= begin_phase("create_gbuffer_targets");
+		for (uint32_t w = 0; w < options.window_count && ret == 0;
+		     ++w) {
+			struct window *window = &windows[w];
+			ret = gbuffer_target_init(&window->gbuffer_target,
+			                          &gbuffer,
+			                          device,
+			                          &vulkan.memory_properties,
+			                          window->extent,
+			                          window->depth_image.image,
+			                          vulkan.depth_format);
+		}
+		end_phase(&gbuffer_zone);
+	}
+
+	if (ret == 0 && options.capture_filename != NULL) {
+		ret = capture_use_swapchain(&capture,
+		                            &vulkan.memory_properties,
+		                            windows[0].images,
+		                            windows[0].image_count,
+		                            windows[0].extent,
+		                            vulkan.swapchain_image_format);
 	}
 
-	int ret = use_image_views(device, image_views, swapchain_image_count);
+	if (ret == 0) {
+		ret = use_image_views(device, slot_count);
+	}
 
-	for (uint32_t i = 0; i < swapchain_image_count; ++i) {
-		vkDestroyImageView(device, image_views[i], NULL);
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		ret |= deferred_push_image(&deferred, &window->depth_image,
+		                           timeline.submitted);
+		ret |= post_target_retire(&window->post_target, &deferred,
+		                          timeline.submitted);
+		ret |= gbuffer_target_retire(&window->gbuffer_target, &deferred,
+		                             timeline.submitted);
+		if (window->image_views == NULL) {
+			continue;
+		}
+		for (uint32_t i = 0; i < window->image_count; ++i) {
+			if (window->image_views[i] == VK_NULL_HANDLE) {
+				continue;
+			}
+			union deferred_handle handle = {
+				.image_view = window->image_views[i],
+			};
+			ret |= retire(DEFERRED_IMAGE_VIEW, handle);
+		}
+		window->images = NULL;
+		window->image_views = NULL;
 	}
-	free(image_views);
-	free(swapchain_images);
+	arena_reset(&setup_arena, mark);
 	return ret;
 }
 
-uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
+static uint8_t surface_capabilities(VkPhysicalDevice physical_device,
+                                    struct window *window)
 {
 	VkSurfaceCapabilitiesKHR surface_capabilities_khr;
 	VkResult result;
 	result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
 		physical_device,
-		vulkan.surface, // TODO: surface_khr
+		window->surface_khr,
 		&surface_capabilities_khr
 	);
 	if (result != VK_SUCCESS) {
@@ -904,23 +2648,32 @@ uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
 		return ret;
 	}
 
-	if (vulkan.swapchain_image_extent.width > surface_capabilities_khr.maxImageExtent.width ||
-	    vulkan.swapchain_image_extent.width < surface_capabilities_khr.minImageExtent.width) {
+	if (window->extent.width > surface_capabilities_khr.maxImageExtent.width ||
+	    window->extent.width < surface_capabilities_khr.minImageExtent.width) {
 		return APP_ERROR_BIT;
 	}
 
-	if (vulkan.swapchain_image_extent.height > surface_capabilities_khr.maxImageExtent.height ||
-	    vulkan.swapchain_image_extent.height < surface_capabilities_khr.minImageExtent.height) {
+	if (window->extent.height > surface_capabilities_khr.maxImageExtent.height ||
+	    window->extent.height < surface_capabilities_khr.minImageExtent.height) {
 		return APP_ERROR_BIT;
 	}
 
-	vulkan.min_image_count = surface_capabilities_khr.minImageCount;
-	vulkan.current_transform = surface_capabilities_khr.currentTransform;
+	window->min_image_count = surface_capabilities_khr.minImageCount;
+	window->current_transform = surface_capabilities_khr.currentTransform;
+	vulkan.swapchain_supported_usage
+		&= surface_capabilities_khr.supportedUsageFlags;
+
+	/* Captured frames are copied out of the swapchain images */
+	if (options.capture_filename != NULL
+	    && !(surface_capabilities_khr.supportedUsageFlags
+	         & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+		printf("Can't capture, swapchain images can't be copied from\n");
+		return APP_ERROR_BIT;
+	}
 
 	VkBool32 supported;
 	result = vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, 0,
-	                                              // TODO: surface_khr
-	                                              vulkan.surface,
+	                                              window->surface_khr,
 	                                              &supported);
 	if (result != VK_SUCCESS) {
 		int ret = VULKAN_ERROR_BIT;
@@ -933,8 +2686,7 @@ uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
 
 	uint32_t surface_format_count;
 	result = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device,
-	                                              // TODO: surface_khr
-	                                              vulkan.surface,
+	                                              window->surface_khr,
 	                                              &surface_format_count,
 	                                              NULL);
 	if (result != VK_SUCCESS) {
@@ -942,19 +2694,20 @@ uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
 		ret |= print_result(result);
 		return ret;
 	}
-	VkSurfaceFormatKHR *surface_formats = malloc(
+	size_t mark = arena_mark(&setup_arena);
+	VkSurfaceFormatKHR *surface_formats = arena_alloc(
+		&setup_arena,
 		surface_format_count * sizeof(VkSurfaceFormatKHR)
 	);
 	if (surface_formats == NULL) {
 		return LIBC_ERROR_BIT;
 	}
 	result = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device,
-	                                              // TODO: surface_khr
-	                                              vulkan.surface,
+	                                              window->surface_khr,
 	                                              &surface_format_count,
 	                                              surface_formats);
 	if (result != VK_SUCCESS) {
-		free(surface_formats);
+		arena_reset(&setup_arena, mark);
 		int ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
@@ -967,7 +2720,7 @@ uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
 			found = true;
 		}
 	}
-	free(surface_formats);
+	arena_reset(&setup_arena, mark);
 
 	if (found) {
 		return 0;
@@ -977,11 +2730,25 @@ uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
 	}
 }
 
-uint8_t physical_device_has_swapchain_extension(
+/* Every window's surface has to take the same swapchain format */
+uint8_t physical_device_capabilities(VkPhysicalDevice physical_device)
+{
+	vulkan.swapchain_supported_usage = ~(VkImageUsageFlags) 0;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		uint8_t ret = surface_capabilities(physical_device, &windows[w]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return NO_ERRORS;
+}
+
+uint8_t physical_device_has_extension(
 	VkPhysicalDevice physical_device,
-	bool *has_swapchain_extension)
+	const char *extension_name,
+	bool *has_extension)
 {
-	*has_swapchain_extension = false;
+	*has_extension = false;
 
 	VkResult result;
 	uint32_t extension_property_count;
@@ -993,7 +2760,9 @@ uint8_t physical_device_has_swapchain_extension(
 		return ret;
 	}
 
-	VkExtensionProperties *extension_properties = malloc(
+	size_t mark = arena_mark(&setup_arena);
+	VkExtensionProperties *extension_properties = arena_alloc(
+		&setup_arena,
 		extension_property_count * sizeof(VkExtensionProperties)
 	);
 	if (extension_properties == NULL) {
@@ -1003,7 +2772,7 @@ uint8_t physical_device_has_swapchain_extension(
 		physical_device, NULL, &extension_property_count,
 		extension_properties);
 	if (result != VK_SUCCESS) {
-		free(extension_properties);
+		arena_reset(&setup_arena, mark);
 		int ret = VULKAN_ERROR_BIT;
 		ret |= print_result(result);
 		return ret;
@@ -1011,11 +2780,11 @@ uint8_t physical_device_has_swapchain_extension(
 
 	for (uint32_t i = 0; i < extension_property_count; ++i) {
 		if (strcmp(extension_properties[i].extensionName,
-		           "VK_KHR_swapchain") == 0) {
-			*has_swapchain_extension = true;
+		           extension_name) == 0) {
+			*has_extension = true;
 		}
 	}
-	free(extension_properties);
+	arena_reset(&setup_arena, mark);
 
 	return 0;
 }
@@ -1073,9 +2842,10 @@ static void shell_surface_configure(void *data,
                                     struct zxdg_surface_v6 *shell_surface,
                                     uint32_t serial)
 {
-	(void) data;
+	struct window *window = data;
 
 	zxdg_surface_v6_ack_configure(shell_surface, serial);
+	window->configured = true;
 };
 
 static struct zxdg_surface_v6_listener shell_surface_listener = {
@@ -1088,27 +2858,18 @@ static void toplevel_configure(void *data,
                                int32_t height,
                                struct wl_array *states)
 {
-	(void) data;
+	struct window *window = data;
 	(void) toplevel;
-	(void) width;
-	(void) height;
 	(void) states;
 
 	if (width <= 0 || height <= 0) {
 		return;
 	}
 
-	if ((uint32_t) width == vulkan.swapchain_image_extent.width &&
-	    (uint32_t) height == vulkan.swapchain_image_extent.height) {
-		return;
-	}
-
-	vulkan.swapchain_image_extent.width = (uint32_t) width;
-	vulkan.swapchain_image_extent.height = (uint32_t) height;
-	resize = true;
-	zxdg_surface_v6_set_window_geometry(wayland.shell_surface, 0, 0,
-	                                    vulkan.swapchain_image_extent.width,
-	                                    vulkan.swapchain_image_extent.height);
+	configure_window(window, (uint32_t) width, (uint32_t) height);
+	zxdg_surface_v6_set_window_geometry(window->shell_surface, 0, 0,
+	                                    window->pending_extent.width,
+	                                    window->pending_extent.height);
 }
 
 static void toplevel_close(void *data,
@@ -1216,6 +2977,37 @@ struct wl_keyboard_listener keyboard_listener = {
 	.repeat_info = keyboard_repeat_info,
 };
 
+static uint8_t create_window_surface(struct window *window)
+{
+	window->surface = wl_compositor_create_surface(wayland.compositor);
+	if (window->surface == NULL) {
+		return WAYLAND_ERROR_BIT;
+	}
+
+	window->shell_surface = zxdg_shell_v6_get_xdg_surface(wayland.shell,
+	                                                      window->surface);
+	if (window->shell_surface == NULL) {
+		return WAYLAND_ERROR_BIT;
+	}
+	zxdg_surface_v6_add_listener(window->shell_surface,
+	                             &shell_surface_listener, window);
+
+	window->toplevel = zxdg_surface_v6_get_toplevel(window->shell_surface);
+	if (window->toplevel == NULL) {
+		return WAYLAND_ERROR_BIT;
+	}
+	zxdg_toplevel_v6_add_listener(window->toplevel,
+	                              &toplevel_listener, window);
+
+	zxdg_toplevel_v6_set_title(window->toplevel, "Hello Vulkan");
+	zxdg_toplevel_v6_set_app_id(window->toplevel, "io.eyl.HelloVulkan");
+	zxdg_surface_v6_set_window_geometry(window->shell_surface, 0, 0,
+	                                    window->extent.width,
+	                                    window->extent.height);
+	wl_surface_commit(window->surface);
+	return NO_ERRORS;
+}
+
 static uint8_t wayland_init()
 {
 	wayland.display = wl_display_connect(NULL);
@@ -1244,49 +3036,68 @@ static uint8_t wayland_init()
 
 	zxdg_shell_v6_add_listener(wayland.shell, &shell_listener, NULL);
 
-	wayland.surface = wl_compositor_create_surface(wayland.compositor);
-	if (wayland.surface == NULL) {
-		return WAYLAND_ERROR_BIT;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		uint8_t err = create_window_surface(&windows[w]);
+		if (err) {
+			return err;
+		}
 	}
 
-	wayland.shell_surface = zxdg_shell_v6_get_xdg_surface(wayland.shell,
-	                                                      wayland.surface);
-	if (wayland.shell_surface == NULL) {
-		return WAYLAND_ERROR_BIT;
-	}
-	zxdg_surface_v6_add_listener(wayland.shell_surface,
-	                             &shell_surface_listener, NULL);
+	return 0;
+}
 
-	wayland.toplevel = zxdg_surface_v6_get_toplevel(wayland.shell_surface);
-	if (wayland.toplevel == NULL) {
-		return WAYLAND_ERROR_BIT;
+/* Each surface may not be presented to before its first configure */
+static uint8_t wait_for_configure()
+{
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		while (!windows[w].configured) {
+			if (wl_display_dispatch(wayland.display) < 0) {
+				return WAYLAND_ERROR_BIT;
+			}
+		}
 	}
-	zxdg_toplevel_v6_add_listener(wayland.toplevel,
-	                              &toplevel_listener, NULL);
-
-	zxdg_toplevel_v6_set_title(wayland.toplevel, "Hello Vulkan");
-	zxdg_toplevel_v6_set_app_id(wayland.toplevel, "io.eyl.HelloVulkan");
-	zxdg_surface_v6_set_window_geometry(wayland.shell_surface, 0, 0,
-	                                    vulkan.swapchain_image_extent.width,
-	                                    vulkan.swapchain_image_extent.height);
-	wl_surface_commit(wayland.surface);
-
-	return 0;
+	return NO_ERRORS;
 }
 
-static void destroy_swapchain()
+static void destroy_swapchains()
 {
-	if (vulkan.swapchain != VK_NULL_HANDLE) {
-		vkDestroySwapchainKHR(vulkan.device, vulkan.swapchain, NULL);
-		vulkan.swapchain = VK_NULL_HANDLE;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		if (windows[w].swapchain_khr != VK_NULL_HANDLE) {
+			vkDestroySwapchainKHR(vulkan.device,
+			                      windows[w].swapchain_khr,
+			                      &host_allocator);
+			windows[w].swapchain_khr = VK_NULL_HANDLE;
+		}
 	}
 }
 
 static void vulkan_fini()
 {
-	destroy_swapchain();
 	if (vulkan.device != VK_NULL_HANDLE) {
-		vkDestroyDevice(vulkan.device, NULL);
+		/*
+		 * Not just the timeline: queued presents may still wait on
+		 * the swapchains and semaphores destroyed below
+		 */
+		if (queue != VK_NULL_HANDLE) {
+			vkQueueWaitIdle(queue);
+		}
+		/* Destroyed with the rest, like the swapchains they follow */
+		for (uint32_t w = 0; w < options.window_count; ++w) {
+			flush_retired_swapchain(&windows[w]);
+		}
+		deferred_fini(&deferred, vulkan.device);
+	}
+	destroy_swapchains();
+	if (vulkan.device != VK_NULL_HANDLE) {
+		destroy_graphics(vulkan.device);
+		particles_fini(&particles, vulkan.device);
+		gpu_mesh_fini(&gpu_mesh, vulkan.device);
+		gpu_cull_fini(&gpu_cull, vulkan.device);
+		gpu_buffer_fini(vulkan.device, &light_buffer);
+		bindless_fini(&bindless, vulkan.device);
+		uniform_ring_fini(&uniform_ring, vulkan.device);
+		timeline_fini(&timeline, vulkan.device);
+		vkDestroyDevice(vulkan.device, &host_allocator);
 		vulkan.device = VK_NULL_HANDLE;
 	}
 	if (vulkan.physical_devices != NULL) {
@@ -1294,12 +3105,16 @@ static void vulkan_fini()
 		vulkan.physical_devices = NULL;
 		vulkan.physical_device_count = 0;
 	}
-	if (vulkan.surface != VK_NULL_HANDLE) {
-		vkDestroySurfaceKHR(vulkan.instance, vulkan.surface, NULL);
-		vulkan.surface = VK_NULL_HANDLE;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		if (windows[w].surface_khr != VK_NULL_HANDLE) {
+			vkDestroySurfaceKHR(vulkan.instance,
+			                    windows[w].surface_khr,
+			                    &host_allocator);
+			windows[w].surface_khr = VK_NULL_HANDLE;
+		}
 	}
 	if (vulkan.instance != VK_NULL_HANDLE) {
-		vkDestroyInstance(vulkan.instance, NULL);
+		vkDestroyInstance(vulkan.instance, &host_allocator);
 		vulkan.instance = VK_NULL_HANDLE;
 	}
 }
@@ -1314,17 +3129,20 @@ static void wayland_fini()
 		wl_seat_destroy(wayland.seat);
 		wayland.seat = NULL;
 	}
-	if (wayland.toplevel != NULL) {
-		zxdg_toplevel_v6_destroy(wayland.toplevel);
-		wayland.toplevel = NULL;
-	}
-	if (wayland.shell_surface != NULL) {
-		zxdg_surface_v6_destroy(wayland.shell_surface);
-		wayland.shell_surface = NULL;
-	}
-	if (wayland.surface != NULL) {
-		wl_surface_destroy(wayland.surface);
-		wayland.surface = NULL;
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		struct window *window = &windows[w];
+		if (window->toplevel != NULL) {
+			zxdg_toplevel_v6_destroy(window->toplevel);
+			window->toplevel = NULL;
+		}
+		if (window->shell_surface != NULL) {
+			zxdg_surface_v6_destroy(window->shell_surface);
+			window->shell_surface = NULL;
+		}
+		if (window->surface != NULL) {
+			wl_surface_destroy(window->surface);
+			window->surface = NULL;
+		}
 	}
 	if (wayland.shell != NULL) {
 		zxdg_shell_v6_destroy(wayland.shell);
@@ -1344,7 +3162,8 @@ static void wayland_fini()
 	}
 }
 
-static uint8_t create_swapchain(VkSwapchainKHR *swapchain_ptr, VkDevice device)
+/* Replaces the window's swapchain, retiring the old one */
+static uint8_t create_swapchain(struct window *window, VkDevice device)
 {
 	uint32_t queue_family_index = vulkan.graphics_queue_family_index;
 	uint32_t queue_index = 0;
@@ -1354,33 +3173,46 @@ static uint8_t create_swapchain(VkSwapchainKHR *swapchain_ptr, VkDevice device)
 		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
 		.pNext = NULL,
 		.flags = 0,
-		.surface = vulkan.surface, // TODO: surface_khr
-		.minImageCount = vulkan.min_image_count,
+		.surface = window->surface_khr,
+		.minImageCount = window->min_image_count,
 		.imageFormat = vulkan.swapchain_image_format,
 		.imageColorSpace = vulkan.swapchain_image_color_space,
-		.imageExtent = vulkan.swapchain_image_extent,
+		.imageExtent = window->extent,
 		.imageArrayLayers = 1,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+		              | (options.capture_filename != NULL
+		                 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+		                 : 0),
 		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
 		.queueFamilyIndexCount = 0,
 		.pQueueFamilyIndices = NULL,
-		.preTransform = vulkan.current_transform,
+		.preTransform = window->current_transform,
 		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
 		.presentMode = VK_PRESENT_MODE_FIFO_KHR,
 		.clipped = VK_TRUE,
-		.oldSwapchain = VK_NULL_HANDLE,
+		.oldSwapchain = window->swapchain_khr,
 	};
 
+	/* Compute post processing writes the images one way or the other */
+	if (options.post_mode == POST_MODE_COMPUTE) {
+		swapchain_create_info.imageUsage
+			|= vulkan.post_storage_output
+			   ? VK_IMAGE_USAGE_STORAGE_BIT
+			   : VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+
 	VkResult result = vkCreateSwapchainKHR(
 		device,
 		&swapchain_create_info,
-		NULL,
-		swapchain_ptr
+		&host_allocator,
+		&window->swapchain_khr
 	);
 	if (result != VK_SUCCESS) {
 		return VULKAN_ERROR_BIT | print_result(result);
 	}
 
+	/* Its last frames may still be presenting, so it goes with them */
+	window->retired_swapchain = swapchain_create_info.oldSwapchain;
 	return NO_ERRORS;
 }
 
@@ -1392,7 +3224,9 @@ static uint32_t find_graphics_queue_family_index(
 	vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
 	                                         &queue_family_property_count,
 	                                         NULL);
-	VkQueueFamilyProperties *queue_family_properties = malloc(
+	size_t mark = arena_mark(&setup_arena);
+	VkQueueFamilyProperties *queue_family_properties = arena_alloc(
+		&setup_arena,
 		queue_family_property_count * sizeof(VkQueueFamilyProperties)
 	);
 	if (queue_family_properties == NULL) {
@@ -1406,6 +3240,8 @@ static uint32_t find_graphics_queue_family_index(
 		if (queue_family_properties[i].queueFlags
 		    & VK_QUEUE_GRAPHICS_BIT) {
 			vulkan.graphics_queue_family_index = i;
+			vulkan.timestamp_valid_bits
+				= queue_family_properties[i].timestampValidBits;
 			graphics_found = true;
 			break;
 		}
@@ -1417,11 +3253,211 @@ static uint32_t find_graphics_queue_family_index(
 		err = APP_ERROR_BIT;
 	}
 
-	free(queue_family_properties);
+	arena_reset(&setup_arena, mark);
 
 	return err;
 }
 
+/*
+ * Leaves graphicsPipelineLibrary false unless both extensions are there and
+ * the feature is supported; the pipeline compiler falls back to monolithic
+ * pipelines in that case.
+ */
+static uint8_t find_graphics_pipeline_library(
+	VkPhysicalDevice physical_device,
+	const VkPhysicalDeviceProperties *properties,
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT *features)
+{
+	features->graphicsPipelineLibrary = VK_FALSE;
+
+	if (!options.pipeline_library
+	    || properties->apiVersion < VK_API_VERSION_1_1) {
+		return NO_ERRORS;
+	}
+
+	const char *extension_names[] = {
+		"VK_KHR_pipeline_library",
+		"VK_EXT_graphics_pipeline_library",
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(extension_names); ++i) {
+		bool has_extension;
+		uint8_t err = physical_device_has_extension(physical_device,
+		                                            extension_names[i],
+		                                            &has_extension);
+		if (err) {
+			return err;
+		}
+		if (!has_extension) {
+			return NO_ERRORS;
+		}
+	}
+
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = features,
+	};
+	vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+	features->pNext = NULL;
+
+	return NO_ERRORS;
+}
+
+/* Leaves timelineSemaphore false unless the extension supports it */
+static uint8_t find_timeline_semaphore(
+	VkPhysicalDevice physical_device,
+	const VkPhysicalDeviceProperties *properties,
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR *features)
+{
+	features->timelineSemaphore = VK_FALSE;
+
+	if (properties->apiVersion < VK_API_VERSION_1_1) {
+		return NO_ERRORS;
+	}
+
+	bool has_extension;
+	uint8_t err = physical_device_has_extension(physical_device,
+	                                            "VK_KHR_timeline_semaphore",
+	                                            &has_extension);
+	if (err || !has_extension) {
+		return err;
+	}
+
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = features,
+	};
+	vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+	features->pNext = NULL;
+
+	return NO_ERRORS;
+}
+
+/*
+ * Compute post processing stores into swapchain images when their usage and
+ * format allow it, and needs to write them without a format qualifier, since
+ * the shader can't know the surface's format. Otherwise it blits into them.
+ */
+static uint8_t find_post_output(VkPhysicalDevice physical_device,
+                                const VkPhysicalDeviceFeatures
+                                *supported_features)
+{
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(physical_device,
+	                                    vulkan.swapchain_image_format,
+	                                    &format_properties);
+	VkFormatFeatureFlags features = format_properties.optimalTilingFeatures;
+
+	vulkan.post_storage_output
+		= (vulkan.swapchain_supported_usage
+		   & VK_IMAGE_USAGE_STORAGE_BIT)
+		  && (features & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+		  && supported_features->shaderStorageImageWriteWithoutFormat;
+	if (vulkan.post_storage_output) {
+		vulkan.enabled_features.shaderStorageImageWriteWithoutFormat
+			= VK_TRUE;
+		return NO_ERRORS;
+	}
+	if (!(vulkan.swapchain_supported_usage
+	      & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+	    || !(features & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+		printf("Compute post processing needs swapchain images it can"
+		       " store into or blit into\n");
+		return APP_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
+
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/*
+ * Bindless descriptors need update after bind, partially bound and variable
+ * count bindings for storage buffers and sampled images; without all of them
+ * the bindless capacities are kept within the core per stage limits. Sets
+ * only the features used in enabled.
+ */
+static uint8_t find_descriptor_indexing(
+	VkPhysicalDevice physical_device,
+	const VkPhysicalDeviceProperties *properties,
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT *enabled)
+{
+	vulkan.descriptor_indexing = false;
+	vulkan.bindless_capacities[BINDLESS_STORAGE_BUFFERS] = min_u32(
+		properties->limits.maxPerStageDescriptorStorageBuffers,
+		BINDLESS_FALLBACK_CAPACITY
+	);
+	vulkan.bindless_capacities[BINDLESS_SAMPLED_IMAGES] = min_u32(
+		properties->limits.maxPerStageDescriptorSampledImages,
+		BINDLESS_FALLBACK_CAPACITY
+	);
+
+	if (properties->apiVersion < VK_API_VERSION_1_1) {
+		return NO_ERRORS;
+	}
+
+	const char *extension_names[] = {
+		"VK_KHR_maintenance3",
+		"VK_EXT_descriptor_indexing",
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(extension_names); ++i) {
+		bool has_extension;
+		uint8_t err = physical_device_has_extension(physical_device,
+		                                            extension_names[i],
+		                                            &has_extension);
+		if (err) {
+			return err;
+		}
+		if (!has_extension) {
+			return NO_ERRORS;
+		}
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+		.pNext = NULL,
+	};
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &supported,
+	};
+	vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+	if (!supported.descriptorBindingStorageBufferUpdateAfterBind
+	    || !supported.descriptorBindingSampledImageUpdateAfterBind
+	    || !supported.descriptorBindingPartiallyBound
+	    || !supported.descriptorBindingVariableDescriptorCount) {
+		return NO_ERRORS;
+	}
+
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
+		.pNext = NULL,
+	};
+	VkPhysicalDeviceProperties2 properties2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &limits,
+	};
+	vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+	vulkan.bindless_capacities[BINDLESS_STORAGE_BUFFERS] = min_u32(
+		min_u32(limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		        limits.maxDescriptorSetUpdateAfterBindStorageBuffers),
+		BINDLESS_MAX_STORAGE_BUFFERS
+	);
+	vulkan.bindless_capacities[BINDLESS_SAMPLED_IMAGES] = min_u32(
+		min_u32(limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		        limits.maxDescriptorSetUpdateAfterBindSampledImages),
+		BINDLESS_MAX_SAMPLED_IMAGES
+	);
+
+	enabled->descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	enabled->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	enabled->descriptorBindingPartiallyBound = VK_TRUE;
+	enabled->descriptorBindingVariableDescriptorCount = VK_TRUE;
+	vulkan.descriptor_indexing = true;
+	return NO_ERRORS;
+}
+
 static uint8_t create_device(VkDevice *device_ptr,
                              VkPhysicalDevice *physical_devices,
                              size_t index)
@@ -1434,23 +3470,168 @@ static uint8_t create_device(VkDevice *device_ptr,
 	if (err) {
 		return err;
 	}
-
-	bool has_swapchain_extension;
-	int ret = physical_device_has_swapchain_extension(
-		physical_device,
-		&has_swapchain_extension
-	);
-	if (ret != 0) {
-		return ret;
-	}
-	if (!has_swapchain_extension) {
-		/* Graphics card can't present image directly to screen */
+
+	bool has_swapchain_extension;
+	int ret = physical_device_has_extension(
+		physical_device,
+		"VK_KHR_swapchain",
+		&has_swapchain_extension
+	);
+	if (ret != 0) {
+		return ret;
+	}
+	if (!has_swapchain_extension) {
+		/* Graphics card can't present image directly to screen */
+		return APP_ERROR_BIT;
+	}
+
+	ret = physical_device_capabilities(physical_device);
+	if (ret != 0) {
+		return ret;
+	}
+
+	vulkan.physical_device = physical_device;
+	vkGetPhysicalDeviceMemoryProperties(physical_device,
+	                                    &vulkan.memory_properties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	vulkan.timestamp_period = properties.limits.timestampPeriod;
+	vulkan.min_uniform_buffer_offset_alignment
+		= properties.limits.minUniformBufferOffsetAlignment;
+
+	if (options.depth) {
+		err = gpu_select_depth_format(physical_device,
+		                              &vulkan.depth_format);
+		if (err) {
+			return err;
+		}
+	}
+
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+	memset(&vulkan.enabled_features, 0, sizeof(vulkan.enabled_features));
+	vulkan.enabled_features.pipelineStatisticsQuery
+		= supported_features.pipelineStatisticsQuery;
+	/* Draws index the bindless arrays with a push constant */
+	vulkan.enabled_features.shaderStorageBufferArrayDynamicIndexing
+		= supported_features.shaderStorageBufferArrayDynamicIndexing;
+	vulkan.enabled_features.shaderSampledImageArrayDynamicIndexing
+		= supported_features.shaderSampledImageArrayDynamicIndexing;
+
+	if (options.post_mode == POST_MODE_COMPUTE) {
+		err = find_post_output(physical_device, &supported_features);
+		if (err) {
+			return err;
+		}
+	}
+
+	const char *enabled_extension_names[7];
+	uint32_t enabled_extension_count = 0;
+	enabled_extension_names[enabled_extension_count++] = "VK_KHR_swapchain";
+
+	if (options.gpu_culling) {
+		/* Indirect draws pick the object with firstInstance */
+		if (!supported_features.multiDrawIndirect
+		    || !supported_features.drawIndirectFirstInstance) {
+			printf("GPU culling needs multiDrawIndirect"
+			       " and drawIndirectFirstInstance\n");
+			return APP_ERROR_BIT;
+		}
+		vulkan.enabled_features.multiDrawIndirect = VK_TRUE;
+		vulkan.enabled_features.drawIndirectFirstInstance = VK_TRUE;
+		/* All objects go in one draw, only 2^16 - 1 are guaranteed */
+		if (options.object_count
+		    > properties.limits.maxDrawIndirectCount) {
+			printf("GPU culling draws at most %u objects\n",
+			       properties.limits.maxDrawIndirectCount);
+			return APP_ERROR_BIT;
+		}
+		/* The draws read the spheres from a bindless storage buffer */
+		if (!supported_features.shaderStorageBufferArrayDynamicIndexing) {
+			printf("GPU culling needs"
+			       " shaderStorageBufferArrayDynamicIndexing\n");
+			return APP_ERROR_BIT;
+		}
+
+		ret = physical_device_has_extension(
+			physical_device,
+			"VK_KHR_draw_indirect_count",
+			&vulkan.draw_indirect_count
+		);
+		if (ret != 0) {
+			return ret;
+		}
+		if (vulkan.draw_indirect_count) {
+			enabled_extension_names[enabled_extension_count++]
+				= "VK_KHR_draw_indirect_count";
+		}
+	}
+
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT
+	graphics_pipeline_library_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+		.pNext = NULL,
+		.graphicsPipelineLibrary = VK_FALSE,
+	};
+	err = find_graphics_pipeline_library(physical_device, &properties,
+	                                     &graphics_pipeline_library_features);
+	if (err) {
+		return err;
+	}
+	vulkan.graphics_pipeline_library
+		= graphics_pipeline_library_features.graphicsPipelineLibrary;
+	if (vulkan.graphics_pipeline_library) {
+		enabled_extension_names[enabled_extension_count++]
+			= "VK_KHR_pipeline_library";
+		enabled_extension_names[enabled_extension_count++]
+			= "VK_EXT_graphics_pipeline_library";
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT
+	descriptor_indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+		.pNext = NULL,
+	};
+	err = find_descriptor_indexing(physical_device, &properties,
+	                               &descriptor_indexing_features);
+	if (err) {
+		return err;
+	}
+	if (vulkan.descriptor_indexing) {
+		enabled_extension_names[enabled_extension_count++]
+			= "VK_KHR_maintenance3";
+		enabled_extension_names[enabled_extension_count++]
+			= "VK_EXT_descriptor_indexing";
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR
+	timeline_semaphore_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+		.pNext = NULL,
+		.timelineSemaphore = VK_FALSE,
+	};
+	err = find_timeline_semaphore(physical_device, &properties,
+	                              &timeline_semaphore_features);
+	if (err) {
+		return err;
+	}
+	if (!timeline_semaphore_features.timelineSemaphore) {
+		printf("Frame synchronization needs VK_KHR_timeline_semaphore\n");
 		return APP_ERROR_BIT;
 	}
-
-	ret = physical_device_capabilities(physical_device);
-	if (ret != 0) {
-		return ret;
+	enabled_extension_names[enabled_extension_count++]
+		= "VK_KHR_timeline_semaphore";
+
+	/* Chain the feature structures of the extensions in use */
+	void *enabled_feature_chain = &timeline_semaphore_features;
+	if (vulkan.graphics_pipeline_library) {
+		graphics_pipeline_library_features.pNext = enabled_feature_chain;
+		enabled_feature_chain = &graphics_pipeline_library_features;
+	}
+	if (vulkan.descriptor_indexing) {
+		descriptor_indexing_features.pNext = enabled_feature_chain;
+		enabled_feature_chain = &descriptor_indexing_features;
 	}
 
 	const float queue_priorities[1] = {1.0f};
@@ -1466,29 +3647,29 @@ static uint8_t create_device(VkDevice *device_ptr,
 	};
 	const char *const enabled_layer_names[] = {
 	};
-	const char *const enabled_extension_names[] = {
-		"VK_KHR_swapchain",
-	};
 	VkDeviceCreateInfo device_create_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = NULL,
+		.pNext = enabled_feature_chain,
 		.flags = 0,
 		.queueCreateInfoCount = ARRAY_SIZE(device_queue_create_infos),
 		.pQueueCreateInfos = device_queue_create_infos,
 		.enabledLayerCount = ARRAY_SIZE(enabled_layer_names),
 		.ppEnabledLayerNames = enabled_layer_names,
-		.enabledExtensionCount = ARRAY_SIZE(enabled_extension_names),
+		.enabledExtensionCount = enabled_extension_count,
 		.ppEnabledExtensionNames = enabled_extension_names,
-		.pEnabledFeatures = NULL,
+		.pEnabledFeatures = &vulkan.enabled_features,
 	};
 	VkResult result;
 	result = vkCreateDevice(physical_device,
 	                        &device_create_info,
-	                        NULL,
+	                        &host_allocator,
 	                        device_ptr);
 	if (result != VK_SUCCESS) {
 		return VULKAN_ERROR_BIT | print_result(result);
 	}
+	/* Uploads need it before there is a swapchain */
+	vkGetDeviceQueue(*device_ptr, vulkan.graphics_queue_family_index, 0,
+	                 &queue);
 
 	return NO_ERRORS;
 }
@@ -1535,21 +3716,36 @@ static uint8_t create_physical_devices(VkPhysicalDevice **physical_devices_ptr,
 	return NO_ERRORS;
 }
 
-static uint8_t create_surface(VkSurfaceKHR *surface_ptr,
-                              VkInstance instance)
+static uint8_t create_surface(struct window *window, VkInstance instance)
 {
+	VkResult result;
+	if (options.headless) {
+		VkHeadlessSurfaceCreateInfoEXT headless_surface_create_info_ext = {
+			.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+			.pNext = NULL,
+			.flags = 0,
+		};
+		result = vkCreateHeadlessSurfaceEXT(instance,
+		                                    &headless_surface_create_info_ext,
+		                                    &host_allocator,
+		                                    &window->surface_khr);
+		if (result != VK_SUCCESS) {
+			return VULKAN_ERROR_BIT | print_result(result);
+		}
+		return NO_ERRORS;
+	}
+
 	VkWaylandSurfaceCreateInfoKHR wayland_surface_create_info_khr = {
 		.sType = VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
 		.pNext = NULL,
 		.flags = 0,
 		.display = wayland.display,
-		.surface = wayland.surface,
+		.surface = window->surface,
 	};
-	VkResult result;
 	result = vkCreateWaylandSurfaceKHR(instance,
 	                                   &wayland_surface_create_info_khr,
-	                                   NULL,
-	                                   surface_ptr);
+	                                   &host_allocator,
+	                                   &window->surface_khr);
 	if (result != VK_SUCCESS) {
 		return VULKAN_ERROR_BIT | print_result(result);
 	}
@@ -1562,20 +3758,31 @@ static uint8_t create_instance(VkInstance *instance_ptr)
 	};
 	const char *enabled_extension_names[] = {
 		"VK_KHR_surface",
-		"VK_KHR_wayland_surface",
+		options.headless ? "VK_EXT_headless_surface"
+		                 : "VK_KHR_wayland_surface",
+	};
+	/* 1.1 for vkGetPhysicalDeviceFeatures2 */
+	VkApplicationInfo application_info = {
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pNext = NULL,
+		.pApplicationName = "hello-vulkan",
+		.applicationVersion = 0,
+		.pEngineName = NULL,
+		.engineVersion = 0,
+		.apiVersion = VK_API_VERSION_1_1,
 	};
 	VkInstanceCreateInfo instance_create_info = {
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
-		.pApplicationInfo = NULL,
+		.pApplicationInfo = &application_info,
 		.enabledLayerCount = ARRAY_SIZE(enabled_layer_names),
 		.ppEnabledLayerNames = enabled_layer_names,
 		.enabledExtensionCount = ARRAY_SIZE(enabled_extension_names),
 		.ppEnabledExtensionNames = enabled_extension_names,
 	};
 	VkResult result;
-	result = vkCreateInstance(&instance_create_info, NULL,
+	result = vkCreateInstance(&instance_create_info, &host_allocator,
 	                          instance_ptr);
 	if (result != VK_SUCCESS) {
 		return VULKAN_ERROR_BIT | print_result(result);
@@ -1583,55 +3790,877 @@ static uint8_t create_instance(VkInstance *instance_ptr)
 	return NO_ERRORS;
 }
 
-int main(int argc, char **argv)
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+	       "  --depth               use a depth buffer, drawing front to back\n"
+	       "  --objects=N           draw N overlapping triangles\n"
+	       "  --overdraw-benchmark  compare fragment invocations per draw order\n"
+	       "  --gpu-culling         cull on the GPU and draw indirectly\n"
+	       "  --cpu-culling         cull on the CPU before recording draws\n"
+	       "  --cull-benchmark      time each CPU culling kernel, with one\n"
+	       "                        and with every thread\n"
+	       "  --trace=FILE          write a Chrome trace of CPU and GPU work\n"
+	       "  --headless            render without a window\n"
+	       "  --frames=N            exit after N frames\n"
+	       "  --resize-interval=N   resize every N frames, headless only\n"
+	       "  --resize-storm=N      send N configures to random sizes, up\n"
+	       "                        to 4 a frame, headless only\n"
+	       "  --report              print frame time statistics on exit\n"
+	       "  --no-pipeline-library build monolithic pipelines only\n"
+	       "  --mmap-hints=LIST     how to map assets: none, populate,\n"
+	       "                        sequential, willneed, huge, readahead\n"
+	       "  --mesh=NAME           draw a mesh from the asset pack, e.g.\n"
+	       "                        sphere, instead of a triangle\n"
+	       "  --capture=FILE        stream frames to FILE, Y4M when it\n"
+	       "                        ends in .y4m and PPM otherwise\n"
+	       "  --capture-interval=N  capture every Nth frame\n"
+	       "  --windows=N           draw N windows, up to 4\n"
+	       "  --post-process=MODE   bloom, tonemap and sharpen the scene\n"
+	       "                        with compute or fragment shaders\n"
+	       "  --post-benchmark      time the compute post processing\n"
+	       "                        against the fragment one\n"
+	       "  --lights=N            shade the scene with N point lights\n"
+	       "  --deferred            shade from a G-buffer in a second\n"
+	       "                        subpass, with 64 lights by default\n"
+	       "  --vertex-pulling      read --mesh vertices from a storage\n"
+	       "                        buffer instead of the vertex input\n"
+	       "  --particles=N         simulate and sort up to N particles\n"
+	       "                        on the GPU, blended over the scene\n"
+	       "  --record-stream=FILE  write the first frame's draws and\n"
+	       "                        resources for hello-vulkan-replay\n",
+	       program);
+}
+
+/* A comma separated list of enum mmap_hint names */
+static uint8_t parse_mmap_hints(const char *list, uint32_t *hints)
+{
+	static const struct {
+		const char *name;
+		uint32_t hint;
+	} names[] = {
+		{ "none", MMAP_HINT_NONE },
+		{ "populate", MMAP_HINT_POPULATE },
+		{ "sequential", MMAP_HINT_SEQUENTIAL },
+		{ "willneed", MMAP_HINT_WILLNEED },
+		{ "huge", MMAP_HINT_HUGE_PAGES },
+		{ "readahead", MMAP_HINT_READAHEAD_THREAD },
+	};
+
+	*hints = MMAP_HINT_NONE;
+	while (*list != '\0') {
+		size_t length = strcspn(list, ",");
+		uint32_t i = 0;
+		while (i < ARRAY_SIZE(names)
+		       && (strlen(names[i].name) != length
+		           || strncmp(names[i].name, list, length) != 0)) {
+			++i;
+		}
+		if (i == ARRAY_SIZE(names)) {
+			return APP_ERROR_BIT;
+		}
+		*hints |= names[i].hint;
+		list += length;
+		if (*list == ',') {
+			++list;
+		}
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t parse_options(int argc, char **argv)
+{
+	enum {
+		OPTION_DEPTH = 256,
+		OPTION_OBJECTS,
+		OPTION_OVERDRAW_BENCHMARK,
+		OPTION_GPU_CULLING,
+		OPTION_CPU_CULLING,
+		OPTION_CULL_BENCHMARK,
+		OPTION_TRACE,
+		OPTION_HEADLESS,
+		OPTION_FRAMES,
+		OPTION_RESIZE_INTERVAL,
+		OPTION_RESIZE_STORM,
+		OPTION_REPORT,
+		OPTION_NO_PIPELINE_LIBRARY,
+		OPTION_MMAP_HINTS,
+		OPTION_MESH,
+		OPTION_CAPTURE,
+		OPTION_CAPTURE_INTERVAL,
+		OPTION_WINDOWS,
+		OPTION_POST_PROCESS,
+		OPTION_POST_BENCHMARK,
+		OPTION_LIGHTS,
+		OPTION_DEFERRED,
+		OPTION_VERTEX_PULLING,
+		OPTION_PARTICLES,
+		OPTION_RECORD_STREAM,
+	};
+	static const struct option long_options[] = {
+		{ "depth", no_argument, NULL, OPTION_DEPTH },
+		{ "objects", required_argument, NULL, OPTION_OBJECTS },
+		{ "overdraw-benchmark", no_argument, NULL,
+		  OPTION_OVERDRAW_BENCHMARK },
+		{ "gpu-culling", no_argument, NULL, OPTION_GPU_CULLING },
+		{ "cpu-culling", no_argument, NULL, OPTION_CPU_CULLING },
+		{ "cull-benchmark", no_argument, NULL, OPTION_CULL_BENCHMARK },
+		{ "trace", required_argument, NULL, OPTION_TRACE },
+		{ "headless", no_argument, NULL, OPTION_HEADLESS },
+		{ "frames", required_argument, NULL, OPTION_FRAMES },
+		{ "resize-interval", required_argument, NULL,
+		  OPTION_RESIZE_INTERVAL },
+		{ "resize-storm", required_argument, NULL, OPTION_RESIZE_STORM },
+		{ "report", no_argument, NULL, OPTION_REPORT },
+		{ "no-pipeline-library", no_argument, NULL,
+		  OPTION_NO_PIPELINE_LIBRARY },
+		{ "mmap-hints", required_argument, NULL, OPTION_MMAP_HINTS },
+		{ "mesh", required_argument, NULL, OPTION_MESH },
+		{ "capture", required_argument, NULL, OPTION_CAPTURE },
+		{ "capture-interval", required_argument, NULL,
+		  OPTION_CAPTURE_INTERVAL },
+		{ "windows", required_argument, NULL, OPTION_WINDOWS },
+		{ "post-process", required_argument, NULL,
+		  OPTION_POST_PROCESS },
+		{ "post-benchmark", no_argument, NULL, OPTION_POST_BENCHMARK },
+		{ "lights", required_argument, NULL, OPTION_LIGHTS },
+		{ "deferred", no_argument, NULL, OPTION_DEFERRED },
+		{ "vertex-pulling", no_argument, NULL, OPTION_VERTEX_PULLING },
+		{ "particles", required_argument, NULL, OPTION_PARTICLES },
+		{ "record-stream", required_argument, NULL,
+		  OPTION_RECORD_STREAM },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		char *end;
+		switch (c) {
+		case OPTION_DEPTH:
+			options.depth = true;
+			break;
+		case OPTION_OBJECTS:
+			options.object_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.object_count == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			options.objects_given = true;
+			break;
+		case OPTION_OVERDRAW_BENCHMARK:
+			options.overdraw_benchmark = true;
+			options.depth = true;
+			break;
+		case OPTION_GPU_CULLING:
+			options.gpu_culling = true;
+			break;
+		case OPTION_CPU_CULLING:
+			options.cpu_culling = true;
+			break;
+		case OPTION_CULL_BENCHMARK:
+			options.cull_benchmark = true;
+			break;
+		case OPTION_TRACE:
+			options.trace_filename = optarg;
+			break;
+		case OPTION_HEADLESS:
+			options.headless = true;
+			break;
+		case OPTION_FRAMES:
+			options.frame_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.frame_count == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_RESIZE_INTERVAL:
+			options.resize_interval = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.resize_interval == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_RESIZE_STORM:
+			options.resize_storm = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.resize_storm == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_REPORT:
+			options.report = true;
+			break;
+		case OPTION_NO_PIPELINE_LIBRARY:
+			options.pipeline_library = false;
+			break;
+		case OPTION_MESH:
+			options.mesh_name = optarg;
+			break;
+		case OPTION_CAPTURE:
+			options.capture_filename = optarg;
+			break;
+		case OPTION_CAPTURE_INTERVAL:
+			options.capture_interval = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.capture_interval == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_WINDOWS:
+			options.window_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.window_count == 0
+			    || options.window_count > MAX_WINDOWS) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_POST_PROCESS:
+			if (strcmp(optarg, "compute") == 0) {
+				options.post_mode = POST_MODE_COMPUTE;
+			}
+			else if (strcmp(optarg, "fragment") == 0) {
+				options.post_mode = POST_MODE_FRAGMENT;
+			}
+			else {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_POST_BENCHMARK:
+			options.post_benchmark = true;
+			break;
+		case OPTION_LIGHTS:
+			options.light_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.light_count == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_DEFERRED:
+			options.deferred = true;
+			options.depth = true;
+			break;
+		case OPTION_VERTEX_PULLING:
+			options.vertex_pulling = true;
+			break;
+		case OPTION_PARTICLES:
+			options.particle_count = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.particle_count == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_RECORD_STREAM:
+			options.stream_filename = optarg;
+			break;
+		case OPTION_MMAP_HINTS:
+			if (parse_mmap_hints(optarg, &options.mmap_hints)) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return APP_ERROR_BIT;
+		}
+	}
+	if (optind != argc) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/* With a window the compositor decides the size */
+	if ((options.resize_interval != 0 || options.resize_storm != 0)
+	    && !options.headless) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	if (options.resize_interval != 0 && options.resize_storm != 0) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/* Culling writes draws for the built in triangle's indices */
+	if (options.mesh_name != NULL && options.gpu_culling) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	if (options.cpu_culling && options.gpu_culling) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/* The built in triangle has no vertex input to replace */
+	if (options.vertex_pulling && options.mesh_name == NULL) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/* Blending needs a color attachment to blend over, not a G-buffer */
+	if (options.particle_count != 0 && options.deferred) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/*
+	 * A command stream holds the forward pipeline's draws, with the
+	 * uniforms at set 0 and push constants as their only resources
+	 */
+	if (options.stream_filename != NULL
+	    && (options.gpu_culling || options.deferred
+	        || options.post_mode != POST_MODE_NONE
+	        || options.particle_count != 0 || options.light_count != 0
+	        || options.vertex_pulling)) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	/* Each benchmark replaces drawing frames */
+	if (options.post_benchmark && options.overdraw_benchmark) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	if (options.overdraw_benchmark && !options.objects_given) {
+		options.object_count = DEFAULT_OVERDRAW_BENCHMARK_OBJECTS;
+	}
+	else if (options.cull_benchmark && !options.objects_given) {
+		options.object_count = DEFAULT_CULL_BENCHMARK_OBJECTS;
+	}
+	if (options.post_benchmark && options.post_mode == POST_MODE_NONE) {
+		options.post_mode = POST_MODE_COMPUTE;
+	}
+	if (options.deferred && options.light_count == 0) {
+		options.light_count = DEFAULT_LIGHT_COUNT;
+	}
+
+	return NO_ERRORS;
+}
+
+/* One "report <name> <value>" line per measurement, for hello-vulkan-bench */
+static void print_report(void)
+{
+	double startup_ms = frames_drawn > 0
+	                    ? (double) (first_frame_ns - start_ns) / 1e6
+	                    : 0.0;
+	double seconds = (double) (last_frame_ns - first_frame_ns) / 1e9;
+	double fps = frames_drawn > 1 && seconds > 0.0
+	             ? (frames_drawn - 1) / seconds
+	             : 0.0;
+
+	struct rusage usage;
+	long peak_rss_kb = 0;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		peak_rss_kb = usage.ru_maxrss;
+	}
+
+	printf("report frames %u\n", frames_drawn);
+	printf("report startup_ms %.3f\n", startup_ms);
+	printf("report fps %.3f\n", fps);
+	printf("report frame_ms_mean %.4f\n", stats_mean(&frame_times));
+	printf("report frame_ms_p50 %.4f\n",
+	       stats_percentile(&frame_times, 50.0));
+	printf("report frame_ms_p90 %.4f\n",
+	       stats_percentile(&frame_times, 90.0));
+	printf("report frame_ms_p99 %.4f\n",
+	       stats_percentile(&frame_times, 99.0));
+	printf("report frame_ms_max %.4f\n",
+	       stats_percentile(&frame_times, 100.0));
+	printf("report peak_rss_kb %ld\n", peak_rss_kb);
+
+	/* Both zero once frames and resizes stop allocating */
+	uint64_t resize_allocations = frames_drawn > 0
+	                              ? last_allocations
+	                                - first_frame_allocations
+	                                - frame_allocations
+	                              : 0;
+	printf("report host_frame_allocations %llu\n",
+	       (unsigned long long) frame_allocations);
+	printf("report host_resize_allocations %llu\n",
+	       (unsigned long long) resize_allocations);
+	printf("report setup_arena_peak_bytes %zu\n", setup_arena.peak);
+	host_memory_print_report();
+
+	/* Zero without resizes; configures never built count as coalesced */
+	printf("report resize_configures %u\n", resize_configures);
+	printf("report resize_configures_coalesced %u\n",
+	       coalesced_configures + pending_configures);
+	printf("report resize_swapchains %u\n", resize_swapchains);
+	printf("report resize_dropped_frames %u\n", dropped_frames);
+	/* Fewer than the recreations only when they outran the capacity */
+	printf("report resize_ms_samples %u\n", resize_times.count);
+	printf("report resize_ms_p50 %.4f\n",
+	       stats_percentile(&resize_times, 50.0));
+	printf("report resize_ms_p90 %.4f\n",
+	       stats_percentile(&resize_times, 90.0));
+	printf("report resize_ms_p99 %.4f\n",
+	       stats_percentile(&resize_times, 99.0));
+	printf("report resize_ms_max %.4f\n",
+	       stats_percentile(&resize_times, 100.0));
+	bool resized = resize_configures != 0;
+	printf("report resize_rss_growth_kb %ld\n",
+	       resized ? resize_end_rss_kb - resize_begin_rss_kb : 0);
+	printf("report resize_vulkan_growth_bytes %lld\n",
+	       resized ? (long long) resize_end_vulkan_bytes
+	                 - (long long) resize_begin_vulkan_bytes
+	               : 0);
+
+	/* GPU time, apart from the frame, without the post processing */
+	if (options.particle_count != 0) {
+		printf("report particle_simulate_ms_mean %.4f\n",
+		       stats_mean(&particle_simulate_times));
+		printf("report particle_sort_ms_mean %.4f\n",
+		       stats_mean(&particle_sort_times));
+		printf("report particle_sort_ms_p90 %.4f\n",
+		       stats_percentile(&particle_sort_times, 90.0));
+	}
+
+	/* Zero without pipeline statistics queries */
+	for (uint32_t i = 0; i < GPU_STATISTIC_COUNT; ++i) {
+		printf("report %s_per_frame %.1f\n", gpu_statistic_names[i],
+		       stats_mean(&frame_statistics[i]));
+	}
+
+	mmap_wait(&assets.map);
+	printf("report asset_major_faults %llu\n",
+	       (unsigned long long) assets.map.faults.major);
+	printf("report asset_minor_faults %llu\n",
+	       (unsigned long long) assets.map.faults.minor);
+
+	if (options.capture_filename != NULL) {
+		capture_print_report(&capture);
+	}
+
+	uint32_t phase_count = atomic_load(&startup_phase_count);
+	if (phase_count > MAX_STARTUP_PHASES) {
+		phase_count = MAX_STARTUP_PHASES;
+	}
+	for (uint32_t i = 0; i < phase_count; ++i) {
+		printf("report phase %s %.3f %.3f\n", startup_phases[i].name,
+		       (double) (startup_phases[i].begin_ns - start_ns) / 1e6,
+		       (double) (startup_phases[i].end_ns - start_ns) / 1e6);
+	}
+}
+
+/*
+ * Times every CPU culling kernel the processor supports over the scene, on
+ * the calling thread alone and then on every processor, in place of starting
+ * Vulkan at all.
+ */
+static uint8_t run_cull_benchmark(uint32_t processor_count)
+{
+	struct frustum frustum;
+	frustum_from_matrix(&frustum, view_projection);
+	struct stats pass_times;
+	uint8_t err = stats_init(&pass_times, CULL_BENCHMARK_PASSES);
+	if (err) {
+		return err;
+	}
+	uint32_t *visible = NULL;
+
+	printf("CPU culling (%u objects, %u passes)\n", scene.object_count,
+	       CULL_BENCHMARK_PASSES);
+	uint32_t thread_counts[] = { 1, processor_count };
+	uint32_t runs = processor_count > 1 ? 2 : 1;
+	for (uint32_t r = 0; r < runs && err == 0; ++r) {
+		struct cpu_cull cull;
+		err = cpu_cull_init(&cull, &scene, thread_counts[r]);
+		if (err) {
+			break;
+		}
+		if (visible == NULL) {
+			visible = malloc(cull.bounds.capacity
+			                 * sizeof(uint32_t));
+			if (visible == NULL) {
+				cpu_cull_fini(&cull);
+				err = LIBC_ERROR_BIT;
+				break;
+			}
+		}
+		for (uint32_t k = 0; k < CPU_CULL_KERNEL_COUNT; ++k) {
+			if (!cpu_cull_kernel_supported(k)) {
+				continue;
+			}
+			cull.kernel = k;
+			/* Warms the caches and the workers up */
+			uint32_t visible_count = cpu_cull_run(&cull, &frustum,
+			                                      visible);
+			pass_times.count = 0;
+			for (uint32_t p = 0; p < CULL_BENCHMARK_PASSES; ++p) {
+				uint64_t begin_ns = trace_now_ns();
+				cpu_cull_run(&cull, &frustum, visible);
+				stats_add(&pass_times,
+				          (double) (trace_now_ns() - begin_ns)
+				          / 1e6);
+			}
+			printf("  %-6s %2u threads %8.3f ms per pass (p90 "
+			       "%.3f), %u visible\n",
+			       cpu_cull_kernel_name(k), cull.pool.thread_count,
+			       stats_percentile(&pass_times, 50.0),
+			       stats_percentile(&pass_times, 90.0),
+			       visible_count);
+		}
+		cpu_cull_fini(&cull);
+	}
+	free(visible);
+	stats_fini(&pass_times);
+	return err;
+}
+
+static uint8_t start_wayland()
+{
+	struct trace_zone zone = begin_phase("wayland_init");
+	uint8_t err = wayland_init();
+	end_phase(&zone);
+	return err;
+}
+
+static uint8_t start_graphics()
 {
-	(void) argc;
-	(void) argv;
+	struct trace_zone zone = begin_phase("create_graphics");
+	uint8_t err = create_graphics(vulkan.device);
+	end_phase(&zone);
+	return err;
+}
 
+int main(int argc, char **argv)
+{
 	uint8_t err;
+	struct task wayland_task = {
+		.function = NULL,
+		.err = NO_ERRORS,
+		.threaded = false,
+	};
+	struct task graphics_task = {
+		.function = NULL,
+		.err = NO_ERRORS,
+		.threaded = false,
+	};
+
+	start_ns = trace_now_ns();
+
+	err = parse_options(argc, argv);
+	if (err) {
+		return err;
+	}
+	for (uint32_t w = 0; w < options.window_count; ++w) {
+		windows[w].extent.width = DEFAULT_WIDTH;
+		windows[w].extent.height = DEFAULT_HEIGHT;
+		windows[w].pending_extent = windows[w].extent;
+	}
+	storm_remaining = options.resize_storm;
+
+	if (options.report) {
+		/* Without --frames, the first minute at 60 Hz */
+		err = stats_init(&frame_times, options.frame_count != 0
+		                               ? options.frame_count
+		                               : 3600);
+		for (uint32_t i = 0; i < GPU_STATISTIC_COUNT && !err; ++i) {
+			err = stats_init(&frame_statistics[i],
+			                 frame_times.capacity);
+		}
+		/*
+		 * At most one recreation finishes per frame, and a storm has
+		 * no more than one per configure, however long it runs
+		 */
+		if (!err) {
+			err = stats_init(&resize_times,
+			                 options.resize_storm
+			                 > frame_times.capacity
+			                 ? options.resize_storm
+			                 : frame_times.capacity);
+		}
+		if (!err && options.particle_count != 0) {
+			err = stats_init(&particle_simulate_times,
+			                 frame_times.capacity);
+			err = err ? err : stats_init(&particle_sort_times,
+			                             frame_times.capacity);
+		}
+		if (err) {
+			stats_fini(&particle_sort_times);
+			stats_fini(&particle_simulate_times);
+			stats_fini(&resize_times);
+			for (uint32_t i = 0; i < GPU_STATISTIC_COUNT; ++i) {
+				stats_fini(&frame_statistics[i]);
+			}
+			stats_fini(&frame_times);
+			return err;
+		}
+	}
+
+	if (options.trace_filename != NULL) {
+		err = trace_init(options.trace_filename, TRACE_CAPACITY);
+		if (err) {
+			return err;
+		}
+	}
+
+	if (options.stream_filename != NULL) {
+		command_stream_init(&command_stream);
+		stream = &command_stream;
+	}
 
-	err = wayland_init();
+	err = scene_init(&scene, options.object_count, options.light_count, 1);
+	if (err) {
+		goto fini;
+	}
+	long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (options.cull_benchmark) {
+		err = run_cull_benchmark(processor_count > 1 ? processor_count
+		                                             : 1);
+		goto fini;
+	}
+	if (options.cpu_culling) {
+		struct trace_zone cull_zone = begin_phase("cpu_cull_init");
+		err = cpu_cull_init(&cpu_cull, &scene,
+		                    processor_count > 1 ? processor_count : 1);
+		end_phase(&cull_zone);
+		if (err) {
+			goto fini;
+		}
+	}
+	/* Draw items, their sort scratch space and the visible objects */
+	err = arena_init(&setup_arena,
+	                 SETUP_ARENA_SIZE
+	                 + 2 * scene.object_count * sizeof(struct draw_item)
+	                 + cpu_cull.bounds.capacity * sizeof(uint32_t));
 	if (err) {
 		goto fini;
 	}
 
-	err = create_instance(&vulkan.instance);
+	/* Paged in while the instance and device are created */
+	struct trace_zone zone = begin_phase("open_assets");
+	err = pack_init(ASSET_PACK_FILENAME, options.mmap_hints, &assets);
+	end_phase(&zone);
 	if (err) {
 		goto fini;
 	}
 
-	err = create_surface(&vulkan.surface, vulkan.instance);
+	/*
+	 * The Wayland connection and its registry roundtrip overlap with
+	 * instance creation and device enumeration, and compiling the pipeline
+	 * overlaps with waiting for the first configure.
+	 */
+	if (!options.headless) {
+		task_start(&wayland_task, start_wayland);
+	}
+
+	zone = begin_phase("create_instance");
+	err = create_instance(&vulkan.instance);
+	end_phase(&zone);
 	if (err) {
 		goto fini;
 	}
 
+	zone = begin_phase("create_physical_devices");
 	err = create_physical_devices(&vulkan.physical_devices,
 	                              &vulkan.physical_device_count,
 	                              vulkan.instance);
+	end_phase(&zone);
+	if (err) {
+		goto fini;
+	}
+
+	err = task_join(&wayland_task);
 	if (err) {
 		goto fini;
 	}
 
+	zone = begin_phase("create_surface");
+	for (uint32_t w = 0; w < options.window_count && !err; ++w) {
+		err = create_surface(&windows[w], vulkan.instance);
+	}
+	end_phase(&zone);
+	if (err) {
+		goto fini;
+	}
+
+	zone = begin_phase("create_device");
 	err = create_device(&vulkan.device, vulkan.physical_devices, 0);
+	end_phase(&zone);
+	if (err) {
+		goto fini;
+	}
+
+	err = timeline_init(&timeline, vulkan.device);
+	if (!err) {
+		err = deferred_init(&deferred, deferred_capacity());
+	}
+	if (err) {
+		goto fini;
+	}
+
+	if (options.capture_filename != NULL) {
+		err = capture_init(&capture, vulkan.device, &timeline,
+		                   vulkan.graphics_queue_family_index,
+		                   options.capture_filename,
+		                   options.capture_interval);
+		if (err) {
+			goto fini;
+		}
+	}
+
+	err = uniform_ring_init(&uniform_ring, vulkan.device,
+	                        sizeof(struct frame_uniforms),
+	                        vulkan.min_uniform_buffer_offset_alignment,
+	                        VK_SHADER_STAGE_VERTEX_BIT
+	                        | VK_SHADER_STAGE_FRAGMENT_BIT);
+	if (err) {
+		goto fini;
+	}
+	err = bindless_init(&bindless, vulkan.device, &vulkan.memory_properties,
+	                    queue, vulkan.graphics_queue_family_index,
+	                    vulkan.descriptor_indexing,
+	                    vulkan.bindless_capacities);
 	if (err) {
 		goto fini;
 	}
 
+	if (scene.light_count != 0) {
+		err = gpu_buffer_init_with_data(
+			vulkan.device, &vulkan.memory_properties, queue,
+			vulkan.graphics_queue_family_index,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			scene.lights,
+			scene.light_count * sizeof(struct scene_light),
+			&light_buffer
+		);
+		if (!err) {
+			err = bindless_add_buffer(&bindless, vulkan.device,
+			                          light_buffer.buffer,
+			                          0, VK_WHOLE_SIZE,
+			                          &light_buffer_index);
+		}
+		if (err) {
+			goto fini;
+		}
+	}
+
+	if (options.gpu_culling) {
+		PFN_vkCmdDrawIndexedIndirectCountKHR
+		cmd_draw_indexed_indirect_count = NULL;
+		if (vulkan.draw_indirect_count) {
+			cmd_draw_indexed_indirect_count
+				= (PFN_vkCmdDrawIndexedIndirectCountKHR)
+				  vkGetDeviceProcAddr(
+					vulkan.device,
+					"vkCmdDrawIndexedIndirectCountKHR"
+				  );
+		}
+		zone = begin_phase("gpu_cull_init");
+		struct mmap_faults faults;
+		mmap_faults_now(&faults);
+		err = gpu_cull_init(&gpu_cull, vulkan.device,
+		                    &vulkan.memory_properties, &scene, &assets,
+		                    cmd_draw_indexed_indirect_count);
+		mmap_faults_add_since(&assets.map, &faults);
+		end_phase(&zone);
+		if (!err) {
+			err = bindless_add_buffer(&bindless, vulkan.device,
+			                          gpu_cull.object_buffer.buffer,
+			                          0, VK_WHOLE_SIZE,
+			                          &gpu_cull_objects);
+		}
+		if (err) {
+			goto fini;
+		}
+	}
+
+	if (options.particle_count != 0) {
+		zone = begin_phase("particles_init");
+		struct mmap_faults faults;
+		mmap_faults_now(&faults);
+		err = particles_init(&particles, vulkan.device,
+		                     &vulkan.memory_properties, queue,
+		                     vulkan.graphics_queue_family_index, &assets,
+		                     options.particle_count, PARTICLE_TIME_STEP);
+		mmap_faults_add_since(&assets.map, &faults);
+		end_phase(&zone);
+		if (!err) {
+			err = bindless_add_buffer(&bindless, vulkan.device,
+			                          particles.state_buffer.buffer,
+			                          0, VK_WHOLE_SIZE,
+			                          &particle_state_index);
+		}
+		if (err) {
+			goto fini;
+		}
+	}
+
+	if (options.mesh_name != NULL) {
+		zone = begin_phase("create_mesh");
+		struct mmap_faults faults;
+		mmap_faults_now(&faults);
+		err = create_mesh(vulkan.device);
+		mmap_faults_add_since(&assets.map, &faults);
+		end_phase(&zone);
+		if (err) {
+			goto fini;
+		}
+	}
+
+	/* The pipeline layout needs the descriptor set layouts */
+	task_start(&graphics_task, start_graphics);
+
+	if (!options.headless) {
+		zone = begin_phase("wait_for_configure");
+		err = wait_for_configure();
+		end_phase(&zone);
+		if (err) {
+			goto fini;
+		}
+	}
+
 	do {
 		resize = false;
+		apply_configures();
 
-		err = create_swapchain(&vulkan.swapchain, vulkan.device);
+		zone = begin_phase("create_swapchain");
+		for (uint32_t w = 0; w < options.window_count && !err; ++w) {
+			err = create_swapchain(&windows[w], vulkan.device);
+		}
+		end_phase(&zone);
 		if (err) {
 			goto fini;
 		}
 
-		err = use_swapchain(vulkan.device, vulkan.swapchain);
-
-		destroy_swapchain();
+		err = task_join(&graphics_task);
+		if (!err) {
+			err = use_swapchains(vulkan.device);
+		}
+		if (err) {
+			goto fini;
+		}
+		/* The next swapchains replace these as their old swapchains */
 	} while (resize);
+	last_allocations = host_memory_thread_allocation_count();
+	resize_end_rss_kb = current_rss_kb();
+	resize_end_vulkan_bytes = host_memory_live_bytes();
 
 fini:
+	err |= task_join(&wayland_task);
+	err |= task_join(&graphics_task);
+	/* The writer waits for the last copies on the timeline itself */
+	err |= capture_fini(&capture);
+	if (stream != NULL && !err && !stream_captured) {
+		printf("No frame was drawn to record\n");
+		err = APP_ERROR_BIT;
+	}
+	if (stream != NULL && !err) {
+		err = command_stream_write(stream, options.stream_filename);
+	}
+	if (stream != NULL) {
+		command_stream_fini(stream);
+	}
 	vulkan_fini();
 	wayland_fini();
+	cpu_cull_fini(&cpu_cull);
+	scene_fini(&scene);
+	err |= trace_fini();
+	if (options.report && !err) {
+		print_report();
+	}
+	pack_fini(&assets);
+	arena_fini(&setup_arena);
+	stats_fini(&particle_sort_times);
+	stats_fini(&particle_simulate_times);
+	stats_fini(&resize_times);
+	for (uint32_t i = 0; i < GPU_STATISTIC_COUNT; ++i) {
+		stats_fini(&frame_statistics[i]);
+	}
+	stats_fini(&frame_times);
 	return err;
 }
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mesh.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <string.h>
+
+uint8_t mesh_init(struct mesh *mesh, const void *data, size_t size)
+{
+	mesh->header = NULL;
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+
+	if (size < sizeof(struct mesh_header)) {
+		return APP_ERROR_BIT;
+	}
+	const struct mesh_header *header = data;
+	if (memcmp(header->magic, MESH_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != MESH_VERSION
+	    || (header->index_size != 2 && header->index_size != 4)
+	    || header->index_count % 3 != 0
+	    || header->vertex_offset % MESH_ALIGNMENT != 0
+	    || header->index_offset % MESH_ALIGNMENT != 0) {
+		return APP_ERROR_BIT;
+	}
+
+	uint64_t vertices_end = (uint64_t) header->vertex_offset
+	                        + (uint64_t) header->vertex_count
+	                          * sizeof(struct mesh_vertex);
+	uint64_t indices_end = (uint64_t) header->index_offset
+	                       + (uint64_t) header->index_count
+	                         * header->index_size;
+	if (header->vertex_offset < sizeof(struct mesh_header)
+	    || vertices_end > size
+	    || header->index_offset < vertices_end
+	    || indices_end > size) {
+		return APP_ERROR_BIT;
+	}
+
+	mesh->header = header;
+	mesh->vertices = (const struct mesh_vertex *)
+	                 ((const char *) data + header->vertex_offset);
+	mesh->indices = (const char *) data + header->index_offset;
+	return NO_ERRORS;
+}
+
+uint32_t mesh_index(const struct mesh *mesh, uint32_t i)
+{
+	if (mesh->header->index_size == 2) {
+		return ((const uint16_t *) mesh->indices)[i];
+	}
+	return ((const uint32_t *) mesh->indices)[i];
+}
+
+static int16_t encode_snorm16(float x)
+{
+	if (x > 1.0f) {
+		x = 1.0f;
+	}
+	else if (x < -1.0f) {
+		x = -1.0f;
+	}
+	return (int16_t) lrintf(x * 32767.0f);
+}
+
+static float decode_snorm16(int16_t x)
+{
+	float f = x / 32767.0f;
+	return f < -1.0f ? -1.0f : f;
+}
+
+void mesh_encode_position(int16_t encoded[4],
+                          const float position[3],
+                          float radius)
+{
+	for (int i = 0; i < 3; ++i) {
+		encoded[i] = encode_snorm16(radius > 0.0f ? position[i] / radius
+		                                          : 0.0f);
+	}
+	encoded[3] = 0;
+}
+
+void mesh_decode_position(float position[3], const int16_t encoded[4])
+{
+	for (int i = 0; i < 3; ++i) {
+		position[i] = decode_snorm16(encoded[i]);
+	}
+}
+
+static float sign_not_zero(float x)
+{
+	return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+/*
+ * Projects onto the octahedron |x| + |y| + |z| = 1, folding the lower half
+ * over the upper one
+ */
+void mesh_encode_normal(int16_t encoded[2], const float normal[3])
+{
+	float l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float x = l1 > 0.0f ? normal[0] / l1 : 0.0f;
+	float y = l1 > 0.0f ? normal[1] / l1 : 0.0f;
+	if (normal[2] < 0.0f) {
+		float folded_x = (1.0f - fabsf(y)) * sign_not_zero(x);
+		float folded_y = (1.0f - fabsf(x)) * sign_not_zero(y);
+		x = folded_x;
+		y = folded_y;
+	}
+	encoded[0] = encode_snorm16(x);
+	encoded[1] = encode_snorm16(y);
+}
+
+/* The same decode as mesh.vert */
+void mesh_decode_normal(float normal[3], const int16_t encoded[2])
+{
+	float x = decode_snorm16(encoded[0]);
+	float y = decode_snorm16(encoded[1]);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+	if (z < 0.0f) {
+		float unfolded_x = (1.0f - fabsf(y)) * sign_not_zero(x);
+		float unfolded_y = (1.0f - fabsf(x)) * sign_not_zero(y);
+		x = unfolded_x;
+		y = unfolded_y;
+	}
+	float length = sqrtf(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_MESH_H
+#define HELLO_VULKAN_MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A mesh file is a header followed by the vertices and then the indices,
+ * each at a MESH_ALIGNMENT boundary so they can be copied to the GPU straight
+ * from the mapping. Positions are snorm16 in units of the bounding sphere
+ * radius around the origin, which matches how scene objects are scaled, and
+ * normals are snorm16 octahedral. That is 12 bytes a vertex against 24 for
+ * float32 positions and normals. Indices are 16 bit when every vertex can be
+ * addressed with them, 32 bit otherwise. Triangles are clockwise on screen.
+ */
+#define MESH_MAGIC "HVMS"
+#define MESH_VERSION 1
+#define MESH_ALIGNMENT 16
+
+struct mesh_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	/* 2 or 4 */
+	uint32_t index_size;
+	uint32_t vertex_offset;
+	uint32_t index_offset;
+	/* Of the source, before positions were scaled into the unit sphere */
+	float radius;
+};
+
+struct mesh_vertex {
+	/* w is unused padding, keeping normals 4 byte aligned */
+	int16_t position[4];
+	int16_t normal[2];
+};
+
+/* Points into the data it was made from, which must stay mapped */
+struct mesh {
+	const struct mesh_header *header;
+	const struct mesh_vertex *vertices;
+	const void *indices;
+};
+
+/* Checks the header and that the vertices and indices lie within size */
+uint8_t mesh_init(struct mesh *mesh, const void *data, size_t size);
+
+uint32_t mesh_index(const struct mesh *mesh, uint32_t i);
+
+/* position must lie within radius of the origin */
+void mesh_encode_position(int16_t encoded[4],
+                          const float position[3],
+                          float radius);
+void mesh_decode_position(float position[3], const int16_t encoded[4]);
+/* normal must be unit length */
+void mesh_encode_normal(int16_t encoded[2], const float normal[3]);
+void mesh_decode_normal(float normal[3], const int16_t encoded[2]);
+
+#endif
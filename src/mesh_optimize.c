@@ -0,0 +1,527 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mesh_optimize.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Forsyth's constants; the cache is LRU and only used for scoring */
+#define SCORE_CACHE_SIZE 32
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+void mesh_analyze_vertex_cache(struct mesh_cache_stats *stats,
+                               const uint32_t *indices,
+                               uint32_t index_count,
+                               uint32_t vertex_count,
+                               uint32_t cache_size)
+{
+	stats->acmr = 0.0;
+	stats->atvr = 0.0;
+	if (index_count == 0 || vertex_count == 0) {
+		return;
+	}
+
+	/* A vertex is cached while fewer than cache_size misses followed it */
+	uint32_t *timestamps = calloc(vertex_count, sizeof(uint32_t));
+	if (timestamps == NULL) {
+		return;
+	}
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < index_count; ++i) {
+		uint32_t v = indices[i];
+		if (timestamps[v] == 0 || misses + 1 - timestamps[v] > cache_size) {
+			++misses;
+			timestamps[v] = misses;
+		}
+	}
+	free(timestamps);
+
+	stats->acmr = (double) misses / (index_count / 3);
+	stats->atvr = (double) misses / vertex_count;
+}
+
+static float vertex_score(int32_t cache_position, uint32_t remaining)
+{
+	if (remaining == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cache_position >= 0) {
+		if (cache_position < 3) {
+			/* Whichever of the last triangle's is used, it's free */
+			score = LAST_TRIANGLE_SCORE;
+		}
+		else {
+			float scale = 1.0f / (SCORE_CACHE_SIZE - 3);
+			score = 1.0f - (cache_position - 3) * scale;
+			score = powf(score, CACHE_DECAY_POWER);
+		}
+	}
+	/* Vertices with few triangles left are finished off first */
+	score += VALENCE_BOOST_SCALE * powf((float) remaining,
+	                                    -VALENCE_BOOST_POWER);
+	return score;
+}
+
+struct adjacency {
+	/* Triangles of vertex v are triangles[offsets[v]..][0..counts[v]] */
+	uint32_t *offsets;
+	uint32_t *counts;
+	uint32_t *triangles;
+};
+
+static void adjacency_fini(struct adjacency *adjacency)
+{
+	free(adjacency->offsets);
+	free(adjacency->counts);
+	free(adjacency->triangles);
+}
+
+static uint8_t adjacency_init(struct adjacency *adjacency,
+                              const uint32_t *indices,
+                              uint32_t index_count,
+                              uint32_t vertex_count)
+{
+	adjacency->offsets = calloc(vertex_count, sizeof(uint32_t));
+	adjacency->counts = calloc(vertex_count, sizeof(uint32_t));
+	adjacency->triangles = malloc(index_count * sizeof(uint32_t));
+	if (adjacency->offsets == NULL || adjacency->counts == NULL
+	    || adjacency->triangles == NULL) {
+		adjacency_fini(adjacency);
+		return LIBC_ERROR_BIT;
+	}
+
+	for (uint32_t i = 0; i < index_count; ++i) {
+		++adjacency->counts[indices[i]];
+	}
+	uint32_t offset = 0;
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		adjacency->offsets[v] = offset;
+		offset += adjacency->counts[v];
+		adjacency->counts[v] = 0;
+	}
+	for (uint32_t i = 0; i < index_count; ++i) {
+		uint32_t v = indices[i];
+		adjacency->triangles[adjacency->offsets[v]
+		                     + adjacency->counts[v]++] = i / 3;
+	}
+	return NO_ERRORS;
+}
+
+/* Takes triangle off the list of vertex v's remaining ones */
+static void remove_triangle(struct adjacency *adjacency,
+                            uint32_t v, uint32_t triangle)
+{
+	uint32_t *triangles = &adjacency->triangles[adjacency->offsets[v]];
+	uint32_t count = adjacency->counts[v];
+	for (uint32_t i = 0; i < count; ++i) {
+		if (triangles[i] == triangle) {
+			triangles[i] = triangles[count - 1];
+			--adjacency->counts[v];
+			return;
+		}
+	}
+}
+
+uint8_t mesh_optimize_vertex_cache(uint32_t *indices,
+                                   uint32_t index_count,
+                                   uint32_t vertex_count)
+{
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return NO_ERRORS;
+	}
+
+	struct adjacency adjacency;
+	uint8_t err = adjacency_init(&adjacency, indices, index_count,
+	                             vertex_count);
+	if (err) {
+		return err;
+	}
+
+	float *vertex_scores = malloc(vertex_count * sizeof(float));
+	int32_t *cache_positions = malloc(vertex_count * sizeof(int32_t));
+	float *triangle_scores = malloc(triangle_count * sizeof(float));
+	bool *emitted = calloc(triangle_count, sizeof(bool));
+	uint32_t *output = malloc(index_count * sizeof(uint32_t));
+	if (vertex_scores == NULL || cache_positions == NULL
+	    || triangle_scores == NULL || emitted == NULL || output == NULL) {
+		free(vertex_scores);
+		free(cache_positions);
+		free(triangle_scores);
+		free(emitted);
+		free(output);
+		adjacency_fini(&adjacency);
+		return LIBC_ERROR_BIT;
+	}
+
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		cache_positions[v] = -1;
+		vertex_scores[v] = vertex_score(-1, adjacency.counts[v]);
+	}
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		const uint32_t *triangle = &indices[t * 3];
+		triangle_scores[t] = vertex_scores[triangle[0]]
+		                     + vertex_scores[triangle[1]]
+		                     + vertex_scores[triangle[2]];
+	}
+
+	/* Three spare entries for the vertices pushed out by a triangle */
+	uint32_t cache[SCORE_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+	uint32_t next_unemitted = 0;
+
+	uint32_t best = 0;
+	float best_score = triangle_scores[0];
+	for (uint32_t t = 1; t < triangle_count; ++t) {
+		if (triangle_scores[t] > best_score) {
+			best = t;
+			best_score = triangle_scores[t];
+		}
+	}
+
+	for (uint32_t emitted_count = 0; emitted_count < triangle_count;
+	     ++emitted_count) {
+		if (best_score < 0.0f) {
+			/* Nothing in the cache has triangles left, start over */
+			while (emitted[next_unemitted]) {
+				++next_unemitted;
+			}
+			best = next_unemitted;
+		}
+
+		const uint32_t *triangle = &indices[best * 3];
+		memcpy(&output[emitted_count * 3], triangle, 3 * sizeof(uint32_t));
+		emitted[best] = true;
+
+		/* The triangle's vertices go to the front of the cache */
+		uint32_t new_cache[SCORE_CACHE_SIZE + 3];
+		uint32_t new_count = 0;
+		for (uint32_t i = 0; i < 3; ++i) {
+			new_cache[new_count++] = triangle[i];
+			remove_triangle(&adjacency, triangle[i], best);
+		}
+		for (uint32_t i = 0; i < cache_count; ++i) {
+			uint32_t v = cache[i];
+			if (v != triangle[0] && v != triangle[1]
+			    && v != triangle[2]) {
+				new_cache[new_count++] = v;
+			}
+		}
+		for (uint32_t i = SCORE_CACHE_SIZE; i < new_count; ++i) {
+			cache_positions[new_cache[i]] = -1;
+		}
+		cache_count = new_count < SCORE_CACHE_SIZE ? new_count
+		                                           : SCORE_CACHE_SIZE;
+		memcpy(cache, new_cache, new_count * sizeof(uint32_t));
+
+		/* Only scores around the cache change */
+		for (uint32_t i = 0; i < new_count; ++i) {
+			uint32_t v = cache[i];
+			if (i < cache_count) {
+				cache_positions[v] = (int32_t) i;
+			}
+			float score = vertex_score(cache_positions[v],
+			                           adjacency.counts[v]);
+			float delta = score - vertex_scores[v];
+			vertex_scores[v] = score;
+			const uint32_t *triangles
+				= &adjacency.triangles[adjacency.offsets[v]];
+			for (uint32_t j = 0; j < adjacency.counts[v]; ++j) {
+				triangle_scores[triangles[j]] += delta;
+			}
+		}
+
+		best_score = -1.0f;
+		for (uint32_t i = 0; i < cache_count; ++i) {
+			uint32_t v = cache[i];
+			const uint32_t *triangles
+				= &adjacency.triangles[adjacency.offsets[v]];
+			for (uint32_t j = 0; j < adjacency.counts[v]; ++j) {
+				uint32_t t = triangles[j];
+				if (triangle_scores[t] > best_score) {
+					best = t;
+					best_score = triangle_scores[t];
+				}
+			}
+		}
+	}
+
+	memcpy(indices, output, index_count * sizeof(uint32_t));
+	free(vertex_scores);
+	free(cache_positions);
+	free(triangle_scores);
+	free(emitted);
+	free(output);
+	adjacency_fini(&adjacency);
+	return NO_ERRORS;
+}
+
+struct cluster {
+	uint32_t first_triangle;
+	uint32_t triangle_count;
+	double centroid[3];
+	double normal[3];
+	double area;
+	double sort_key;
+};
+
+static int compare_clusters(const void *a, const void *b)
+{
+	double x = ((const struct cluster *) a)->sort_key;
+	double y = ((const struct cluster *) b)->sort_key;
+	/* Descending, the most occluding first */
+	return (x < y) - (x > y);
+}
+
+/* Area weighted centroid and summed normal of the cluster's triangles */
+static void measure_cluster(struct cluster *cluster,
+                            const uint32_t *indices,
+                            const float (*positions)[3])
+{
+	memset(cluster->centroid, 0, sizeof(cluster->centroid));
+	memset(cluster->normal, 0, sizeof(cluster->normal));
+	cluster->area = 0.0;
+
+	uint32_t end = cluster->first_triangle + cluster->triangle_count;
+	for (uint32_t t = cluster->first_triangle; t < end; ++t) {
+		const float *a = positions[indices[t * 3 + 0]];
+		const float *b = positions[indices[t * 3 + 1]];
+		const float *c = positions[indices[t * 3 + 2]];
+		double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+		double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+		double n[3] = {
+			ab[1] * ac[2] - ab[2] * ac[1],
+			ab[2] * ac[0] - ab[0] * ac[2],
+			ab[0] * ac[1] - ab[1] * ac[0],
+		};
+		double area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) / 2.0;
+		for (int k = 0; k < 3; ++k) {
+			cluster->centroid[k] += (a[k] + b[k] + c[k]) / 3.0 * area;
+			cluster->normal[k] += n[k];
+		}
+		cluster->area += area;
+	}
+}
+
+/* A FIFO cache over timestamps, emptied by moving time past all of them */
+struct fifo_cache {
+	uint32_t *timestamps;
+	uint32_t time;
+	uint32_t size;
+};
+
+static uint32_t fifo_cache_add_triangle(struct fifo_cache *cache,
+                                        const uint32_t *triangle)
+{
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < 3; ++i) {
+		uint32_t v = triangle[i];
+		if (cache->timestamps[v] == 0
+		    || cache->time + 1 - cache->timestamps[v] > cache->size) {
+			++cache->time;
+			cache->timestamps[v] = cache->time;
+			++misses;
+		}
+	}
+	return misses;
+}
+
+static void fifo_cache_clear(struct fifo_cache *cache)
+{
+	cache->time += cache->size;
+}
+
+/*
+ * Starts a cluster wherever a triangle misses on all three vertices, then
+ * splits those wherever a cluster started on an empty cache has come down to
+ * threshold times the ACMR of the one it is split from
+ */
+static uint32_t find_clusters(uint32_t *starts,
+                              const uint32_t *indices,
+                              uint32_t index_count,
+                              uint32_t vertex_count,
+                              uint32_t cache_size,
+                              double threshold)
+{
+	uint32_t triangle_count = index_count / 3;
+	struct fifo_cache cache = {
+		.timestamps = calloc(vertex_count, sizeof(uint32_t)),
+		.time = 0,
+		.size = cache_size,
+	};
+	uint32_t *hard = malloc((triangle_count + 1) * sizeof(uint32_t));
+	if (cache.timestamps == NULL || hard == NULL) {
+		free(cache.timestamps);
+		free(hard);
+		starts[0] = 0;
+		return 1;
+	}
+
+	uint32_t hard_count = 0;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		if (fifo_cache_add_triangle(&cache, &indices[t * 3]) == 3) {
+			hard[hard_count++] = t;
+		}
+	}
+	/* The first triangle always misses on all three */
+	hard[hard_count] = triangle_count;
+
+	uint32_t count = 0;
+	for (uint32_t h = 0; h < hard_count; ++h) {
+		uint32_t begin = hard[h];
+		uint32_t end = hard[h + 1];
+
+		fifo_cache_clear(&cache);
+		uint32_t cluster_misses = 0;
+		for (uint32_t t = begin; t < end; ++t) {
+			cluster_misses += fifo_cache_add_triangle(&cache,
+			                                          &indices[t * 3]);
+		}
+		double target = (double) cluster_misses / (end - begin)
+		                * threshold;
+
+		fifo_cache_clear(&cache);
+		starts[count++] = begin;
+		uint32_t running_misses = 0;
+		uint32_t running_count = 0;
+		for (uint32_t t = begin; t < end; ++t) {
+			running_misses += fifo_cache_add_triangle(&cache,
+			                                          &indices[t * 3]);
+			++running_count;
+			if (t + 1 < end
+			    && (double) running_misses / running_count <= target) {
+				starts[count++] = t + 1;
+				running_misses = 0;
+				running_count = 0;
+				fifo_cache_clear(&cache);
+			}
+		}
+	}
+
+	free(hard);
+	free(cache.timestamps);
+	return count;
+}
+
+uint8_t mesh_optimize_overdraw(uint32_t *indices,
+                               uint32_t index_count,
+                               const float (*positions)[3],
+                               uint32_t vertex_count,
+                               uint32_t cache_size,
+                               double threshold)
+{
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return NO_ERRORS;
+	}
+
+	uint32_t *starts = malloc((triangle_count + 1) * sizeof(uint32_t));
+	if (starts == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	uint32_t cluster_count = find_clusters(starts, indices, index_count,
+	                                       vertex_count, cache_size,
+	                                       threshold);
+	starts[cluster_count] = triangle_count;
+
+	struct cluster *clusters = malloc(cluster_count
+	                                  * sizeof(struct cluster));
+	uint32_t *output = malloc(index_count * sizeof(uint32_t));
+	if (clusters == NULL || output == NULL) {
+		free(clusters);
+		free(output);
+		free(starts);
+		return LIBC_ERROR_BIT;
+	}
+
+	double mesh_centroid[3] = {0.0, 0.0, 0.0};
+	double mesh_area = 0.0;
+	for (uint32_t c = 0; c < cluster_count; ++c) {
+		clusters[c].first_triangle = starts[c];
+		clusters[c].triangle_count = starts[c + 1] - starts[c];
+		measure_cluster(&clusters[c], indices, positions);
+		for (int k = 0; k < 3; ++k) {
+			mesh_centroid[k] += clusters[c].centroid[k];
+		}
+		mesh_area += clusters[c].area;
+	}
+
+	/*
+	 * Clusters facing away from the mesh center and far out along their
+	 * normal are the most likely to cover the rest from any direction
+	 */
+	for (uint32_t c = 0; c < cluster_count; ++c) {
+		struct cluster *cluster = &clusters[c];
+		double length = sqrt(cluster->normal[0] * cluster->normal[0]
+		                     + cluster->normal[1] * cluster->normal[1]
+		                     + cluster->normal[2] * cluster->normal[2]);
+		cluster->sort_key = 0.0;
+		if (length == 0.0 || cluster->area == 0.0 || mesh_area == 0.0) {
+			continue;
+		}
+		for (int k = 0; k < 3; ++k) {
+			double offset = cluster->centroid[k] / cluster->area
+			                - mesh_centroid[k] / mesh_area;
+			cluster->sort_key += offset * cluster->normal[k] / length;
+		}
+	}
+
+	qsort(clusters, cluster_count, sizeof(struct cluster),
+	      compare_clusters);
+
+	uint32_t written = 0;
+	for (uint32_t c = 0; c < cluster_count; ++c) {
+		uint32_t count = clusters[c].triangle_count * 3;
+		memcpy(&output[written], &indices[clusters[c].first_triangle * 3],
+		       count * sizeof(uint32_t));
+		written += count;
+	}
+	memcpy(indices, output, index_count * sizeof(uint32_t));
+
+	free(clusters);
+	free(output);
+	free(starts);
+	return NO_ERRORS;
+}
+
+uint32_t mesh_optimize_vertex_fetch(uint32_t *remap,
+                                    uint32_t *indices,
+                                    uint32_t index_count,
+                                    uint32_t vertex_count)
+{
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		remap[v] = UINT32_MAX;
+	}
+	uint32_t next = 0;
+	for (uint32_t i = 0; i < index_count; ++i) {
+		uint32_t v = indices[i];
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = next++;
+		}
+		indices[i] = remap[v];
+	}
+	return next;
+}
@@ -0,0 +1,69 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+} frame;
+
+layout(push_constant) uniform Object {
+	vec3 center;
+	float radius;
+} object;
+
+// The bindless storage buffer capacity
+layout(constant_id = 0) const uint BUFFER_COUNT = 1;
+// The bindless index of the mesh's vertex buffer
+layout(constant_id = 1) const uint VERTICES = 0;
+
+// The same 12 byte vertices as mesh.vert's vertex input, three words each:
+// snorm16 position x and y, z and padding, then the octahedral normal
+layout(set = 1, binding = 0) readonly buffer Vertices {
+	uint words[];
+} buffers[BUFFER_COUNT];
+
+layout(location = 0) out vec3 fragColor;
+// For lighting
+layout(location = 1) out vec3 fragPosition;
+layout(location = 2) out vec3 fragNormal;
+
+// Towards the light, up and to the left in front of the screen
+const vec3 light = normalize(vec3(-0.4, -0.6, -0.7));
+
+vec2 sign_not_zero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 decode_normal(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * sign_not_zero(n.xy);
+	}
+	return normalize(n);
+}
+
+void main() {
+	// The index buffer still sets gl_VertexIndex, no vertex input does
+	uint base = 3 * uint(gl_VertexIndex);
+	vec2 xy = unpackSnorm2x16(buffers[VERTICES].words[base]);
+	vec2 zw = unpackSnorm2x16(buffers[VERTICES].words[base + 1]);
+	vec3 position = vec3(xy, zw.x);
+	vec2 octahedral_normal
+		= unpackSnorm2x16(buffers[VERTICES].words[base + 2]);
+
+	// Positions are in units of the mesh's bounding sphere
+	vec3 p = position * object.radius + object.center;
+	gl_Position = frame.view_projection * vec4(p, 1.0);
+
+	vec3 normal = decode_normal(octahedral_normal);
+	float diffuse = max(dot(normal, light), 0.0);
+	fragColor = (0.5 + 0.5 * normal) * (0.2 + 0.8 * diffuse);
+	fragPosition = p;
+	fragNormal = normal;
+}
@@ -0,0 +1,825 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts a Wavefront OBJ file, or generates a UV sphere, into the binary
+ * mesh format hello-vulkan draws:
+ *
+ *     hello-vulkan-mesh [--sphere=SEGMENTS] [--optimize] [INPUT.obj] OUTPUT
+ *
+ * OBJ faces are counter-clockwise from outside with y up, so positions are
+ * turned half way around x and triangles reversed to face the viewer with
+ * y down. Vertices without normals get area weighted face normals.
+ *
+ * --optimize reorders triangles for the vertex cache and overdraw, then
+ * vertices for fetch locality, printing the ACMR and ATVR before and after.
+ * --shuffle scrambles both first, as a worst case to compare against.
+ */
+
+#include "error.h"
+#include "mesh.h"
+#include "mesh_optimize.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LENGTH 1024
+#define MAX_FACE_VERTICES 64
+#define DEFAULT_CACHE_SIZE 16
+#define OVERDRAW_THRESHOLD 1.05
+
+/* Float positions and normals, triangles counter-clockwise from outside */
+struct source_mesh {
+	float (*positions)[3];
+	float (*normals)[3];
+	uint32_t vertex_count;
+	uint32_t vertex_capacity;
+	uint32_t *indices;
+	uint32_t index_count;
+	uint32_t index_capacity;
+};
+
+struct options {
+	uint32_t sphere_segments;
+	bool optimize;
+	bool shuffle;
+	uint32_t shuffle_seed;
+	uint32_t cache_size;
+	const char *input_filename;
+	const char *output_filename;
+};
+
+static struct options options = {
+	.sphere_segments = 0,
+	.optimize = false,
+	.shuffle = false,
+	.shuffle_seed = 0,
+	.cache_size = DEFAULT_CACHE_SIZE,
+	.input_filename = NULL,
+	.output_filename = NULL,
+};
+
+static void source_mesh_fini(struct source_mesh *mesh)
+{
+	free(mesh->positions);
+	free(mesh->normals);
+	free(mesh->indices);
+	memset(mesh, 0, sizeof(*mesh));
+}
+
+static uint8_t grow(void **array, uint32_t *capacity, uint32_t count,
+                    size_t element_size)
+{
+	if (count < *capacity) {
+		return NO_ERRORS;
+	}
+	uint32_t new_capacity = *capacity ? *capacity * 2 : 1024;
+	void *new_array = realloc(*array, new_capacity * element_size);
+	if (new_array == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	*array = new_array;
+	*capacity = new_capacity;
+	return NO_ERRORS;
+}
+
+static uint8_t add_vertex(struct source_mesh *mesh,
+                          const float position[3],
+                          const float normal[3])
+{
+	uint32_t capacity = mesh->vertex_capacity;
+	uint8_t err = grow((void **) &mesh->positions, &capacity,
+	                   mesh->vertex_count, sizeof(*mesh->positions));
+	if (!err) {
+		capacity = mesh->vertex_capacity;
+		err = grow((void **) &mesh->normals, &capacity,
+		           mesh->vertex_count, sizeof(*mesh->normals));
+	}
+	if (err) {
+		return err;
+	}
+	mesh->vertex_capacity = capacity;
+	memcpy(mesh->positions[mesh->vertex_count], position,
+	       sizeof(*mesh->positions));
+	memcpy(mesh->normals[mesh->vertex_count], normal,
+	       sizeof(*mesh->normals));
+	++mesh->vertex_count;
+	return NO_ERRORS;
+}
+
+static uint8_t add_triangle(struct source_mesh *mesh,
+                            uint32_t a, uint32_t b, uint32_t c)
+{
+	while (mesh->index_count + 3 > mesh->index_capacity) {
+		uint8_t err = grow((void **) &mesh->indices,
+		                   &mesh->index_capacity, mesh->index_count + 2,
+		                   sizeof(uint32_t));
+		if (err) {
+			return err;
+		}
+	}
+	mesh->indices[mesh->index_count++] = a;
+	mesh->indices[mesh->index_count++] = b;
+	mesh->indices[mesh->index_count++] = c;
+	return NO_ERRORS;
+}
+
+static uint8_t generate_sphere(struct source_mesh *mesh, uint32_t segments)
+{
+	uint32_t rings = segments / 2;
+	const float pi = 3.14159265358979f;
+
+	for (uint32_t ring = 0; ring <= rings; ++ring) {
+		float polar = pi * ring / rings;
+		for (uint32_t segment = 0; segment <= segments; ++segment) {
+			float azimuth = 2.0f * pi * segment / segments;
+			float normal[3] = {
+				sinf(polar) * cosf(azimuth),
+				cosf(polar),
+				sinf(polar) * sinf(azimuth),
+			};
+			uint8_t err = add_vertex(mesh, normal, normal);
+			if (err) {
+				return err;
+			}
+		}
+	}
+
+	uint32_t stride = segments + 1;
+	for (uint32_t ring = 0; ring < rings; ++ring) {
+		for (uint32_t segment = 0; segment < segments; ++segment) {
+			uint32_t a = ring * stride + segment;
+			uint32_t b = a + stride;
+			uint8_t err = NO_ERRORS;
+			/* The quads at the poles are triangles */
+			if (ring != 0) {
+				err |= add_triangle(mesh, a, a + 1, b);
+			}
+			if (ring != rings - 1) {
+				err |= add_triangle(mesh, a + 1, b + 1, b);
+			}
+			if (err) {
+				return err;
+			}
+		}
+	}
+	return NO_ERRORS;
+}
+
+/* 1 based, negative counts back from the last one, 0 when absent */
+static bool parse_obj_index(const char **s, uint32_t count, uint32_t *index)
+{
+	char *end;
+	long value = strtol(*s, &end, 10);
+	if (end == *s) {
+		*index = 0;
+		return true;
+	}
+	*s = end;
+	if (value < 0) {
+		value += (long) count + 1;
+	}
+	if (value <= 0 || value > (long) count) {
+		return false;
+	}
+	*index = (uint32_t) value;
+	return true;
+}
+
+struct obj_arrays {
+	float (*values)[3];
+	uint32_t count;
+	uint32_t capacity;
+};
+
+static uint8_t obj_arrays_add(struct obj_arrays *arrays, const char *s)
+{
+	uint8_t err = grow((void **) &arrays->values, &arrays->capacity,
+	                   arrays->count, sizeof(*arrays->values));
+	if (err) {
+		return err;
+	}
+	float *value = arrays->values[arrays->count];
+	if (sscanf(s, "%f %f %f", &value[0], &value[1], &value[2]) != 3) {
+		return APP_ERROR_BIT;
+	}
+	++arrays->count;
+	return NO_ERRORS;
+}
+
+/*
+ * Every position and normal pair becomes its own vertex; faces share them
+ * through a table keyed by the pair
+ */
+struct vertex_table {
+	uint64_t *keys;
+	uint32_t *vertices;
+	uint32_t capacity;
+	uint32_t count;
+};
+
+static uint8_t vertex_table_find(struct vertex_table *table,
+                                 struct source_mesh *mesh,
+                                 const struct obj_arrays *positions,
+                                 const struct obj_arrays *normals,
+                                 uint32_t position, uint32_t normal,
+                                 uint32_t *vertex)
+{
+	if (2 * (table->count + 1) > table->capacity) {
+		uint32_t capacity = table->capacity ? table->capacity * 2 : 4096;
+		uint64_t *keys = malloc(capacity * sizeof(uint64_t));
+		uint32_t *vertices = malloc(capacity * sizeof(uint32_t));
+		if (keys == NULL || vertices == NULL) {
+			free(keys);
+			free(vertices);
+			return LIBC_ERROR_BIT;
+		}
+		memset(keys, 0, capacity * sizeof(uint64_t));
+		for (uint32_t i = 0; i < table->capacity; ++i) {
+			if (table->keys[i] == 0) {
+				continue;
+			}
+			uint32_t slot = (uint32_t) (table->keys[i]
+			                            * 0x9E3779B97F4A7C15ull >> 32)
+			                & (capacity - 1);
+			while (keys[slot] != 0) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			keys[slot] = table->keys[i];
+			vertices[slot] = table->vertices[i];
+		}
+		free(table->keys);
+		free(table->vertices);
+		table->keys = keys;
+		table->vertices = vertices;
+		table->capacity = capacity;
+	}
+
+	/* Positions are 1 based, so a key is never 0 */
+	uint64_t key = (uint64_t) position << 32 | normal;
+	uint32_t slot = (uint32_t) (key * 0x9E3779B97F4A7C15ull >> 32)
+	                & (table->capacity - 1);
+	while (table->keys[slot] != 0) {
+		if (table->keys[slot] == key) {
+			*vertex = table->vertices[slot];
+			return NO_ERRORS;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	static const float no_normal[3] = {0.0f, 0.0f, 0.0f};
+	uint8_t err = add_vertex(mesh, positions->values[position - 1],
+	                         normal ? normals->values[normal - 1]
+	                                : no_normal);
+	if (err) {
+		return err;
+	}
+	table->keys[slot] = key;
+	table->vertices[slot] = mesh->vertex_count - 1;
+	++table->count;
+	*vertex = mesh->vertex_count - 1;
+	return NO_ERRORS;
+}
+
+static uint8_t parse_face(struct source_mesh *mesh,
+                          struct vertex_table *table,
+                          const struct obj_arrays *positions,
+                          const struct obj_arrays *normals,
+                          const char *s)
+{
+	uint32_t face[MAX_FACE_VERTICES];
+	uint32_t face_count = 0;
+	while (true) {
+		while (*s == ' ' || *s == '\t') {
+			++s;
+		}
+		if (*s == '\0' || *s == '\n' || *s == '\r') {
+			break;
+		}
+		if (face_count == MAX_FACE_VERTICES) {
+			return APP_ERROR_BIT;
+		}
+
+		uint32_t position;
+		uint32_t texture_coordinate = 0;
+		uint32_t normal = 0;
+		if (!parse_obj_index(&s, positions->count, &position)
+		    || position == 0) {
+			return APP_ERROR_BIT;
+		}
+		if (*s == '/') {
+			++s;
+			/* Texture coordinates aren't kept, only skipped */
+			if (!parse_obj_index(&s, UINT32_MAX / 2,
+			                     &texture_coordinate)) {
+				return APP_ERROR_BIT;
+			}
+			if (*s == '/') {
+				++s;
+				if (!parse_obj_index(&s, normals->count, &normal)) {
+					return APP_ERROR_BIT;
+				}
+			}
+		}
+
+		uint8_t err = vertex_table_find(table, mesh, positions, normals,
+		                                position, normal,
+		                                &face[face_count]);
+		if (err) {
+			return err;
+		}
+		++face_count;
+	}
+
+	for (uint32_t i = 2; i < face_count; ++i) {
+		uint8_t err = add_triangle(mesh, face[0], face[i - 1], face[i]);
+		if (err) {
+			return err;
+		}
+	}
+	return NO_ERRORS;
+}
+
+static void cross(float out[3], const float a[3], const float b[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static void normalize(float v[3])
+{
+	float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length > 0.0f) {
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+	else {
+		v[0] = 0.0f;
+		v[1] = 0.0f;
+		v[2] = 1.0f;
+	}
+}
+
+/*
+ * Vertices that came without one get the sum of their faces' normals, which
+ * are as long as the faces are large
+ */
+static void generate_missing_normals(struct source_mesh *mesh)
+{
+	bool *missing = calloc(mesh->vertex_count, sizeof(bool));
+	if (missing == NULL) {
+		return;
+	}
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		const float *n = mesh->normals[i];
+		missing[i] = n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f;
+	}
+	for (uint32_t i = 0; i < mesh->index_count; i += 3) {
+		const uint32_t *t = &mesh->indices[i];
+		const float *a = mesh->positions[t[0]];
+		const float *b = mesh->positions[t[1]];
+		const float *c = mesh->positions[t[2]];
+		float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+		float ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+		float face_normal[3];
+		cross(face_normal, ab, ac);
+		for (int j = 0; j < 3; ++j) {
+			if (!missing[t[j]]) {
+				continue;
+			}
+			for (int k = 0; k < 3; ++k) {
+				mesh->normals[t[j]][k] += face_normal[k];
+			}
+		}
+	}
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		normalize(mesh->normals[i]);
+	}
+	free(missing);
+}
+
+static uint8_t load_obj(struct source_mesh *mesh, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		printf("Could not open %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+
+	struct obj_arrays positions = {NULL, 0, 0};
+	struct obj_arrays normals = {NULL, 0, 0};
+	struct vertex_table table = {NULL, NULL, 0, 0};
+
+	char line[MAX_LINE_LENGTH];
+	uint32_t line_number = 0;
+	uint8_t err = NO_ERRORS;
+	while (!err && fgets(line, sizeof(line), file) != NULL) {
+		++line_number;
+		if (strncmp(line, "v ", 2) == 0) {
+			err = obj_arrays_add(&positions, line + 2);
+		}
+		else if (strncmp(line, "vn ", 3) == 0) {
+			err = obj_arrays_add(&normals, line + 3);
+		}
+		else if (strncmp(line, "f ", 2) == 0) {
+			err = parse_face(mesh, &table, &positions, &normals,
+			                 line + 2);
+		}
+		if (err) {
+			printf("%s:%u: could not parse\n", filename, line_number);
+		}
+	}
+	if (ferror(file)) {
+		err |= LIBC_ERROR_BIT;
+	}
+	fclose(file);
+
+	free(table.keys);
+	free(table.vertices);
+	free(positions.values);
+	free(normals.values);
+
+	if (!err) {
+		generate_missing_normals(mesh);
+	}
+	return err;
+}
+
+/* Half a turn around x: y up and towards the viewer becomes y and z away */
+static void turn_to_clip_space(struct source_mesh *mesh)
+{
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		mesh->positions[i][1] = -mesh->positions[i][1];
+		mesh->positions[i][2] = -mesh->positions[i][2];
+		mesh->normals[i][1] = -mesh->normals[i][1];
+		mesh->normals[i][2] = -mesh->normals[i][2];
+	}
+}
+
+/* Moves the bounding box center to the origin, returning the radius */
+static float center(struct source_mesh *mesh)
+{
+	float min[3] = {INFINITY, INFINITY, INFINITY};
+	float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		for (int k = 0; k < 3; ++k) {
+			min[k] = fminf(min[k], mesh->positions[i][k]);
+			max[k] = fmaxf(max[k], mesh->positions[i][k]);
+		}
+	}
+	float radius = 0.0f;
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		float length_squared = 0.0f;
+		for (int k = 0; k < 3; ++k) {
+			mesh->positions[i][k] -= (min[k] + max[k]) / 2.0f;
+			length_squared += mesh->positions[i][k]
+			                  * mesh->positions[i][k];
+		}
+		radius = fmaxf(radius, sqrtf(length_squared));
+	}
+	return radius;
+}
+
+/* xorshift32, so a seed gives the same mesh everywhere */
+static uint32_t next_random(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* Moves vertex i to remap[i], dropping the ones mapped to UINT32_MAX */
+static uint8_t remap_vertices(struct source_mesh *mesh,
+                              const uint32_t *remap,
+                              uint32_t vertex_count)
+{
+	float (*positions)[3] = malloc(vertex_count * sizeof(*positions));
+	float (*normals)[3] = malloc(vertex_count * sizeof(*normals));
+	if (positions == NULL || normals == NULL) {
+		free(positions);
+		free(normals);
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		if (remap[i] == UINT32_MAX) {
+			continue;
+		}
+		memcpy(positions[remap[i]], mesh->positions[i],
+		       sizeof(*positions));
+		memcpy(normals[remap[i]], mesh->normals[i], sizeof(*normals));
+	}
+	free(mesh->positions);
+	free(mesh->normals);
+	mesh->positions = positions;
+	mesh->normals = normals;
+	mesh->vertex_count = vertex_count;
+	mesh->vertex_capacity = vertex_count;
+	return NO_ERRORS;
+}
+
+static uint8_t shuffle(struct source_mesh *mesh, uint32_t seed)
+{
+	uint32_t state = seed != 0 ? seed : 1;
+	uint32_t triangle_count = mesh->index_count / 3;
+	/* Nothing to scramble, and the loops below count down from count - 1 */
+	if (triangle_count < 2 || mesh->vertex_count < 2) {
+		return NO_ERRORS;
+	}
+	for (uint32_t i = triangle_count - 1; i > 0; --i) {
+		uint32_t j = next_random(&state) % (i + 1);
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t index = mesh->indices[i * 3 + k];
+			mesh->indices[i * 3 + k] = mesh->indices[j * 3 + k];
+			mesh->indices[j * 3 + k] = index;
+		}
+	}
+
+	uint32_t *remap = malloc(mesh->vertex_count * sizeof(uint32_t));
+	if (remap == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		remap[i] = i;
+	}
+	for (uint32_t i = mesh->vertex_count - 1; i > 0; --i) {
+		uint32_t j = next_random(&state) % (i + 1);
+		uint32_t v = remap[i];
+		remap[i] = remap[j];
+		remap[j] = v;
+	}
+	for (uint32_t i = 0; i < mesh->index_count; ++i) {
+		mesh->indices[i] = remap[mesh->indices[i]];
+	}
+	uint8_t err = remap_vertices(mesh, remap, mesh->vertex_count);
+	free(remap);
+	return err;
+}
+
+static void print_cache_stats(const char *label,
+                              const struct source_mesh *mesh)
+{
+	struct mesh_cache_stats stats;
+	mesh_analyze_vertex_cache(&stats, mesh->indices, mesh->index_count,
+	                          mesh->vertex_count, options.cache_size);
+	printf("%s: ACMR %.3f, ATVR %.3f with a %u vertex FIFO cache\n",
+	       label, stats.acmr, stats.atvr, options.cache_size);
+}
+
+static uint8_t optimize(struct source_mesh *mesh)
+{
+	print_cache_stats("Before", mesh);
+
+	uint8_t err = mesh_optimize_vertex_cache(mesh->indices,
+	                                         mesh->index_count,
+	                                         mesh->vertex_count);
+	if (err) {
+		return err;
+	}
+	print_cache_stats("Vertex cache", mesh);
+
+	err = mesh_optimize_overdraw(mesh->indices, mesh->index_count,
+	                             (const float (*)[3]) mesh->positions,
+	                             mesh->vertex_count, options.cache_size,
+	                             OVERDRAW_THRESHOLD);
+	if (err) {
+		return err;
+	}
+	print_cache_stats("Overdraw", mesh);
+
+	uint32_t *remap = malloc(mesh->vertex_count * sizeof(uint32_t));
+	if (remap == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	uint32_t vertex_count = mesh_optimize_vertex_fetch(remap, mesh->indices,
+	                                                   mesh->index_count,
+	                                                   mesh->vertex_count);
+	err = remap_vertices(mesh, remap, vertex_count);
+	free(remap);
+	if (err) {
+		return err;
+	}
+	print_cache_stats("Vertex fetch", mesh);
+	return NO_ERRORS;
+}
+
+static uint32_t align(uint32_t offset)
+{
+	return (offset + MESH_ALIGNMENT - 1) / MESH_ALIGNMENT * MESH_ALIGNMENT;
+}
+
+static uint8_t write_mesh(const struct source_mesh *mesh,
+                          float radius,
+                          const char *filename)
+{
+	uint32_t index_size = mesh->vertex_count <= 65536 ? 2 : 4;
+	uint32_t vertex_offset = align(sizeof(struct mesh_header));
+	uint32_t index_offset = align(vertex_offset + mesh->vertex_count
+	                                              * sizeof(struct mesh_vertex));
+	size_t size = (size_t) index_offset
+	              + (size_t) mesh->index_count * index_size;
+
+	char *data = calloc(1, size);
+	if (data == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+
+	struct mesh_header header = {
+		.magic = MESH_MAGIC,
+		.version = MESH_VERSION,
+		.vertex_count = mesh->vertex_count,
+		.index_count = mesh->index_count,
+		.index_size = index_size,
+		.vertex_offset = vertex_offset,
+		.index_offset = index_offset,
+		.radius = radius,
+	};
+	memcpy(data, &header, sizeof(header));
+
+	struct mesh_vertex *vertices
+		= (struct mesh_vertex *) (data + vertex_offset);
+	for (uint32_t i = 0; i < mesh->vertex_count; ++i) {
+		mesh_encode_position(vertices[i].position, mesh->positions[i],
+		                     radius);
+		mesh_encode_normal(vertices[i].normal, mesh->normals[i]);
+	}
+
+	/* Reversed, since y now points down the screen */
+	for (uint32_t i = 0; i < mesh->index_count; ++i) {
+		uint32_t corner = i % 3;
+		uint32_t source = i - corner + (corner == 0 ? 0 : 3 - corner);
+		uint32_t index = mesh->indices[source];
+		if (index_size == 2) {
+			((uint16_t *) (data + index_offset))[i] = (uint16_t) index;
+		}
+		else {
+			((uint32_t *) (data + index_offset))[i] = index;
+		}
+	}
+
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) {
+		free(data);
+		printf("Could not create %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+	uint8_t err = NO_ERRORS;
+	if (fwrite(data, 1, size, file) != size) {
+		err = LIBC_ERROR_BIT;
+	}
+	if (fclose(file) != 0) {
+		err |= LIBC_ERROR_BIT;
+	}
+	free(data);
+	if (err) {
+		remove(filename);
+		return err;
+	}
+
+	/* float32 positions and normals with 32 bit indices */
+	size_t float_size = sizeof(struct mesh_header)
+	                    + (size_t) mesh->vertex_count * 6 * sizeof(float)
+	                    + (size_t) mesh->index_count * sizeof(uint32_t);
+	printf("Wrote %u vertices, %u triangles, %zu bytes"
+	       " (%zu as float32, %.0f%%)\n",
+	       mesh->vertex_count, mesh->index_count / 3, size, float_size,
+	       100.0 * size / float_size);
+	return NO_ERRORS;
+}
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options] [INPUT.obj] OUTPUT\n"
+	       "  --sphere=SEGMENTS  generate a UV sphere instead of reading\n"
+	       "  --optimize         reorder for the vertex cache, overdraw\n"
+	       "                     and vertex fetch\n"
+	       "  --shuffle=SEED     scramble triangles and vertices first\n"
+	       "  --cache-size=N     vertices in the simulated FIFO cache,\n"
+	       "                     default %u\n",
+	       program, DEFAULT_CACHE_SIZE);
+}
+
+static uint8_t parse_options(int argc, char **argv)
+{
+	enum {
+		OPTION_SPHERE = 256,
+		OPTION_OPTIMIZE,
+		OPTION_SHUFFLE,
+		OPTION_CACHE_SIZE,
+	};
+	static const struct option long_options[] = {
+		{ "sphere", required_argument, NULL, OPTION_SPHERE },
+		{ "optimize", no_argument, NULL, OPTION_OPTIMIZE },
+		{ "shuffle", required_argument, NULL, OPTION_SHUFFLE },
+		{ "cache-size", required_argument, NULL, OPTION_CACHE_SIZE },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		char *end;
+		switch (c) {
+		case OPTION_SPHERE:
+			options.sphere_segments = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.sphere_segments < 4) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_OPTIMIZE:
+			options.optimize = true;
+			break;
+		case OPTION_SHUFFLE:
+			options.shuffle = true;
+			options.shuffle_seed = strtoul(optarg, &end, 10);
+			if (*end != '\0') {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_CACHE_SIZE:
+			options.cache_size = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.cache_size < 3) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return APP_ERROR_BIT;
+		}
+	}
+
+	int operand_count = options.sphere_segments != 0 ? 1 : 2;
+	if (argc - optind != operand_count) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	if (options.sphere_segments == 0) {
+		options.input_filename = argv[optind++];
+	}
+	options.output_filename = argv[optind];
+	return NO_ERRORS;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t err = parse_options(argc, argv);
+	if (err) {
+		return err;
+	}
+
+	struct source_mesh mesh;
+	memset(&mesh, 0, sizeof(mesh));
+	if (options.sphere_segments != 0) {
+		err = generate_sphere(&mesh, options.sphere_segments);
+	}
+	else {
+		err = load_obj(&mesh, options.input_filename);
+		if (!err) {
+			turn_to_clip_space(&mesh);
+		}
+	}
+	if (!err && mesh.index_count == 0) {
+		printf("No triangles\n");
+		err = APP_ERROR_BIT;
+	}
+
+	if (!err && options.shuffle) {
+		err = shuffle(&mesh, options.shuffle_seed);
+	}
+	if (!err && options.optimize) {
+		err = optimize(&mesh);
+	}
+	else if (!err) {
+		print_cache_stats("Order", &mesh);
+	}
+
+	if (!err) {
+		float radius = center(&mesh);
+		err = write_mesh(&mesh, radius, options.output_filename);
+	}
+	source_mesh_fini(&mesh);
+	return err;
+}
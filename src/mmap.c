@@ -14,19 +14,97 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* For RUSAGE_THREAD */
+#define _GNU_SOURCE
+
 #include "mmap.h"
 
 #include "error.h"
 
 #include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
-uint8_t mmap_init(const char *filename, struct mmap_result *result)
+void mmap_faults_now(struct mmap_faults *faults)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) == -1) {
+		faults->major = 0;
+		faults->minor = 0;
+		return;
+	}
+	faults->major = usage.ru_majflt;
+	faults->minor = usage.ru_minflt;
+}
+
+static void add_faults_since(struct mmap_faults *total,
+                             const struct mmap_faults *since)
+{
+	struct mmap_faults now;
+	mmap_faults_now(&now);
+	total->major += now.major - since->major;
+	total->minor += now.minor - since->minor;
+}
+
+void mmap_faults_add_since(struct mmap_result *result,
+                           const struct mmap_faults *since)
+{
+	add_faults_since(&result->faults, since);
+}
+
+/* One read per page brings it into the page cache and the page tables */
+static void *touch_pages(void *data)
+{
+	struct mmap_result *result = data;
+	struct mmap_faults since;
+	mmap_faults_now(&since);
+
+	const volatile uint8_t *bytes = (const volatile uint8_t *) result->data;
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	for (size_t offset = 0; offset < result->data_size;
+	     offset += page_size) {
+		(void) bytes[offset];
+	}
+
+	result->readahead_faults.major = 0;
+	result->readahead_faults.minor = 0;
+	add_faults_since(&result->readahead_faults, &since);
+	return NULL;
+}
+
+static void advise(struct mmap_result *result, uint32_t hints)
+{
+	if (hints & MMAP_HINT_SEQUENTIAL) {
+		madvise(result->data, result->data_size, MADV_SEQUENTIAL);
+	}
+	if (hints & MMAP_HINT_WILLNEED) {
+		madvise(result->data, result->data_size, MADV_WILLNEED);
+	}
+#ifdef MADV_HUGEPAGE
+	/* File backed huge pages need CONFIG_READ_ONLY_THP_FOR_FS */
+	if ((hints & MMAP_HINT_HUGE_PAGES)
+	    && result->data_size >= MMAP_HUGE_PAGE_SIZE) {
+		madvise(result->data, result->data_size, MADV_HUGEPAGE);
+	}
+#endif
+}
+
+uint8_t mmap_init(const char *filename,
+                  uint32_t hints,
+                  struct mmap_result *result)
 {
 	result->data = NULL;
 	result->data_size = 0;
+	result->faults.major = 0;
+	result->faults.minor = 0;
+	result->readahead = false;
+	result->readahead_faults.major = 0;
+	result->readahead_faults.minor = 0;
+
+	struct mmap_faults since;
+	mmap_faults_now(&since);
 
 	int fd = open(filename, O_RDONLY | O_CLOEXEC);
 	if (fd == -1) {
@@ -39,8 +117,13 @@ uint8_t mmap_init(const char *filename, struct mmap_result *result)
 		return POSIX_ERROR_BIT;
 	}
 
+	int flags = MAP_PRIVATE;
+	if (hints & MMAP_HINT_POPULATE) {
+		flags |= MAP_POPULATE;
+	}
+
 	result->data_size = stat.st_size;
-	result->data = mmap(NULL, result->data_size, PROT_READ, MAP_PRIVATE,
+	result->data = mmap(NULL, result->data_size, PROT_READ, flags,
 	                    fd, 0);
 
 	if (result->data == MAP_FAILED) {
@@ -51,11 +134,33 @@ uint8_t mmap_init(const char *filename, struct mmap_result *result)
 	}
 
 	close(fd);
+
+	advise(result, hints);
+	add_faults_since(&result->faults, &since);
+
+	if ((hints & MMAP_HINT_READAHEAD_THREAD) && result->data_size > 0) {
+		/* Without a thread the pages still fault in on first use */
+		result->readahead = pthread_create(&result->readahead_thread,
+		                                   NULL, touch_pages,
+		                                   result) == 0;
+	}
 	return 0;
 }
 
+void mmap_wait(struct mmap_result *result)
+{
+	if (!result->readahead) {
+		return;
+	}
+	pthread_join(result->readahead_thread, NULL);
+	result->readahead = false;
+	result->faults.major += result->readahead_faults.major;
+	result->faults.minor += result->readahead_faults.minor;
+}
+
 void mmap_fini(struct mmap_result *result)
 {
+	mmap_wait(result);
 	munmap((void *) result->data, result->data_size);
 	result->data = NULL;
 	result->data_size = 0;
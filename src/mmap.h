@@ -17,15 +17,63 @@
 #ifndef HELLO_VULKAN_MMAP_H
 #define HELLO_VULKAN_MMAP_H
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * How a mapping is going to be read, so first touches don't each take a
+ * demand fault on the startup path. Hints the kernel can't honour are
+ * skipped rather than failing the mapping.
+ */
+enum mmap_hint {
+	MMAP_HINT_NONE = 0,
+	/* Fault everything in before mmap_init returns */
+	MMAP_HINT_POPULATE = 1 << 0,
+	MMAP_HINT_SEQUENTIAL = 1 << 1,
+	MMAP_HINT_WILLNEED = 1 << 2,
+	/* Only for mappings of at least MMAP_HUGE_PAGE_SIZE */
+	MMAP_HINT_HUGE_PAGES = 1 << 3,
+	/* Touch every page from a thread until mmap_wait */
+	MMAP_HINT_READAHEAD_THREAD = 1 << 4,
+};
+
+#define MMAP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+struct mmap_faults {
+	uint64_t major;
+	uint64_t minor;
+};
+
 struct mmap_result {
 	uint32_t *data;
 	size_t data_size;
+
+	/* Taken while mapping, by the readahead thread and by callers */
+	struct mmap_faults faults;
+
+	bool readahead;
+	pthread_t readahead_thread;
+	struct mmap_faults readahead_faults;
 };
 
-uint8_t mmap_init(const char *filename, struct mmap_result *result);
+uint8_t mmap_init(const char *filename,
+                  uint32_t hints,
+                  struct mmap_result *result);
+/* Waits for the readahead thread, if any */
 void mmap_fini(struct mmap_result *result);
 
+/* Joins the readahead thread and adds the faults it took */
+void mmap_wait(struct mmap_result *result);
+
+/* The calling thread's faults so far */
+void mmap_faults_now(struct mmap_faults *faults);
+/*
+ * Charges the calling thread's faults since a mmap_faults_now to a mapping,
+ * from one thread at a time.
+ */
+void mmap_faults_add_since(struct mmap_result *result,
+                           const struct mmap_faults *since);
+
 #endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "nbody.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BODIES_ALIGNMENT 32
+/* Drops the sparse tail past the radius enclosing this much of the mass */
+#define PLUMMER_MASS_CUTOFF 0.999f
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static float random_range(uint32_t *state, float min, float max)
+{
+	float unit = (float) (xorshift32(state) >> 8) * (1.0f / 16777216.0f);
+	return min + unit * (max - min);
+}
+
+static void random_direction(uint32_t *state, float length, float v[3])
+{
+	float z = random_range(state, -1.0f, 1.0f);
+	float angle = random_range(state, 0.0f, 2.0f * (float) M_PI);
+	float r = sqrtf(1.0f - z * z);
+	v[0] = length * r * cosf(angle);
+	v[1] = length * r * sinf(angle);
+	v[2] = length * z;
+}
+
+uint8_t nbody_bodies_init(struct nbody_bodies *bodies, uint32_t count)
+{
+	memset(bodies, 0, sizeof(*bodies));
+	uint32_t capacity = (count + NBODY_WIDTH - 1) / NBODY_WIDTH * NBODY_WIDTH;
+	size_t size = (size_t) capacity * sizeof(float);
+	float **arrays[] = {
+		&bodies->x, &bodies->y, &bodies->z, &bodies->mass,
+		&bodies->vx, &bodies->vy, &bodies->vz,
+		&bodies->ax, &bodies->ay, &bodies->az,
+	};
+	for (uint32_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i) {
+		*arrays[i] = aligned_alloc(BODIES_ALIGNMENT, size);
+		if (*arrays[i] == NULL) {
+			nbody_bodies_fini(bodies);
+			return LIBC_ERROR_BIT;
+		}
+		memset(*arrays[i], 0, size);
+	}
+	bodies->count = count;
+	bodies->capacity = capacity;
+	return NO_ERRORS;
+}
+
+void nbody_bodies_fini(struct nbody_bodies *bodies)
+{
+	free(bodies->x);
+	free(bodies->y);
+	free(bodies->z);
+	free(bodies->mass);
+	free(bodies->vx);
+	free(bodies->vy);
+	free(bodies->vz);
+	free(bodies->ax);
+	free(bodies->ay);
+	free(bodies->az);
+	memset(bodies, 0, sizeof(*bodies));
+}
+
+/* Aarseth, Henon and Wielen's sampling, in units where G = M = a = 1 */
+void nbody_generate_plummer(struct nbody_bodies *bodies, uint32_t seed)
+{
+	uint32_t state = seed != 0 ? seed : 1;
+	double center[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		float enclosed = random_range(&state, 0.0f, PLUMMER_MASS_CUTOFF);
+		while (enclosed == 0.0f) {
+			enclosed = random_range(&state, 0.0f, PLUMMER_MASS_CUTOFF);
+		}
+		float radius = 1.0f / sqrtf(powf(enclosed, -2.0f / 3.0f) - 1.0f);
+		float position[3];
+		random_direction(&state, radius, position);
+
+		/* Von Neumann rejection of q = v / v_escape from q^2 (1 - q^2)^3.5 */
+		float q;
+		float y;
+		do {
+			q = random_range(&state, 0.0f, 1.0f);
+			y = random_range(&state, 0.0f, 0.1f);
+		} while (y > q * q * powf(1.0f - q * q, 3.5f));
+		float speed = q * sqrtf(2.0f) * powf(1.0f + radius * radius, -0.25f);
+		float velocity[3];
+		random_direction(&state, speed, velocity);
+
+		bodies->x[i] = position[0];
+		bodies->y[i] = position[1];
+		bodies->z[i] = position[2];
+		bodies->vx[i] = velocity[0];
+		bodies->vy[i] = velocity[1];
+		bodies->vz[i] = velocity[2];
+		bodies->mass[i] = 1.0f / bodies->count;
+		for (uint32_t j = 0; j < 3; ++j) {
+			center[j] += position[j];
+			center[3 + j] += velocity[j];
+		}
+	}
+
+	for (uint32_t j = 0; j < 6; ++j) {
+		center[j] /= bodies->count;
+	}
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		bodies->x[i] -= (float) center[0];
+		bodies->y[i] -= (float) center[1];
+		bodies->z[i] -= (float) center[2];
+		bodies->vx[i] -= (float) center[3];
+		bodies->vy[i] -= (float) center[4];
+		bodies->vz[i] -= (float) center[5];
+	}
+}
+
+uint8_t nbody_write(const struct nbody_bodies *bodies,
+                    const struct nbody_header *header,
+                    const char *filename)
+{
+	size_t size = sizeof(struct nbody_header)
+	              + (size_t) bodies->count * sizeof(struct nbody_record);
+	char *data = malloc(size);
+	if (data == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+
+	struct nbody_header written = *header;
+	memcpy(written.magic, NBODY_MAGIC, sizeof(written.magic));
+	written.version = NBODY_VERSION;
+	written.body_count = bodies->count;
+	memcpy(data, &written, sizeof(written));
+
+	struct nbody_record *records
+		= (struct nbody_record *) (data + sizeof(struct nbody_header));
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		records[i] = (struct nbody_record) {
+			.position = {bodies->x[i], bodies->y[i], bodies->z[i]},
+			.mass = bodies->mass[i],
+			.velocity = {bodies->vx[i], bodies->vy[i], bodies->vz[i]},
+			.padding = 0.0f,
+		};
+	}
+
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) {
+		free(data);
+		printf("Could not create %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+	uint8_t err = NO_ERRORS;
+	if (fwrite(data, 1, size, file) != size) {
+		err = LIBC_ERROR_BIT;
+	}
+	if (fclose(file) != 0) {
+		err |= LIBC_ERROR_BIT;
+	}
+	free(data);
+	if (err) {
+		remove(filename);
+	}
+	return err;
+}
+
+uint8_t nbody_read(struct nbody_bodies *bodies,
+                   struct nbody_header *header,
+                   const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		printf("Could not open %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+	if (fread(header, sizeof(*header), 1, file) != 1
+	    || memcmp(header->magic, NBODY_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != NBODY_VERSION) {
+		fclose(file);
+		printf("%s is not an N-body snapshot\n", filename);
+		return APP_ERROR_BIT;
+	}
+
+	uint8_t err = nbody_bodies_init(bodies, header->body_count);
+	if (err) {
+		fclose(file);
+		return err;
+	}
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		struct nbody_record record;
+		if (fread(&record, sizeof(record), 1, file) != 1) {
+			printf("%s is truncated\n", filename);
+			err = APP_ERROR_BIT;
+			break;
+		}
+		bodies->x[i] = record.position[0];
+		bodies->y[i] = record.position[1];
+		bodies->z[i] = record.position[2];
+		bodies->mass[i] = record.mass;
+		bodies->vx[i] = record.velocity[0];
+		bodies->vy[i] = record.velocity[1];
+		bodies->vz[i] = record.velocity[2];
+	}
+	fclose(file);
+	if (err) {
+		nbody_bodies_fini(bodies);
+	}
+	return err;
+}
+
+double nbody_compare(const struct nbody_bodies *a,
+                     const struct nbody_bodies *b)
+{
+	double radius_squared = 0.0;
+	double largest_squared = 0.0;
+	for (uint32_t i = 0; i < a->count; ++i) {
+		radius_squared += (double) a->x[i] * a->x[i]
+		                  + (double) a->y[i] * a->y[i]
+		                  + (double) a->z[i] * a->z[i];
+		double dx = (double) a->x[i] - b->x[i];
+		double dy = (double) a->y[i] - b->y[i];
+		double dz = (double) a->z[i] - b->z[i];
+		double distance_squared = dx * dx + dy * dy + dz * dz;
+		/* Written so a NaN counts as the largest */
+		if (!(distance_squared <= largest_squared)) {
+			largest_squared = distance_squared;
+		}
+	}
+	if (radius_squared == 0.0) {
+		return sqrt(largest_squared);
+	}
+	return sqrt(largest_squared / (radius_squared / a->count));
+}
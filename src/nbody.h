@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_NBODY_H
+#define HELLO_VULKAN_NBODY_H
+
+#include <stdint.h>
+
+/* Bodies per AVX2 register, which every array is padded to */
+#define NBODY_WIDTH 8
+
+/*
+ * A snapshot file is a header followed by one record per body, in the
+ * std430 layout of a vec4 position and mass and a vec4 velocity, so a GPU
+ * backend can write its storage buffer out as it is.
+ */
+#define NBODY_MAGIC "HVNB"
+#define NBODY_VERSION 1
+
+struct nbody_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t body_count;
+	uint32_t step;
+	float time;
+	float softening;
+};
+
+struct nbody_record {
+	float position[3];
+	float mass;
+	float velocity[3];
+	float padding;
+};
+
+/*
+ * Bodies as a structure of arrays, each aligned and padded to NBODY_WIDTH
+ * with massless bodies at the origin, which pull on nothing. Accelerations
+ * are kept between steps for the integrator.
+ */
+struct nbody_bodies {
+	float *x;
+	float *y;
+	float *z;
+	float *mass;
+	float *vx;
+	float *vy;
+	float *vz;
+	float *ax;
+	float *ay;
+	float *az;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+uint8_t nbody_bodies_init(struct nbody_bodies *bodies, uint32_t count);
+void nbody_bodies_fini(struct nbody_bodies *bodies);
+
+/*
+ * A Plummer sphere of total mass 1 and scale radius 1 (with G = 1) in its
+ * center of mass frame, the same bodies for the same seed on every backend.
+ */
+void nbody_generate_plummer(struct nbody_bodies *bodies, uint32_t seed);
+
+uint8_t nbody_write(const struct nbody_bodies *bodies,
+                    const struct nbody_header *header,
+                    const char *filename);
+/* Initializes bodies from the file, which the caller then finishes */
+uint8_t nbody_read(struct nbody_bodies *bodies,
+                   struct nbody_header *header,
+                   const char *filename);
+
+/*
+ * The largest distance between a body's positions in a and in b, relative to
+ * the root mean square radius of a. Both must have the same bodies.
+ */
+double nbody_compare(const struct nbody_bodies *a,
+                     const struct nbody_bodies *b);
+
+#endif
@@ -0,0 +1,577 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "nbody_cpu.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NBODY_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#define NBODY_ARM
+#include <arm_neon.h>
+#endif
+
+/* Bodies a direct task accelerates */
+#define BLOCK_BODIES 64
+/* Bodies swept past a block at a time, 16 KiB of positions and masses */
+#define TILE_BODIES 1024
+/* Bodies a Barnes-Hut task walks the octree for */
+#define WALK_BODIES 256
+/* Past this, bodies that share a leaf stay together in it */
+#define OCTREE_MAX_DEPTH 20
+
+#define OCTREE_EMPTY -1
+#define OCTREE_INTERNAL -2
+
+typedef void (*accelerate_function)(const struct nbody_bodies *bodies,
+                                    float softening_squared,
+                                    uint32_t begin,
+                                    uint32_t end);
+
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/*
+ * Every kernel zeroes its block's accelerations, then adds each tile's pull
+ * to them, so a tile is read from memory once per block rather than once per
+ * body. Massless padding pulls on nothing and softening keeps a body's pull
+ * on itself at 0.
+ */
+static void accelerate_scalar(const struct nbody_bodies *bodies,
+                              float softening_squared,
+                              uint32_t begin,
+                              uint32_t end)
+{
+	for (uint32_t i = begin; i < end; ++i) {
+		bodies->ax[i] = 0.0f;
+		bodies->ay[i] = 0.0f;
+		bodies->az[i] = 0.0f;
+	}
+	for (uint32_t tile = 0; tile < bodies->capacity; tile += TILE_BODIES) {
+		uint32_t tile_end = min_u32(tile + TILE_BODIES, bodies->capacity);
+		for (uint32_t i = begin; i < end; ++i) {
+			float x = bodies->x[i];
+			float y = bodies->y[i];
+			float z = bodies->z[i];
+			float ax = bodies->ax[i];
+			float ay = bodies->ay[i];
+			float az = bodies->az[i];
+			for (uint32_t j = tile; j < tile_end; ++j) {
+				float dx = bodies->x[j] - x;
+				float dy = bodies->y[j] - y;
+				float dz = bodies->z[j] - z;
+				float r2 = dx * dx + dy * dy + dz * dz
+				           + softening_squared;
+				float inverse = 1.0f / sqrtf(r2);
+				float s = bodies->mass[j] * inverse * inverse * inverse;
+				ax += dx * s;
+				ay += dy * s;
+				az += dz * s;
+			}
+			bodies->ax[i] = ax;
+			bodies->ay[i] = ay;
+			bodies->az[i] = az;
+		}
+	}
+}
+
+#ifdef NBODY_X86
+/* Eight bodies per register, each other body broadcast to all of them */
+__attribute__((target("avx2,fma")))
+static void accelerate_avx2(const struct nbody_bodies *bodies,
+                            float softening_squared,
+                            uint32_t begin,
+                            uint32_t end)
+{
+	const __m256 softening = _mm256_set1_ps(softening_squared);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	for (uint32_t i = begin; i < end; i += 8) {
+		_mm256_store_ps(bodies->ax + i, zero);
+		_mm256_store_ps(bodies->ay + i, zero);
+		_mm256_store_ps(bodies->az + i, zero);
+	}
+	for (uint32_t tile = 0; tile < bodies->capacity; tile += TILE_BODIES) {
+		uint32_t tile_end = min_u32(tile + TILE_BODIES, bodies->capacity);
+		for (uint32_t i = begin; i < end; i += 8) {
+			__m256 x = _mm256_load_ps(bodies->x + i);
+			__m256 y = _mm256_load_ps(bodies->y + i);
+			__m256 z = _mm256_load_ps(bodies->z + i);
+			__m256 ax = _mm256_load_ps(bodies->ax + i);
+			__m256 ay = _mm256_load_ps(bodies->ay + i);
+			__m256 az = _mm256_load_ps(bodies->az + i);
+			for (uint32_t j = tile; j < tile_end; ++j) {
+				__m256 dx = _mm256_sub_ps(
+					_mm256_broadcast_ss(bodies->x + j), x
+				);
+				__m256 dy = _mm256_sub_ps(
+					_mm256_broadcast_ss(bodies->y + j), y
+				);
+				__m256 dz = _mm256_sub_ps(
+					_mm256_broadcast_ss(bodies->z + j), z
+				);
+				__m256 r2 = _mm256_fmadd_ps(
+					dx, dx,
+					_mm256_fmadd_ps(dy, dy,
+					                _mm256_fmadd_ps(dz, dz,
+					                                softening))
+				);
+				/* A Newton step takes the 12 bit estimate to 23 */
+				__m256 inverse = _mm256_rsqrt_ps(r2);
+				inverse = _mm256_mul_ps(
+					_mm256_mul_ps(half, inverse),
+					_mm256_fnmadd_ps(_mm256_mul_ps(r2, inverse),
+					                 inverse, three)
+				);
+				__m256 s = _mm256_mul_ps(
+					_mm256_broadcast_ss(bodies->mass + j),
+					_mm256_mul_ps(inverse,
+					              _mm256_mul_ps(inverse, inverse))
+				);
+				ax = _mm256_fmadd_ps(dx, s, ax);
+				ay = _mm256_fmadd_ps(dy, s, ay);
+				az = _mm256_fmadd_ps(dz, s, az);
+			}
+			_mm256_store_ps(bodies->ax + i, ax);
+			_mm256_store_ps(bodies->ay + i, ay);
+			_mm256_store_ps(bodies->az + i, az);
+		}
+	}
+}
+#endif
+
+#ifdef NBODY_ARM
+static void accelerate_neon(const struct nbody_bodies *bodies,
+                            float softening_squared,
+                            uint32_t begin,
+                            uint32_t end)
+{
+	const float32x4_t softening = vdupq_n_f32(softening_squared);
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+
+	for (uint32_t i = begin; i < end; i += 4) {
+		vst1q_f32(bodies->ax + i, zero);
+		vst1q_f32(bodies->ay + i, zero);
+		vst1q_f32(bodies->az + i, zero);
+	}
+	for (uint32_t tile = 0; tile < bodies->capacity; tile += TILE_BODIES) {
+		uint32_t tile_end = min_u32(tile + TILE_BODIES, bodies->capacity);
+		for (uint32_t i = begin; i < end; i += 4) {
+			float32x4_t x = vld1q_f32(bodies->x + i);
+			float32x4_t y = vld1q_f32(bodies->y + i);
+			float32x4_t z = vld1q_f32(bodies->z + i);
+			float32x4_t ax = vld1q_f32(bodies->ax + i);
+			float32x4_t ay = vld1q_f32(bodies->ay + i);
+			float32x4_t az = vld1q_f32(bodies->az + i);
+			for (uint32_t j = tile; j < tile_end; ++j) {
+				float32x4_t dx = vsubq_f32(vdupq_n_f32(bodies->x[j]),
+				                           x);
+				float32x4_t dy = vsubq_f32(vdupq_n_f32(bodies->y[j]),
+				                           y);
+				float32x4_t dz = vsubq_f32(vdupq_n_f32(bodies->z[j]),
+				                           z);
+				float32x4_t r2 = vfmaq_f32(
+					vfmaq_f32(vfmaq_f32(softening, dz, dz),
+					          dy, dy),
+					dx, dx
+				);
+				/* Two Newton steps take the 8 bit estimate to 23 */
+				float32x4_t inverse = vrsqrteq_f32(r2);
+				inverse = vmulq_f32(
+					inverse,
+					vrsqrtsq_f32(vmulq_f32(r2, inverse), inverse)
+				);
+				inverse = vmulq_f32(
+					inverse,
+					vrsqrtsq_f32(vmulq_f32(r2, inverse), inverse)
+				);
+				float32x4_t s = vmulq_n_f32(
+					vmulq_f32(inverse, vmulq_f32(inverse, inverse)),
+					bodies->mass[j]
+				);
+				ax = vfmaq_f32(ax, dx, s);
+				ay = vfmaq_f32(ay, dy, s);
+				az = vfmaq_f32(az, dz, s);
+			}
+			vst1q_f32(bodies->ax + i, ax);
+			vst1q_f32(bodies->ay + i, ay);
+			vst1q_f32(bodies->az + i, az);
+		}
+	}
+}
+#endif
+
+static const accelerate_function accelerate_functions[NBODY_KERNEL_COUNT] = {
+	[NBODY_SCALAR] = accelerate_scalar,
+#ifdef NBODY_X86
+	[NBODY_AVX2] = accelerate_avx2,
+#endif
+#ifdef NBODY_ARM
+	[NBODY_NEON] = accelerate_neon,
+#endif
+};
+
+bool nbody_kernel_supported(enum nbody_kernel kernel)
+{
+	switch (kernel) {
+	case NBODY_SCALAR:
+		return true;
+#ifdef NBODY_X86
+	case NBODY_AVX2:
+		return __builtin_cpu_supports("avx2")
+		       && __builtin_cpu_supports("fma");
+#endif
+#ifdef NBODY_ARM
+	/* Part of every AArch64 processor */
+	case NBODY_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *nbody_kernel_name(enum nbody_kernel kernel)
+{
+	static const char *const names[NBODY_KERNEL_COUNT] = {
+		[NBODY_SCALAR] = "scalar",
+		[NBODY_AVX2] = "avx2",
+		[NBODY_NEON] = "neon",
+	};
+	return names[kernel];
+}
+
+static void accelerate_block(void *data, uint32_t block)
+{
+	struct nbody_cpu *cpu = data;
+	uint32_t begin = block * BLOCK_BODIES;
+	uint32_t end = min_u32(begin + BLOCK_BODIES, cpu->bodies->capacity);
+	accelerate_functions[cpu->kernel](cpu->bodies,
+	                                  cpu->softening * cpu->softening,
+	                                  begin, end);
+}
+
+static int32_t push_node(struct nbody_octree *octree,
+                         const float center[3],
+                         float half_size)
+{
+	if (octree->node_count == octree->node_capacity) {
+		uint32_t capacity = octree->node_capacity * 2;
+		struct nbody_octree_node *nodes = realloc(
+			octree->nodes, capacity * sizeof(struct nbody_octree_node)
+		);
+		if (nodes == NULL) {
+			return -1;
+		}
+		octree->nodes = nodes;
+		octree->node_capacity = capacity;
+	}
+
+	struct nbody_octree_node *node = &octree->nodes[octree->node_count];
+	memset(node, 0, sizeof(*node));
+	memcpy(node->center, center, sizeof(node->center));
+	node->half_size = half_size;
+	for (int c = 0; c < 8; ++c) {
+		node->children[c] = -1;
+	}
+	node->body = OCTREE_EMPTY;
+	return (int32_t) octree->node_count++;
+}
+
+static int32_t push_child(struct nbody_octree *octree,
+                          int32_t parent,
+                          int octant)
+{
+	const struct nbody_octree_node *node = &octree->nodes[parent];
+	float quarter = 0.5f * node->half_size;
+	float center[3] = {
+		node->center[0] + (octant & 1 ? quarter : -quarter),
+		node->center[1] + (octant & 2 ? quarter : -quarter),
+		node->center[2] + (octant & 4 ? quarter : -quarter),
+	};
+	int32_t child = push_node(octree, center, quarter);
+	if (child >= 0) {
+		octree->nodes[parent].children[octant] = child;
+	}
+	return child;
+}
+
+static int octant_of(const struct nbody_octree_node *node, const float p[3])
+{
+	return (p[0] >= node->center[0])
+	       | (p[1] >= node->center[1]) << 1
+	       | (p[2] >= node->center[2]) << 2;
+}
+
+/* Adds the body to every node on its way down, the center of mass summed */
+static uint8_t insert_body(struct nbody_octree *octree,
+                           const struct nbody_bodies *bodies,
+                           int32_t body)
+{
+	const float p[3] = {bodies->x[body], bodies->y[body], bodies->z[body]};
+	float mass = bodies->mass[body];
+	int32_t index = 0;
+	for (uint32_t depth = 0;; ++depth) {
+		struct nbody_octree_node *node = &octree->nodes[index];
+		node->mass += mass;
+		for (int k = 0; k < 3; ++k) {
+			node->center_of_mass[k] += mass * p[k];
+		}
+		if (node->body == OCTREE_EMPTY) {
+			node->body = body;
+			return NO_ERRORS;
+		}
+		if (node->body >= 0) {
+			if (depth == OCTREE_MAX_DEPTH) {
+				return NO_ERRORS;
+			}
+			/* Push the leaf's body down a level */
+			int32_t other = node->body;
+			const float q[3] = {
+				bodies->x[other], bodies->y[other], bodies->z[other]
+			};
+			int octant = octant_of(node, q);
+			node->body = OCTREE_INTERNAL;
+			int32_t child = push_child(octree, index, octant);
+			if (child < 0) {
+				return LIBC_ERROR_BIT;
+			}
+			struct nbody_octree_node *leaf = &octree->nodes[child];
+			leaf->body = other;
+			leaf->mass = bodies->mass[other];
+			for (int k = 0; k < 3; ++k) {
+				leaf->center_of_mass[k] = leaf->mass * q[k];
+			}
+			node = &octree->nodes[index];
+		}
+
+		int octant = octant_of(node, p);
+		int32_t child = node->children[octant];
+		if (child < 0) {
+			child = push_child(octree, index, octant);
+			if (child < 0) {
+				return LIBC_ERROR_BIT;
+			}
+		}
+		index = child;
+	}
+}
+
+static uint8_t build_octree(struct nbody_octree *octree,
+                            const struct nbody_bodies *bodies)
+{
+	float low[3] = {INFINITY, INFINITY, INFINITY};
+	float high[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		const float p[3] = {bodies->x[i], bodies->y[i], bodies->z[i]};
+		for (int k = 0; k < 3; ++k) {
+			low[k] = fminf(low[k], p[k]);
+			high[k] = fmaxf(high[k], p[k]);
+		}
+	}
+	float center[3];
+	float half_size = 0.0f;
+	for (int k = 0; k < 3; ++k) {
+		center[k] = 0.5f * (low[k] + high[k]);
+		half_size = fmaxf(half_size, 0.5f * (high[k] - low[k]));
+	}
+	/* Rounding must not leave the extreme bodies outside */
+	half_size = half_size * 1.001f + 1e-6f;
+
+	octree->node_count = 0;
+	push_node(octree, center, half_size);
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		uint8_t err = insert_body(octree, bodies, (int32_t) i);
+		if (err) {
+			return err;
+		}
+	}
+	for (uint32_t n = 0; n < octree->node_count; ++n) {
+		struct nbody_octree_node *node = &octree->nodes[n];
+		if (node->mass > 0.0f) {
+			for (int k = 0; k < 3; ++k) {
+				node->center_of_mass[k] /= node->mass;
+			}
+		}
+	}
+	return NO_ERRORS;
+}
+
+/*
+ * Opens a node when its width is at least theta times its distance from the
+ * body, otherwise its center of mass stands in for everything inside.
+ */
+static void walk_bodies(void *data, uint32_t task)
+{
+	struct nbody_cpu *cpu = data;
+	const struct nbody_bodies *bodies = cpu->bodies;
+	const struct nbody_octree_node *nodes = cpu->octree.nodes;
+	float softening_squared = cpu->softening * cpu->softening;
+	float theta_squared = cpu->theta * cpu->theta;
+	uint32_t begin = task * WALK_BODIES;
+	uint32_t end = min_u32(begin + WALK_BODIES, bodies->count);
+
+	uint64_t interactions = 0;
+	int32_t stack[8 * (OCTREE_MAX_DEPTH + 1)];
+	for (uint32_t i = begin; i < end; ++i) {
+		float x = bodies->x[i];
+		float y = bodies->y[i];
+		float z = bodies->z[i];
+		float ax = 0.0f;
+		float ay = 0.0f;
+		float az = 0.0f;
+		uint32_t top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const struct nbody_octree_node *node = &nodes[stack[--top]];
+			float dx = node->center_of_mass[0] - x;
+			float dy = node->center_of_mass[1] - y;
+			float dz = node->center_of_mass[2] - z;
+			float d2 = dx * dx + dy * dy + dz * dz;
+			float width = 2.0f * node->half_size;
+			if (node->body == OCTREE_INTERNAL
+			    && width * width >= theta_squared * d2) {
+				for (int c = 0; c < 8; ++c) {
+					if (node->children[c] >= 0) {
+						stack[top++] = node->children[c];
+					}
+				}
+				continue;
+			}
+			float inverse = 1.0f / sqrtf(d2 + softening_squared);
+			float s = node->mass * inverse * inverse * inverse;
+			ax += dx * s;
+			ay += dy * s;
+			az += dz * s;
+			++interactions;
+		}
+		bodies->ax[i] = ax;
+		bodies->ay[i] = ay;
+		bodies->az[i] = az;
+	}
+	cpu->task_interactions[task] = interactions;
+}
+
+uint8_t nbody_cpu_init(struct nbody_cpu *cpu,
+                       struct nbody_bodies *bodies,
+                       uint32_t thread_count,
+                       float softening,
+                       float theta)
+{
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->bodies = bodies;
+	cpu->softening = softening;
+	cpu->theta = theta;
+	cpu->kernel = NBODY_SCALAR;
+	for (uint32_t k = 0; k < NBODY_KERNEL_COUNT; ++k) {
+		if (nbody_kernel_supported(k)) {
+			cpu->kernel = k;
+		}
+	}
+
+	uint8_t err = thread_pool_init(&cpu->pool, thread_count);
+	if (err) {
+		return err;
+	}
+	if (theta > 0.0f) {
+		cpu->task_count = (bodies->count + WALK_BODIES - 1) / WALK_BODIES;
+		cpu->task_interactions = calloc(cpu->task_count,
+		                                sizeof(uint64_t));
+		cpu->octree.node_capacity = 2 * bodies->count + 1;
+		cpu->octree.nodes = malloc(cpu->octree.node_capacity
+		                           * sizeof(struct nbody_octree_node));
+		if (cpu->task_interactions == NULL
+		    || cpu->octree.nodes == NULL) {
+			nbody_cpu_fini(cpu);
+			return LIBC_ERROR_BIT;
+		}
+	}
+	else {
+		cpu->task_count = (bodies->capacity + BLOCK_BODIES - 1)
+		                  / BLOCK_BODIES;
+	}
+	return NO_ERRORS;
+}
+
+void nbody_cpu_fini(struct nbody_cpu *cpu)
+{
+	thread_pool_fini(&cpu->pool);
+	free(cpu->task_interactions);
+	free(cpu->octree.nodes);
+	memset(cpu, 0, sizeof(*cpu));
+}
+
+uint8_t nbody_cpu_accelerate(struct nbody_cpu *cpu, uint64_t *interactions)
+{
+	if (cpu->theta <= 0.0f) {
+		thread_pool_run(&cpu->pool, accelerate_block, cpu,
+		                cpu->task_count);
+		*interactions = (uint64_t) cpu->bodies->count
+		                * cpu->bodies->count;
+		return NO_ERRORS;
+	}
+
+	uint8_t err = build_octree(&cpu->octree, cpu->bodies);
+	if (err) {
+		return err;
+	}
+	thread_pool_run(&cpu->pool, walk_bodies, cpu, cpu->task_count);
+	*interactions = 0;
+	for (uint32_t t = 0; t < cpu->task_count; ++t) {
+		*interactions += cpu->task_interactions[t];
+	}
+	return NO_ERRORS;
+}
+
+static void kick(struct nbody_bodies *bodies, float time_step)
+{
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		bodies->vx[i] += bodies->ax[i] * time_step;
+		bodies->vy[i] += bodies->ay[i] * time_step;
+		bodies->vz[i] += bodies->az[i] * time_step;
+	}
+}
+
+uint8_t nbody_cpu_step(struct nbody_cpu *cpu,
+                       float time_step,
+                       uint64_t *interactions)
+{
+	struct nbody_bodies *bodies = cpu->bodies;
+	kick(bodies, 0.5f * time_step);
+	for (uint32_t i = 0; i < bodies->count; ++i) {
+		bodies->x[i] += bodies->vx[i] * time_step;
+		bodies->y[i] += bodies->vy[i] * time_step;
+		bodies->z[i] += bodies->vz[i] * time_step;
+	}
+	uint8_t err = nbody_cpu_accelerate(cpu, interactions);
+	if (err) {
+		return err;
+	}
+	kick(bodies, 0.5f * time_step);
+	return NO_ERRORS;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_NBODY_CPU_H
+#define HELLO_VULKAN_NBODY_CPU_H
+
+#include "nbody.h"
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum nbody_kernel {
+	NBODY_SCALAR,
+	NBODY_AVX2,
+	NBODY_NEON,
+	NBODY_KERNEL_COUNT,
+};
+
+/*
+ * An internal node has children, a leaf a single body (or, at the depth
+ * limit, every body that landed there). Each has the total mass and the
+ * center of mass of what it holds.
+ */
+struct nbody_octree_node {
+	float center_of_mass[3];
+	float mass;
+	float center[3];
+	float half_size;
+	int32_t children[8];
+	int32_t body;
+};
+
+struct nbody_octree {
+	struct nbody_octree_node *nodes;
+	uint32_t node_count;
+	uint32_t node_capacity;
+};
+
+/*
+ * Gravity on the CPU, summing every pair directly with the widest kernel
+ * supported, or approximating with a Barnes-Hut octree when theta is
+ * above 0. Direct sums take blocks of bodies per task and sweep the others
+ * past them in tiles that stay in the L1 cache; both split the bodies over
+ * a thread pool.
+ */
+struct nbody_cpu {
+	struct nbody_bodies *bodies;
+	enum nbody_kernel kernel;
+	float softening;
+	float theta;
+	struct thread_pool pool;
+	struct nbody_octree octree;
+	/* Pairs each task evaluated, summed for the interaction rate */
+	uint64_t *task_interactions;
+	uint32_t task_count;
+};
+
+bool nbody_kernel_supported(enum nbody_kernel kernel);
+const char *nbody_kernel_name(enum nbody_kernel kernel);
+
+uint8_t nbody_cpu_init(struct nbody_cpu *cpu,
+                       struct nbody_bodies *bodies,
+                       uint32_t thread_count,
+                       float softening,
+                       float theta);
+void nbody_cpu_fini(struct nbody_cpu *cpu);
+
+/* Fills the accelerations, returning the pairs evaluated */
+uint8_t nbody_cpu_accelerate(struct nbody_cpu *cpu, uint64_t *interactions);
+
+/*
+ * A kick-drift-kick leapfrog step, which needs the accelerations of the
+ * current positions, so call nbody_cpu_accelerate once before the first.
+ */
+uint8_t nbody_cpu_step(struct nbody_cpu *cpu,
+                       float time_step,
+                       uint64_t *interactions);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Steps an N-body simulation on the CPU, as the reference a GPU backend is
+ * verified and compared against:
+ *
+ *     hello-vulkan-nbody [options]
+ *
+ * Bodies start as a Plummer sphere from the seed, or from a snapshot, and
+ * move with a kick-drift-kick leapfrog. The time per step and the pairwise
+ * interactions per second are printed; --output writes the final snapshot,
+ * and --compare fails when any body ends further than the tolerance (in RMS
+ * radii) from where a snapshot has it.
+ */
+
+#include "error.h"
+#include "nbody.h"
+#include "nbody_cpu.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BODY_COUNT 16384
+#define DEFAULT_STEP_COUNT 10
+#define DEFAULT_TIME_STEP 0.001f
+#define DEFAULT_SOFTENING 0.01f
+#define DEFAULT_TOLERANCE 1e-4
+
+struct options {
+	uint32_t body_count;
+	uint32_t step_count;
+	float time_step;
+	float softening;
+	uint32_t seed;
+	uint32_t thread_count;
+	int kernel;
+	float theta;
+	double tolerance;
+	const char *input_filename;
+	const char *output_filename;
+	const char *compare_filename;
+};
+
+static struct options options = {
+	.body_count = DEFAULT_BODY_COUNT,
+	.step_count = DEFAULT_STEP_COUNT,
+	.time_step = DEFAULT_TIME_STEP,
+	.softening = DEFAULT_SOFTENING,
+	.seed = 1,
+	.thread_count = 0,
+	.kernel = -1,
+	.theta = 0.0f,
+	.tolerance = DEFAULT_TOLERANCE,
+	.input_filename = NULL,
+	.output_filename = NULL,
+	.compare_filename = NULL,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+	       "  --bodies=N         bodies in the Plummer sphere, default %u\n"
+	       "  --seed=N           seed of the Plummer sphere, default 1\n"
+	       "  --input=FILE       start from a snapshot instead\n"
+	       "  --steps=N          steps to take, default %u\n"
+	       "  --time-step=DT     default %g\n"
+	       "  --softening=EPS    Plummer softening length, default %g\n"
+	       "  --threads=N        default one per processor\n"
+	       "  --kernel=NAME      scalar, avx2 or neon for direct sums,\n"
+	       "                     default the widest supported\n"
+	       "  --barnes-hut=THETA approximate with an octree, opening\n"
+	       "                     nodes wider than THETA times their\n"
+	       "                     distance\n"
+	       "  --output=FILE      write the final snapshot\n"
+	       "  --compare=FILE     compare the final positions against a\n"
+	       "                     snapshot\n"
+	       "  --tolerance=X      largest distance --compare allows, in\n"
+	       "                     RMS radii, default %g\n",
+	       program, DEFAULT_BODY_COUNT, DEFAULT_STEP_COUNT,
+	       DEFAULT_TIME_STEP, DEFAULT_SOFTENING, DEFAULT_TOLERANCE);
+}
+
+static uint8_t parse_options(int argc, char **argv)
+{
+	enum {
+		OPTION_BODIES = 256,
+		OPTION_SEED,
+		OPTION_INPUT,
+		OPTION_STEPS,
+		OPTION_TIME_STEP,
+		OPTION_SOFTENING,
+		OPTION_THREADS,
+		OPTION_KERNEL,
+		OPTION_BARNES_HUT,
+		OPTION_OUTPUT,
+		OPTION_COMPARE,
+		OPTION_TOLERANCE,
+	};
+	static const struct option long_options[] = {
+		{ "bodies", required_argument, NULL, OPTION_BODIES },
+		{ "seed", required_argument, NULL, OPTION_SEED },
+		{ "input", required_argument, NULL, OPTION_INPUT },
+		{ "steps", required_argument, NULL, OPTION_STEPS },
+		{ "time-step", required_argument, NULL, OPTION_TIME_STEP },
+		{ "softening", required_argument, NULL, OPTION_SOFTENING },
+		{ "threads", required_argument, NULL, OPTION_THREADS },
+		{ "kernel", required_argument, NULL, OPTION_KERNEL },
+		{ "barnes-hut", required_argument, NULL, OPTION_BARNES_HUT },
+		{ "output", required_argument, NULL, OPTION_OUTPUT },
+		{ "compare", required_argument, NULL, OPTION_COMPARE },
+		{ "tolerance", required_argument, NULL, OPTION_TOLERANCE },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		char *end = NULL;
+		bool valid = true;
+		switch (c) {
+		case OPTION_BODIES:
+			options.body_count = strtoul(optarg, &end, 10);
+			valid = options.body_count > 0;
+			break;
+		case OPTION_SEED:
+			options.seed = strtoul(optarg, &end, 10);
+			break;
+		case OPTION_INPUT:
+			options.input_filename = optarg;
+			break;
+		case OPTION_STEPS:
+			options.step_count = strtoul(optarg, &end, 10);
+			break;
+		case OPTION_TIME_STEP:
+			options.time_step = strtof(optarg, &end);
+			valid = options.time_step > 0.0f;
+			break;
+		case OPTION_SOFTENING:
+			/* Without it a body's pull on itself divides by 0 */
+			options.softening = strtof(optarg, &end);
+			valid = options.softening > 0.0f;
+			break;
+		case OPTION_THREADS:
+			options.thread_count = strtoul(optarg, &end, 10);
+			valid = options.thread_count > 0;
+			break;
+		case OPTION_KERNEL:
+			options.kernel = -1;
+			for (int k = 0; k < NBODY_KERNEL_COUNT; ++k) {
+				if (strcmp(optarg, nbody_kernel_name(k)) == 0) {
+					options.kernel = k;
+				}
+			}
+			if (options.kernel < 0) {
+				printf("Unknown kernel %s\n", optarg);
+				valid = false;
+			}
+			else if (!nbody_kernel_supported(options.kernel)) {
+				printf("This processor does not support %s\n",
+				       optarg);
+				valid = false;
+			}
+			break;
+		case OPTION_BARNES_HUT:
+			options.theta = strtof(optarg, &end);
+			valid = options.theta > 0.0f;
+			break;
+		case OPTION_OUTPUT:
+			options.output_filename = optarg;
+			break;
+		case OPTION_COMPARE:
+			options.compare_filename = optarg;
+			break;
+		case OPTION_TOLERANCE:
+			options.tolerance = strtod(optarg, &end);
+			valid = options.tolerance >= 0.0;
+			break;
+		default:
+			valid = false;
+			break;
+		}
+		if (!valid || (end != NULL && *end != '\0')) {
+			print_usage(argv[0]);
+			return APP_ERROR_BIT;
+		}
+	}
+	if (optind != argc) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	if (options.thread_count == 0) {
+		long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+		options.thread_count = processor_count > 1 ? processor_count : 1;
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t simulate(struct nbody_bodies *bodies, struct nbody_header *header)
+{
+	struct nbody_cpu cpu;
+	uint8_t err = nbody_cpu_init(&cpu, bodies, options.thread_count,
+	                             options.softening, options.theta);
+	if (err) {
+		return err;
+	}
+	if (options.kernel >= 0) {
+		cpu.kernel = options.kernel;
+	}
+	if (options.theta > 0.0f) {
+		printf("Barnes-Hut, theta %g", options.theta);
+	}
+	else {
+		printf("Direct, %s", nbody_kernel_name(cpu.kernel));
+	}
+	printf(", %u bodies, %u threads\n", bodies->count,
+	       cpu.pool.thread_count);
+
+	uint64_t interactions;
+	err = nbody_cpu_accelerate(&cpu, &interactions);
+	uint64_t total_interactions = 0;
+	uint64_t begin_ns = now_ns();
+	for (uint32_t s = 0; s < options.step_count && !err; ++s) {
+		err = nbody_cpu_step(&cpu, options.time_step, &interactions);
+		total_interactions += interactions;
+	}
+	double seconds = (double) (now_ns() - begin_ns) / 1e9;
+	nbody_cpu_fini(&cpu);
+	if (err) {
+		return err;
+	}
+
+	header->step += options.step_count;
+	header->time += options.step_count * options.time_step;
+	header->softening = options.softening;
+	if (options.step_count > 0) {
+		printf("%.3f ms per step, %.3f G interactions/s,"
+		       " %.0f interactions per body\n",
+		       seconds * 1e3 / options.step_count,
+		       total_interactions / seconds / 1e9,
+		       (double) total_interactions / options.step_count
+		       / bodies->count);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t compare(const struct nbody_bodies *bodies)
+{
+	struct nbody_bodies expected;
+	struct nbody_header header;
+	uint8_t err = nbody_read(&expected, &header, options.compare_filename);
+	if (err) {
+		return err;
+	}
+	if (expected.count != bodies->count) {
+		printf("%s has %u bodies, not %u\n", options.compare_filename,
+		       expected.count, bodies->count);
+		nbody_bodies_fini(&expected);
+		return APP_ERROR_BIT;
+	}
+	double distance = nbody_compare(&expected, bodies);
+	nbody_bodies_fini(&expected);
+	bool within = distance <= options.tolerance;
+	printf("Largest distance from %s: %.3g RMS radii, %s\n",
+	       options.compare_filename, distance,
+	       within ? "within tolerance" : "beyond tolerance");
+	return within ? NO_ERRORS : APP_ERROR_BIT;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t err = parse_options(argc, argv);
+	if (err) {
+		return err;
+	}
+
+	struct nbody_bodies bodies;
+	struct nbody_header header;
+	memset(&header, 0, sizeof(header));
+	if (options.input_filename != NULL) {
+		err = nbody_read(&bodies, &header, options.input_filename);
+	}
+	else {
+		err = nbody_bodies_init(&bodies, options.body_count);
+		if (!err) {
+			nbody_generate_plummer(&bodies, options.seed);
+		}
+	}
+	if (err) {
+		return err;
+	}
+
+	err = simulate(&bodies, &header);
+	if (!err && options.output_filename != NULL) {
+		err = nbody_write(&bodies, &header, options.output_filename);
+	}
+	if (!err && options.compare_filename != NULL) {
+		err = compare(&bodies);
+	}
+	nbody_bodies_fini(&bodies);
+	return err;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pack.h"
+
+#include "error.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+const char *const pack_type_names[PACK_TYPE_COUNT] = {
+	[PACK_TYPE_SPIRV] = "spirv",
+	[PACK_TYPE_MESH] = "mesh",
+	[PACK_TYPE_TEXTURE] = "texture",
+	[PACK_TYPE_PIPELINE_CACHE] = "pipeline_cache",
+};
+
+uint32_t pack_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (const char *c = name; *c != '\0'; ++c) {
+		hash ^= (uint8_t) *c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint8_t check_pack(const struct pack *pack)
+{
+	size_t size = pack->map.data_size;
+	if (size < sizeof(struct pack_header)) {
+		return APP_ERROR_BIT;
+	}
+
+	const struct pack_header *header
+		= (const struct pack_header *) pack->map.data;
+	if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != PACK_VERSION
+	    || header->alignment != PACK_ALIGNMENT) {
+		return APP_ERROR_BIT;
+	}
+	if (header->entry_count
+	    > (size - sizeof(struct pack_header)) / sizeof(struct pack_entry)) {
+		return APP_ERROR_BIT;
+	}
+
+	const struct pack_entry *entries
+		= (const struct pack_entry *) (header + 1);
+	for (uint32_t i = 0; i < header->entry_count; ++i) {
+		const struct pack_entry *entry = &entries[i];
+		if (entry->offset % PACK_ALIGNMENT != 0
+		    || entry->offset > size
+		    || entry->size > size - entry->offset
+		    || entry->type >= PACK_TYPE_COUNT
+		    || entry->name[PACK_NAME_SIZE - 1] != '\0'
+		    || entry->hash != pack_hash(entry->name)) {
+			return APP_ERROR_BIT;
+		}
+		if (i > 0 && entries[i - 1].hash > entry->hash) {
+			return APP_ERROR_BIT;
+		}
+	}
+
+	return NO_ERRORS;
+}
+
+uint8_t pack_init(const char *filename, uint32_t hints, struct pack *pack)
+{
+	pack->entries = NULL;
+	pack->entry_count = 0;
+
+	uint8_t err = mmap_init(filename, hints, &pack->map);
+	if (err) {
+		return err;
+	}
+
+	err = check_pack(pack);
+	if (err) {
+		printf("%s is not a valid asset pack\n", filename);
+		mmap_fini(&pack->map);
+		return err;
+	}
+
+	const struct pack_header *header
+		= (const struct pack_header *) pack->map.data;
+	pack->entries = (const struct pack_entry *) (header + 1);
+	pack->entry_count = header->entry_count;
+	return NO_ERRORS;
+}
+
+void pack_fini(struct pack *pack)
+{
+	if (pack->map.data != NULL) {
+		mmap_fini(&pack->map);
+	}
+	pack->entries = NULL;
+	pack->entry_count = 0;
+}
+
+/* The first entry with the hash, or where it would be inserted */
+static uint32_t lower_bound(const struct pack *pack, uint32_t hash)
+{
+	uint32_t low = 0;
+	uint32_t high = pack->entry_count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (pack->entries[middle].hash < hash) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+const struct pack_entry *pack_find(const struct pack *pack,
+                                   const char *name,
+                                   enum pack_type type)
+{
+	uint32_t hash = pack_hash(name);
+	for (uint32_t i = lower_bound(pack, hash);
+	     i < pack->entry_count && pack->entries[i].hash == hash; ++i) {
+		const struct pack_entry *entry = &pack->entries[i];
+		if (entry->type == type && strcmp(entry->name, name) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+const struct pack_entry *pack_find_hash(const struct pack *pack,
+                                        uint32_t hash,
+                                        enum pack_type type)
+{
+	for (uint32_t i = lower_bound(pack, hash);
+	     i < pack->entry_count && pack->entries[i].hash == hash; ++i) {
+		if (pack->entries[i].type == type) {
+			return &pack->entries[i];
+		}
+	}
+	return NULL;
+}
+
+uint8_t pack_advise(const struct pack *pack,
+                    const struct pack_entry *entry,
+                    int advice)
+{
+	uint64_t offset = 0;
+	uint64_t size = pack->map.data_size;
+	if (entry != NULL) {
+		offset = entry->offset;
+		size = entry->size;
+	}
+	if (size == 0) {
+		return NO_ERRORS;
+	}
+
+	/* madvise wants a page aligned start */
+	uint64_t page_size = (uint64_t) sysconf(_SC_PAGESIZE);
+	uint64_t start = offset - offset % page_size;
+	char *address = (char *) pack->map.data + start;
+	if (madvise(address, size + (offset - start), advice) == -1) {
+		return POSIX_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
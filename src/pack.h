@@ -0,0 +1,101 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_PACK_H
+#define HELLO_VULKAN_PACK_H
+
+#include "mmap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An asset pack is one file holding every asset, mapped once. A header is
+ * followed by an index of entries sorted by name hash, then the blobs, each
+ * starting on a PACK_ALIGNMENT boundary so they can be used in place. The
+ * pack is written by hello-vulkan-pack on the machine it is read on, so
+ * everything is in host byte order.
+ */
+#define PACK_MAGIC "HVPK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 64
+#define PACK_NAME_SIZE 40
+
+enum pack_type {
+	PACK_TYPE_SPIRV,
+	PACK_TYPE_MESH,
+	PACK_TYPE_TEXTURE,
+	PACK_TYPE_PIPELINE_CACHE,
+	PACK_TYPE_COUNT,
+};
+
+struct pack_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t alignment;
+};
+
+struct pack_entry {
+	uint32_t hash;
+	uint32_t type;
+	uint64_t offset;
+	uint64_t size;
+	/* Zero padded, always terminated */
+	char name[PACK_NAME_SIZE];
+};
+
+struct pack {
+	struct mmap_result map;
+	const struct pack_entry *entries;
+	uint32_t entry_count;
+};
+
+extern const char *const pack_type_names[PACK_TYPE_COUNT];
+
+/* FNV-1a, the hash the index is sorted by */
+uint32_t pack_hash(const char *name);
+
+/*
+ * Checks the header and that every entry lies within the file, mapping it
+ * with enum mmap_hint hints
+ */
+uint8_t pack_init(const char *filename, uint32_t hints, struct pack *pack);
+void pack_fini(struct pack *pack);
+
+/* NULL when there is no entry of that type */
+const struct pack_entry *pack_find(const struct pack *pack,
+                                   const char *name,
+                                   enum pack_type type);
+const struct pack_entry *pack_find_hash(const struct pack *pack,
+                                        uint32_t hash,
+                                        enum pack_type type);
+
+static inline const void *pack_data(const struct pack *pack,
+                                    const struct pack_entry *entry)
+{
+	return (const char *) pack->map.data + entry->offset;
+}
+
+/*
+ * Passes madvise advice such as MADV_WILLNEED or MADV_SEQUENTIAL for the
+ * pages of one entry, or the whole pack when entry is NULL.
+ */
+uint8_t pack_advise(const struct pack *pack,
+                    const struct pack_entry *entry,
+                    int advice);
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes an asset pack from loose files, for hello-vulkan to map at startup:
+ *
+ *     hello-vulkan-pack OUTPUT TYPE:NAME=FILE...
+ *
+ * The pack is written next to OUTPUT and renamed over it once complete, then
+ * opened again to check it.
+ */
+
+#include "error.h"
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PATH_LENGTH 4096
+
+struct input {
+	struct pack_entry entry;
+	const char *filename;
+};
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s OUTPUT TYPE:NAME=FILE...\n"
+	       "  TYPE is spirv, mesh, texture or pipeline_cache\n",
+	       program);
+}
+
+static uint8_t parse_input(const char *arg, struct input *input)
+{
+	const char *colon = strchr(arg, ':');
+	const char *equals = colon ? strchr(colon, '=') : NULL;
+	if (equals == NULL) {
+		return APP_ERROR_BIT;
+	}
+
+	size_t type_length = colon - arg;
+	uint32_t type = 0;
+	while (type < PACK_TYPE_COUNT
+	       && (strlen(pack_type_names[type]) != type_length
+	           || strncmp(pack_type_names[type], arg, type_length) != 0)) {
+		++type;
+	}
+	size_t name_length = equals - (colon + 1);
+	if (type == PACK_TYPE_COUNT || name_length == 0
+	    || name_length >= PACK_NAME_SIZE || equals[1] == '\0') {
+		return APP_ERROR_BIT;
+	}
+
+	memset(&input->entry, 0, sizeof(input->entry));
+	memcpy(input->entry.name, colon + 1, name_length);
+	input->entry.hash = pack_hash(input->entry.name);
+	input->entry.type = type;
+	input->filename = equals + 1;
+	return NO_ERRORS;
+}
+
+static int compare_inputs(const void *a, const void *b)
+{
+	uint32_t x = ((const struct input *) a)->entry.hash;
+	uint32_t y = ((const struct input *) b)->entry.hash;
+	return (x > y) - (x < y);
+}
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+static uint8_t file_size(const char *filename, uint64_t *size)
+{
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	if (fseek(file, 0, SEEK_END) != 0) {
+		fclose(file);
+		return LIBC_ERROR_BIT;
+	}
+	long end = ftell(file);
+	fclose(file);
+	if (end < 0) {
+		return LIBC_ERROR_BIT;
+	}
+	*size = (uint64_t) end;
+	return NO_ERRORS;
+}
+
+static uint8_t copy_file(FILE *output, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	char buffer[65536];
+	size_t read;
+	uint8_t err = NO_ERRORS;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		if (fwrite(buffer, 1, read, output) != read) {
+			err = LIBC_ERROR_BIT;
+			break;
+		}
+	}
+	if (ferror(file)) {
+		err = LIBC_ERROR_BIT;
+	}
+	fclose(file);
+	return err;
+}
+
+static uint8_t pad(FILE *output, uint64_t from, uint64_t to)
+{
+	static const char zeros[PACK_ALIGNMENT] = {0};
+	if (to > from && fwrite(zeros, 1, to - from, output) != to - from) {
+		return LIBC_ERROR_BIT;
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t write_pack(const char *filename,
+                          const struct input *inputs,
+                          uint32_t input_count)
+{
+	FILE *output = fopen(filename, "wb");
+	if (output == NULL) {
+		printf("Could not create %s\n", filename);
+		return LIBC_ERROR_BIT;
+	}
+
+	struct pack_header header = {
+		.magic = PACK_MAGIC,
+		.version = PACK_VERSION,
+		.entry_count = input_count,
+		.alignment = PACK_ALIGNMENT,
+	};
+	uint8_t err = NO_ERRORS;
+	if (fwrite(&header, sizeof(header), 1, output) != 1) {
+		err = LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < input_count && !err; ++i) {
+		if (fwrite(&inputs[i].entry, sizeof(struct pack_entry), 1,
+		           output) != 1) {
+			err = LIBC_ERROR_BIT;
+		}
+	}
+
+	uint64_t offset = sizeof(header)
+	                  + (uint64_t) input_count * sizeof(struct pack_entry);
+	for (uint32_t i = 0; i < input_count && !err; ++i) {
+		err = pad(output, offset, inputs[i].entry.offset);
+		if (!err) {
+			err = copy_file(output, inputs[i].filename);
+			if (err) {
+				printf("Could not read %s\n", inputs[i].filename);
+			}
+		}
+		offset = inputs[i].entry.offset + inputs[i].entry.size;
+	}
+
+	if (fclose(output) != 0) {
+		err |= LIBC_ERROR_BIT;
+	}
+	if (err) {
+		remove(filename);
+	}
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+
+	uint32_t input_count = argc - 2;
+	struct input *inputs = malloc(input_count * sizeof(struct input));
+	if (inputs == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+
+	for (uint32_t i = 0; i < input_count; ++i) {
+		if (parse_input(argv[i + 2], &inputs[i]) != NO_ERRORS) {
+			print_usage(argv[0]);
+			free(inputs);
+			return APP_ERROR_BIT;
+		}
+	}
+
+	/* Lookups compare hashes only, so names must not collide */
+	qsort(inputs, input_count, sizeof(struct input), compare_inputs);
+	for (uint32_t i = 1; i < input_count; ++i) {
+		if (inputs[i].entry.hash == inputs[i - 1].entry.hash) {
+			printf("%s and %s have the same hash\n",
+			       inputs[i - 1].entry.name, inputs[i].entry.name);
+			free(inputs);
+			return APP_ERROR_BIT;
+		}
+	}
+
+	uint64_t offset = sizeof(struct pack_header)
+	                  + (uint64_t) input_count * sizeof(struct pack_entry);
+	for (uint32_t i = 0; i < input_count; ++i) {
+		uint8_t err = file_size(inputs[i].filename,
+		                        &inputs[i].entry.size);
+		if (err) {
+			printf("Could not read %s\n", inputs[i].filename);
+			free(inputs);
+			return err;
+		}
+		inputs[i].entry.offset = align(offset);
+		offset = inputs[i].entry.offset + inputs[i].entry.size;
+	}
+
+	const char *output = argv[1];
+	char temporary[MAX_PATH_LENGTH];
+	if (snprintf(temporary, sizeof(temporary), "%s.tmp", output)
+	    >= (int) sizeof(temporary)) {
+		free(inputs);
+		return APP_ERROR_BIT;
+	}
+	uint8_t err = write_pack(temporary, inputs, input_count);
+	free(inputs);
+	if (err) {
+		return err;
+	}
+	if (rename(temporary, output) != 0) {
+		remove(temporary);
+		return LIBC_ERROR_BIT;
+	}
+
+	struct pack pack;
+	err = pack_init(output, MMAP_HINT_NONE, &pack);
+	if (err) {
+		return err;
+	}
+	printf("Packed %u assets, %zu bytes\n", pack.entry_count,
+	       pack.map.data_size);
+	pack_fini(&pack);
+	return NO_ERRORS;
+}
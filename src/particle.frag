@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragCorner;
+
+layout(location = 0) out vec4 outColor;
+
+// A soft disc, premultiplied for blending over what is behind
+void main() {
+	float alpha = fragColor.a * max(1.0 - dot(fragCorner, fragCorner), 0.0);
+	outColor = vec4(fragColor.rgb * alpha, alpha);
+}
@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+} frame;
+
+// The bindless storage buffer capacity
+layout(constant_id = 0) const uint BUFFER_COUNT = 1;
+
+// Two vec4 per particle: position and remaining life, velocity and size
+layout(set = 1, binding = 0) readonly buffer Particles {
+	vec4 particles[];
+} buffers[BUFFER_COUNT];
+
+// The bindless index of the sorted particles
+layout(push_constant) uniform Draw {
+	uint particles;
+} draw;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragCorner;
+
+// Two triangles, wound clockwise like the scene's
+vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0),
+	vec2(1.0, -1.0),
+	vec2(1.0, 1.0),
+	vec2(-1.0, -1.0),
+	vec2(1.0, 1.0),
+	vec2(-1.0, 1.0)
+);
+
+// One instance per particle, the farthest first
+void main() {
+	vec4 position = buffers[draw.particles].particles[2 * gl_InstanceIndex];
+	vec4 velocity = buffers[draw.particles].particles[2 * gl_InstanceIndex + 1];
+	fragCorner = corners[gl_VertexIndex];
+	vec3 corner = vec3(fragCorner * velocity.w, 0.0);
+	gl_Position = frame.view_projection * vec4(position.xyz + corner, 1.0);
+
+	// From white hot to a fading ember over the last seconds of life
+	float heat = clamp(position.w / 3.0, 0.0, 1.0);
+	vec3 color = mix(vec3(1.0, 0.25, 0.05), vec3(1.0, 0.9, 0.6), heat);
+	fragColor = vec4(color, clamp(position.w, 0.0, 1.0) * 0.6);
+}
@@ -0,0 +1,646 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "particles.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PARTICLE_WORKGROUP_SIZE 64
+/* Must match the radix shaders, one digit per invocation */
+#define RADIX_WORKGROUP_SIZE 256
+#define RADIX_TILES_PER_BLOCK 16
+#define RADIX_BLOCK_SIZE (RADIX_WORKGROUP_SIZE * RADIX_TILES_PER_BLOCK)
+#define RADIX_DIGITS 256
+#define RADIX_PASSES 4
+/* Seconds, so that emission keeps the system near capacity */
+#define PARTICLE_MEAN_LIFE 2.0f
+/* A quad of two triangles per particle */
+#define PARTICLE_VERTEX_COUNT 6
+
+enum particle_binding {
+	BINDING_STATE,
+	BINDING_COMPACTED,
+	BINDING_COUNTERS,
+	BINDING_KEYS_IN,
+	BINDING_VALUES_IN,
+	BINDING_KEYS_OUT,
+	BINDING_VALUES_OUT,
+	BINDING_HISTOGRAMS,
+	BINDING_COUNT,
+};
+
+/* Position and remaining life, then velocity and size, in std430 */
+struct particle {
+	float position[4];
+	float velocity[4];
+};
+
+/* The draw's instance count is copied from next once the frame is sorted */
+struct particle_counters {
+	VkDrawIndirectCommand draw;
+	uint32_t next;
+	uint32_t frame;
+};
+
+struct particle_push_constants {
+	float view_projection[16];
+	uint32_t capacity;
+	uint32_t emit_count;
+	uint32_t shift;
+	float time_step;
+};
+
+static const char *const shader_names[PARTICLE_PASS_COUNT] = {
+	[PARTICLE_EMIT] = "particle_emit.comp.spv",
+	[PARTICLE_SIMULATE] = "particle_simulate.comp.spv",
+	[PARTICLE_RADIX_COUNT] = "radix_count.comp.spv",
+	[PARTICLE_RADIX_SCAN] = "radix_scan.comp.spv",
+	[PARTICLE_RADIX_SCATTER] = "radix_scatter.comp.spv",
+	[PARTICLE_GATHER] = "particle_gather.comp.spv",
+};
+
+static uint32_t block_count(const struct particles *particles)
+{
+	return (particles->capacity + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+}
+
+static uint8_t create_shader_module(VkDevice device,
+                                    const struct pack *assets,
+                                    const char *name,
+                                    VkShaderModule *shader_module)
+{
+	const struct pack_entry *entry = pack_find(assets, name,
+	                                           PACK_TYPE_SPIRV);
+	if (entry == NULL) {
+		printf("No shader %s in the asset pack\n", name);
+		return APP_ERROR_BIT;
+	}
+
+	VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.codeSize = entry->size,
+		.pCode = pack_data(assets, entry),
+	};
+	VkResult result;
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator, shader_module);
+	if (result != VK_SUCCESS) {
+		*shader_module = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_buffers(struct particles *particles,
+                              VkDevice device,
+                              const VkPhysicalDeviceMemoryProperties
+                              *memory_properties,
+                              VkQueue queue,
+                              uint32_t queue_family_index)
+{
+	VkDeviceSize particle_size = (VkDeviceSize) particles->capacity
+	                             * sizeof(struct particle);
+	VkDeviceSize sort_size = (VkDeviceSize) particles->capacity
+	                         * sizeof(uint32_t);
+	struct {
+		struct gpu_buffer *buffer;
+		VkDeviceSize size;
+	} buffers[] = {
+		{ &particles->state_buffer, particle_size },
+		{ &particles->compacted_buffer, particle_size },
+		{ &particles->key_buffers[0], sort_size },
+		{ &particles->key_buffers[1], sort_size },
+		{ &particles->value_buffers[0], sort_size },
+		{ &particles->value_buffers[1], sort_size },
+		{
+			&particles->histogram_buffer,
+			(VkDeviceSize) RADIX_DIGITS * block_count(particles)
+			* sizeof(uint32_t),
+		},
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(buffers); ++i) {
+		uint8_t err = gpu_buffer_init(device, memory_properties,
+		                              buffers[i].size,
+		                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		                              buffers[i].buffer);
+		if (err) {
+			return err;
+		}
+	}
+
+	/* No particles to begin with */
+	struct particle_counters counters = {
+		.draw = {
+			.vertexCount = PARTICLE_VERTEX_COUNT,
+			.instanceCount = 0,
+			.firstVertex = 0,
+			.firstInstance = 0,
+		},
+		.next = 0,
+		.frame = 0,
+	};
+	return gpu_buffer_init_with_data(device, memory_properties, queue,
+	                                 queue_family_index,
+	                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	                                 | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	                                 | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+	                                 | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                                 &counters, sizeof(counters),
+	                                 &particles->counter_buffer);
+}
+
+static uint8_t create_descriptor_sets(struct particles *particles,
+                                      VkDevice device)
+{
+	VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[BINDING_COUNT];
+	for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+		VkDescriptorSetLayoutBinding binding = {
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		};
+		descriptor_set_layout_bindings[i] = binding;
+	}
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = ARRAY_SIZE(descriptor_set_layout_bindings),
+		.pBindings = descriptor_set_layout_bindings,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &particles->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		particles->descriptor_set_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorPoolSize descriptor_pool_sizes[] = {
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = ARRAY_SIZE(particles->descriptor_sets)
+			                   * BINDING_COUNT,
+		},
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = ARRAY_SIZE(particles->descriptor_sets),
+		.poolSizeCount = ARRAY_SIZE(descriptor_pool_sizes),
+		.pPoolSizes = descriptor_pool_sizes,
+	};
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &particles->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		particles->descriptor_pool = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSetLayout set_layouts[] = {
+		particles->descriptor_set_layout,
+		particles->descriptor_set_layout,
+	};
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = particles->descriptor_pool,
+		.descriptorSetCount = ARRAY_SIZE(set_layouts),
+		.pSetLayouts = set_layouts,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  particles->descriptor_sets);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	/* Set 1 swaps the sort's input and output */
+	for (uint32_t s = 0; s < ARRAY_SIZE(particles->descriptor_sets); ++s) {
+		const struct gpu_buffer *buffers[BINDING_COUNT] = {
+			[BINDING_STATE] = &particles->state_buffer,
+			[BINDING_COMPACTED] = &particles->compacted_buffer,
+			[BINDING_COUNTERS] = &particles->counter_buffer,
+			[BINDING_KEYS_IN] = &particles->key_buffers[s],
+			[BINDING_VALUES_IN] = &particles->value_buffers[s],
+			[BINDING_KEYS_OUT] = &particles->key_buffers[1 - s],
+			[BINDING_VALUES_OUT] = &particles->value_buffers[1 - s],
+			[BINDING_HISTOGRAMS] = &particles->histogram_buffer,
+		};
+		VkDescriptorBufferInfo descriptor_buffer_infos[BINDING_COUNT];
+		for (uint32_t b = 0; b < BINDING_COUNT; ++b) {
+			VkDescriptorBufferInfo descriptor_buffer_info = {
+				.buffer = buffers[b]->buffer,
+				.offset = 0,
+				.range = VK_WHOLE_SIZE,
+			};
+			descriptor_buffer_infos[b] = descriptor_buffer_info;
+		}
+		VkWriteDescriptorSet write_descriptor_set = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = NULL,
+			.dstSet = particles->descriptor_sets[s],
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = BINDING_COUNT,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pImageInfo = NULL,
+			.pBufferInfo = descriptor_buffer_infos,
+			.pTexelBufferView = NULL,
+		};
+		vkUpdateDescriptorSets(device, 1, &write_descriptor_set,
+		                       0, NULL);
+	}
+	return NO_ERRORS;
+}
+
+/* Every pass reads the bindings it needs, so one layout serves them all */
+static uint8_t create_compute_pipelines(struct particles *particles,
+                                        VkDevice device,
+                                        const struct pack *assets)
+{
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct particle_push_constants),
+	};
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &particles->descriptor_set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+	VkResult result;
+	result = vkCreatePipelineLayout(device, &pipeline_layout_create_info,
+	                                &host_allocator,
+	                                &particles->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		particles->pipeline_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkShaderModule shader_modules[PARTICLE_PASS_COUNT] = { 0 };
+	VkComputePipelineCreateInfo
+	compute_pipeline_create_infos[PARTICLE_PASS_COUNT];
+	uint8_t err = NO_ERRORS;
+	for (uint32_t i = 0; i < PARTICLE_PASS_COUNT && !err; ++i) {
+		err = create_shader_module(device, assets, shader_names[i],
+		                           &shader_modules[i]);
+		VkComputePipelineCreateInfo compute_pipeline_create_info = {
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.pNext = NULL,
+				.flags = 0,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = shader_modules[i],
+				.pName = "main",
+				.pSpecializationInfo = NULL,
+			},
+			.layout = particles->pipeline_layout,
+			.basePipelineHandle = VK_NULL_HANDLE,
+			.basePipelineIndex = -1,
+		};
+		compute_pipeline_create_infos[i] = compute_pipeline_create_info;
+	}
+	if (!err) {
+		result = vkCreateComputePipelines(
+			device, VK_NULL_HANDLE, PARTICLE_PASS_COUNT,
+			compute_pipeline_create_infos, &host_allocator,
+			particles->pipelines
+		);
+		if (result != VK_SUCCESS) {
+			memset(particles->pipelines, 0,
+			       sizeof(particles->pipelines));
+			err = VULKAN_ERROR_BIT | print_result(result);
+		}
+	}
+	for (uint32_t i = 0; i < PARTICLE_PASS_COUNT; ++i) {
+		if (shader_modules[i] != VK_NULL_HANDLE) {
+			vkDestroyShaderModule(device, shader_modules[i],
+			                      &host_allocator);
+		}
+	}
+	return err;
+}
+
+uint8_t particles_init(struct particles *particles,
+                       VkDevice device,
+                       const VkPhysicalDeviceMemoryProperties
+                       *memory_properties,
+                       VkQueue queue,
+                       uint32_t queue_family_index,
+                       const struct pack *assets,
+                       uint32_t capacity,
+                       float time_step)
+{
+	memset(particles, 0, sizeof(*particles));
+	particles->capacity = capacity;
+	particles->time_step = time_step;
+	/* One particle born for every one expected to die each step */
+	particles->emit_count = (uint32_t) (capacity * time_step
+	                                    / PARTICLE_MEAN_LIFE);
+	if (particles->emit_count == 0) {
+		particles->emit_count = 1;
+	}
+
+	uint8_t err = create_buffers(particles, device, memory_properties,
+	                             queue, queue_family_index);
+	err = err ? err : create_descriptor_sets(particles, device);
+	err = err ? err : create_compute_pipelines(particles, device, assets);
+	if (err) {
+		particles_fini(particles, device);
+	}
+	return err;
+}
+
+void particles_fini(struct particles *particles, VkDevice device)
+{
+	for (uint32_t i = 0; i < PARTICLE_PASS_COUNT; ++i) {
+		if (particles->pipelines[i] != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, particles->pipelines[i],
+			                  &host_allocator);
+			particles->pipelines[i] = VK_NULL_HANDLE;
+		}
+	}
+	if (particles->pipeline_layout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, particles->pipeline_layout,
+		                        &host_allocator);
+		particles->pipeline_layout = VK_NULL_HANDLE;
+	}
+	if (particles->descriptor_pool != VK_NULL_HANDLE) {
+		vkDestroyDescriptorPool(device, particles->descriptor_pool,
+		                        &host_allocator);
+		particles->descriptor_pool = VK_NULL_HANDLE;
+	}
+	if (particles->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device,
+		                             particles->descriptor_set_layout,
+		                             &host_allocator);
+		particles->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+	if (particles->vert_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, particles->vert_shader_module,
+		                      &host_allocator);
+		particles->vert_shader_module = VK_NULL_HANDLE;
+	}
+	if (particles->frag_shader_module != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, particles->frag_shader_module,
+		                      &host_allocator);
+		particles->frag_shader_module = VK_NULL_HANDLE;
+	}
+	gpu_buffer_fini(device, &particles->counter_buffer);
+	gpu_buffer_fini(device, &particles->histogram_buffer);
+	for (uint32_t i = 0; i < 2; ++i) {
+		gpu_buffer_fini(device, &particles->value_buffers[i]);
+		gpu_buffer_fini(device, &particles->key_buffers[i]);
+	}
+	gpu_buffer_fini(device, &particles->compacted_buffer);
+	gpu_buffer_fini(device, &particles->state_buffer);
+	particles->pipeline = VK_NULL_HANDLE;
+}
+
+uint8_t particles_add_pipeline(struct particles *particles,
+                               VkDevice device,
+                               const struct pack *assets,
+                               struct pipeline_compiler *compiler,
+                               VkPipelineLayout pipeline_layout,
+                               VkRenderPass render_pass,
+                               uint32_t storage_buffer_capacity,
+                               bool depth_test)
+{
+	uint8_t err = create_shader_module(device, assets,
+	                                   "particle.vert.spv",
+	                                   &particles->vert_shader_module);
+	err = err ? err : create_shader_module(device, assets,
+	                                       "particle.frag.spv",
+	                                       &particles->frag_shader_module);
+	if (err) {
+		return err;
+	}
+
+	/* Tested against the scene's depth but never written, for blending */
+	struct pipeline_state state = {
+		.name = "particles",
+		.vert_shader_module = particles->vert_shader_module,
+		.frag_shader_module = particles->frag_shader_module,
+		.layout = pipeline_layout,
+		.render_pass = render_pass,
+		.subpass = 0,
+		.color_attachment_count = 1,
+		.vertex_attribute_count = 0,
+		.constants = {
+			storage_buffer_capacity,
+		},
+		.constant_count = 1,
+		.depth_test = depth_test,
+		.blend = true,
+	};
+	return pipeline_compiler_add(compiler, &state, &particles->variant);
+}
+
+uint8_t particles_wait_pipeline(struct particles *particles,
+                                struct pipeline_compiler *compiler)
+{
+	return pipeline_compiler_wait(compiler, particles->variant,
+	                              &particles->pipeline);
+}
+
+static void record_barrier(VkCommandBuffer command_buffer,
+                           VkPipelineStageFlags src_stage_mask,
+                           VkAccessFlags src_access_mask,
+                           VkPipelineStageFlags dst_stage_mask,
+                           VkAccessFlags dst_access_mask)
+{
+	VkMemoryBarrier memory_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = src_access_mask,
+		.dstAccessMask = dst_access_mask,
+	};
+	vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask,
+	                     0, 1, &memory_barrier, 0, NULL, 0, NULL);
+}
+
+static void record_compute_barrier(VkCommandBuffer command_buffer)
+{
+	record_barrier(command_buffer,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	               VK_ACCESS_SHADER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static void record_dispatch(const struct particles *particles,
+                            VkCommandBuffer command_buffer,
+                            enum particle_pass pass,
+                            uint32_t set,
+                            const struct particle_push_constants
+                            *push_constants,
+                            uint32_t group_count)
+{
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                  particles->pipelines[pass]);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                        particles->pipeline_layout, 0, 1,
+	                        &particles->descriptor_sets[set], 0, NULL);
+	vkCmdPushConstants(command_buffer, particles->pipeline_layout,
+	                   VK_SHADER_STAGE_COMPUTE_BIT, 0,
+	                   sizeof(*push_constants), push_constants);
+	vkCmdDispatch(command_buffer, group_count, 1, 1);
+}
+
+void particles_record_simulate(const struct particles *particles,
+                               VkCommandBuffer command_buffer,
+                               const float view_projection[16])
+{
+	/* The previous frame's draw and passes must finish with the buffers */
+	record_barrier(command_buffer,
+	               VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+	               | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+	               | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+	               | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	               VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+	               | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	               | VK_ACCESS_TRANSFER_WRITE_BIT);
+	vkCmdFillBuffer(command_buffer, particles->counter_buffer.buffer,
+	                offsetof(struct particle_counters, next),
+	                sizeof(uint32_t), 0);
+	record_barrier(command_buffer,
+	               VK_PIPELINE_STAGE_TRANSFER_BIT,
+	               VK_ACCESS_TRANSFER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	struct particle_push_constants push_constants = {
+		.capacity = particles->capacity,
+		.emit_count = particles->emit_count,
+		.shift = 0,
+		.time_step = particles->time_step,
+	};
+	memcpy(push_constants.view_projection, view_projection,
+	       sizeof(push_constants.view_projection));
+
+	/* The survivors first, so that emission only fills what is left */
+	record_dispatch(particles, command_buffer, PARTICLE_SIMULATE, 0,
+	                &push_constants,
+	                (particles->capacity + PARTICLE_WORKGROUP_SIZE - 1)
+	                / PARTICLE_WORKGROUP_SIZE);
+	record_compute_barrier(command_buffer);
+	record_dispatch(particles, command_buffer, PARTICLE_EMIT, 0,
+	                &push_constants,
+	                (particles->emit_count + PARTICLE_WORKGROUP_SIZE - 1)
+	                / PARTICLE_WORKGROUP_SIZE);
+	record_compute_barrier(command_buffer);
+}
+
+void particles_record_sort(const struct particles *particles,
+                           VkCommandBuffer command_buffer)
+{
+	struct particle_push_constants push_constants = {
+		.capacity = particles->capacity,
+		.emit_count = particles->emit_count,
+		.shift = 0,
+		.time_step = particles->time_step,
+	};
+	memset(push_constants.view_projection, 0,
+	       sizeof(push_constants.view_projection));
+
+	/* An even number of passes leaves the result in set 0's input */
+	for (uint32_t pass = 0; pass < RADIX_PASSES; ++pass) {
+		uint32_t set = pass % 2;
+		push_constants.shift = 8 * pass;
+		record_dispatch(particles, command_buffer,
+		                PARTICLE_RADIX_COUNT, set, &push_constants,
+		                block_count(particles));
+		record_compute_barrier(command_buffer);
+		record_dispatch(particles, command_buffer,
+		                PARTICLE_RADIX_SCAN, set, &push_constants, 1);
+		record_compute_barrier(command_buffer);
+		record_dispatch(particles, command_buffer,
+		                PARTICLE_RADIX_SCATTER, set, &push_constants,
+		                block_count(particles));
+		record_compute_barrier(command_buffer);
+	}
+
+	record_dispatch(particles, command_buffer, PARTICLE_GATHER, 0,
+	                &push_constants,
+	                (particles->capacity + PARTICLE_WORKGROUP_SIZE - 1)
+	                / PARTICLE_WORKGROUP_SIZE);
+
+	record_barrier(command_buffer,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	               VK_ACCESS_SHADER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_TRANSFER_BIT,
+	               VK_ACCESS_TRANSFER_READ_BIT);
+	VkBufferCopy buffer_copy = {
+		.srcOffset = offsetof(struct particle_counters, next),
+		.dstOffset = offsetof(struct particle_counters, draw)
+		             + offsetof(VkDrawIndirectCommand, instanceCount),
+		.size = sizeof(uint32_t),
+	};
+	vkCmdCopyBuffer(command_buffer, particles->counter_buffer.buffer,
+	                particles->counter_buffer.buffer, 1, &buffer_copy);
+	record_barrier(command_buffer,
+	               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+	               | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	               VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+	               | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+	               VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+	               | VK_ACCESS_SHADER_READ_BIT);
+}
+
+void particles_record_draw(const struct particles *particles,
+                           VkCommandBuffer command_buffer,
+                           VkPipelineLayout pipeline_layout,
+                           uint32_t state_index)
+{
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                  particles->pipeline);
+	vkCmdPushConstants(command_buffer, pipeline_layout,
+	                   VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(state_index),
+	                   &state_index);
+	vkCmdDrawIndirect(command_buffer, particles->counter_buffer.buffer,
+	                  offsetof(struct particle_counters, draw), 1,
+	                  sizeof(VkDrawIndirectCommand));
+}
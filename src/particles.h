@@ -0,0 +1,119 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_PARTICLES_H
+#define HELLO_VULKAN_PARTICLES_H
+
+#include "gpu.h"
+#include "pack.h"
+#include "pipeline_compiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum particle_pass {
+	PARTICLE_EMIT,
+	PARTICLE_SIMULATE,
+	PARTICLE_RADIX_COUNT,
+	PARTICLE_RADIX_SCAN,
+	PARTICLE_RADIX_SCATTER,
+	PARTICLE_GATHER,
+	PARTICLE_PASS_COUNT,
+};
+
+/*
+ * A particle system that lives on the GPU. Each frame the live particles are
+ * simulated from the state buffer into a compacted one, dropping the dead,
+ * and new ones are appended after them. A radix sort then orders their depth
+ * keys back to front, 8 bits per pass, and a gather writes the particles back
+ * to the state buffer in that order, where the blended pipeline draws them
+ * with one indirect draw whose instance count is the number alive.
+ */
+struct particles {
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	/* Sort passes alternate between the key and value buffers */
+	VkDescriptorSet descriptor_sets[2];
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipelines[PARTICLE_PASS_COUNT];
+
+	VkShaderModule vert_shader_module;
+	VkShaderModule frag_shader_module;
+	uint32_t variant;
+	/* Set by particles_wait_pipeline */
+	VkPipeline pipeline;
+
+	/* The sorted particles drawn, then the compacted ones of this frame */
+	struct gpu_buffer state_buffer;
+	struct gpu_buffer compacted_buffer;
+	struct gpu_buffer key_buffers[2];
+	struct gpu_buffer value_buffers[2];
+	/* Per digit, per block counts, scanned in place into offsets */
+	struct gpu_buffer histogram_buffer;
+	/* The indirect draw, the compaction counter and the frame number */
+	struct gpu_buffer counter_buffer;
+
+	uint32_t capacity;
+	uint32_t emit_count;
+	float time_step;
+};
+
+uint8_t particles_init(struct particles *particles,
+                       VkDevice device,
+                       const VkPhysicalDeviceMemoryProperties
+                       *memory_properties,
+                       VkQueue queue,
+                       uint32_t queue_family_index,
+                       const struct pack *assets,
+                       uint32_t capacity,
+                       float time_step);
+void particles_fini(struct particles *particles, VkDevice device);
+
+/*
+ * Queues the blended pipeline that draws the particles on the compiler, which
+ * has to be finished before particles_fini. It uses the scene's layout and
+ * reads the state buffer through the bindless storage buffers.
+ */
+uint8_t particles_add_pipeline(struct particles *particles,
+                               VkDevice device,
+                               const struct pack *assets,
+                               struct pipeline_compiler *compiler,
+                               VkPipelineLayout pipeline_layout,
+                               VkRenderPass render_pass,
+                               uint32_t storage_buffer_capacity,
+                               bool depth_test);
+uint8_t particles_wait_pipeline(struct particles *particles,
+                                struct pipeline_compiler *compiler);
+
+/* Both outside of a render pass, the sort after the simulation */
+void particles_record_simulate(const struct particles *particles,
+                               VkCommandBuffer command_buffer,
+                               const float view_projection[16]);
+void particles_record_sort(const struct particles *particles,
+                           VkCommandBuffer command_buffer);
+/*
+ * Records the draw inside a render pass, with the scene's descriptor sets
+ * bound and state_index the state buffer's bindless index.
+ */
+void particles_record_draw(const struct particles *particles,
+                           VkCommandBuffer command_buffer,
+                           VkPipelineLayout pipeline_layout,
+                           uint32_t state_index);
+
+#endif
@@ -0,0 +1,643 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipeline_compiler.h"
+
+#include "error.h"
+#include "gpu.h"
+#include "host_memory.h"
+#include "trace.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Fixed function state of a variant, pointed into by the create infos */
+struct create_state {
+	VkPipelineShaderStageCreateInfo stages[2];
+	VkSpecializationMapEntry constant_entries[PIPELINE_MAX_CONSTANTS];
+	VkSpecializationInfo specialization;
+	VkPipelineVertexInputStateCreateInfo vertex_input;
+	VkPipelineInputAssemblyStateCreateInfo input_assembly;
+	VkPipelineViewportStateCreateInfo viewport;
+	VkPipelineRasterizationStateCreateInfo rasterization;
+	VkPipelineMultisampleStateCreateInfo multisample;
+	VkPipelineDepthStencilStateCreateInfo depth_stencil;
+	VkPipelineColorBlendAttachmentState
+	color_blend_attachments[PIPELINE_MAX_COLOR_ATTACHMENTS];
+	VkPipelineColorBlendStateCreateInfo color_blend;
+	VkDynamicState dynamic_states[2];
+	VkPipelineDynamicStateCreateInfo dynamic;
+};
+
+static void init_create_state(struct create_state *s,
+                              const struct pipeline_state *state)
+{
+	for (uint32_t i = 0; i < state->constant_count; ++i) {
+		VkSpecializationMapEntry entry = {
+			.constantID = i,
+			.offset = i * sizeof(uint32_t),
+			.size = sizeof(uint32_t),
+		};
+		s->constant_entries[i] = entry;
+	}
+	VkSpecializationInfo specialization = {
+		.mapEntryCount = state->constant_count,
+		.pMapEntries = s->constant_entries,
+		.dataSize = state->constant_count * sizeof(uint32_t),
+		.pData = state->constants,
+	};
+	s->specialization = specialization;
+
+	VkPipelineShaderStageCreateInfo
+	pipeline_shader_vert_stage_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = state->vert_shader_module,
+		.pName = "main",
+		.pSpecializationInfo = state->constant_count != 0
+		                       ? &s->specialization : NULL,
+	};
+	s->stages[0] = pipeline_shader_vert_stage_create_info;
+
+	VkPipelineShaderStageCreateInfo
+	pipeline_shader_frag_stage_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.module = state->frag_shader_module,
+		.pName = "main",
+		.pSpecializationInfo = state->constant_count != 0
+		                       ? &s->specialization : NULL,
+	};
+	s->stages[1] = pipeline_shader_frag_stage_create_info;
+
+	VkPipelineVertexInputStateCreateInfo
+	pipeline_vertex_input_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.vertexBindingDescriptionCount
+			= state->vertex_attribute_count != 0 ? 1 : 0,
+		.pVertexBindingDescriptions = &state->vertex_binding,
+		.vertexAttributeDescriptionCount = state->vertex_attribute_count,
+		.pVertexAttributeDescriptions = state->vertex_attributes,
+	};
+	s->vertex_input = pipeline_vertex_input_state_create_info;
+
+	VkPipelineInputAssemblyStateCreateInfo
+	pipeline_input_assembly_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		.primitiveRestartEnable = VK_FALSE,
+	};
+	s->input_assembly = pipeline_input_assembly_state_create_info;
+
+	/* Viewport and scissor are dynamic, so variants outlive swapchains */
+	VkPipelineViewportStateCreateInfo
+	pipeline_viewport_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.viewportCount = 1,
+		.pViewports = NULL,
+		.scissorCount = 1,
+		.pScissors = NULL,
+	};
+	s->viewport = pipeline_viewport_state_create_info;
+
+	VkPipelineRasterizationStateCreateInfo
+	pipeline_rasterization_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.depthClampEnable = VK_FALSE,
+		.rasterizerDiscardEnable = VK_FALSE,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_BACK_BIT,
+		.frontFace = VK_FRONT_FACE_CLOCKWISE,
+		.depthBiasEnable = VK_FALSE,
+		.depthBiasConstantFactor = 0.0f,
+		.depthBiasClamp = 0.0f,
+		.depthBiasSlopeFactor = 0.0f,
+		.lineWidth = 1.0f,
+	};
+	s->rasterization = pipeline_rasterization_state_create_info;
+
+	VkPipelineMultisampleStateCreateInfo
+	pipeline_multisample_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+		.sampleShadingEnable = VK_FALSE,
+		.minSampleShading = 1.0f,
+		.pSampleMask = NULL,
+		.alphaToCoverageEnable = VK_FALSE,
+		.alphaToOneEnable = VK_FALSE,
+	};
+	s->multisample = pipeline_multisample_state_create_info;
+
+	VkPipelineDepthStencilStateCreateInfo
+	pipeline_depth_stencil_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.depthTestEnable = state->depth_test ? VK_TRUE : VK_FALSE,
+		.depthWriteEnable = state->depth_test && !state->blend
+		                    ? VK_TRUE : VK_FALSE,
+		.depthCompareOp = VK_COMPARE_OP_LESS,
+		.depthBoundsTestEnable = VK_FALSE,
+		.stencilTestEnable = VK_FALSE,
+		.front = {
+			.failOp = VK_STENCIL_OP_KEEP,
+			.passOp = VK_STENCIL_OP_KEEP,
+			.depthFailOp = VK_STENCIL_OP_KEEP,
+			.compareOp = VK_COMPARE_OP_ALWAYS,
+			.compareMask = 0,
+			.writeMask = 0,
+			.reference = 0,
+		},
+		.back = {
+			.failOp = VK_STENCIL_OP_KEEP,
+			.passOp = VK_STENCIL_OP_KEEP,
+			.depthFailOp = VK_STENCIL_OP_KEEP,
+			.compareOp = VK_COMPARE_OP_ALWAYS,
+			.compareMask = 0,
+			.writeMask = 0,
+			.reference = 0,
+		},
+		.minDepthBounds = 0.0f,
+		.maxDepthBounds = 1.0f,
+	};
+	s->depth_stencil = pipeline_depth_stencil_state_create_info;
+
+	/* Blending is premultiplied alpha over what is already there */
+	VkPipelineColorBlendAttachmentState
+	pipeline_color_blend_attachment_state = {
+		.blendEnable = state->blend ? VK_TRUE : VK_FALSE,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstColorBlendFactor = state->blend
+		                       ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA
+		                       : VK_BLEND_FACTOR_ZERO,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = state->blend
+		                       ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA
+		                       : VK_BLEND_FACTOR_ZERO,
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+		                  | VK_COLOR_COMPONENT_G_BIT
+		                  | VK_COLOR_COMPONENT_B_BIT
+		                  | VK_COLOR_COMPONENT_A_BIT
+	};
+	for (uint32_t i = 0; i < state->color_attachment_count; ++i) {
+		s->color_blend_attachments[i]
+			= pipeline_color_blend_attachment_state;
+	}
+
+	VkPipelineColorBlendStateCreateInfo
+	pipeline_color_blend_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.logicOpEnable = VK_FALSE,
+		.logicOp = VK_LOGIC_OP_COPY,
+		.attachmentCount = state->color_attachment_count,
+		.pAttachments = s->color_blend_attachments,
+		.blendConstants = {
+			[0] = 0.0f,
+			[1] = 0.0f,
+			[2] = 0.0f,
+			[3] = 0.0f,
+		},
+	};
+	s->color_blend = pipeline_color_blend_state_create_info;
+
+	s->dynamic_states[0] = VK_DYNAMIC_STATE_VIEWPORT;
+	s->dynamic_states[1] = VK_DYNAMIC_STATE_SCISSOR;
+	VkPipelineDynamicStateCreateInfo
+	pipeline_dynamic_state_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.dynamicStateCount = ARRAY_SIZE(s->dynamic_states),
+		.pDynamicStates = s->dynamic_states,
+	};
+	s->dynamic = pipeline_dynamic_state_create_info;
+}
+
+static uint8_t create_pipeline(VkDevice device,
+                               const VkGraphicsPipelineCreateInfo *create_info,
+                               VkPipeline *pipeline,
+                               double *ms)
+{
+	uint64_t begin_ns = trace_now_ns();
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+	                                            create_info,
+	                                            &host_allocator, pipeline);
+	*ms += (double) (trace_now_ns() - begin_ns) / 1e6;
+	if (result != VK_SUCCESS) {
+		*pipeline = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t build_monolithic(VkDevice device,
+                                struct pipeline_variant *variant)
+{
+	struct create_state s;
+	init_create_state(&s, &variant->state);
+
+	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.stageCount = ARRAY_SIZE(s.stages),
+		.pStages = s.stages,
+		.pVertexInputState = &s.vertex_input,
+		.pInputAssemblyState = &s.input_assembly,
+		.pTessellationState = NULL,
+		.pViewportState = &s.viewport,
+		.pRasterizationState = &s.rasterization,
+		.pMultisampleState = &s.multisample,
+		.pDepthStencilState = variant->state.depth_test
+		                      ? &s.depth_stencil
+		                      : NULL,
+		.pColorBlendState = &s.color_blend,
+		.pDynamicState = &s.dynamic,
+		.layout = variant->state.layout,
+		.renderPass = variant->state.render_pass,
+		.subpass = variant->state.subpass,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1,
+	};
+	struct trace_zone zone = trace_begin("pipeline_monolithic");
+	uint8_t err = create_pipeline(device, &graphics_pipeline_create_info,
+	                              &variant->linked, &variant->link_ms);
+	trace_end(&zone);
+	return err;
+}
+
+/*
+ * Each library only gets the state its part of the pipeline needs. The
+ * layout is complete in both shader libraries, so no independent sets.
+ */
+static uint8_t build_libraries(VkDevice device,
+                               struct pipeline_variant *variant)
+{
+	static const VkGraphicsPipelineLibraryFlagsEXT
+	library_flags[PIPELINE_LIBRARY_COUNT] = {
+		[PIPELINE_LIBRARY_VERTEX_INPUT]
+			= VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+		[PIPELINE_LIBRARY_PRE_RASTERIZATION]
+			= VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+		[PIPELINE_LIBRARY_FRAGMENT_SHADER]
+			= VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+		[PIPELINE_LIBRARY_FRAGMENT_OUTPUT]
+			= VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+	};
+
+	struct create_state s;
+	init_create_state(&s, &variant->state);
+
+	struct trace_zone zone = trace_begin("pipeline_libraries");
+	uint8_t err = NO_ERRORS;
+	for (uint32_t i = 0; i < PIPELINE_LIBRARY_COUNT && !err; ++i) {
+		VkGraphicsPipelineLibraryCreateInfoEXT library_create_info = {
+			.sType
+			= VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+			.pNext = NULL,
+			.flags = library_flags[i],
+		};
+		VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
+			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+			.pNext = &library_create_info,
+			.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR
+			         | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT,
+			.stageCount = 0,
+			.pStages = NULL,
+			.pVertexInputState = NULL,
+			.pInputAssemblyState = NULL,
+			.pTessellationState = NULL,
+			.pViewportState = NULL,
+			.pRasterizationState = NULL,
+			.pMultisampleState = NULL,
+			.pDepthStencilState = NULL,
+			.pColorBlendState = NULL,
+			.pDynamicState = NULL,
+			.layout = VK_NULL_HANDLE,
+			.renderPass = variant->state.render_pass,
+			.subpass = variant->state.subpass,
+			.basePipelineHandle = VK_NULL_HANDLE,
+			.basePipelineIndex = -1,
+		};
+		switch (i) {
+		case PIPELINE_LIBRARY_VERTEX_INPUT:
+			graphics_pipeline_create_info.pVertexInputState
+				= &s.vertex_input;
+			graphics_pipeline_create_info.pInputAssemblyState
+				= &s.input_assembly;
+			break;
+		case PIPELINE_LIBRARY_PRE_RASTERIZATION:
+			graphics_pipeline_create_info.stageCount = 1;
+			graphics_pipeline_create_info.pStages = &s.stages[0];
+			graphics_pipeline_create_info.pViewportState = &s.viewport;
+			graphics_pipeline_create_info.pRasterizationState
+				= &s.rasterization;
+			graphics_pipeline_create_info.pDynamicState = &s.dynamic;
+			graphics_pipeline_create_info.layout = variant->state.layout;
+			break;
+		case PIPELINE_LIBRARY_FRAGMENT_SHADER:
+			graphics_pipeline_create_info.stageCount = 1;
+			graphics_pipeline_create_info.pStages = &s.stages[1];
+			graphics_pipeline_create_info.pMultisampleState
+				= &s.multisample;
+			graphics_pipeline_create_info.pDepthStencilState
+				= variant->state.depth_test ? &s.depth_stencil : NULL;
+			graphics_pipeline_create_info.layout = variant->state.layout;
+			break;
+		case PIPELINE_LIBRARY_FRAGMENT_OUTPUT:
+			graphics_pipeline_create_info.pMultisampleState
+				= &s.multisample;
+			graphics_pipeline_create_info.pColorBlendState
+				= &s.color_blend;
+			break;
+		}
+		err = create_pipeline(device, &graphics_pipeline_create_info,
+		                      &variant->libraries[i], &variant->library_ms);
+	}
+	trace_end(&zone);
+	return err;
+}
+
+static uint8_t link_libraries(VkDevice device,
+                              struct pipeline_variant *variant,
+                              bool optimize,
+                              VkPipeline *pipeline,
+                              double *ms)
+{
+	VkPipelineLibraryCreateInfoKHR library_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+		.pNext = NULL,
+		.libraryCount = PIPELINE_LIBRARY_COUNT,
+		.pLibraries = variant->libraries,
+	};
+	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = &library_create_info,
+		.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT
+		                  : 0,
+		.stageCount = 0,
+		.pStages = NULL,
+		.pVertexInputState = NULL,
+		.pInputAssemblyState = NULL,
+		.pTessellationState = NULL,
+		.pViewportState = NULL,
+		.pRasterizationState = NULL,
+		.pMultisampleState = NULL,
+		.pDepthStencilState = NULL,
+		.pColorBlendState = NULL,
+		.pDynamicState = NULL,
+		.layout = variant->state.layout,
+		.renderPass = variant->state.render_pass,
+		.subpass = variant->state.subpass,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1,
+	};
+	struct trace_zone zone = trace_begin(optimize ? "pipeline_optimize"
+	                                              : "pipeline_fast_link");
+	uint8_t err = create_pipeline(device, &graphics_pipeline_create_info,
+	                              pipeline, ms);
+	trace_end(&zone);
+	return err;
+}
+
+static void print_times(const struct pipeline_compiler *compiler,
+                        const struct pipeline_variant *variant)
+{
+	if (compiler->graphics_pipeline_library) {
+		printf("Pipeline %s: libraries %.2f ms, fast link %.2f ms,"
+		       " optimized link %.2f ms\n", variant->state.name,
+		       variant->library_ms, variant->link_ms,
+		       variant->optimize_ms);
+	}
+	else {
+		printf("Pipeline %s: %.2f ms\n", variant->state.name,
+		       variant->link_ms);
+	}
+}
+
+/* Called with the mutex held, which it drops while compiling */
+static void build(struct pipeline_compiler *compiler, uint32_t index)
+{
+	struct pipeline_variant *variant = &compiler->variants[index];
+	pthread_mutex_unlock(&compiler->mutex);
+
+	uint8_t err;
+	if (compiler->graphics_pipeline_library) {
+		err = build_libraries(compiler->device, variant);
+		if (!err) {
+			err = link_libraries(compiler->device, variant, false,
+			                     &variant->linked, &variant->link_ms);
+		}
+	}
+	else {
+		err = build_monolithic(compiler->device, variant);
+	}
+
+	pthread_mutex_lock(&compiler->mutex);
+	if (err) {
+		variant->failed = true;
+	}
+	else {
+		atomic_store(&variant->current, variant->linked);
+		if (compiler->graphics_pipeline_library) {
+			compiler->optimize_queue[compiler->optimize_tail++] = index;
+			pthread_cond_signal(&compiler->work);
+		}
+		else {
+			print_times(compiler, variant);
+		}
+	}
+	pthread_cond_broadcast(&compiler->ready);
+}
+
+static void optimize(struct pipeline_compiler *compiler, uint32_t index)
+{
+	struct pipeline_variant *variant = &compiler->variants[index];
+	pthread_mutex_unlock(&compiler->mutex);
+
+	/* The fast linked pipeline keeps being drawn with if this fails */
+	uint8_t err = link_libraries(compiler->device, variant, true,
+	                             &variant->optimized,
+	                             &variant->optimize_ms);
+
+	pthread_mutex_lock(&compiler->mutex);
+	if (!err) {
+		atomic_store(&variant->current, variant->optimized);
+		print_times(compiler, variant);
+	}
+}
+
+static void *run_worker(void *data)
+{
+	struct pipeline_compiler *compiler = data;
+
+	pthread_mutex_lock(&compiler->mutex);
+	while (!compiler->stopping) {
+		if (compiler->build_head != compiler->build_tail) {
+			build(compiler,
+			      compiler->build_queue[compiler->build_head++]);
+		}
+		else if (compiler->optimize_head != compiler->optimize_tail) {
+			optimize(compiler,
+			         compiler->optimize_queue[compiler->optimize_head++]);
+		}
+		else {
+			pthread_cond_wait(&compiler->work, &compiler->mutex);
+		}
+	}
+	pthread_mutex_unlock(&compiler->mutex);
+	return NULL;
+}
+
+uint8_t pipeline_compiler_init(struct pipeline_compiler *compiler,
+                               VkDevice device,
+                               bool graphics_pipeline_library,
+                               uint32_t thread_count,
+                               uint32_t variant_capacity)
+{
+	memset(compiler, 0, sizeof(*compiler));
+	compiler->device = device;
+	compiler->graphics_pipeline_library = graphics_pipeline_library;
+	compiler->variant_capacity = variant_capacity;
+	pthread_mutex_init(&compiler->mutex, NULL);
+	pthread_cond_init(&compiler->work, NULL);
+	pthread_cond_init(&compiler->ready, NULL);
+
+	compiler->variants = calloc(variant_capacity,
+	                            sizeof(struct pipeline_variant));
+	compiler->build_queue = malloc(variant_capacity * sizeof(uint32_t));
+	compiler->optimize_queue = malloc(variant_capacity * sizeof(uint32_t));
+	compiler->threads = malloc(thread_count * sizeof(pthread_t));
+	if (compiler->variants == NULL || compiler->build_queue == NULL
+	    || compiler->optimize_queue == NULL || compiler->threads == NULL) {
+		pipeline_compiler_fini(compiler);
+		return LIBC_ERROR_BIT;
+	}
+
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		if (pthread_create(&compiler->threads[i], NULL,
+		                   run_worker, compiler) != 0) {
+			pipeline_compiler_fini(compiler);
+			return POSIX_ERROR_BIT;
+		}
+		compiler->thread_count = i + 1;
+	}
+	return NO_ERRORS;
+}
+
+void pipeline_compiler_fini(struct pipeline_compiler *compiler)
+{
+	if (compiler->device == VK_NULL_HANDLE) {
+		return;
+	}
+
+	pthread_mutex_lock(&compiler->mutex);
+	compiler->stopping = true;
+	pthread_cond_broadcast(&compiler->work);
+	pthread_mutex_unlock(&compiler->mutex);
+	for (uint32_t i = 0; i < compiler->thread_count; ++i) {
+		pthread_join(compiler->threads[i], NULL);
+	}
+	pthread_cond_destroy(&compiler->ready);
+	pthread_cond_destroy(&compiler->work);
+	pthread_mutex_destroy(&compiler->mutex);
+
+	for (uint32_t i = 0; i < compiler->variant_count; ++i) {
+		struct pipeline_variant *variant = &compiler->variants[i];
+		if (variant->optimized != VK_NULL_HANDLE) {
+			vkDestroyPipeline(compiler->device, variant->optimized,
+			                  &host_allocator);
+		}
+		if (variant->linked != VK_NULL_HANDLE) {
+			vkDestroyPipeline(compiler->device, variant->linked,
+			                  &host_allocator);
+		}
+		for (uint32_t j = 0; j < PIPELINE_LIBRARY_COUNT; ++j) {
+			if (variant->libraries[j] != VK_NULL_HANDLE) {
+				vkDestroyPipeline(compiler->device,
+				                  variant->libraries[j],
+				                  &host_allocator);
+			}
+		}
+	}
+
+	free(compiler->threads);
+	free(compiler->optimize_queue);
+	free(compiler->build_queue);
+	free(compiler->variants);
+	memset(compiler, 0, sizeof(*compiler));
+}
+
+uint8_t pipeline_compiler_add(struct pipeline_compiler *compiler,
+                              const struct pipeline_state *state,
+                              uint32_t *variant)
+{
+	pthread_mutex_lock(&compiler->mutex);
+	if (compiler->variant_count == compiler->variant_capacity) {
+		pthread_mutex_unlock(&compiler->mutex);
+		return APP_ERROR_BIT;
+	}
+	*variant = compiler->variant_count++;
+	compiler->variants[*variant].state = *state;
+	atomic_init(&compiler->variants[*variant].current, VK_NULL_HANDLE);
+	compiler->build_queue[compiler->build_tail++] = *variant;
+	pthread_cond_signal(&compiler->work);
+	pthread_mutex_unlock(&compiler->mutex);
+	return NO_ERRORS;
+}
+
+uint8_t pipeline_compiler_wait(struct pipeline_compiler *compiler,
+                               uint32_t variant,
+                               VkPipeline *pipeline)
+{
+	struct pipeline_variant *v = &compiler->variants[variant];
+	pthread_mutex_lock(&compiler->mutex);
+	while (atomic_load(&v->current) == VK_NULL_HANDLE && !v->failed) {
+		pthread_cond_wait(&compiler->ready, &compiler->mutex);
+	}
+	*pipeline = atomic_load(&v->current);
+	pthread_mutex_unlock(&compiler->mutex);
+	return *pipeline == VK_NULL_HANDLE ? VULKAN_ERROR_BIT : NO_ERRORS;
+}
+
+VkPipeline pipeline_compiler_get(struct pipeline_compiler *compiler,
+                                 uint32_t variant)
+{
+	return atomic_load(&compiler->variants[variant].current);
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_PIPELINE_COMPILER_H
+#define HELLO_VULKAN_PIPELINE_COMPILER_H
+
+#include <vulkan/vulkan.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum pipeline_library {
+	PIPELINE_LIBRARY_VERTEX_INPUT,
+	PIPELINE_LIBRARY_PRE_RASTERIZATION,
+	PIPELINE_LIBRARY_FRAGMENT_SHADER,
+	PIPELINE_LIBRARY_FRAGMENT_OUTPUT,
+	PIPELINE_LIBRARY_COUNT,
+};
+
+#define PIPELINE_MAX_VERTEX_ATTRIBUTES 4
+#define PIPELINE_MAX_CONSTANTS 2
+#define PIPELINE_MAX_COLOR_ATTACHMENTS 2
+
+/* Everything a variant differs by; the handles must outlive the compiler */
+struct pipeline_state {
+	const char *name;
+	VkShaderModule vert_shader_module;
+	VkShaderModule frag_shader_module;
+	VkPipelineLayout layout;
+	VkRenderPass render_pass;
+	uint32_t subpass;
+	/* Every color attachment of the subpass blends the same way */
+	uint32_t color_attachment_count;
+	/* One vertex buffer binding, none without attributes */
+	VkVertexInputBindingDescription vertex_binding;
+	VkVertexInputAttributeDescription
+	vertex_attributes[PIPELINE_MAX_VERTEX_ATTRIBUTES];
+	uint32_t vertex_attribute_count;
+	/* Specialization constants of both shaders, by constant_id */
+	uint32_t constants[PIPELINE_MAX_CONSTANTS];
+	uint32_t constant_count;
+	bool depth_test;
+	bool blend;
+};
+
+struct pipeline_variant {
+	struct pipeline_state state;
+	VkPipeline libraries[PIPELINE_LIBRARY_COUNT];
+	/* Fast linked from the libraries, or monolithic without them */
+	VkPipeline linked;
+	VkPipeline optimized;
+	/* The best of the two so far, read without the lock */
+	_Atomic(VkPipeline) current;
+	bool failed;
+	double library_ms;
+	double link_ms;
+	double optimize_ms;
+};
+
+/*
+ * Builds pipeline variants on worker threads. With
+ * VK_EXT_graphics_pipeline_library each variant is first compiled as four
+ * libraries and fast linked, so it can be drawn with quickly, then linked
+ * again with link time optimization to replace it. Without the extension a
+ * variant is one monolithic pipeline. Every build is queued before any
+ * optimization.
+ */
+struct pipeline_compiler {
+	VkDevice device;
+	bool graphics_pipeline_library;
+
+	struct pipeline_variant *variants;
+	uint32_t variant_count;
+	uint32_t variant_capacity;
+
+	/* Each variant goes through each queue at most once */
+	uint32_t *build_queue;
+	uint32_t build_head;
+	uint32_t build_tail;
+	uint32_t *optimize_queue;
+	uint32_t optimize_head;
+	uint32_t optimize_tail;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t ready;
+	bool stopping;
+
+	pthread_t *threads;
+	uint32_t thread_count;
+};
+
+uint8_t pipeline_compiler_init(struct pipeline_compiler *compiler,
+                               VkDevice device,
+                               bool graphics_pipeline_library,
+                               uint32_t thread_count,
+                               uint32_t variant_capacity);
+/* Stops after the builds in progress, then destroys every pipeline */
+void pipeline_compiler_fini(struct pipeline_compiler *compiler);
+
+uint8_t pipeline_compiler_add(struct pipeline_compiler *compiler,
+                              const struct pipeline_state *state,
+                              uint32_t *variant);
+/* Blocks until the variant can be drawn with */
+uint8_t pipeline_compiler_wait(struct pipeline_compiler *compiler,
+                               uint32_t variant,
+                               VkPipeline *pipeline);
+/* Never blocks, null until the variant can be drawn with */
+VkPipeline pipeline_compiler_get(struct pipeline_compiler *compiler,
+                                 uint32_t variant);
+
+#endif
@@ -0,0 +1,1218 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "post.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+/* The workgroup sizes of post_blur.comp and post_tonemap.comp */
+#define BLUR_TILE 128
+#define TONEMAP_TILE 16
+#define BLOOM_THRESHOLD 0.5f
+#define SHARPEN 0.25f
+
+struct post_push_constants {
+	int32_t direction[2];
+	float threshold;
+	float sharpen;
+};
+
+static const VkShaderStageFlags push_constant_stages
+	= VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+static uint8_t create_shader_module(VkDevice device,
+                                    const struct pack *assets,
+                                    const char *name,
+                                    VkShaderModule *shader_module)
+{
+	const struct pack_entry *entry = pack_find(assets, name,
+	                                           PACK_TYPE_SPIRV);
+	if (entry == NULL) {
+		printf("No shader %s in the asset pack\n", name);
+		return APP_ERROR_BIT;
+	}
+
+	VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.codeSize = entry->size,
+		.pCode = pack_data(assets, entry),
+	};
+	VkResult result;
+	result = vkCreateShaderModule(device, &shader_module_create_info,
+	                              &host_allocator, shader_module);
+	if (result != VK_SUCCESS) {
+		*shader_module = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_compute_pipeline(const struct post *post,
+                                       VkDevice device,
+                                       const struct pack *assets,
+                                       const char *name,
+                                       VkPipeline *pipeline)
+{
+	VkShaderModule comp_shader_module;
+	uint8_t err = create_shader_module(device, assets, name,
+	                                   &comp_shader_module);
+	if (err) {
+		return err;
+	}
+
+	VkComputePipelineCreateInfo compute_pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = comp_shader_module,
+			.pName = "main",
+			.pSpecializationInfo = NULL,
+		},
+		.layout = post->pipeline_layout,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1,
+	};
+	VkResult result;
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+	                                  &compute_pipeline_create_info,
+	                                  &host_allocator, pipeline);
+	vkDestroyShaderModule(device, comp_shader_module, &host_allocator);
+	if (result != VK_SUCCESS) {
+		*pipeline = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+/* Every pass reads the bindings it needs, so one layout serves them all */
+static uint8_t create_pipeline_layout(struct post *post, VkDevice device)
+{
+	VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[3];
+	for (uint32_t i = 0; i < ARRAY_SIZE(descriptor_set_layout_bindings);
+	     ++i) {
+		VkDescriptorSetLayoutBinding binding = {
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+			              | VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL,
+		};
+		descriptor_set_layout_bindings[i] = binding;
+	}
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = ARRAY_SIZE(descriptor_set_layout_bindings),
+		.pBindings = descriptor_set_layout_bindings,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &post->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		post->descriptor_set_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = push_constant_stages,
+		.offset = 0,
+		.size = sizeof(struct post_push_constants),
+	};
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &post->descriptor_set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+	result = vkCreatePipelineLayout(device, &pipeline_layout_create_info,
+	                                &host_allocator,
+	                                &post->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		post->pipeline_layout = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+/*
+ * A single color attachment that the full screen triangle overwrites. The
+ * attachment may still be read by the previous frame's passes.
+ */
+static uint8_t create_render_pass(VkDevice device,
+                                  VkFormat format,
+                                  VkImageLayout final_layout,
+                                  VkRenderPass *render_pass)
+{
+	VkAttachmentDescription color_attachment_description = {
+		.flags = 0,
+		.format = format,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = final_layout,
+	};
+	VkAttachmentReference color_attachment_reference = {
+		.attachment = 0,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+	VkSubpassDescription subpass_description = {
+		.flags = 0,
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.inputAttachmentCount = 0,
+		.pInputAttachments = NULL,
+		.colorAttachmentCount = 1,
+		.pColorAttachments = &color_attachment_reference,
+		.pResolveAttachments = NULL,
+		.pDepthStencilAttachment = NULL,
+		.preserveAttachmentCount = 0,
+		.pPreserveAttachments = NULL,
+	};
+	VkSubpassDependency subpass_dependency = {
+		.srcSubpass = VK_SUBPASS_EXTERNAL,
+		.dstSubpass = 0,
+		.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		                | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+		                | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		                 | VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.dependencyFlags = 0,
+	};
+	VkRenderPassCreateInfo render_pass_create_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.attachmentCount = 1,
+		.pAttachments = &color_attachment_description,
+		.subpassCount = 1,
+		.pSubpasses = &subpass_description,
+		.dependencyCount = 1,
+		.pDependencies = &subpass_dependency,
+	};
+	VkResult result;
+	result = vkCreateRenderPass(device, &render_pass_create_info,
+	                            &host_allocator, render_pass);
+	if (result != VK_SUCCESS) {
+		*render_pass = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t add_fragment_variant(const struct post *post,
+                                    struct pipeline_compiler *compiler,
+                                    const char *name,
+                                    VkShaderModule frag_shader_module,
+                                    VkRenderPass render_pass,
+                                    uint32_t *variant)
+{
+	struct pipeline_state state = {
+		.name = name,
+		.vert_shader_module = post->fullscreen_vert_shader_module,
+		.frag_shader_module = frag_shader_module,
+		.layout = post->pipeline_layout,
+		.render_pass = render_pass,
+		.subpass = 0,
+		.color_attachment_count = 1,
+		.vertex_attribute_count = 0,
+		.constant_count = 0,
+		.depth_test = false,
+		.blend = false,
+	};
+	return pipeline_compiler_add(compiler, &state, variant);
+}
+
+static uint8_t create_fragment_passes(struct post *post,
+                                      VkDevice device,
+                                      const struct pack *assets,
+                                      struct pipeline_compiler *compiler,
+                                      VkFormat output_format)
+{
+	uint8_t err;
+	err = create_shader_module(device, assets, "fullscreen.vert.spv",
+	                           &post->fullscreen_vert_shader_module);
+	err = err ? err : create_shader_module(
+		device, assets, "post_blur.frag.spv",
+		&post->blur_frag_shader_module
+	);
+	err = err ? err : create_shader_module(
+		device, assets, "post_tonemap.frag.spv",
+		&post->tonemap_frag_shader_module
+	);
+	/* Later passes load what earlier ones wrote in the general layout */
+	err = err ? err : create_render_pass(device, POST_HDR_FORMAT,
+	                                     VK_IMAGE_LAYOUT_GENERAL,
+	                                     &post->blur_render_pass);
+	err = err ? err : create_render_pass(device, POST_LDR_FORMAT,
+	                                     VK_IMAGE_LAYOUT_GENERAL,
+	                                     &post->ldr_render_pass);
+	err = err ? err : create_render_pass(device, output_format,
+	                                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	                                     &post->output_render_pass);
+	if (err) {
+		return err;
+	}
+
+	err = add_fragment_variant(post, compiler, "post_blur",
+	                           post->blur_frag_shader_module,
+	                           post->blur_render_pass,
+	                           &post->blur_variant);
+	/* Only benchmarked against compute, which writes the LDR image too */
+	if (!err && post->compute) {
+		err = add_fragment_variant(post, compiler, "post_tonemap_ldr",
+		                           post->tonemap_frag_shader_module,
+		                           post->ldr_render_pass,
+		                           &post->tonemap_ldr_variant);
+	}
+	if (!err && post->mode == POST_MODE_FRAGMENT) {
+		err = add_fragment_variant(post, compiler, "post_tonemap",
+		                           post->tonemap_frag_shader_module,
+		                           post->output_render_pass,
+		                           &post->tonemap_output_variant);
+	}
+	return err;
+}
+
+uint8_t post_init(struct post *post,
+                  VkDevice device,
+                  const struct pack *assets,
+                  struct pipeline_compiler *compiler,
+                  VkFormat output_format,
+                  enum post_mode mode,
+                  bool storage_output,
+                  bool read_back,
+                  bool benchmark)
+{
+	memset(post, 0, sizeof(*post));
+	post->mode = mode;
+	post->storage_output = mode == POST_MODE_COMPUTE && storage_output;
+	post->read_back = read_back;
+	post->compute = mode == POST_MODE_COMPUTE || benchmark;
+	post->fragment = mode == POST_MODE_FRAGMENT || benchmark;
+
+	uint8_t err = create_pipeline_layout(post, device);
+	if (!err && post->compute) {
+		err = create_compute_pipeline(post, device, assets,
+		                              "post_blur.comp.spv",
+		                              &post->blur_pipeline);
+		err = err ? err : create_compute_pipeline(
+			post, device, assets, "post_tonemap.comp.spv",
+			&post->tonemap_pipeline
+		);
+	}
+	if (!err && post->storage_output) {
+		err = create_compute_pipeline(post, device, assets,
+		                              "post_tonemap_any.comp.spv",
+		                              &post->tonemap_output_pipeline);
+	}
+	if (!err && post->fragment) {
+		err = create_fragment_passes(post, device, assets, compiler,
+		                             output_format);
+	}
+	if (err) {
+		post_fini(post, device);
+	}
+	return err;
+}
+
+void post_fini(struct post *post, VkDevice device)
+{
+	VkPipeline pipelines[] = {
+		post->blur_pipeline,
+		post->tonemap_pipeline,
+		post->tonemap_output_pipeline,
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(pipelines); ++i) {
+		if (pipelines[i] != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, pipelines[i], &host_allocator);
+		}
+	}
+	post->blur_pipeline = VK_NULL_HANDLE;
+	post->tonemap_pipeline = VK_NULL_HANDLE;
+	post->tonemap_output_pipeline = VK_NULL_HANDLE;
+
+	VkShaderModule shader_modules[] = {
+		post->fullscreen_vert_shader_module,
+		post->blur_frag_shader_module,
+		post->tonemap_frag_shader_module,
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(shader_modules); ++i) {
+		if (shader_modules[i] != VK_NULL_HANDLE) {
+			vkDestroyShaderModule(device, shader_modules[i],
+			                      &host_allocator);
+		}
+	}
+	post->fullscreen_vert_shader_module = VK_NULL_HANDLE;
+	post->blur_frag_shader_module = VK_NULL_HANDLE;
+	post->tonemap_frag_shader_module = VK_NULL_HANDLE;
+
+	VkRenderPass render_passes[] = {
+		post->blur_render_pass,
+		post->ldr_render_pass,
+		post->output_render_pass,
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(render_passes); ++i) {
+		if (render_passes[i] != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(device, render_passes[i],
+			                    &host_allocator);
+		}
+	}
+	post->blur_render_pass = VK_NULL_HANDLE;
+	post->ldr_render_pass = VK_NULL_HANDLE;
+	post->output_render_pass = VK_NULL_HANDLE;
+
+	if (post->pipeline_layout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, post->pipeline_layout,
+		                        &host_allocator);
+		post->pipeline_layout = VK_NULL_HANDLE;
+	}
+	if (post->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device,
+		                             post->descriptor_set_layout,
+		                             &host_allocator);
+		post->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+}
+
+uint8_t post_wait_pipelines(struct post *post,
+                            struct pipeline_compiler *compiler)
+{
+	if (!post->fragment) {
+		return NO_ERRORS;
+	}
+	uint8_t err;
+	err = pipeline_compiler_wait(compiler, post->blur_variant,
+	                             &post->blur_fragment_pipeline);
+	if (!err && post->compute) {
+		err = pipeline_compiler_wait(
+			compiler, post->tonemap_ldr_variant,
+			&post->tonemap_ldr_fragment_pipeline
+		);
+	}
+	if (!err && post->mode == POST_MODE_FRAGMENT) {
+		err = pipeline_compiler_wait(
+			compiler, post->tonemap_output_variant,
+			&post->tonemap_output_fragment_pipeline
+		);
+	}
+	return err;
+}
+
+static uint8_t create_image(VkDevice device,
+                            const VkPhysicalDeviceMemoryProperties
+                            *memory_properties,
+                            VkFormat format,
+                            VkImageUsageFlags usage,
+                            VkExtent2D extent,
+                            struct gpu_image *image)
+{
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent = {
+			.width = extent.width,
+			.height = extent.height,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = usage | VK_IMAGE_USAGE_STORAGE_BIT
+		         | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	return gpu_image_init(device, memory_properties, &image_create_info,
+	                      VK_IMAGE_ASPECT_COLOR_BIT,
+	                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                      image);
+}
+
+static uint8_t create_framebuffer(VkDevice device,
+                                  VkRenderPass render_pass,
+                                  VkImageView view,
+                                  VkExtent2D extent,
+                                  VkFramebuffer *framebuffer)
+{
+	VkFramebufferCreateInfo framebuffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.renderPass = render_pass,
+		.attachmentCount = 1,
+		.pAttachments = &view,
+		.width = extent.width,
+		.height = extent.height,
+		.layers = 1,
+	};
+	VkResult result;
+	result = vkCreateFramebuffer(device, &framebuffer_create_info,
+	                             &host_allocator, framebuffer);
+	if (result != VK_SUCCESS) {
+		*framebuffer = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+/* Bindings from 0, in the general layout every pass uses them in */
+static void write_descriptor_set(VkDevice device,
+                                 VkDescriptorSet descriptor_set,
+                                 const VkImageView *views,
+                                 uint32_t view_count)
+{
+	VkDescriptorImageInfo descriptor_image_infos[3];
+	for (uint32_t i = 0; i < view_count; ++i) {
+		VkDescriptorImageInfo descriptor_image_info = {
+			.sampler = VK_NULL_HANDLE,
+			.imageView = views[i],
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+		};
+		descriptor_image_infos[i] = descriptor_image_info;
+	}
+	VkWriteDescriptorSet write_descriptor_set = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = descriptor_set,
+		.dstBinding = 0,
+		.dstArrayElement = 0,
+		.descriptorCount = view_count,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+		.pImageInfo = descriptor_image_infos,
+		.pBufferInfo = NULL,
+		.pTexelBufferView = NULL,
+	};
+	vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+}
+
+static uint8_t create_descriptor_sets(struct post_target *target,
+                                      const struct post *post,
+                                      VkDevice device,
+                                      struct arena *arena,
+                                      const VkImageView *output_views)
+{
+	uint32_t output_set_count = post->storage_output
+	                            ? target->image_count
+	                            : 0;
+	uint32_t set_count = ARRAY_SIZE(target->blur_sets) + 1
+	                     + output_set_count;
+	VkDescriptorPoolSize descriptor_pool_sizes[] = {
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = 3 * set_count,
+		},
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = set_count,
+		.poolSizeCount = ARRAY_SIZE(descriptor_pool_sizes),
+		.pPoolSizes = descriptor_pool_sizes,
+	};
+	VkResult result;
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &target->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		target->descriptor_pool = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSet *sets = arena_alloc(arena,
+	                                    set_count * sizeof(VkDescriptorSet));
+	VkDescriptorSetLayout *set_layouts = arena_alloc(
+		arena,
+		set_count * sizeof(VkDescriptorSetLayout)
+	);
+	if (sets == NULL || set_layouts == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < set_count; ++i) {
+		set_layouts[i] = post->descriptor_set_layout;
+	}
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = target->descriptor_pool,
+		.descriptorSetCount = set_count,
+		.pSetLayouts = set_layouts,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  sets);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	target->blur_sets[0] = sets[0];
+	target->blur_sets[1] = sets[1];
+	target->tonemap_set = sets[2];
+	target->output_sets = output_set_count != 0 ? sets + 3 : NULL;
+
+	VkImageView blur_views[2][2] = {
+		{ target->hdr.view, target->blur[0].view },
+		{ target->blur[0].view, target->blur[1].view },
+	};
+	write_descriptor_set(device, target->blur_sets[0], blur_views[0], 2);
+	write_descriptor_set(device, target->blur_sets[1], blur_views[1], 2);
+	VkImageView tonemap_views[] = {
+		target->hdr.view,
+		target->blur[1].view,
+		target->ldr.view,
+	};
+	write_descriptor_set(device, target->tonemap_set, tonemap_views, 3);
+	for (uint32_t i = 0; i < output_set_count; ++i) {
+		tonemap_views[2] = output_views[i];
+		write_descriptor_set(device, target->output_sets[i],
+		                     tonemap_views, 3);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_framebuffers(struct post_target *target,
+                                   const struct post *post,
+                                   VkDevice device,
+                                   struct arena *arena,
+                                   const VkImageView *output_views)
+{
+	uint8_t err;
+	err = create_framebuffer(device, post->blur_render_pass,
+	                         target->blur[0].view, target->extent,
+	                         &target->blur_framebuffers[0]);
+	err = err ? err : create_framebuffer(device, post->blur_render_pass,
+	                                     target->blur[1].view,
+	                                     target->extent,
+	                                     &target->blur_framebuffers[1]);
+	if (!err && post->compute) {
+		err = create_framebuffer(device, post->ldr_render_pass,
+		                         target->ldr.view, target->extent,
+		                         &target->ldr_framebuffer);
+	}
+	if (err || post->mode != POST_MODE_FRAGMENT) {
+		return err;
+	}
+
+	target->output_framebuffers = arena_alloc(
+		arena,
+		target->image_count * sizeof(VkFramebuffer)
+	);
+	if (target->output_framebuffers == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	for (uint32_t i = 0; i < target->image_count; ++i) {
+		target->output_framebuffers[i] = VK_NULL_HANDLE;
+	}
+	for (uint32_t i = 0; i < target->image_count && !err; ++i) {
+		err = create_framebuffer(device, post->output_render_pass,
+		                         output_views[i], target->extent,
+		                         &target->output_framebuffers[i]);
+	}
+	return err;
+}
+
+uint8_t post_target_init(struct post_target *target,
+                         const struct post *post,
+                         VkDevice device,
+                         const VkPhysicalDeviceMemoryProperties
+                         *memory_properties,
+                         struct arena *arena,
+                         VkExtent2D extent,
+                         const VkImageView *output_views,
+                         uint32_t image_count)
+{
+	memset(target, 0, sizeof(*target));
+	target->extent = extent;
+	target->image_count = image_count;
+
+	uint8_t err;
+	/* The benchmark clears it instead of drawing the scene */
+	err = create_image(device, memory_properties, POST_HDR_FORMAT,
+	                   VK_IMAGE_USAGE_TRANSFER_DST_BIT, extent,
+	                   &target->hdr);
+	for (uint32_t i = 0; i < ARRAY_SIZE(target->blur) && !err; ++i) {
+		err = create_image(device, memory_properties, POST_HDR_FORMAT,
+		                   0, extent, &target->blur[i]);
+	}
+	err = err ? err : create_image(device, memory_properties,
+	                               POST_LDR_FORMAT,
+	                               VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+	                               extent, &target->ldr);
+	err = err ? err : create_descriptor_sets(target, post, device, arena,
+	                                         output_views);
+	if (!err && post->fragment) {
+		err = create_framebuffers(target, post, device, arena,
+		                          output_views);
+	}
+	return err;
+}
+
+uint8_t post_target_retire(struct post_target *target,
+                           struct deferred *deferred,
+                           uint64_t last_use)
+{
+	uint8_t err = NO_ERRORS;
+	VkFramebuffer framebuffers[] = {
+		target->blur_framebuffers[0],
+		target->blur_framebuffers[1],
+		target->ldr_framebuffer,
+	};
+	for (uint32_t i = 0; i < ARRAY_SIZE(framebuffers); ++i) {
+		if (framebuffers[i] != VK_NULL_HANDLE) {
+			union deferred_handle handle = {
+				.framebuffer = framebuffers[i],
+			};
+			err |= deferred_push(deferred, DEFERRED_FRAMEBUFFER,
+			                     handle, last_use);
+		}
+	}
+	target->blur_framebuffers[0] = VK_NULL_HANDLE;
+	target->blur_framebuffers[1] = VK_NULL_HANDLE;
+	target->ldr_framebuffer = VK_NULL_HANDLE;
+	if (target->output_framebuffers != NULL) {
+		for (uint32_t i = 0; i < target->image_count; ++i) {
+			if (target->output_framebuffers[i] == VK_NULL_HANDLE) {
+				continue;
+			}
+			union deferred_handle handle = {
+				.framebuffer = target->output_framebuffers[i],
+			};
+			err |= deferred_push(deferred, DEFERRED_FRAMEBUFFER,
+			                     handle, last_use);
+		}
+		target->output_framebuffers = NULL;
+	}
+
+	/* Frees the descriptor sets along with it */
+	if (target->descriptor_pool != VK_NULL_HANDLE) {
+		union deferred_handle handle = {
+			.descriptor_pool = target->descriptor_pool,
+		};
+		err |= deferred_push(deferred, DEFERRED_DESCRIPTOR_POOL, handle,
+		                     last_use);
+		target->descriptor_pool = VK_NULL_HANDLE;
+	}
+	target->output_sets = NULL;
+
+	err |= deferred_push_image(deferred, &target->hdr, last_use);
+	err |= deferred_push_image(deferred, &target->blur[0], last_use);
+	err |= deferred_push_image(deferred, &target->blur[1], last_use);
+	err |= deferred_push_image(deferred, &target->ldr, last_use);
+	return err;
+}
+
+static void record_image_barrier(VkCommandBuffer command_buffer,
+                                 VkImage image,
+                                 VkImageLayout old_layout,
+                                 VkImageLayout new_layout,
+                                 VkPipelineStageFlags src_stage_mask,
+                                 VkAccessFlags src_access_mask,
+                                 VkPipelineStageFlags dst_stage_mask,
+                                 VkAccessFlags dst_access_mask)
+{
+	VkImageMemoryBarrier image_memory_barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = src_access_mask,
+		.dstAccessMask = dst_access_mask,
+		.oldLayout = old_layout,
+		.newLayout = new_layout,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+	};
+	vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask,
+	                     0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+}
+
+static void record_push_constants(const struct post *post,
+                                  VkCommandBuffer command_buffer,
+                                  int32_t x,
+                                  int32_t y,
+                                  float threshold)
+{
+	struct post_push_constants push_constants = {
+		.direction = {x, y},
+		.threshold = threshold,
+		.sharpen = SHARPEN,
+	};
+	vkCmdPushConstants(command_buffer, post->pipeline_layout,
+	                   push_constant_stages, 0, sizeof(push_constants),
+	                   &push_constants);
+}
+
+/* Both blur images are overwritten, after the last frame's reads */
+static void record_begin(const struct post_target *target,
+                         VkCommandBuffer command_buffer,
+                         VkPipelineStageFlags dst_stage_mask)
+{
+	record_image_barrier(command_buffer, target->hdr.image,
+	                     VK_IMAGE_LAYOUT_GENERAL,
+	                     VK_IMAGE_LAYOUT_GENERAL,
+	                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	                     VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+	                     dst_stage_mask,
+	                     VK_ACCESS_SHADER_READ_BIT);
+	if (dst_stage_mask != VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) {
+		return;
+	}
+	for (uint32_t i = 0; i < ARRAY_SIZE(target->blur); ++i) {
+		record_image_barrier(command_buffer, target->blur[i].image,
+		                     VK_IMAGE_LAYOUT_UNDEFINED,
+		                     VK_IMAGE_LAYOUT_GENERAL,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		                     | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+		                     | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		                     VK_ACCESS_SHADER_WRITE_BIT
+		                     | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		                     VK_ACCESS_SHADER_WRITE_BIT);
+	}
+}
+
+static void record_compute_blur(const struct post *post,
+                                const struct post_target *target,
+                                VkCommandBuffer command_buffer)
+{
+	uint32_t width = target->extent.width;
+	uint32_t height = target->extent.height;
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                  post->blur_pipeline);
+
+	/* A workgroup per BLUR_TILE pixels of a row, then of a column */
+	for (uint32_t pass = 0; pass < 2; ++pass) {
+		vkCmdBindDescriptorSets(command_buffer,
+		                        VK_PIPELINE_BIND_POINT_COMPUTE,
+		                        post->pipeline_layout, 0, 1,
+		                        &target->blur_sets[pass], 0, NULL);
+		if (pass == 0) {
+			record_push_constants(post, command_buffer, 1, 0,
+			                      BLOOM_THRESHOLD);
+			vkCmdDispatch(command_buffer,
+			              (width + BLUR_TILE - 1) / BLUR_TILE,
+			              height, 1);
+		}
+		else {
+			record_push_constants(post, command_buffer, 0, 1, 0.0f);
+			vkCmdDispatch(command_buffer,
+			              (height + BLUR_TILE - 1) / BLUR_TILE,
+			              width, 1);
+		}
+		record_image_barrier(command_buffer, target->blur[pass].image,
+		                     VK_IMAGE_LAYOUT_GENERAL,
+		                     VK_IMAGE_LAYOUT_GENERAL,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		                     VK_ACCESS_SHADER_WRITE_BIT,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		                     VK_ACCESS_SHADER_READ_BIT);
+	}
+}
+
+static void record_compute_tonemap(const struct post *post,
+                                   const struct post_target *target,
+                                   VkCommandBuffer command_buffer,
+                                   VkPipeline pipeline,
+                                   VkDescriptorSet descriptor_set)
+{
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                  pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                        post->pipeline_layout, 0, 1, &descriptor_set,
+	                        0, NULL);
+	record_push_constants(post, command_buffer, 0, 0, 0.0f);
+	vkCmdDispatch(command_buffer,
+	              (target->extent.width + TONEMAP_TILE - 1) / TONEMAP_TILE,
+	              (target->extent.height + TONEMAP_TILE - 1) / TONEMAP_TILE,
+	              1);
+}
+
+static void record_fragment_pass(const struct post *post,
+                                 const struct post_target *target,
+                                 VkCommandBuffer command_buffer,
+                                 VkRenderPass render_pass,
+                                 VkFramebuffer framebuffer,
+                                 VkPipeline pipeline,
+                                 VkDescriptorSet descriptor_set)
+{
+	VkRenderPassBeginInfo render_pass_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.pNext = NULL,
+		.renderPass = render_pass,
+		.framebuffer = framebuffer,
+		.renderArea = {
+			.offset = {
+				.x = 0,
+				.y = 0,
+			},
+			.extent = target->extent,
+		},
+		.clearValueCount = 0,
+		.pClearValues = NULL,
+	};
+	vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
+	                     VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                  pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                        post->pipeline_layout, 0, 1, &descriptor_set,
+	                        0, NULL);
+	VkViewport viewport = {
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float) target->extent.width,
+		.height = (float) target->extent.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	vkCmdSetScissor(command_buffer, 0, 1, &render_pass_begin_info.renderArea);
+	vkCmdDraw(command_buffer, 3, 1, 0, 0);
+	vkCmdEndRenderPass(command_buffer);
+}
+
+/* Each pass loads what the one before it wrote as an attachment */
+static void record_fragment_blur(const struct post *post,
+                                 const struct post_target *target,
+                                 VkCommandBuffer command_buffer)
+{
+	VkMemoryBarrier memory_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+	};
+	for (uint32_t pass = 0; pass < 2; ++pass) {
+		if (pass == 0) {
+			record_push_constants(post, command_buffer, 1, 0,
+			                      BLOOM_THRESHOLD);
+		}
+		else {
+			record_push_constants(post, command_buffer, 0, 1, 0.0f);
+		}
+		record_fragment_pass(post, target, command_buffer,
+		                     post->blur_render_pass,
+		                     target->blur_framebuffers[pass],
+		                     post->blur_fragment_pipeline,
+		                     target->blur_sets[pass]);
+		vkCmdPipelineBarrier(command_buffer,
+		                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		                     0, 1, &memory_barrier, 0, NULL, 0, NULL);
+	}
+}
+
+/* Written with compute and copied, after the last frame's blit */
+static void record_compute_ldr(const struct post *post,
+                               const struct post_target *target,
+                               VkCommandBuffer command_buffer)
+{
+	record_compute_blur(post, target, command_buffer);
+	record_image_barrier(command_buffer, target->ldr.image,
+	                     VK_IMAGE_LAYOUT_UNDEFINED,
+	                     VK_IMAGE_LAYOUT_GENERAL,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+	                     | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+	                     | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_SHADER_WRITE_BIT
+	                     | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_ACCESS_SHADER_WRITE_BIT);
+	record_compute_tonemap(post, target, command_buffer,
+	                       post->tonemap_pipeline, target->tonemap_set);
+}
+
+void post_record(const struct post *post,
+                 const struct post_target *target,
+                 VkCommandBuffer command_buffer,
+                 uint32_t image_index,
+                 VkImage output_image)
+{
+	if (post->mode == POST_MODE_FRAGMENT) {
+		record_begin(target, command_buffer,
+		             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		record_fragment_blur(post, target, command_buffer);
+		record_fragment_pass(post, target, command_buffer,
+		                     post->output_render_pass,
+		                     target->output_framebuffers[image_index],
+		                     post->tonemap_output_fragment_pipeline,
+		                     target->tonemap_set);
+		return;
+	}
+
+	record_begin(target, command_buffer,
+	             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	/*
+	 * Presenting waits on the submit's semaphore, so the last barrier
+	 * only has to reach a transfer reading the output back
+	 */
+	VkPipelineStageFlags output_stage
+		= post->read_back ? VK_PIPELINE_STAGE_TRANSFER_BIT
+		                  : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	VkAccessFlags output_access = post->read_back
+	                              ? VK_ACCESS_TRANSFER_READ_BIT
+	                              : 0;
+	/* Acquiring waits for color attachment output, so start from there */
+	if (post->storage_output) {
+		record_compute_blur(post, target, command_buffer);
+		record_image_barrier(command_buffer, output_image,
+		                     VK_IMAGE_LAYOUT_UNDEFINED,
+		                     VK_IMAGE_LAYOUT_GENERAL,
+		                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		                     0,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		                     VK_ACCESS_SHADER_WRITE_BIT);
+		record_compute_tonemap(post, target, command_buffer,
+		                       post->tonemap_output_pipeline,
+		                       target->output_sets[image_index]);
+		record_image_barrier(command_buffer, output_image,
+		                     VK_IMAGE_LAYOUT_GENERAL,
+		                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		                     VK_ACCESS_SHADER_WRITE_BIT,
+		                     output_stage,
+		                     output_access);
+		return;
+	}
+
+	record_compute_ldr(post, target, command_buffer);
+	record_image_barrier(command_buffer, target->ldr.image,
+	                     VK_IMAGE_LAYOUT_GENERAL,
+	                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_ACCESS_SHADER_WRITE_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_TRANSFER_READ_BIT);
+	record_image_barrier(command_buffer, output_image,
+	                     VK_IMAGE_LAYOUT_UNDEFINED,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	                     0,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_TRANSFER_WRITE_BIT);
+	/* Same size, so only the format is converted */
+	VkImageBlit image_blit = {
+		.srcSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.srcOffsets = {
+			{ 0, 0, 0 },
+			{
+				(int32_t) target->extent.width,
+				(int32_t) target->extent.height,
+				1,
+			},
+		},
+		.dstSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.dstOffsets = {
+			{ 0, 0, 0 },
+			{
+				(int32_t) target->extent.width,
+				(int32_t) target->extent.height,
+				1,
+			},
+		},
+	};
+	vkCmdBlitImage(command_buffer,
+	               target->ldr.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	               output_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	               1, &image_blit, VK_FILTER_NEAREST);
+	record_image_barrier(command_buffer, output_image,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_TRANSFER_WRITE_BIT,
+	                     output_stage,
+	                     output_access);
+}
+
+/* One mode's chain into the LDR image */
+static void record_ldr(const struct post *post,
+                       const struct post_target *target,
+                       VkCommandBuffer command_buffer,
+                       enum post_mode mode)
+{
+	if (mode == POST_MODE_FRAGMENT) {
+		record_begin(target, command_buffer,
+		             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		record_fragment_blur(post, target, command_buffer);
+		record_fragment_pass(post, target, command_buffer,
+		                     post->ldr_render_pass,
+		                     target->ldr_framebuffer,
+		                     post->tonemap_ldr_fragment_pipeline,
+		                     target->tonemap_set);
+	}
+	else {
+		record_begin(target, command_buffer,
+		             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		record_compute_ldr(post, target, command_buffer);
+	}
+}
+
+uint8_t post_benchmark(const struct post *post,
+                       const struct post_target *target,
+                       VkDevice device,
+                       VkQueue queue,
+                       uint32_t queue_family_index,
+                       float timestamp_period,
+                       uint32_t timestamp_valid_bits,
+                       uint32_t iterations,
+                       double *compute_ms,
+                       double *fragment_ms)
+{
+	VkQueryPoolCreateInfo query_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = 3,
+		.pipelineStatistics = 0,
+	};
+	VkResult result;
+	VkQueryPool query_pool;
+	result = vkCreateQueryPool(device, &query_pool_create_info,
+	                           &host_allocator, &query_pool);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	struct gpu_one_shot one_shot;
+	uint8_t err = gpu_one_shot_begin(device, queue_family_index,
+	                                 &one_shot);
+	if (err) {
+		vkDestroyQueryPool(device, query_pool, &host_allocator);
+		return err;
+	}
+	VkCommandBuffer command_buffer = one_shot.command_buffer;
+	vkCmdResetQueryPool(command_buffer, query_pool, 0, 3);
+
+	/* Bright enough to bloom, the cost doesn't depend on the contents */
+	record_image_barrier(command_buffer, target->hdr.image,
+	                     VK_IMAGE_LAYOUT_UNDEFINED,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	                     0,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_TRANSFER_WRITE_BIT);
+	VkClearColorValue clear_color = {
+		.float32 = {2.0f, 1.0f, 0.5f, 1.0f},
+	};
+	VkImageSubresourceRange subresource_range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	vkCmdClearColorImage(command_buffer, target->hdr.image,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     &clear_color, 1, &subresource_range);
+	record_image_barrier(command_buffer, target->hdr.image,
+	                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                     VK_IMAGE_LAYOUT_GENERAL,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_ACCESS_TRANSFER_WRITE_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+	                     | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	                     VK_ACCESS_SHADER_READ_BIT);
+
+	/* Each timestamp waits for everything recorded before it */
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	                    query_pool, 0);
+	for (uint32_t i = 0; i < iterations; ++i) {
+		record_ldr(post, target, command_buffer, POST_MODE_COMPUTE);
+	}
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	                    query_pool, 1);
+	for (uint32_t i = 0; i < iterations; ++i) {
+		record_ldr(post, target, command_buffer, POST_MODE_FRAGMENT);
+	}
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	                    query_pool, 2);
+
+	err = gpu_one_shot_end(device, queue, &one_shot);
+	uint64_t timestamps[3];
+	if (!err) {
+		result = vkGetQueryPoolResults(device, query_pool, 0, 3,
+		                               sizeof(timestamps), timestamps,
+		                               sizeof(timestamps[0]),
+		                               VK_QUERY_RESULT_64_BIT
+		                               | VK_QUERY_RESULT_WAIT_BIT);
+		if (result != VK_SUCCESS) {
+			err = VULKAN_ERROR_BIT | print_result(result);
+		}
+	}
+	vkDestroyQueryPool(device, query_pool, &host_allocator);
+	if (err) {
+		return err;
+	}
+
+	uint64_t mask = timestamp_valid_bits >= 64
+	                ? UINT64_MAX
+	                : (UINT64_C(1) << timestamp_valid_bits) - 1;
+	/* Per iteration, with the period in nanoseconds per tick */
+	double scale = (double) timestamp_period / 1e6 / iterations;
+	*compute_ms = (double) ((timestamps[1] - timestamps[0]) & mask)
+	              * scale;
+	*fragment_ms = (double) ((timestamps[2] - timestamps[1]) & mask)
+	               * scale;
+	return NO_ERRORS;
+}
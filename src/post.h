@@ -0,0 +1,167 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_POST_H
+#define HELLO_VULKAN_POST_H
+
+#include "arena.h"
+#include "deferred.h"
+#include "gpu.h"
+#include "pack.h"
+#include "pipeline_compiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The scene renders into this when post processing, then gets tonemapped */
+#define POST_HDR_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+#define POST_LDR_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+
+enum post_mode {
+	POST_MODE_NONE,
+	/* Shared memory tiles in compute shaders */
+	POST_MODE_COMPUTE,
+	/* The same passes as full screen triangles */
+	POST_MODE_FRAGMENT,
+};
+
+/*
+ * Bloom, tonemapping and sharpening of an HDR scene. A bright pass blurred
+ * horizontally then vertically is the bloom, and one more pass tonemaps the
+ * scene with it and sharpens the result into the swapchain image. Compute
+ * writes it as a storage image when the swapchain allows, and otherwise into
+ * an LDR image that is blitted over. Every pass reads its inputs with image
+ * loads in either mode, so the two only differ in how the work is shaped.
+ */
+struct post {
+	enum post_mode mode;
+	/* Compute writes straight into the swapchain images */
+	bool storage_output;
+	/* The output is copied out by a transfer after the chain */
+	bool read_back;
+	/* Which of the two chains can be recorded, both for the benchmark */
+	bool compute;
+	bool fragment;
+
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkPipelineLayout pipeline_layout;
+
+	VkPipeline blur_pipeline;
+	VkPipeline tonemap_pipeline;
+	/* Without a format qualifier, null without storage_output */
+	VkPipeline tonemap_output_pipeline;
+
+	VkShaderModule fullscreen_vert_shader_module;
+	VkShaderModule blur_frag_shader_module;
+	VkShaderModule tonemap_frag_shader_module;
+	VkRenderPass blur_render_pass;
+	VkRenderPass ldr_render_pass;
+	VkRenderPass output_render_pass;
+	uint32_t blur_variant;
+	uint32_t tonemap_ldr_variant;
+	uint32_t tonemap_output_variant;
+	/* Set by post_wait_pipelines */
+	VkPipeline blur_fragment_pipeline;
+	VkPipeline tonemap_ldr_fragment_pipeline;
+	VkPipeline tonemap_output_fragment_pipeline;
+};
+
+/* A window's images for the chain, sized and recreated with its swapchain */
+struct post_target {
+	VkExtent2D extent;
+	struct gpu_image hdr;
+	/* The bright pass blurred horizontally, then vertically */
+	struct gpu_image blur[2];
+	/* Blitted from without storage output, and what the benchmark writes */
+	struct gpu_image ldr;
+
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet blur_sets[2];
+	/* Tonemaps into ldr */
+	VkDescriptorSet tonemap_set;
+	/* Per swapchain image with storage output, in the setup arena */
+	VkDescriptorSet *output_sets;
+
+	VkFramebuffer blur_framebuffers[2];
+	VkFramebuffer ldr_framebuffer;
+	/* Per swapchain image in fragment mode, in the setup arena */
+	VkFramebuffer *output_framebuffers;
+	uint32_t image_count;
+};
+
+/*
+ * Compute pipelines are created right away, fragment ones are queued on the
+ * compiler, which has to be finished before post_fini.
+ */
+uint8_t post_init(struct post *post,
+                  VkDevice device,
+                  const struct pack *assets,
+                  struct pipeline_compiler *compiler,
+                  VkFormat output_format,
+                  enum post_mode mode,
+                  bool storage_output,
+                  bool read_back,
+                  bool benchmark);
+void post_fini(struct post *post, VkDevice device);
+
+/* Blocks until the fragment pipelines can be drawn with */
+uint8_t post_wait_pipelines(struct post *post,
+                            struct pipeline_compiler *compiler);
+
+/* The caller retires whatever was created, even on failure */
+uint8_t post_target_init(struct post_target *target,
+                         const struct post *post,
+                         VkDevice device,
+                         const VkPhysicalDeviceMemoryProperties
+                         *memory_properties,
+                         struct arena *arena,
+                         VkExtent2D extent,
+                         const VkImageView *output_views,
+                         uint32_t image_count);
+uint8_t post_target_retire(struct post_target *target,
+                           struct deferred *deferred,
+                           uint64_t last_use);
+
+/*
+ * Records the chain after the scene's render pass left the HDR image in
+ * the general layout, leaving the swapchain image ready to present.
+ */
+void post_record(const struct post *post,
+                 const struct post_target *target,
+                 VkCommandBuffer command_buffer,
+                 uint32_t image_index,
+                 VkImage output_image);
+
+/*
+ * Times iterations of the compute chain, then as many of the fragment one,
+ * both into the LDR image from a cleared HDR image, and waits for them.
+ * Needs both chains and timestamps on the queue.
+ */
+uint8_t post_benchmark(const struct post *post,
+                       const struct post_target *target,
+                       VkDevice device,
+                       VkQueue queue,
+                       uint32_t queue_family_index,
+                       float timestamp_period,
+                       uint32_t timestamp_valid_bits,
+                       uint32_t iterations,
+                       double *compute_ms,
+                       double *fragment_ms);
+
+#endif
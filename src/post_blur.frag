@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define RADIUS 8
+
+// The same blur as post_blur.comp, every tap loaded by every fragment
+layout(set = 0, binding = 0, rgba16f) uniform readonly image2D source;
+
+layout(push_constant) uniform Post {
+	ivec2 direction;
+	float threshold;
+	float sharpen;
+} post;
+
+const float weights[RADIUS + 1] = float[](
+	0.103153, 0.099979, 0.091032, 0.077864, 0.062565,
+	0.047227, 0.033489, 0.022308, 0.013960
+);
+
+layout(location = 0) out vec4 outColor;
+
+vec3 load(ivec2 position) {
+	ivec2 clamped = clamp(position, ivec2(0), imageSize(source) - 1);
+	return max(imageLoad(source, clamped).rgb - post.threshold, 0.0);
+}
+
+void main() {
+	ivec2 position = ivec2(gl_FragCoord.xy);
+	vec3 sum = load(position) * weights[0];
+	for (int t = 1; t <= RADIUS; ++t) {
+		sum += (load(position - post.direction * t)
+		        + load(position + post.direction * t)) * weights[t];
+	}
+	outColor = vec4(sum, 1.0);
+}
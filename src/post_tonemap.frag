@@ -0,0 +1,36 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The same tonemap and sharpen as post_tonemap.comp, without the tile
+layout(set = 0, binding = 0, rgba16f) uniform readonly image2D scene;
+layout(set = 0, binding = 1, rgba16f) uniform readonly image2D bloom;
+
+layout(push_constant) uniform Post {
+	ivec2 direction;
+	float threshold;
+	float sharpen;
+} post;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 tonemap(vec3 color) {
+	return clamp((color * (2.51 * color + 0.03))
+	             / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+
+vec3 load(ivec2 position) {
+	ivec2 clamped = clamp(position, ivec2(0), imageSize(scene) - 1);
+	return tonemap(imageLoad(scene, clamped).rgb
+	               + imageLoad(bloom, clamped).rgb);
+}
+
+void main() {
+	ivec2 position = ivec2(gl_FragCoord.xy);
+	vec3 neighbours = load(position + ivec2(0, -1))
+	                  + load(position + ivec2(0, 1))
+	                  + load(position + ivec2(-1, 0))
+	                  + load(position + ivec2(1, 0));
+	vec3 color = load(position) * (1.0 + 4.0 * post.sharpen)
+	             - neighbours * post.sharpen;
+	outColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
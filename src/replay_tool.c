@@ -0,0 +1,1043 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Replays a command stream written by hello-vulkan --record-stream into an
+ * offscreen image, with no window, compositor or app logic around it:
+ *
+ *     hello-vulkan-replay [--iterations=N] [--icd=FILE] STREAM
+ *
+ * The resources are created and the commands recorded once, then the one
+ * command buffer is submitted N times, each waited for. The median and 90th
+ * percentile GPU time (from timestamp queries) and CPU time from submit to
+ * fence are printed, so the same file on another driver or build times
+ * exactly the same work.
+ */
+
+#include "command_stream.h"
+#include "error.h"
+#include "gpu.h"
+#include "host_memory.h"
+#include "pipeline_compiler.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <vulkan/vulkan.h>
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_ITERATIONS 100
+
+struct options {
+	uint32_t iterations;
+	const char *icd_filename;
+	const char *stream_filename;
+};
+
+static struct options options = {
+	.iterations = DEFAULT_ITERATIONS,
+	.icd_filename = NULL,
+	.stream_filename = NULL,
+};
+
+/* Everything the replay creates, null until it is */
+struct replay {
+	VkInstance instance;
+	VkPhysicalDevice physical_device;
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	uint32_t queue_family_index;
+	uint32_t timestamp_valid_bits;
+	VkDevice device;
+	VkQueue queue;
+
+	struct gpu_image color_image;
+	struct gpu_image depth_image;
+	VkRenderPass render_pass;
+	VkFramebuffer framebuffer;
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	VkPipelineLayout pipeline_layout;
+	VkShaderModule vert_shader_module;
+	VkShaderModule frag_shader_module;
+	bool pipeline_compiler_ready;
+	struct pipeline_compiler pipeline_compiler;
+	VkPipeline pipeline;
+
+	/* Per resource, null for shaders */
+	struct gpu_buffer *buffers;
+	VkDescriptorSet *descriptor_sets;
+	uint32_t buffer_count;
+
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+	VkQueryPool query_pool;
+	VkFence fence;
+	uint32_t draw_count;
+};
+
+static uint8_t vulkan_error(VkResult result)
+{
+	return VULKAN_ERROR_BIT | print_result(result);
+}
+
+static uint8_t create_device(struct replay *replay)
+{
+	/* 1.1, like hello-vulkan, so drivers take the same paths */
+	VkApplicationInfo application_info = {
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pNext = NULL,
+		.pApplicationName = "hello-vulkan-replay",
+		.applicationVersion = 0,
+		.pEngineName = NULL,
+		.engineVersion = 0,
+		.apiVersion = VK_API_VERSION_1_1,
+	};
+	VkInstanceCreateInfo instance_create_info = {
+		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.pApplicationInfo = &application_info,
+		.enabledLayerCount = 0,
+		.ppEnabledLayerNames = NULL,
+		.enabledExtensionCount = 0,
+		.ppEnabledExtensionNames = NULL,
+	};
+	VkResult result = vkCreateInstance(&instance_create_info,
+	                                   &host_allocator, &replay->instance);
+	if (result != VK_SUCCESS) {
+		replay->instance = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+
+	VkPhysicalDevice physical_devices[16];
+	uint32_t physical_device_count = 16;
+	result = vkEnumeratePhysicalDevices(replay->instance,
+	                                    &physical_device_count,
+	                                    physical_devices);
+	if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+		return vulkan_error(result);
+	}
+	/* The first device with a graphics queue */
+	for (uint32_t d = 0; d < physical_device_count; ++d) {
+		VkQueueFamilyProperties families[16];
+		uint32_t family_count = 16;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_devices[d],
+		                                         &family_count,
+		                                         families);
+		for (uint32_t f = 0; f < family_count; ++f) {
+			if (families[f].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+				replay->physical_device = physical_devices[d];
+				replay->queue_family_index = f;
+				replay->timestamp_valid_bits
+					= families[f].timestampValidBits;
+				break;
+			}
+		}
+		if (replay->physical_device != VK_NULL_HANDLE) {
+			break;
+		}
+	}
+	if (replay->physical_device == VK_NULL_HANDLE) {
+		printf("No device with a graphics queue\n");
+		return APP_ERROR_BIT;
+	}
+	vkGetPhysicalDeviceProperties(replay->physical_device,
+	                              &replay->properties);
+	vkGetPhysicalDeviceMemoryProperties(replay->physical_device,
+	                                    &replay->memory_properties);
+
+	float queue_priority = 1.0f;
+	VkDeviceQueueCreateInfo queue_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queueFamilyIndex = replay->queue_family_index,
+		.queueCount = 1,
+		.pQueuePriorities = &queue_priority,
+	};
+	VkDeviceCreateInfo device_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queueCreateInfoCount = 1,
+		.pQueueCreateInfos = &queue_create_info,
+		.enabledLayerCount = 0,
+		.ppEnabledLayerNames = NULL,
+		.enabledExtensionCount = 0,
+		.ppEnabledExtensionNames = NULL,
+		.pEnabledFeatures = NULL,
+	};
+	result = vkCreateDevice(replay->physical_device, &device_create_info,
+	                        &host_allocator, &replay->device);
+	if (result != VK_SUCCESS) {
+		replay->device = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+	vkGetDeviceQueue(replay->device, replay->queue_family_index, 0,
+	                 &replay->queue);
+	return NO_ERRORS;
+}
+
+/* The attachments the stream was recorded with, never presented */
+static uint8_t create_render_pass(struct replay *replay,
+                                  const struct command_stream_header *header)
+{
+	bool depth = header->depth_format != VK_FORMAT_UNDEFINED;
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = header->color_format,
+		.extent = {
+			.width = header->width,
+			.height = header->height,
+			.depth = 1,
+		},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = NULL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	uint8_t err = gpu_image_init(replay->device,
+	                             &replay->memory_properties,
+	                             &image_create_info,
+	                             VK_IMAGE_ASPECT_COLOR_BIT,
+	                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                             &replay->color_image);
+	if (err) {
+		return err;
+	}
+	if (depth) {
+		image_create_info.format = header->depth_format;
+		image_create_info.usage
+			= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+			  | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		VkImageAspectFlags aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		if (gpu_format_has_stencil(header->depth_format)) {
+			aspect_mask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+		err = gpu_image_init(replay->device,
+		                     &replay->memory_properties,
+		                     &image_create_info, aspect_mask,
+		                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		                     &replay->depth_image);
+		if (err) {
+			return err;
+		}
+	}
+
+	VkAttachmentDescription attachment_descriptions[] = {
+		{
+			.flags = 0,
+			.format = header->color_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		},
+		{
+			.flags = 0,
+			.format = header->depth_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout
+				= VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		},
+	};
+	VkAttachmentReference color_attachment_reference = {
+		.attachment = 0,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+	VkAttachmentReference depth_attachment_reference = {
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+	VkSubpassDescription subpass_description = {
+		.flags = 0,
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.inputAttachmentCount = 0,
+		.pInputAttachments = NULL,
+		.colorAttachmentCount = 1,
+		.pColorAttachments = &color_attachment_reference,
+		.pResolveAttachments = NULL,
+		.pDepthStencilAttachment = depth ? &depth_attachment_reference
+		                                 : NULL,
+		.preserveAttachmentCount = 0,
+		.pPreserveAttachments = NULL,
+	};
+	/* Each run waits for the last, as frames in flight would not */
+	VkSubpassDependency subpass_dependency = {
+		.srcSubpass = VK_SUBPASS_EXTERNAL,
+		.dstSubpass = 0,
+		.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		                | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		                | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		                 | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+		                 | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		                 | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+		                 | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		.dependencyFlags = 0,
+	};
+	VkRenderPassCreateInfo render_pass_create_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.attachmentCount = depth ? 2 : 1,
+		.pAttachments = attachment_descriptions,
+		.subpassCount = 1,
+		.pSubpasses = &subpass_description,
+		.dependencyCount = 1,
+		.pDependencies = &subpass_dependency,
+	};
+	VkResult result = vkCreateRenderPass(replay->device,
+	                                     &render_pass_create_info,
+	                                     &host_allocator,
+	                                     &replay->render_pass);
+	if (result != VK_SUCCESS) {
+		replay->render_pass = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+
+	VkImageView attachments[] = {
+		replay->color_image.view,
+		replay->depth_image.view,
+	};
+	VkFramebufferCreateInfo framebuffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.renderPass = replay->render_pass,
+		.attachmentCount = depth ? 2 : 1,
+		.pAttachments = attachments,
+		.width = header->width,
+		.height = header->height,
+		.layers = 1,
+	};
+	result = vkCreateFramebuffer(replay->device, &framebuffer_create_info,
+	                             &host_allocator, &replay->framebuffer);
+	if (result != VK_SUCCESS) {
+		replay->framebuffer = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t create_shader_module(struct replay *replay,
+                                    const struct command_stream *stream,
+                                    enum command_stream_resource_type type,
+                                    VkShaderModule *shader_module)
+{
+	for (uint32_t i = 0; i < stream->header.resource_count; ++i) {
+		const struct command_stream_resource *resource
+			= &stream->resources[i];
+		if (resource->type != type) {
+			continue;
+		}
+		if (resource->size == 0 || resource->size % 4 != 0) {
+			break;
+		}
+		VkShaderModuleCreateInfo shader_module_create_info = {
+			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.codeSize = resource->size,
+			.pCode = stream->blobs[i],
+		};
+		VkResult result = vkCreateShaderModule(
+			replay->device, &shader_module_create_info,
+			&host_allocator, shader_module
+		);
+		if (result != VK_SUCCESS) {
+			*shader_module = VK_NULL_HANDLE;
+			return vulkan_error(result);
+		}
+		return NO_ERRORS;
+	}
+	printf("The stream has no valid %s shader\n",
+	       type == COMMAND_STREAM_VERTEX_SHADER ? "vertex" : "fragment");
+	return APP_ERROR_BIT;
+}
+
+/* The uniforms at set 0 and the push constants, as hello-vulkan has them */
+static uint8_t create_pipeline(struct replay *replay,
+                               const struct command_stream *stream)
+{
+	const struct command_stream_header *header = &stream->header;
+	VkDescriptorSetLayoutBinding binding = {
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+		              | VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = NULL,
+	};
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = 1,
+		.pBindings = &binding,
+	};
+	VkResult result = vkCreateDescriptorSetLayout(
+		replay->device, &descriptor_set_layout_create_info,
+		&host_allocator, &replay->descriptor_set_layout
+	);
+	if (result != VK_SUCCESS) {
+		replay->descriptor_set_layout = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = header->push_constant_size,
+	};
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &replay->descriptor_set_layout,
+		.pushConstantRangeCount = header->push_constant_size != 0
+		                          ? 1
+		                          : 0,
+		.pPushConstantRanges = &push_constant_range,
+	};
+	result = vkCreatePipelineLayout(replay->device,
+	                                &pipeline_layout_create_info,
+	                                &host_allocator,
+	                                &replay->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		replay->pipeline_layout = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+
+	uint8_t err = create_shader_module(replay, stream,
+	                                   COMMAND_STREAM_VERTEX_SHADER,
+	                                   &replay->vert_shader_module);
+	if (!err) {
+		err = create_shader_module(replay, stream,
+		                           COMMAND_STREAM_FRAGMENT_SHADER,
+		                           &replay->frag_shader_module);
+	}
+	if (!err) {
+		err = pipeline_compiler_init(&replay->pipeline_compiler,
+		                             replay->device, false, 1, 1);
+		replay->pipeline_compiler_ready = !err;
+	}
+	if (err) {
+		return err;
+	}
+
+	struct pipeline_state state = {
+		.name = "replay",
+		.vert_shader_module = replay->vert_shader_module,
+		.frag_shader_module = replay->frag_shader_module,
+		.layout = replay->pipeline_layout,
+		.render_pass = replay->render_pass,
+		.subpass = 0,
+		.color_attachment_count = 1,
+		.vertex_binding = {
+			.binding = 0,
+			.stride = header->vertex_stride,
+			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+		},
+		.vertex_attribute_count = header->attribute_count,
+		.constant_count = 0,
+		.depth_test = header->depth_format != VK_FORMAT_UNDEFINED,
+		.blend = false,
+	};
+	for (uint32_t i = 0; i < header->attribute_count; ++i) {
+		state.vertex_attributes[i] = (VkVertexInputAttributeDescription) {
+			.location = header->attributes[i].location,
+			.binding = 0,
+			.format = header->attributes[i].format,
+			.offset = header->attributes[i].offset,
+		};
+	}
+	uint32_t variant;
+	err = pipeline_compiler_add(&replay->pipeline_compiler, &state,
+	                            &variant);
+	if (err) {
+		return err;
+	}
+	return pipeline_compiler_wait(&replay->pipeline_compiler, variant,
+	                              &replay->pipeline);
+}
+
+/* Device local copies of the buffers, a descriptor set per uniforms */
+static uint8_t create_buffers(struct replay *replay,
+                              const struct command_stream *stream)
+{
+	uint32_t resource_count = stream->header.resource_count;
+	replay->buffers = calloc(resource_count + 1, sizeof(struct gpu_buffer));
+	replay->descriptor_sets = calloc(resource_count + 1,
+	                                 sizeof(VkDescriptorSet));
+	if (replay->buffers == NULL || replay->descriptor_sets == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	replay->buffer_count = resource_count;
+
+	uint32_t uniforms_count = 0;
+	for (uint32_t i = 0; i < resource_count; ++i) {
+		VkBufferUsageFlags usage;
+		switch (stream->resources[i].type) {
+		case COMMAND_STREAM_UNIFORMS:
+			usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+			++uniforms_count;
+			break;
+		case COMMAND_STREAM_VERTEX_BUFFER:
+			usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+			break;
+		case COMMAND_STREAM_INDEX_BUFFER:
+			usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+			break;
+		default:
+			continue;
+		}
+		if (stream->resources[i].size == 0) {
+			printf("Resource %u is empty\n", i);
+			return APP_ERROR_BIT;
+		}
+		uint8_t err = gpu_buffer_init_with_data(
+			replay->device, &replay->memory_properties,
+			replay->queue, replay->queue_family_index, usage,
+			stream->blobs[i], stream->resources[i].size,
+			&replay->buffers[i]
+		);
+		if (err) {
+			return err;
+		}
+	}
+	if (uniforms_count == 0) {
+		return NO_ERRORS;
+	}
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.descriptorCount = uniforms_count,
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = uniforms_count,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+	VkResult result = vkCreateDescriptorPool(replay->device,
+	                                         &descriptor_pool_create_info,
+	                                         &host_allocator,
+	                                         &replay->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		replay->descriptor_pool = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+	for (uint32_t i = 0; i < resource_count; ++i) {
+		if (stream->resources[i].type != COMMAND_STREAM_UNIFORMS) {
+			continue;
+		}
+		VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.pNext = NULL,
+			.descriptorPool = replay->descriptor_pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts = &replay->descriptor_set_layout,
+		};
+		result = vkAllocateDescriptorSets(replay->device,
+		                                  &descriptor_set_allocate_info,
+		                                  &replay->descriptor_sets[i]);
+		if (result != VK_SUCCESS) {
+			return vulkan_error(result);
+		}
+		VkDescriptorBufferInfo buffer_info = {
+			.buffer = replay->buffers[i].buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE,
+		};
+		VkWriteDescriptorSet write = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = NULL,
+			.dstSet = replay->descriptor_sets[i],
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.pImageInfo = NULL,
+			.pBufferInfo = &buffer_info,
+			.pTexelBufferView = NULL,
+		};
+		vkUpdateDescriptorSets(replay->device, 1, &write, 0, NULL);
+	}
+	return NO_ERRORS;
+}
+
+/* Translates each command back into the call it was recorded from */
+static uint8_t record_commands(struct replay *replay,
+                               const struct command_stream *stream)
+{
+	VkCommandBuffer command_buffer = replay->command_buffer;
+	const uint32_t *words = stream->words;
+	uint32_t count = stream->header.word_count;
+	for (uint32_t w = 0; w < count;) {
+		uint32_t arguments = command_stream_argument_count(
+			stream, words + w, count - w
+		);
+		if (arguments == UINT32_MAX) {
+			printf("Command word %u is not valid\n", w);
+			return APP_ERROR_BIT;
+		}
+		const uint32_t *a = words + w + 1;
+		switch (words[w]) {
+		case COMMAND_STREAM_BIND_PIPELINE:
+			vkCmdBindPipeline(command_buffer,
+			                  VK_PIPELINE_BIND_POINT_GRAPHICS,
+			                  replay->pipeline);
+			break;
+		case COMMAND_STREAM_BIND_UNIFORMS:
+			vkCmdBindDescriptorSets(command_buffer,
+			                        VK_PIPELINE_BIND_POINT_GRAPHICS,
+			                        replay->pipeline_layout, 0, 1,
+			                        &replay->descriptor_sets[a[0]],
+			                        0, NULL);
+			break;
+		case COMMAND_STREAM_BIND_VERTEX_BUFFER: {
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(command_buffer, 0, 1,
+			                       &replay->buffers[a[0]].buffer,
+			                       &offset);
+			break;
+		}
+		case COMMAND_STREAM_BIND_INDEX_BUFFER:
+			vkCmdBindIndexBuffer(command_buffer,
+			                     replay->buffers[a[0]].buffer, 0,
+			                     (VkIndexType) a[1]);
+			break;
+		case COMMAND_STREAM_PUSH_CONSTANTS:
+			vkCmdPushConstants(command_buffer,
+			                   replay->pipeline_layout,
+			                   VK_SHADER_STAGE_VERTEX_BIT,
+			                   a[0], a[1], a + 2);
+			break;
+		case COMMAND_STREAM_DRAW:
+			vkCmdDraw(command_buffer, a[0], a[1], a[2], a[3]);
+			++replay->draw_count;
+			break;
+		case COMMAND_STREAM_DRAW_INDEXED:
+			vkCmdDrawIndexed(command_buffer, a[0], a[1], a[2],
+			                 (int32_t) a[3], a[4]);
+			++replay->draw_count;
+			break;
+		}
+		w += 1 + arguments;
+	}
+	return NO_ERRORS;
+}
+
+static uint8_t record_command_buffer(struct replay *replay,
+                                     const struct command_stream *stream)
+{
+	const struct command_stream_header *header = &stream->header;
+	VkCommandPoolCreateInfo command_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queueFamilyIndex = replay->queue_family_index,
+	};
+	VkResult result = vkCreateCommandPool(replay->device,
+	                                      &command_pool_create_info,
+	                                      &host_allocator,
+	                                      &replay->command_pool);
+	if (result != VK_SUCCESS) {
+		replay->command_pool = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = replay->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	result = vkAllocateCommandBuffers(replay->device,
+	                                  &command_buffer_allocate_info,
+	                                  &replay->command_buffer);
+	if (result != VK_SUCCESS) {
+		return vulkan_error(result);
+	}
+	if (replay->timestamp_valid_bits != 0) {
+		VkQueryPoolCreateInfo query_pool_create_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 2,
+			.pipelineStatistics = 0,
+		};
+		result = vkCreateQueryPool(replay->device,
+		                           &query_pool_create_info,
+		                           &host_allocator,
+		                           &replay->query_pool);
+		if (result != VK_SUCCESS) {
+			replay->query_pool = VK_NULL_HANDLE;
+			return vulkan_error(result);
+		}
+	}
+
+	VkCommandBuffer command_buffer = replay->command_buffer;
+	VkCommandBufferBeginInfo command_buffer_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.pInheritanceInfo = NULL,
+	};
+	result = vkBeginCommandBuffer(command_buffer,
+	                              &command_buffer_begin_info);
+	if (result != VK_SUCCESS) {
+		return vulkan_error(result);
+	}
+	if (replay->query_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(command_buffer, replay->query_pool, 0, 2);
+		vkCmdWriteTimestamp(command_buffer,
+		                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		                    replay->query_pool, 0);
+	}
+
+	VkClearValue clear_values[2];
+	memset(clear_values, 0, sizeof(clear_values));
+	clear_values[1].depthStencil.depth = 1.0f;
+	VkRect2D render_area = {
+		.offset = {
+			.x = 0,
+			.y = 0,
+		},
+		.extent = {
+			.width = header->width,
+			.height = header->height,
+		},
+	};
+	VkRenderPassBeginInfo render_pass_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.pNext = NULL,
+		.renderPass = replay->render_pass,
+		.framebuffer = replay->framebuffer,
+		.renderArea = render_area,
+		.clearValueCount = header->depth_format != VK_FORMAT_UNDEFINED
+		                   ? 2
+		                   : 1,
+		.pClearValues = clear_values,
+	};
+	vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
+	                     VK_SUBPASS_CONTENTS_INLINE);
+	VkViewport viewport = {
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float) header->width,
+		.height = (float) header->height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	vkCmdSetScissor(command_buffer, 0, 1, &render_area);
+	uint8_t err = record_commands(replay, stream);
+	vkCmdEndRenderPass(command_buffer);
+	if (replay->query_pool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(command_buffer,
+		                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		                    replay->query_pool, 1);
+	}
+	result = vkEndCommandBuffer(command_buffer);
+	if (result != VK_SUCCESS) {
+		return vulkan_error(result);
+	}
+	if (err) {
+		return err;
+	}
+
+	VkFenceCreateInfo fence_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+	};
+	result = vkCreateFence(replay->device, &fence_create_info,
+	                       &host_allocator, &replay->fence);
+	if (result != VK_SUCCESS) {
+		replay->fence = VK_NULL_HANDLE;
+		return vulkan_error(result);
+	}
+	return NO_ERRORS;
+}
+
+/* Submits and waits, with the GPU milliseconds -1 without timestamps */
+static uint8_t run(struct replay *replay, double *gpu_ms)
+{
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = NULL,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = NULL,
+		.pWaitDstStageMask = NULL,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &replay->command_buffer,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = NULL,
+	};
+	VkResult result = vkQueueSubmit(replay->queue, 1, &submit_info,
+	                                replay->fence);
+	if (result == VK_SUCCESS) {
+		result = vkWaitForFences(replay->device, 1, &replay->fence,
+		                         VK_TRUE, UINT64_MAX);
+	}
+	if (result == VK_SUCCESS) {
+		result = vkResetFences(replay->device, 1, &replay->fence);
+	}
+	if (result != VK_SUCCESS) {
+		return vulkan_error(result);
+	}
+
+	*gpu_ms = -1.0;
+	if (replay->query_pool == VK_NULL_HANDLE) {
+		return NO_ERRORS;
+	}
+	uint64_t timestamps[2];
+	result = vkGetQueryPoolResults(replay->device, replay->query_pool, 0, 2,
+	                               sizeof(timestamps), timestamps,
+	                               sizeof(uint64_t),
+	                               VK_QUERY_RESULT_64_BIT
+	                               | VK_QUERY_RESULT_WAIT_BIT);
+	if (result != VK_SUCCESS) {
+		return vulkan_error(result);
+	}
+	uint64_t mask = replay->timestamp_valid_bits == 64
+	                ? UINT64_MAX
+	                : (1ull << replay->timestamp_valid_bits) - 1;
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+	*gpu_ms = (double) ticks * replay->properties.limits.timestampPeriod
+	          / 1e6;
+	return NO_ERRORS;
+}
+
+static void replay_fini(struct replay *replay)
+{
+	VkDevice device = replay->device;
+	if (device != VK_NULL_HANDLE) {
+		vkDeviceWaitIdle(device);
+		if (replay->fence != VK_NULL_HANDLE) {
+			vkDestroyFence(device, replay->fence, &host_allocator);
+		}
+		if (replay->query_pool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, replay->query_pool,
+			                   &host_allocator);
+		}
+		if (replay->command_pool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(device, replay->command_pool,
+			                     &host_allocator);
+		}
+		if (replay->descriptor_pool != VK_NULL_HANDLE) {
+			vkDestroyDescriptorPool(device, replay->descriptor_pool,
+			                        &host_allocator);
+		}
+		for (uint32_t i = 0; i < replay->buffer_count; ++i) {
+			gpu_buffer_fini(device, &replay->buffers[i]);
+		}
+		if (replay->pipeline_compiler_ready) {
+			pipeline_compiler_fini(&replay->pipeline_compiler);
+		}
+		if (replay->vert_shader_module != VK_NULL_HANDLE) {
+			vkDestroyShaderModule(device, replay->vert_shader_module,
+			                      &host_allocator);
+		}
+		if (replay->frag_shader_module != VK_NULL_HANDLE) {
+			vkDestroyShaderModule(device, replay->frag_shader_module,
+			                      &host_allocator);
+		}
+		if (replay->pipeline_layout != VK_NULL_HANDLE) {
+			vkDestroyPipelineLayout(device, replay->pipeline_layout,
+			                        &host_allocator);
+		}
+		if (replay->descriptor_set_layout != VK_NULL_HANDLE) {
+			vkDestroyDescriptorSetLayout(
+				device, replay->descriptor_set_layout,
+				&host_allocator
+			);
+		}
+		if (replay->framebuffer != VK_NULL_HANDLE) {
+			vkDestroyFramebuffer(device, replay->framebuffer,
+			                     &host_allocator);
+		}
+		if (replay->render_pass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(device, replay->render_pass,
+			                    &host_allocator);
+		}
+		gpu_image_fini(device, &replay->depth_image);
+		gpu_image_fini(device, &replay->color_image);
+		vkDestroyDevice(device, &host_allocator);
+	}
+	free(replay->descriptor_sets);
+	free(replay->buffers);
+	if (replay->instance != VK_NULL_HANDLE) {
+		vkDestroyInstance(replay->instance, &host_allocator);
+	}
+	memset(replay, 0, sizeof(*replay));
+}
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options] STREAM\n"
+	       "  --iterations=N  submissions to time, default %u\n"
+	       "  --icd=FILE      Vulkan driver manifest to replay on\n",
+	       program, DEFAULT_ITERATIONS);
+}
+
+static uint8_t parse_options(int argc, char **argv)
+{
+	enum {
+		OPTION_ITERATIONS = 256,
+		OPTION_ICD,
+	};
+	static const struct option long_options[] = {
+		{ "iterations", required_argument, NULL, OPTION_ITERATIONS },
+		{ "icd", required_argument, NULL, OPTION_ICD },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		char *end;
+		switch (c) {
+		case OPTION_ITERATIONS:
+			options.iterations = strtoul(optarg, &end, 10);
+			if (*end != '\0' || options.iterations == 0) {
+				print_usage(argv[0]);
+				return APP_ERROR_BIT;
+			}
+			break;
+		case OPTION_ICD:
+			options.icd_filename = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+			return APP_ERROR_BIT;
+		}
+	}
+	if (argc - optind != 1) {
+		print_usage(argv[0]);
+		return APP_ERROR_BIT;
+	}
+	options.stream_filename = argv[optind];
+	return NO_ERRORS;
+}
+
+static uint8_t replay_stream(const struct command_stream *stream)
+{
+	const struct command_stream_header *header = &stream->header;
+	if (header->width == 0 || header->height == 0) {
+		printf("The stream has no extent\n");
+		return APP_ERROR_BIT;
+	}
+
+	struct replay replay;
+	memset(&replay, 0, sizeof(replay));
+	struct stats gpu_times;
+	struct stats cpu_times;
+	memset(&gpu_times, 0, sizeof(gpu_times));
+	memset(&cpu_times, 0, sizeof(cpu_times));
+	uint8_t err = stats_init(&gpu_times, options.iterations);
+	err = err ? err : stats_init(&cpu_times, options.iterations);
+	err = err ? err : create_device(&replay);
+	err = err ? err : create_render_pass(&replay, header);
+	err = err ? err : create_pipeline(&replay, stream);
+	err = err ? err : create_buffers(&replay, stream);
+	err = err ? err : record_command_buffer(&replay, stream);
+
+	/* The first run warms the caches and the driver up */
+	double gpu_ms;
+	if (!err) {
+		err = run(&replay, &gpu_ms);
+	}
+	for (uint32_t i = 0; i < options.iterations && !err; ++i) {
+		uint64_t begin_ns = trace_now_ns();
+		err = run(&replay, &gpu_ms);
+		stats_add(&cpu_times,
+		          (double) (trace_now_ns() - begin_ns) / 1e6);
+		if (gpu_ms >= 0.0) {
+			stats_add(&gpu_times, gpu_ms);
+		}
+	}
+
+	if (!err) {
+		printf("Replayed %s on %s: %ux%u, %u draws, %u iterations\n",
+		       options.stream_filename, replay.properties.deviceName,
+		       header->width, header->height, replay.draw_count,
+		       options.iterations);
+		if (gpu_times.count > 0) {
+			printf("  GPU             %8.3f ms (p90 %.3f)\n",
+			       stats_percentile(&gpu_times, 50.0),
+			       stats_percentile(&gpu_times, 90.0));
+		}
+		printf("  submit to fence %8.3f ms (p90 %.3f)\n",
+		       stats_percentile(&cpu_times, 50.0),
+		       stats_percentile(&cpu_times, 90.0));
+	}
+	replay_fini(&replay);
+	stats_fini(&cpu_times);
+	stats_fini(&gpu_times);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t err = parse_options(argc, argv);
+	if (err) {
+		return err;
+	}
+	/* Before the loader reads them, as hello-vulkan-bench does */
+	if (options.icd_filename != NULL) {
+		setenv("VK_ICD_FILENAMES", options.icd_filename, 1);
+		setenv("VK_DRIVER_FILES", options.icd_filename, 1);
+	}
+
+	struct command_stream stream;
+	err = command_stream_read(&stream, options.stream_filename);
+	if (err) {
+		return err;
+	}
+	err = replay_stream(&stream);
+	command_stream_fini(&stream);
+	return err;
+}
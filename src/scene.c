@@ -0,0 +1,117 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scene.h"
+
+#include "error.h"
+
+#include <stdlib.h>
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static float random_range(uint32_t *state, float min, float max)
+{
+	float unit = (float) (xorshift32(state) >> 8) * (1.0f / 16777216.0f);
+	return min + unit * (max - min);
+}
+
+static void init_lights(struct scene *scene, uint32_t *state)
+{
+	for (uint32_t i = 0; i < scene->light_count; ++i) {
+		struct scene_light *light = &scene->lights[i];
+		light->position[0] = random_range(state, -1.25f, 1.25f);
+		light->position[1] = random_range(state, -1.25f, 1.25f);
+		light->position[2] = random_range(state, 0.0f, 0.25f);
+		light->radius = random_range(state, 0.25f, 0.75f);
+		light->color[0] = random_range(state, 0.25f, 1.0f);
+		light->color[1] = random_range(state, 0.25f, 1.0f);
+		light->color[2] = random_range(state, 0.25f, 1.0f);
+		light->intensity = random_range(state, 0.5f, 1.5f);
+	}
+}
+
+uint8_t scene_init(struct scene *scene,
+                   uint32_t object_count,
+                   uint32_t light_count,
+                   uint32_t seed)
+{
+	scene->objects = NULL;
+	scene->object_count = 0;
+	scene->lights = NULL;
+	scene->light_count = 0;
+
+	if (object_count == 0) {
+		return APP_ERROR_BIT;
+	}
+
+	scene->objects = malloc(object_count * sizeof(struct scene_object));
+	if (scene->objects == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	scene->object_count = object_count;
+
+	if (light_count != 0) {
+		scene->lights = malloc(light_count * sizeof(struct scene_light));
+		if (scene->lights == NULL) {
+			scene_fini(scene);
+			return LIBC_ERROR_BIT;
+		}
+		scene->light_count = light_count;
+	}
+
+	/* Lights are placed the same whatever the objects */
+	uint32_t light_state = seed != 0 ? seed : 1;
+	init_lights(scene, &light_state);
+
+	/* A single object is the original centered triangle */
+	if (object_count == 1) {
+		scene->objects[0].center[0] = 0.0f;
+		scene->objects[0].center[1] = 0.0f;
+		scene->objects[0].center[2] = 0.5f;
+		scene->objects[0].radius = 0.70710678f;
+		return NO_ERRORS;
+	}
+
+	uint32_t state = seed != 0 ? seed : 1;
+	for (uint32_t i = 0; i < object_count; ++i) {
+		struct scene_object *object = &scene->objects[i];
+		/* Spread past the edges, so that some objects can be culled */
+		object->center[0] = random_range(&state, -1.5f, 1.5f);
+		object->center[1] = random_range(&state, -1.5f, 1.5f);
+		object->center[2] = random_range(&state, 0.05f, 0.95f);
+		object->radius = random_range(&state, 0.25f, 0.75f);
+	}
+
+	return NO_ERRORS;
+}
+
+void scene_fini(struct scene *scene)
+{
+	free(scene->objects);
+	scene->objects = NULL;
+	scene->object_count = 0;
+	free(scene->lights);
+	scene->lights = NULL;
+	scene->light_count = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_SCENE_H
+#define HELLO_VULKAN_SCENE_H
+
+#include <stdint.h>
+
+/*
+ * Objects live directly in clip space: x and y in [-1, 1], z in [0, 1] with 0
+ * nearest to the viewer. Every vertex of an object lies within radius of its
+ * center, so the center and radius double as a bounding sphere.
+ */
+struct scene_object {
+	float center[3];
+	float radius;
+};
+
+/*
+ * A point light in front of the objects, in the std430 layout of the Lights
+ * buffer. Its contribution falls off smoothly to nothing at radius.
+ */
+struct scene_light {
+	float position[3];
+	float radius;
+	float color[3];
+	float intensity;
+};
+
+struct scene {
+	struct scene_object *objects;
+	uint32_t object_count;
+	/* Null without lights */
+	struct scene_light *lights;
+	uint32_t light_count;
+};
+
+uint8_t scene_init(struct scene *scene,
+                   uint32_t object_count,
+                   uint32_t light_count,
+                   uint32_t seed);
+void scene_fini(struct scene *scene);
+
+#endif
@@ -5,7 +5,22 @@ out gl_PerVertex {
 	vec4 gl_Position;
 };
 
+// Per frame constants, at a dynamic offset in the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+	mat4 view_projection;
+	float time;
+	uint index;
+} frame;
+
+layout(push_constant) uniform Object {
+	vec3 center;
+	float radius;
+} object;
+
 layout(location = 0) out vec3 fragColor;
+// For lighting, triangles face the viewer
+layout(location = 1) out vec3 fragPosition;
+layout(location = 2) out vec3 fragNormal;
 
 vec2 positions[3] = vec2[](
 	vec2(0.0, -0.5),
@@ -20,6 +35,10 @@ vec3 colors[3] = vec3[](
 );
 
 void main() {
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+	// Scale so that every vertex lies within radius of the center
+	vec2 position = positions[gl_VertexIndex] * object.radius * sqrt(2.0);
+	fragPosition = vec3(position + object.center.xy, object.center.z);
+	gl_Position = frame.view_projection * vec4(fragPosition, 1.0);
 	fragColor = colors[gl_VertexIndex];
+	fragNormal = vec3(0.0, 0.0, -1.0);
 }
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#include "error.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+uint8_t stats_init(struct stats *stats, uint32_t capacity)
+{
+	stats->samples = malloc(capacity * sizeof(double));
+	if (stats->samples == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	stats->count = 0;
+	stats->capacity = capacity;
+	return NO_ERRORS;
+}
+
+void stats_fini(struct stats *stats)
+{
+	free(stats->samples);
+	stats->samples = NULL;
+	stats->count = 0;
+	stats->capacity = 0;
+}
+
+void stats_add(struct stats *stats, double sample)
+{
+	if (stats->count < stats->capacity) {
+		stats->samples[stats->count++] = sample;
+	}
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+double stats_percentile(struct stats *stats, double p)
+{
+	if (stats->count == 0) {
+		return 0.0;
+	}
+	qsort(stats->samples, stats->count, sizeof(double), compare_doubles);
+
+	double rank = ceil(p / 100.0 * stats->count);
+	uint32_t index = rank < 1.0 ? 0 : (uint32_t) rank - 1;
+	if (index >= stats->count) {
+		index = stats->count - 1;
+	}
+	return stats->samples[index];
+}
+
+double stats_mean(const struct stats *stats)
+{
+	if (stats->count == 0) {
+		return 0.0;
+	}
+	double sum = 0.0;
+	for (uint32_t i = 0; i < stats->count; ++i) {
+		sum += stats->samples[i];
+	}
+	return sum / stats->count;
+}
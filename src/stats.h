@@ -0,0 +1,40 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_STATS_H
+#define HELLO_VULKAN_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Fixed capacity sample set, allocated up front so that adding a sample in a
+ * frame loop is a store. Samples past the capacity are dropped.
+ */
+struct stats {
+	double *samples;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+uint8_t stats_init(struct stats *stats, uint32_t capacity);
+void stats_fini(struct stats *stats);
+
+void stats_add(struct stats *stats, double sample);
+/* Nearest rank percentile, p in [0, 100], sorting the samples in place */
+double stats_percentile(struct stats *stats, double p);
+double stats_mean(const struct stats *stats);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thread_pool.h"
+
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void run_tasks(struct thread_pool *pool)
+{
+	while (true) {
+		uint32_t task = atomic_fetch_add(&pool->next_task, 1);
+		if (task >= pool->task_count) {
+			return;
+		}
+		pool->function(pool->data, task);
+	}
+}
+
+static void *run_worker(void *data)
+{
+	struct thread_pool *pool = data;
+
+	uint64_t generation = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (!pool->stopping && pool->generation == generation) {
+			pthread_cond_wait(&pool->work, &pool->mutex);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_tasks(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->pending == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+uint8_t thread_pool_init(struct thread_pool *pool, uint32_t thread_count)
+{
+	memset(pool, 0, sizeof(*pool));
+	if (thread_count == 0) {
+		thread_count = 1;
+	}
+	pool->threads = malloc(thread_count * sizeof(pthread_t));
+	if (pool->threads == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	atomic_init(&pool->next_task, 0);
+	pool->thread_count = 1;
+
+	for (uint32_t i = 1; i < thread_count; ++i) {
+		int result = pthread_create(&pool->threads[i - 1], NULL,
+		                            run_worker, pool);
+		if (result != 0) {
+			printf("Cannot start worker thread: %s\n",
+			       strerror(result));
+			thread_pool_fini(pool);
+			return POSIX_ERROR_BIT;
+		}
+		++pool->thread_count;
+	}
+	return NO_ERRORS;
+}
+
+void thread_pool_fini(struct thread_pool *pool)
+{
+	if (pool->threads == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+	for (uint32_t i = 0; i + 1 < pool->thread_count; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->thread_count = 0;
+}
+
+void thread_pool_run(struct thread_pool *pool,
+                     thread_pool_function function,
+                     void *data,
+                     uint32_t task_count)
+{
+	pool->function = function;
+	pool->data = data;
+	pool->task_count = task_count;
+	atomic_store(&pool->next_task, 0);
+	if (pool->thread_count > 1) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->pending = pool->thread_count - 1;
+		++pool->generation;
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	run_tasks(pool);
+
+	if (pool->thread_count > 1) {
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->pending != 0) {
+			pthread_cond_wait(&pool->done, &pool->mutex);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
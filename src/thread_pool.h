@@ -0,0 +1,61 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HELLO_VULKAN_THREAD_POOL_H
+#define HELLO_VULKAN_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*thread_pool_function)(void *data, uint32_t task);
+
+/*
+ * Workers that sleep between runs. A run hands out tasks in order from a
+ * shared counter to the workers and the calling thread alike, so the caller
+ * is never idle and an uneven task finishes on whoever is free.
+ */
+struct thread_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t *threads;
+	/* Including the calling thread */
+	uint32_t thread_count;
+	uint64_t generation;
+	uint32_t pending;
+	bool stopping;
+
+	/* The run in progress */
+	thread_pool_function function;
+	void *data;
+	uint32_t task_count;
+	atomic_uint next_task;
+};
+
+/* Starts thread_count - 1 workers, none for a thread count of 1 */
+uint8_t thread_pool_init(struct thread_pool *pool, uint32_t thread_count);
+void thread_pool_fini(struct thread_pool *pool);
+
+/* Calls function once per task, returning when every call has */
+void thread_pool_run(struct thread_pool *pool,
+                     thread_pool_function function,
+                     void *data,
+                     uint32_t task_count);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timeline.h"
+
+#include "error.h"
+#include "gpu.h"
+#include "host_memory.h"
+
+uint8_t timeline_init(struct timeline *timeline, VkDevice device)
+{
+	timeline->semaphore = VK_NULL_HANDLE;
+	timeline->submitted = 0;
+	timeline->completed = 0;
+	timeline->wait_semaphores = (PFN_vkWaitSemaphoresKHR)
+		vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+	timeline->get_semaphore_counter_value
+		= (PFN_vkGetSemaphoreCounterValueKHR)
+		  vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+	if (timeline->wait_semaphores == NULL
+	    || timeline->get_semaphore_counter_value == NULL) {
+		return APP_ERROR_BIT;
+	}
+
+	VkSemaphoreTypeCreateInfoKHR semaphore_type_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+		.pNext = NULL,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+		.initialValue = 0,
+	};
+	VkSemaphoreCreateInfo semaphore_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &semaphore_type_create_info,
+		.flags = 0,
+	};
+	VkResult result;
+	result = vkCreateSemaphore(device, &semaphore_create_info,
+	                           &host_allocator, &timeline->semaphore);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	return NO_ERRORS;
+}
+
+void timeline_fini(struct timeline *timeline, VkDevice device)
+{
+	if (timeline->semaphore != VK_NULL_HANDLE) {
+		vkDestroySemaphore(device, timeline->semaphore,
+		                   &host_allocator);
+		timeline->semaphore = VK_NULL_HANDLE;
+	}
+}
+
+uint8_t timeline_wait(struct timeline *timeline,
+                      VkDevice device,
+                      uint64_t value)
+{
+	if (value <= timeline->completed) {
+		return NO_ERRORS;
+	}
+	VkSemaphoreWaitInfoKHR semaphore_wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+		.pNext = NULL,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &timeline->semaphore,
+		.pValues = &value,
+	};
+	VkResult result = timeline->wait_semaphores(device,
+	                                            &semaphore_wait_info,
+	                                            UINT64_MAX);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	timeline->completed = value;
+	return NO_ERRORS;
+}
+
+uint8_t timeline_poll(struct timeline *timeline, VkDevice device)
+{
+	uint64_t value;
+	VkResult result = timeline->get_semaphore_counter_value(
+		device,
+		timeline->semaphore,
+		&value
+	);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+	if (value > timeline->completed) {
+		timeline->completed = value;
+	}
+	return NO_ERRORS;
+}
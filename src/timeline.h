@@ -0,0 +1,48 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_TIMELINE_H
+#define HELLO_VULKAN_TIMELINE_H
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+/*
+ * A VK_KHR_timeline_semaphore counting submissions: every submit signals the
+ * next value, so any value at or below completed is done on the GPU. Waits
+ * are for a single submission, never for the whole device.
+ */
+struct timeline {
+	VkSemaphore semaphore;
+	/* The value signaled by the last submit */
+	uint64_t submitted;
+	/* The highest value seen signaled */
+	uint64_t completed;
+	PFN_vkWaitSemaphoresKHR wait_semaphores;
+	PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value;
+};
+
+uint8_t timeline_init(struct timeline *timeline, VkDevice device);
+void timeline_fini(struct timeline *timeline, VkDevice device);
+
+uint8_t timeline_wait(struct timeline *timeline,
+                      VkDevice device,
+                      uint64_t value);
+/* Updates completed without blocking */
+uint8_t timeline_poll(struct timeline *timeline, VkDevice device);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#include "error.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The GPU gets its own row in the viewer, before the CPU threads from 1 */
+#define TRACE_GPU_TID 0
+
+struct trace_event {
+	const char *name;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+	uint32_t tid;
+};
+
+atomic_bool trace_enabled = false;
+
+static struct trace_event *events = NULL;
+static uint32_t event_mask = 0;
+static atomic_uint_fast64_t event_count = 0;
+static atomic_uint next_tid = 1;
+static _Thread_local uint32_t thread_tid = 0;
+static const char *trace_filename = NULL;
+static uint64_t start_ns = 0;
+
+uint64_t trace_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+uint8_t trace_init(const char *filename, uint32_t capacity)
+{
+	/* Round up to a power of two so that wrapping is a mask */
+	uint32_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	events = malloc(size * sizeof(struct trace_event));
+	if (events == NULL) {
+		return LIBC_ERROR_BIT;
+	}
+	event_mask = size - 1;
+	atomic_store(&event_count, 0);
+	trace_filename = filename;
+	start_ns = trace_now_ns();
+	atomic_store(&trace_enabled, true);
+	return NO_ERRORS;
+}
+
+static void record(const char *name, uint64_t begin_ns, uint64_t end_ns,
+                   uint32_t tid)
+{
+	uint64_t index = atomic_fetch_add_explicit(&event_count, 1,
+	                                           memory_order_relaxed);
+	struct trace_event *event = &events[index & event_mask];
+	event->name = name;
+	event->begin_ns = begin_ns;
+	event->end_ns = end_ns;
+	event->tid = tid;
+}
+
+void trace_end(const struct trace_zone *zone)
+{
+	if (!trace_enabled) {
+		return;
+	}
+	if (thread_tid == 0) {
+		thread_tid = atomic_fetch_add(&next_tid, 1);
+	}
+	record(zone->name, zone->begin_ns, trace_now_ns(), thread_tid);
+}
+
+void trace_gpu_zone(const char *name, uint64_t begin_ns, uint64_t end_ns)
+{
+	if (!trace_enabled) {
+		return;
+	}
+	record(name, begin_ns, end_ns, TRACE_GPU_TID);
+}
+
+static double relative_us(uint64_t ns)
+{
+	return ((double) ns - (double) start_ns) / 1000.0;
+}
+
+uint8_t trace_fini(void)
+{
+	if (!trace_enabled) {
+		return NO_ERRORS;
+	}
+	atomic_store(&trace_enabled, false);
+
+	uint8_t err = NO_ERRORS;
+	FILE *file = fopen(trace_filename, "w");
+	if (file == NULL) {
+		err = LIBC_ERROR_BIT;
+		goto free;
+	}
+
+	uint64_t count = atomic_load(&event_count);
+	uint64_t first = 0;
+	if (count > (uint64_t) event_mask + 1) {
+		first = count - event_mask - 1;
+		printf("Trace ring wrapped, kept the last %u events\n",
+		       event_mask + 1);
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+	              "\"tid\":%u,\"args\":{\"name\":\"GPU\"}}",
+	        TRACE_GPU_TID);
+	for (uint64_t i = first; i < count; ++i) {
+		const struct trace_event *event = &events[i & event_mask];
+		fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+		              "\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+		        event->name,
+		        event->tid == TRACE_GPU_TID ? "gpu" : "cpu",
+		        event->tid,
+		        relative_us(event->begin_ns),
+		        (double) (event->end_ns - event->begin_ns) / 1000.0);
+	}
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file) != 0) {
+		err = LIBC_ERROR_BIT;
+	}
+
+free:
+	free(events);
+	events = NULL;
+	return err;
+}
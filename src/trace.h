@@ -0,0 +1,59 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_TRACE_H
+#define HELLO_VULKAN_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Timeline of CPU and GPU zones, written as Chrome trace-event JSON that
+ * chrome://tracing and Perfetto load. Events go into a ring preallocated by
+ * trace_init with a single atomic increment each, so recording takes no locks
+ * and no allocations. When the ring wraps, the oldest events are overwritten.
+ * Zone names must outlive the trace, string literals in practice.
+ */
+
+struct trace_zone {
+	const char *name;
+	uint64_t begin_ns;
+};
+
+/* Read by every thread that records, so atomic */
+extern atomic_bool trace_enabled;
+
+uint8_t trace_init(const char *filename, uint32_t capacity);
+/* Writes the file, after every thread that records has stopped */
+uint8_t trace_fini(void);
+
+uint64_t trace_now_ns(void);
+
+static inline struct trace_zone trace_begin(const char *name)
+{
+	struct trace_zone zone = {
+		.name = name,
+		.begin_ns = trace_enabled ? trace_now_ns() : 0,
+	};
+	return zone;
+}
+
+void trace_end(const struct trace_zone *zone);
+/* Times are on the trace_now_ns clock */
+void trace_gpu_zone(const char *name, uint64_t begin_ns, uint64_t end_ns);
+
+#endif
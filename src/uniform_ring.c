@@ -0,0 +1,195 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "uniform_ring.h"
+
+#include "error.h"
+#include "host_memory.h"
+
+#include <string.h>
+
+uint8_t uniform_ring_init(struct uniform_ring *ring,
+                          VkDevice device,
+                          VkDeviceSize element_size,
+                          VkDeviceSize min_offset_alignment,
+                          VkShaderStageFlags stages)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->element_size = element_size;
+	/* The alignment is a power of two */
+	VkDeviceSize alignment = min_offset_alignment ? min_offset_alignment : 1;
+	ring->stride = (element_size + alignment - 1) & ~(alignment - 1);
+
+	VkDescriptorSetLayoutBinding descriptor_set_layout_binding = {
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = stages,
+		.pImmutableSamplers = NULL,
+	};
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.bindingCount = 1,
+		.pBindings = &descriptor_set_layout_binding,
+	};
+	VkResult result;
+	result = vkCreateDescriptorSetLayout(device,
+	                                     &descriptor_set_layout_create_info,
+	                                     &host_allocator,
+	                                     &ring->descriptor_set_layout);
+	if (result != VK_SUCCESS) {
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	return NO_ERRORS;
+}
+
+void uniform_ring_fini(struct uniform_ring *ring, VkDevice device)
+{
+	uniform_ring_release_slots(ring, device);
+	if (ring->descriptor_set_layout != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device, ring->descriptor_set_layout,
+		                             &host_allocator);
+		ring->descriptor_set_layout = VK_NULL_HANDLE;
+	}
+}
+
+uint8_t uniform_ring_use_slots(
+	struct uniform_ring *ring,
+	VkDevice device,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	uint32_t slot_count)
+{
+	/* Written by the CPU every frame and read once by the GPU */
+	uint8_t err = gpu_buffer_init(device, memory_properties,
+	                              slot_count * ring->stride,
+	                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+	                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+	                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	                              | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+	                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	                              &ring->buffer);
+	if (err) {
+		return err;
+	}
+	ring->slot_count = slot_count;
+	memset(ring->buffer.mapped, 0, slot_count * ring->stride);
+
+	VkDescriptorPoolSize descriptor_pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+	};
+	VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.maxSets = 1,
+		.poolSizeCount = 1,
+		.pPoolSizes = &descriptor_pool_size,
+	};
+	VkResult result;
+	result = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+	                                &host_allocator,
+	                                &ring->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		ring->descriptor_pool = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = ring->descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &ring->descriptor_set_layout,
+	};
+	result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+	                                  &ring->descriptor_set);
+	if (result != VK_SUCCESS) {
+		ring->descriptor_set = VK_NULL_HANDLE;
+		return VULKAN_ERROR_BIT | print_result(result);
+	}
+
+	/* A new set, so no pending command buffer has it bound */
+	VkDescriptorBufferInfo descriptor_buffer_info = {
+		.buffer = ring->buffer.buffer,
+		.offset = 0,
+		.range = ring->element_size,
+	};
+	VkWriteDescriptorSet write_descriptor_set = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = ring->descriptor_set,
+		.dstBinding = 0,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.pImageInfo = NULL,
+		.pBufferInfo = &descriptor_buffer_info,
+		.pTexelBufferView = NULL,
+	};
+	vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+	return NO_ERRORS;
+}
+
+void uniform_ring_release_slots(struct uniform_ring *ring, VkDevice device)
+{
+	if (ring->descriptor_pool != VK_NULL_HANDLE) {
+		vkDestroyDescriptorPool(device, ring->descriptor_pool,
+		                        &host_allocator);
+		ring->descriptor_pool = VK_NULL_HANDLE;
+		ring->descriptor_set = VK_NULL_HANDLE;
+	}
+	gpu_buffer_fini(device, &ring->buffer);
+	ring->slot_count = 0;
+}
+
+uint8_t uniform_ring_retire_slots(struct uniform_ring *ring,
+                                  VkDevice device,
+                                  struct deferred *deferred,
+                                  uint64_t last_use)
+{
+	uint8_t err = NO_ERRORS;
+	/* Frees the set along with it */
+	if (ring->descriptor_pool != VK_NULL_HANDLE) {
+		union deferred_handle handle = {
+			.descriptor_pool = ring->descriptor_pool,
+		};
+		err |= deferred_push(deferred, DEFERRED_DESCRIPTOR_POOL, handle,
+		                     last_use);
+		ring->descriptor_pool = VK_NULL_HANDLE;
+		ring->descriptor_set = VK_NULL_HANDLE;
+	}
+	err |= deferred_push_buffer(deferred, device, &ring->buffer, last_use);
+	ring->slot_count = 0;
+	return err;
+}
+
+void uniform_ring_record_bind(const struct uniform_ring *ring,
+                              VkCommandBuffer command_buffer,
+                              VkPipelineLayout pipeline_layout,
+                              uint32_t set,
+                              uint32_t slot)
+{
+	uint32_t dynamic_offset = (uint32_t) (slot * ring->stride);
+	vkCmdBindDescriptorSets(command_buffer,
+	                        VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                        pipeline_layout, set, 1,
+	                        &ring->descriptor_set, 1, &dynamic_offset);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2016-2019 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELLO_VULKAN_UNIFORM_RING_H
+#define HELLO_VULKAN_UNIFORM_RING_H
+
+#include "deferred.h"
+#include "gpu.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+/*
+ * Per frame uniform data in one persistently mapped buffer, a slot per
+ * command buffer at a multiple of minUniformBufferOffsetAlignment. A single
+ * descriptor set with a VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC binding
+ * covers every slot; command buffers pick theirs with the dynamic offset they
+ * are recorded with, so a frame only writes its slot once the last submit of
+ * its command buffer finished, without touching descriptors. Each swapchain
+ * generation gets its own buffer, pool and set, since the last generation's
+ * command buffers may still be pending with the old set bound.
+ */
+struct uniform_ring {
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet descriptor_set;
+	struct gpu_buffer buffer;
+	VkDeviceSize element_size;
+	VkDeviceSize stride;
+	uint32_t slot_count;
+};
+
+/* The layout, before pipeline layouts need it */
+uint8_t uniform_ring_init(struct uniform_ring *ring,
+                          VkDevice device,
+                          VkDeviceSize element_size,
+                          VkDeviceSize min_offset_alignment,
+                          VkShaderStageFlags stages);
+void uniform_ring_fini(struct uniform_ring *ring, VkDevice device);
+
+/* The buffer and set, once the number of command buffers is known */
+uint8_t uniform_ring_use_slots(
+	struct uniform_ring *ring,
+	VkDevice device,
+	const VkPhysicalDeviceMemoryProperties *memory_properties,
+	uint32_t slot_count);
+/* Destroys them right away, the GPU has to be done with them */
+void uniform_ring_release_slots(struct uniform_ring *ring, VkDevice device);
+/* Leaves them to be destroyed once the timeline passes last_use */
+uint8_t uniform_ring_retire_slots(struct uniform_ring *ring,
+                                  VkDevice device,
+                                  struct deferred *deferred,
+                                  uint64_t last_use);
+
+static inline void *uniform_ring_slot(const struct uniform_ring *ring,
+                                      uint32_t slot)
+{
+	return (char *) ring->buffer.mapped + slot * ring->stride;
+}
+
+void uniform_ring_record_bind(const struct uniform_ring *ring,
+                              VkCommandBuffer command_buffer,
+                              VkPipelineLayout pipeline_layout,
+                              uint32_t set,
+                              uint32_t slot);
+
+#endif